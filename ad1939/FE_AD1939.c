@@ -19,8 +19,22 @@
 #include <linux/uaccess.h>
 #include <linux/init.h>
 #include<linux/cdev.h>
+#include <linux/idr.h>
 #include <linux/spi/spi.h>
 #include <linux/regmap.h>
+#include <linux/spinlock.h>
+#include <linux/workqueue.h>
+#include <linux/wait.h>
+#include <linux/bitops.h>
+#include <linux/mutex.h>
+#include <linux/ktime.h>
+#include <linux/delay.h>
+#include <linux/hrtimer.h>
+
+#include "fe_fixedpoint.h"
+#include "fe_spi_calibrate.h"
+#include "fe_ad1939_ioctl.h"
+#include "fe_gain_map.h"
 
 
 // Define information about this kernel module
@@ -32,17 +46,150 @@ MODULE_VERSION("1.0");
 static uint8_t bits = 8;
 static uint32_t speed = 500000;
 static struct spi_device *spi_device;
+static struct regmap *ad1939_regmap;
+
+// Control port clocks tried by the link calibration, up to the 10 MHz CCLK limit of the AD1939
+static const uint32_t ad1939_spi_speeds[] = { 500000, 1000000, 2000000, 4000000, 6250000, 8000000, 10000000 };
+
+//Register memory map
+#define AD1939_PLL_CLK_CTRL0    0x00
+#define AD1939_PLL_CLK_CTRL1    0x01
+#define AD1939_DAC_CTRL0        0x02
+#define AD1939_DAC_CTRL1        0x03
+#define AD1939_DAC_CTRL2        0x04
+#define AD1939_DAC_MUTE         0x05
+#define AD1939_DAC1_LEFT_VOL    0x06
+#define AD1939_DAC1_RIGHT_VOL   0x07
+#define AD1939_DAC2_LEFT_VOL    0x08
+#define AD1939_DAC2_RIGHT_VOL   0x09
+#define AD1939_DAC3_LEFT_VOL    0x0A
+#define AD1939_DAC3_RIGHT_VOL   0x0B
+#define AD1939_DAC4_LEFT_VOL    0x0C
+#define AD1939_DAC4_RIGHT_VOL   0x0D
+#define AD1939_ADC_CTRL0        0x0E
+#define AD1939_ADC_CTRL1        0x0F
+#define AD1939_ADC_CTRL2        0x10
+
+// Number of DAC volume registers, left and right of DAC1 to DAC4 starting at AD1939_DAC1_LEFT_VOL
+#define AD1939_NUM_VOLUMES      8
+
+// Sample rate fields (DAC control 0 bits 2:1, ADC control 0 bits 7:6)
+#define AD1939_DAC_FS_MASK      0x06
+#define AD1939_ADC_FS_MASK      0xC0
+
+// Converter enable (PLL and clock control 0) and PLL lock indicator (PLL and clock control 1)
+#define AD1939_CLK_ENABLE       0x80
+#define AD1939_PLL_LOCKED       0x08
+
+// How long a rate switch waits for the PLL to lock, and the polling period
+#define AD1939_PLL_LOCK_TIMEOUT_US  50000
+#define AD1939_PLL_POLL_US          100
+
+// Shortest period of the fade timer, a fade never steps a code more than once per period
+#define AD1939_FADE_MIN_PERIOD_US   1000
+
+// Chip address byte of the SPI commands, or'ed into the top of the 16 bit register address by regmap
+#define AD1939_SPI_WRITE        0x08
+#define AD1939_SPI_READ         0x09
+
+
+// Largest number of AD1939s the driver can handle, each one gets a minor number
+#define FE_AD1939_MAX_DEVICES 16
+
+/** Power on values of the registers, the cache starts from these */
+static const struct reg_default ad1939_reg_defaults[] =
+{
+    { AD1939_PLL_CLK_CTRL0,  0x00 },
+    { AD1939_DAC_CTRL0,      0x00 },
+    { AD1939_DAC_CTRL1,      0x00 },
+    { AD1939_DAC_CTRL2,      0x00 },
+    { AD1939_DAC_MUTE,       0x00 },
+    { AD1939_ADC_CTRL0,      0x00 },
+    { AD1939_ADC_CTRL1,      0x00 },
+    { AD1939_ADC_CTRL2,      0x00 },
+};
+
+/** PLL control 1 holds the (read only) PLL lock bit so it always goes to the codec
+
+    The DAC volume registers are written by the volume queue of each device (see AD1939_volume_work) without going
+    through the regmap, so they are kept out of the cache as well.
+*/
+static bool ad1939_volatile_reg(struct device *dev, unsigned int reg)
+{
+    if (reg >= AD1939_DAC1_LEFT_VOL && reg <= AD1939_DAC4_RIGHT_VOL)
+        return true;
+
+    return reg == AD1939_PLL_CLK_CTRL1;
+}
+
+/** regmap description of the codec
+
+    Each SPI command is 3 bytes: the chip address with the read/write bit, the register and the value.  The codec
+    doesn't auto-increment so bulk writes are sent a register at a time.  The cache means the reads never go on the
+    wire and writes that don't change a register are dropped.
+*/
+static const struct regmap_config ad1939_regmap_config =
+{
+    .name = "ad1939",
+    .reg_bits = 16,
+    .val_bits = 8,
+    .read_flag_mask = AD1939_SPI_READ,
+    .write_flag_mask = AD1939_SPI_WRITE,
+    .max_register = AD1939_ADC_CTRL2,
+    .volatile_reg = ad1939_volatile_reg,
+    .reg_defaults = ad1939_reg_defaults,
+    .num_reg_defaults = ARRAY_SIZE(ad1939_reg_defaults),
+    .cache_type = REGCACHE_RBTREE,
+    .use_single_write = true,
+};
+
+/** Codec set up sent once the SPI device is ready */
+static const struct reg_sequence ad1939_init_sequence[] =
+{
+    { AD1939_PLL_CLK_CTRL0, 0x80 },     // Enable the ADCs and DACs
+    { AD1939_PLL_CLK_CTRL1, 0x00 },     // PLL mode
+    { AD1939_ADC_CTRL2,     0xC8 },
+    { AD1939_DAC_CTRL0,     0x00 },     // 48 kHz
+    { AD1939_ADC_CTRL0,     0x00 },     // 48 kHz
+    { AD1939_DAC1_LEFT_VOL, 0x00 },     // 0 dB, the link calibration may have left a test pattern
+};
+
+/** Register settings of a sample rate
 
+    Only the 48 kHz family is listed: 44.1 kHz would use the same register values as 48 kHz and needs the FPGA to
+    switch to the 44.1 kHz family clocks, which this driver doesn't drive, so it is refused rather than reported as
+    set while nothing changes.
+*/
+struct ad1939_rate
+{
+    uint32_t fs;                ///< Sample rate in kHz, unsigned Q16
+    uint8_t dac_fs;             ///< DAC control 0 sample rate field
+    uint8_t adc_fs;             ///< ADC control 0 sample rate field
+};
 
-struct fixed_num
+static const struct ad1939_rate ad1939_rates[] =
 {
-    int integer;
-    int fraction;
-    int fraction_len;
+    { 48 << 16,             0x00, 0x00 },
+    { 96 << 16,             0x02, 0x40 },
+    { 192 << 16,            0x04, 0x80 },
 };
 
-static struct class *cl; // Global variable for the device class
-static dev_t dev_num;
+// The init sequence runs the codec at 48 kHz
+#define AD1939_DEFAULT_RATE     0
+
+// Sample rate switching, shared by every AD1939 since they drive the same codec
+static DEFINE_MUTEX(ad1939_rate_lock);     // Serializes the rate switches with the register image
+static unsigned int ad1939_rate_index = AD1939_DEFAULT_RATE;
+static s64 ad1939_switch_ns;               // Time taken by the last switch, until the PLL locked
+static struct spi_message ad1939_rate_msg;
+static struct spi_transfer ad1939_rate_xfer[4];
+static uint8_t ad1939_rate_cmd[4][3];
+
+static struct class *cl; // Global variable for the device class, shared by every AD1939
+static dev_t dev_num;    // First device number of the region reserved for the AD1939s
+static DEFINE_IDA(fe_AD1939_ida); // Minor numbers in use
+
+struct fe_AD1939_dev;
 
 // Function Prototypes
 static int AD1939_probe(struct platform_device *pdev);
@@ -51,11 +198,15 @@ static ssize_t AD1939_read(struct file *file, char *buffer, size_t len, loff_t *
 static ssize_t AD1939_write(struct file *file, const char *buffer, size_t len, loff_t *offset);
 static int AD1939_open(struct inode *inode, struct file *file);
 static int AD1939_release(struct inode *inode, struct file *file);
+static long AD1939_ioctl(struct file *file, unsigned int cmd, unsigned long arg);
+static int AD1939_fade(struct fe_AD1939_dev *devp, uint32_t channels, uint32_t target, uint32_t duration_ms);
 static ssize_t name_read(struct device *dev, struct device_attribute *attr, char *buf);
 
 // SPI operation prototypes
 static ssize_t sample_frequency_write(struct device *dev, struct device_attribute *attr, const char *buf, size_t count);
 static ssize_t sample_frequency_read(struct device *dev, struct device_attribute *attr, char *buf);
+static ssize_t switch_time_read(struct device *dev, struct device_attribute *attr, char *buf);
+static int AD1939_wait_pll_lock(void);
 static ssize_t dac1_left_volume_write(struct device *dev, struct device_attribute *attr, const char *buf, size_t count);
 static ssize_t dac1_left_volume_read(struct device *dev, struct device_attribute *attr, char *buf);
 static ssize_t dac1_right_volume_write(struct device *dev, struct device_attribute *attr, const char *buf, size_t count);
@@ -72,16 +223,39 @@ static ssize_t dac4_left_volume_write(struct device *dev, struct device_attribut
 static ssize_t dac4_left_volume_read(struct device *dev, struct device_attribute *attr, char *buf);
 static ssize_t dac4_right_volume_write(struct device *dev, struct device_attribute *attr, const char *buf, size_t count);
 static ssize_t dac4_right_volume_read(struct device *dev, struct device_attribute *attr, char *buf);
+static ssize_t dac_volumes_write(struct device *dev, struct device_attribute *attr, const char *buf, size_t count);
+static ssize_t dac_volumes_read(struct device *dev, struct device_attribute *attr, char *buf);
+static ssize_t flush_write(struct device *dev, struct device_attribute *attr, const char *buf, size_t count);
+static ssize_t fade_write(struct device *dev, struct device_attribute *attr, const char *buf, size_t count);
+static ssize_t fade_read(struct device *dev, struct device_attribute *attr, char *buf);
+static enum hrtimer_restart AD1939_fade_tick(struct hrtimer *timer);
+static ssize_t spi_speed_read(struct device *dev, struct device_attribute *attr, char *buf);
+static int AD1939_spi_verify(struct spi_device *spi);
+static int AD1939_fsync(struct file *file, loff_t start, loff_t end, int datasync);
+static void AD1939_volume_work(struct work_struct *work);
+static void AD1939_volume_complete(void *context);
+static int AD1939_volume_flush(struct fe_AD1939_dev *devp);
+static bool AD1939_volume_idle(struct fe_AD1939_dev *devp);
+
+// DAC attenuations: code N attenuates by N * 0.375 dB, 0 to 95.625 dB
+static const struct fe_gain_map_desc ad1939_volume_desc =
+{
+    .num_codes = 256,
+    .first_value = 0,
+    .step = 24576,
+    .first_code = 0,
+    .code_step = 1,
+};
+
+static struct fe_gain_map ad1939_volume_map;
 
 // Custom function declarations
-char *strcat2(char *dst, char *src);
-uint32_t set_fixed_num(const char *s);
-int fp_to_string(char *buf, uint32_t fp28_num);
 uint8_t find_volume_level(uint32_t fp28_num);
 uint32_t decode_volume(uint8_t volume_level);
 
 //Create the attributes that show up in /dev/class
 static DEVICE_ATTR(sample_frequency,          0664, sample_frequency_read,          sample_frequency_write);
+static DEVICE_ATTR(switch_time,               0444, switch_time_read,               NULL);
 static DEVICE_ATTR(dac1_left_volume,          0664, dac1_left_volume_read,          dac1_left_volume_write);
 static DEVICE_ATTR(dac2_left_volume,          0664, dac2_left_volume_read,          dac2_left_volume_write);
 static DEVICE_ATTR(dac3_left_volume,          0664, dac3_left_volume_read,          dac3_left_volume_write);
@@ -90,6 +264,10 @@ static DEVICE_ATTR(dac1_right_volume,         0664, dac1_right_volume_read,
 static DEVICE_ATTR(dac2_right_volume,         0664, dac2_right_volume_read,         dac2_right_volume_write);
 static DEVICE_ATTR(dac3_right_volume,         0664, dac3_right_volume_read,         dac3_right_volume_write);
 static DEVICE_ATTR(dac4_right_volume,         0664, dac4_right_volume_read,         dac4_right_volume_write);
+static DEVICE_ATTR(dac_volumes,               0664, dac_volumes_read,               dac_volumes_write);
+static DEVICE_ATTR(flush,                     0220, NULL,                           flush_write);
+static DEVICE_ATTR(fade,                      0664, fade_read,                      fade_write);
+static DEVICE_ATTR(spi_speed,                 0444, spi_speed_read,                 NULL);
 
 static DEVICE_ATTR(name, 0444, name_read, NULL);
 
@@ -100,17 +278,30 @@ static DEVICE_ATTR(name, 0444, name_read, NULL);
 struct fe_AD1939_dev
 {
     struct cdev cdev;           ///< The driver structure containing major/minor, etc
+    dev_t devt;                 ///< Device number of this AD1939
     char *name;                 ///< This gets the name of the device when loading the driver
     void __iomem *regs;         ///< Pointer to the registers on the device
-    int sample_frequency;
-    int dac1_left_volume;
-    int dac2_left_volume;
-    int dac3_left_volume;
-    int dac4_left_volume;
-    int dac1_right_volume;
-    int dac2_right_volume;
-    int dac3_right_volume;
-    int dac4_right_volume;
+
+    // DAC volume queue, the stores only update the table and the worker sends every pending register in one message
+    spinlock_t volume_lock;                             ///< Protects the table and the state of the message
+    uint8_t volume_level[AD1939_NUM_VOLUMES];           ///< Latest attenuation code of each channel, in register order
+    unsigned long volume_dirty;                         ///< Channels whose code hasn't been sent yet
+    bool volume_busy;                                   ///< volume_msg is on the bus
+    int volume_status;                                  ///< First SPI error since the last flush
+    struct work_struct volume_work;
+    wait_queue_head_t volume_wait;                      ///< Woken every time a message completes
+    struct spi_message volume_msg;
+    struct spi_transfer volume_xfer[AD1939_NUM_VOLUMES];
+    uint8_t volume_cmd[AD1939_NUM_VOLUMES][3];
+
+    // Timed fade, the timer steps the table under volume_lock and the queue sends each step
+    struct hrtimer fade_timer;
+    unsigned long fade_mask;                            ///< Channels still fading
+    uint8_t fade_start[AD1939_NUM_VOLUMES];             ///< Code of each channel when the fade started
+    uint8_t fade_target;                                ///< Code every channel fades to
+    unsigned int fade_step;                             ///< Steps done
+    unsigned int fade_steps;                            ///< Steps of the whole fade
+    ktime_t fade_period;                                ///< Time between two steps
 };
 
 
@@ -149,6 +340,8 @@ static const struct file_operations fe_AD1939_fops =
     .write = AD1939_write,             ///< Write the device contents for the entry in /dev
     .open = AD1939_open,               ///< Called when the device is opened
     .release = AD1939_release,         ///< Called when the device is closes
+    .fsync = AD1939_fsync,             ///< Waits for the queued volume writes to reach the codec
+    .unlocked_ioctl = AD1939_ioctl,    ///< Register image, see fe_ad1939_ioctl.h
 };
 
 /** Function called initially on the driver loads
@@ -160,20 +353,37 @@ static const struct file_operations fe_AD1939_fops =
 static int AD1939_init(void)
 {
     int ret_val = 0;
+    char className[20];
     
     // Add the spi master 
     struct spi_master *master;
     
     pr_info("Initializing the Audio Logic AD1939 module\n");
 
-    // Register our driver with the "Platform Driver" bus
-    ret_val = platform_driver_register(&AD1939_platform);
+    ret_val = fe_gain_map_init(&ad1939_volume_map, &ad1939_volume_desc);
     if (ret_val != 0)
     {
-        pr_err("platform_driver_register returned %d\n", ret_val);
+        pr_err("fe_gain_map_init returned %d\n", ret_val);
         return ret_val;
     }
-    
+
+    //Reserve a Major number and enough Minor numbers for every AD1939 in the system
+    ret_val = alloc_chrdev_region(&dev_num, 0, FE_AD1939_MAX_DEVICES, "fe_AD1939_");
+    if (ret_val != 0)
+    {
+        pr_err("alloc_chrdev_region returned %d\n", ret_val);
+        return ret_val;
+    }
+
+    //One class for all the AD1939s, named after the Major number like the per device classes used to be
+    sprintf(className, "fe_AD1939_%d", MAJOR(dev_num));
+    cl = class_create(THIS_MODULE, className);
+    if (IS_ERR(cl))
+    {
+        ret_val = PTR_ERR(cl);
+        goto bad_class_create;
+    }
+
     /*------------------------------------------------------------------
     This SPI initialization is based off code written by Piktas Zuikis
     ------------------------------------------------------------------*/
@@ -192,7 +402,8 @@ static int AD1939_init(void)
     master = spi_busnum_to_master( spi_device_info.bus_num );
     if( !master ){
         printk("MASTER not found.\n");
-            return -ENODEV;
+        ret_val = -ENODEV;
+        goto bad_spi;
     }
      
     // create a new slave device, given the master and device info
@@ -201,7 +412,8 @@ static int AD1939_init(void)
     printk("Setting up new slave device\n");
     if( !spi_device ) {
         printk("FAILED to create slave.\n");
-        return -ENODEV;
+        ret_val = -ENODEV;
+        goto bad_spi;
     }
      
     printk("Set the bits per word\n");
@@ -213,48 +425,65 @@ static int AD1939_init(void)
     if( ret_val ){
         printk("FAILED to setup slave.\n");
         spi_unregister_device( spi_device );
-        return -ENODEV;
+        spi_device = NULL;
+        ret_val = -ENODEV;
+        goto bad_spi;
     }  
 
-    printk("Sending SPI initialization commands...\n");
-
-    printk("\tUnmuting the channels\n");
-    // Set the unmute commands
-    char cmd[3] = {0x08,0x00,0x80};
-    ret_val = spi_write(spi_device,&cmd, sizeof(cmd));
-    //printk("%d\n",ret_val);
+    // Run the control port as fast as it reliably goes
+    speed = fe_spi_calibrate(spi_device, ad1939_spi_speeds, ARRAY_SIZE(ad1939_spi_speeds), AD1939_spi_verify);
+    printk("SPI clock set to %u Hz\n", speed);
 
-    // Send the pll mode command
-    printk("\tSetting PLL mode\n");
-    cmd[1] = 0x01;
-    cmd[2] = 0x00;
-    ret_val = spi_write(spi_device,&cmd, sizeof(cmd));
-    //printk("%d\n",ret_val);
-    
-    cmd[1] = 0x10;
-    cmd[2] = 0xC8;
-    ret_val = spi_write(spi_device,&cmd, sizeof(cmd));
-    //printk("%d\n",ret_val);
+    // Put a register cache in front of the SPI device
+    ad1939_regmap = regmap_init_spi(spi_device, &ad1939_regmap_config);
+    if (IS_ERR(ad1939_regmap))
+    {
+        printk("FAILED to create the regmap.\n");
+        ret_val = PTR_ERR(ad1939_regmap);
+        ad1939_regmap = NULL;
+        goto bad_regmap;
+    }
 
-    // Set the sampling frequency (ADC control register 0)
-    printk("\tSetting sampling frequency to 48 kHz\n");
-    cmd[1] = 0x02;
-    cmd[2] = 0x00;
-    ret_val = spi_write(spi_device,&cmd, sizeof(cmd));
-    //printk("%d\n",ret_val);
+    printk("Sending SPI initialization commands...\n");
 
-    cmd[1] = 14;
-    cmd[2] = 0x00;
-    ret_val = spi_write(spi_device,&cmd, sizeof(cmd));
-    //printk("%d\n",ret_val);
+    // Enable the converters, PLL mode and 48 kHz
+    ret_val = regmap_multi_reg_write(ad1939_regmap, ad1939_init_sequence, ARRAY_SIZE(ad1939_init_sequence));
+    if (ret_val)
+        printk("FAILED to send the initialization commands (%d).\n", ret_val);
+    else if (AD1939_wait_pll_lock())
+        printk("The PLL did not lock.\n");
 
     /*------------------------------------------------------------------
     --------------------------------------------------------------------
     ------------------------------------------------------------------*/
+
+    // Register our driver with the "Platform Driver" bus, once the regmap is up since probe hands it to the device
+    ret_val = platform_driver_register(&AD1939_platform);
+    if (ret_val != 0)
+    {
+        pr_err("platform_driver_register returned %d\n", ret_val);
+        goto bad_platform_driver_register;
+    }
     
     pr_info("Audio Logic AD1939 module successfully initialized!\n");
 
     return 0;
+
+bad_platform_driver_register:
+    regmap_exit(ad1939_regmap);
+    ad1939_regmap = NULL;
+
+bad_regmap:
+    spi_unregister_device( spi_device );
+    spi_device = NULL;
+
+bad_spi:
+    class_destroy(cl);
+
+bad_class_create:
+    unregister_chrdev_region(dev_num, FE_AD1939_MAX_DEVICES);
+
+    return ret_val;
 }
 
 
@@ -271,8 +500,8 @@ static int AD1939_probe(struct platform_device *pdev)
 {
     int ret_val = -EBUSY;
 
-    char deviceName[20] = "fe_AD1939_";
-    char deviceMinor[20];
+    char deviceName[20];
+    int minor;
     int status;
 
     struct device *deviceObj;
@@ -282,6 +511,8 @@ static int AD1939_probe(struct platform_device *pdev)
 
     // Create structure to hold device-specific information (like the registers). Make size of &pdev->dev + sizeof(struct(fe_AD1939_dev)).
     fe_AD1939_devp = devm_kzalloc(&pdev->dev, sizeof(fe_AD1939_dev_t), GFP_KERNEL);
+    if (fe_AD1939_devp == NULL)
+        return -ENOMEM;
 
     // Give a pointer to the instance-specific data to the generic platform_device structure
     // so we can access this data later on (for instance, in the read and write functions)
@@ -296,37 +527,46 @@ static int AD1939_probe(struct platform_device *pdev)
     strcpy(fe_AD1939_devp->name, (char *)pdev->name);
     pr_info("%s\n", (char *)pdev->name);
 
-    //Request a Major/Minor number for the driver
-    status = alloc_chrdev_region(&dev_num, 0, 1, "fe_HA");
-    if (status != 0)
-        goto bad_alloc_chrdev_region;
+    //Take the lowest free Minor number from the region reserved in AD1939_init
+    minor = ida_alloc_max(&fe_AD1939_ida, FE_AD1939_MAX_DEVICES - 1, GFP_KERNEL);
+    if (minor < 0)
+    {
+        pr_err("No free minor numbers, only %d AD1939s are supported\n", FE_AD1939_MAX_DEVICES);
+        ret_val = minor;
+        goto bad_ida_alloc;
+    }
+    fe_AD1939_devp->devt = MKDEV(MAJOR(dev_num), minor);
 
-    //Create the device name with the information reserved above
-    sprintf(deviceMinor, "%d", MAJOR(dev_num));
-    strcat(deviceName, deviceMinor);
+    //Create the device name, the first AD1939 keeps the fe_AD1939_NNN name so existing scripts still find it
+    if (minor == 0)
+        sprintf(deviceName, "fe_AD1939_%d", MAJOR(dev_num));
+    else
+        sprintf(deviceName, "fe_AD1939_%d_%d", MAJOR(dev_num), minor);
     pr_info("%s\n", deviceName);
 
-    //Create sysfs entries
-    cl = class_create(THIS_MODULE, deviceName); //"fe_HA");
-    if (cl == NULL)
-        goto bad_class_create;
-
     //Initialize a char dev structure
     cdev_init(&fe_AD1939_devp->cdev, &fe_AD1939_fops);
 
     //Registers the char driver with the kernel
-    status = cdev_add(&fe_AD1939_devp->cdev, dev_num, 1);
+    status = cdev_add(&fe_AD1939_devp->cdev, fe_AD1939_devp->devt, 1);
     if (status != 0)
         goto bad_cdev_add;
 
     //Creates the device entries in sysfs
-    deviceObj = device_create(cl, NULL, dev_num, NULL, deviceName);
-    if (deviceObj == NULL)
+    deviceObj = device_create(cl, NULL, fe_AD1939_devp->devt, NULL, deviceName);
+    if (IS_ERR(deviceObj))
         goto bad_device_create;
 
     //Put a pointer to the fe_fir_dev struct that is created into the driver object so it can be accessed uniquely from elsewhere
     dev_set_drvdata(deviceObj, fe_AD1939_devp);
 
+    //The volume registers power up at 0 dB and are only written by the queue
+    spin_lock_init(&fe_AD1939_devp->volume_lock);
+    init_waitqueue_head(&fe_AD1939_devp->volume_wait);
+    INIT_WORK(&fe_AD1939_devp->volume_work, AD1939_volume_work);
+    hrtimer_init(&fe_AD1939_devp->fade_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+    fe_AD1939_devp->fade_timer.function = AD1939_fade_tick;
+
     //---------------------------------------------------------
     status = device_create_file(deviceObj, &dev_attr_sample_frequency);
     if (status)
@@ -384,10 +624,50 @@ static int AD1939_probe(struct platform_device *pdev)
     if (status)
         goto bad_device_create_file_10;
 
+    //---------------------------------------------------------
+    status = device_create_file(deviceObj, &dev_attr_dac_volumes);
+    if (status)
+        goto bad_device_create_file_11;
+
+    //---------------------------------------------------------
+    status = device_create_file(deviceObj, &dev_attr_flush);
+    if (status)
+        goto bad_device_create_file_12;
+
+    //---------------------------------------------------------
+    status = device_create_file(deviceObj, &dev_attr_spi_speed);
+    if (status)
+        goto bad_device_create_file_13;
+
+    //---------------------------------------------------------
+    status = device_create_file(deviceObj, &dev_attr_switch_time);
+    if (status)
+        goto bad_device_create_file_14;
+
+    //---------------------------------------------------------
+    status = device_create_file(deviceObj, &dev_attr_fade);
+    if (status)
+        goto bad_device_create_file_15;
+
     pr_info("AD1939_probe exit\n");
 
     return 0;
 
+bad_device_create_file_15:
+    device_remove_file(deviceObj, &dev_attr_fade);
+
+bad_device_create_file_14:
+    device_remove_file(deviceObj, &dev_attr_switch_time);
+
+bad_device_create_file_13:
+    device_remove_file(deviceObj, &dev_attr_spi_speed);
+
+bad_device_create_file_12:
+    device_remove_file(deviceObj, &dev_attr_flush);
+
+bad_device_create_file_11:
+    device_remove_file(deviceObj, &dev_attr_dac_volumes);
+
 bad_device_create_file_10:
     device_remove_file(deviceObj, &dev_attr_name);
     
@@ -417,17 +697,15 @@ bad_device_create_file_2:
     
 bad_device_create_file_1:
     device_remove_file(deviceObj, &dev_attr_sample_frequency); 
+    device_destroy(cl, fe_AD1939_devp->devt);
     
 bad_device_create:
     cdev_del(&fe_AD1939_devp->cdev);
 
 bad_cdev_add:
-    class_destroy(cl);
-
-bad_class_create:
-    unregister_chrdev_region(dev_num, 1);
+    ida_free(&fe_AD1939_ida, minor);
 
-bad_alloc_chrdev_region:
+bad_ida_alloc:
 bad_mem_alloc:
 
 //bad_ioremap:
@@ -454,16 +732,6 @@ static int AD1939_open(struct inode *inode, struct file *file)
     devp = container_of(inode->i_cdev, fe_AD1939_dev_t, cdev);
     file->private_data = devp;
 
-    //Instantiate default values for the codec
-    devp->sample_frequency       = 48.0;
-    devp->dac1_left_volume       = 0.0;
-    devp->dac2_left_volume       = 0.0;
-    devp->dac3_left_volume       = 0.0;
-    devp->dac4_left_volume       = 0.0;
-    devp->dac1_right_volume      = 0.0;
-    devp->dac2_right_volume      = 0.0;
-    devp->dac3_right_volume      = 0.0;
-    devp->dac4_right_volume      = 0.0;
     return 0;
 }
 
@@ -484,21 +752,136 @@ static int AD1939_release(struct inode *inode, struct file *file)
 
 
 
-/** Read the contents of the coefficients stucture
+/** Called on fsync of the device, waits for the DAC volumes written before it to reach the codec
+
+    @param file Pointer to the file for this operation
+    @param start Unused
+    @param end Unused
+    @param datasync Unused
+    @returns SUCCESS or the first SPI error since the last flush
+*/
+static int AD1939_fsync(struct file *file, loff_t start, loff_t end, int datasync)
+{
+    return AD1939_volume_flush((fe_AD1939_dev_t *)file->private_data);
+}
+
+
+
+/** Fills an image of the codec registers, indexed by register address
+
+    Everything comes from the register cache and the volume table except PLL and clock control 1, the one volatile
+    register, which costs a single SPI read.  (The control port doesn't auto-increment, so a burst read of the codec
+    isn't possible anyway.)
+
+    @param devp Pointer to the driver instance
+    @param regs FE_AD1939_NUM_REGS bytes to fill
+    @returns SUCCESS or the SPI error
+*/
+static int AD1939_snapshot(fe_AD1939_dev_t *devp, uint8_t *regs)
+{
+    unsigned int reg;
+    unsigned int value;
+    unsigned long flags;
+    int status = 0;
+
+    //A rate switch updates the cache on its own, wait for it to finish
+    mutex_lock(&ad1939_rate_lock);
+    for (reg = 0; reg < FE_AD1939_NUM_REGS; reg++)
+    {
+        //The volumes are filled from the queue's table below
+        if (reg >= AD1939_DAC1_LEFT_VOL && reg <= AD1939_DAC4_RIGHT_VOL)
+            continue;
+
+        status = regmap_read(ad1939_regmap, reg, &value);
+        if (status)
+            break;
+
+        regs[reg] = value;
+    }
+    mutex_unlock(&ad1939_rate_lock);
+
+    if (status)
+        return status;
+
+    spin_lock_irqsave(&devp->volume_lock, flags);
+    memcpy(&regs[AD1939_DAC1_LEFT_VOL], devp->volume_level, AD1939_NUM_VOLUMES);
+    spin_unlock_irqrestore(&devp->volume_lock, flags);
+
+    return 0;
+}
+
+
+
+/** Read an image of the codec registers
 
-    This function will read the contents of the coefficient memory as stored in the shadow register and return then
-    to the calling function as a binary array of 32 length fixed point values.  If done in the terminal window, hexdump
-    can be used to see the values.
+    This function returns the FE_AD1939_NUM_REGS control registers of the codec as a binary array, one byte per
+    register indexed by its address.  If done in the terminal window, hexdump can be used to see the values.
 
     @param file Pointer to the file being accessed
     @param buffer Pointer to a buffer array to return the data on
-    @len Unused
+    @len Size of buffer
     @offset Pass-by-reference variable to hold where to start transmitting from in the array.
-    @returns AD1939_read Number of bits sent in buffer, and will return 0 for the last transaction.
+    @returns AD1939_read Number of bytes sent in buffer, and will return 0 for the last transaction.
 */
 static ssize_t AD1939_read(struct file *file, char *buffer, size_t len, loff_t *offset)
 {
-    return 0;
+    uint8_t regs[FE_AD1939_NUM_REGS];
+    int status;
+
+    fe_AD1939_dev_t *devp = (fe_AD1939_dev_t *)file->private_data;
+
+    if (*offset >= FE_AD1939_NUM_REGS)
+        return 0;
+
+    status = AD1939_snapshot(devp, regs);
+    if (status)
+        return status;
+
+    return simple_read_from_buffer(buffer, len, offset, regs, sizeof(regs));
+}
+
+
+
+/** ioctl entry point of /dev/fe_AD1939_N, the commands are defined in fe_ad1939_ioctl.h
+
+    @param file Pointer to the file being accessed
+    @param cmd ioctl command
+    @param arg Argument of the command
+    @returns SUCCESS or error code
+*/
+static long AD1939_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
+{
+    struct fe_ad1939_regs image;
+    struct fe_ad1939_fade fade;
+    int status;
+
+    fe_AD1939_dev_t *devp = (fe_AD1939_dev_t *)file->private_data;
+
+    switch (cmd)
+    {
+        case FE_AD1939_IOC_GET_REGS:
+            memset(&image, 0, sizeof(image));
+            status = AD1939_snapshot(devp, image.regs);
+            if (status)
+                return status;
+
+            if (copy_to_user((void __user *)arg, &image, sizeof(image)))
+                return -EFAULT;
+
+            return 0;
+
+        case FE_AD1939_IOC_FADE:
+            if (copy_from_user(&fade, (void __user *)arg, sizeof(fade)))
+                return -EFAULT;
+
+            if (fade.reserved)
+                return -EINVAL;
+
+            return AD1939_fade(devp, fade.channels, fade.target, fade.duration_ms);
+
+        default:
+            return -ENOTTY;
+    }
 }
 
 
@@ -538,24 +921,35 @@ static int AD1939_remove(struct platform_device *pdev)
     // Grab the instance-specific information out of the platform device
     fe_AD1939_dev_t *dev = (fe_AD1939_dev_t *)platform_get_drvdata(pdev);
 
-    //device_remove_file(deviceObj, &dev_attr_numCoefs);
-    //device_remove_file(deviceObj, &dev_attr_name);
-    //device_remove_file(deviceObj, &dev_attr_name);
-
-    //device_destroy(cl, dev_num);
-    //class_destroy(cl);
-
-
     pr_info("AD1939_remove enter\n");
 
     // Turn the HA off
     //iowrite32(0x00, dev->regs);
 
+    // Remove the sysfs entries (and their attributes) of this AD1939
+    device_destroy(cl, dev->devt);
+
     // Unregister the character file (remove it from /dev)
     cdev_del(&dev->cdev);
 
-    //Tell the os that the major/minor pair is avalible again
-    unregister_chrdev_region(dev_num, 2);
+    // Stop any fade where it is
+    hrtimer_cancel(&dev->fade_timer);
+    spin_lock_irq(&dev->volume_lock);
+    dev->fade_mask = 0;
+    spin_unlock_irq(&dev->volume_lock);
+
+    // Nothing can queue a volume anymore, let the queued ones reach the codec before the structure goes away
+    if (AD1939_volume_flush(dev))
+    {
+        spin_lock_irq(&dev->volume_lock);
+        dev->volume_dirty = 0;
+        spin_unlock_irq(&dev->volume_lock);
+    }
+    wait_event(dev->volume_wait, AD1939_volume_idle(dev));
+    cancel_work_sync(&dev->volume_work);
+
+    //Tell the os that the minor number is avalible again, the region is released in AD1939_exit
+    ida_free(&fe_AD1939_ida, MINOR(dev->devt));
 
     //Remove the pointer to the registers so it doesn't leak
     //iounmap(dev->regs);
@@ -576,10 +970,19 @@ static void AD1939_exit(void)
     // This will cause "AD1939_remove" to be called for each connected device
     platform_driver_unregister(&AD1939_platform);
  
+    if( ad1939_regmap ){
+        regmap_exit( ad1939_regmap );
+    }
+
     if( spi_device ){
         spi_unregister_device( spi_device );
     }
 
+    // Every AD1939 is gone, release the class and the device numbers
+    class_destroy(cl);
+    unregister_chrdev_region(dev_num, FE_AD1939_MAX_DEVICES);
+    ida_destroy(&fe_AD1939_ida);
+
     pr_info("Audio Logic AD1939 module successfully unregistered\n");
 }
 
@@ -603,801 +1006,718 @@ static ssize_t name_read(struct device *dev, struct device_attribute *attr, char
     return strlen(buf);
 }
 
-static ssize_t sample_frequency_write(struct device *dev, struct device_attribute *attr, const char *buf, size_t count)
+/** Function to display the SPI clock chosen by the link calibration
+
+    @param dev
+    @param attr
+    @param buf charactor buffer for the sysfs return
+    @returns Length of the buffer
+*/
+static ssize_t spi_speed_read(struct device *dev, struct device_attribute *attr, char *buf)
 {
-    char substring[80];
-    char fs_string[6];
-    int substring_count = 0;
-    int i;
-    int cmd_val;
-    char cmd[3] = {0x08,0x00,0x00};
+    return sprintf(buf, "%u\n", speed);
+}
 
-    fe_AD1939_dev_t *devp = (fe_AD1939_dev_t *)dev_get_drvdata(dev);
+/** Waits for the PLL of the codec to lock
+
+    @returns SUCCESS, -ETIMEDOUT or the SPI error
+*/
+static int AD1939_wait_pll_lock(void)
+{
+    unsigned int pll_ctrl1;
+    int waited;
+    int status;
 
-    for (i = 0; i < count; i++)
+    for (waited = 0; waited <= AD1939_PLL_LOCK_TIMEOUT_US; waited += AD1939_PLL_POLL_US)
     {
-        //If its not a space or a comma, add the digit to the substring
-        if ((buf[i] != ',') && (buf[i] != ' ') && (buf[i] != '\0') && (buf[i] != '\r') && (buf[i] != '\n'))
-        {
-            substring[substring_count] = buf[i];
-            substring_count++;
-        }
-    }
+        //PLL and clock control 1 is volatile, this always reads the codec
+        status = regmap_read(ad1939_regmap, AD1939_PLL_CLK_CTRL1, &pll_ctrl1);
+        if (status)
+            return status;
 
-    substring[substring_count] = '\0';
+        if (pll_ctrl1 & AD1939_PLL_LOCKED)
+            return 0;
 
-    // Determine which sample frequency to choose
-    if (strncmp(substring,"48",sizeof(substring)) == 0 || strncmp(substring,"48.0",sizeof(substring)) == 0)
-    {
-      printk("Setting sampling frequency to 48 kHz\n");
-      cmd[1] = 0x02;
-      cmd[2] = 0x00;
-      cmd_val = spi_write(spi_device,&cmd, sizeof(cmd));
-      cmd[1] = 14;
-      cmd[2] = 0x00;
-      cmd_val = spi_write(spi_device,&cmd, sizeof(cmd));
-      strcpy(fs_string,"48.0\0");
-    }
-    else if (strncmp(substring,"96",sizeof(substring)) == 0 || strncmp(substring,"96.0",sizeof(substring)) == 0)
-    {
-      printk("Setting sampling frequency to 96 kHz\n");
-      cmd[1] = 0x02;
-      cmd[2] = 0x02;
-      cmd_val = spi_write(spi_device,&cmd, sizeof(cmd));
-      cmd[1] = 0x0E;
-      cmd[2] = 0x40;
-      cmd_val = spi_write(spi_device,&cmd, sizeof(cmd));
-      strcpy(fs_string,"96.0\0");
-    }
-    else if (strncmp(substring,"192",sizeof(substring)) == 0 || strncmp(substring,"192.0",sizeof(substring)) == 0)
-    {
-      printk("Setting sampling frequency to 192 kHz\n");
-      cmd[1] = 0x02;
-      cmd[2] = 0x04;
-      cmd_val = spi_write(spi_device,&cmd, sizeof(cmd));
-      cmd[1] = 0x0E;
-      cmd[2] = 0x80;
-      cmd_val = spi_write(spi_device,&cmd, sizeof(cmd));
-      strcpy(fs_string,"192.0\0");
+        usleep_range(AD1939_PLL_POLL_US, 2 * AD1939_PLL_POLL_US);
     }
-    else
-      printk("Invalid value.  Please enter either '48','96', or '192'\n");
-     
 
-    //Convert the buffer to a fixed point value
-    devp->sample_frequency = set_fixed_num(fs_string);
+    return -ETIMEDOUT;
+}
 
-    return count;
+/** Puts one register write of the rate switch message together */
+static void AD1939_rate_cmd(int i, unsigned int reg, unsigned int value)
+{
+    ad1939_rate_cmd[i][0] = AD1939_SPI_WRITE;
+    ad1939_rate_cmd[i][1] = reg;
+    ad1939_rate_cmd[i][2] = value;
+
+    ad1939_rate_xfer[i].tx_buf = ad1939_rate_cmd[i];
+    ad1939_rate_xfer[i].len = sizeof(ad1939_rate_cmd[i]);
+    ad1939_rate_xfer[i].cs_change = 1;
 }
-static ssize_t sample_frequency_read(struct device *dev, struct device_attribute *attr, char *buf)
+
+/** Switches the codec to another sample rate
+
+    The converters are stopped, both rate fields are changed and the converters are started again in a single SPI
+    message, then the PLL lock bit is polled.  The time from the start of the message to the PLL lock is kept for the
+    switch_time attribute.
+
+    @param index Entry of ad1939_rates to switch to
+    @returns SUCCESS or error code
+*/
+static int AD1939_set_rate(unsigned int index)
 {
-    fe_AD1939_dev_t *devp = (fe_AD1939_dev_t *)dev_get_drvdata(dev);
+    const struct ad1939_rate *rate = &ad1939_rates[index];
+    unsigned int pll_ctrl0;
+    unsigned int dac_ctrl0;
+    unsigned int adc_ctrl0;
+    ktime_t start;
+    int status;
 
-    // Copy the sample frequency to the output buffer
-    fp_to_string(buf, devp->sample_frequency);
+    mutex_lock(&ad1939_rate_lock);
+
+    //Every register written here is cached, the reads don't go on the wire
+    regmap_read(ad1939_regmap, AD1939_PLL_CLK_CTRL0, &pll_ctrl0);
+    regmap_read(ad1939_regmap, AD1939_DAC_CTRL0, &dac_ctrl0);
+    regmap_read(ad1939_regmap, AD1939_ADC_CTRL0, &adc_ctrl0);
+
+    dac_ctrl0 = (dac_ctrl0 & ~AD1939_DAC_FS_MASK) | rate->dac_fs;
+    adc_ctrl0 = (adc_ctrl0 & ~AD1939_ADC_FS_MASK) | rate->adc_fs;
+
+    memset(ad1939_rate_xfer, 0, sizeof(ad1939_rate_xfer));
+    spi_message_init(&ad1939_rate_msg);
+    AD1939_rate_cmd(0, AD1939_PLL_CLK_CTRL0, pll_ctrl0 & ~AD1939_CLK_ENABLE);
+    AD1939_rate_cmd(1, AD1939_DAC_CTRL0, dac_ctrl0);
+    AD1939_rate_cmd(2, AD1939_ADC_CTRL0, adc_ctrl0);
+    AD1939_rate_cmd(3, AD1939_PLL_CLK_CTRL0, pll_ctrl0 | AD1939_CLK_ENABLE);
+    ad1939_rate_xfer[3].cs_change = 0;
+    spi_message_add_tail(&ad1939_rate_xfer[0], &ad1939_rate_msg);
+    spi_message_add_tail(&ad1939_rate_xfer[1], &ad1939_rate_msg);
+    spi_message_add_tail(&ad1939_rate_xfer[2], &ad1939_rate_msg);
+    spi_message_add_tail(&ad1939_rate_xfer[3], &ad1939_rate_msg);
+
+    start = ktime_get();
+    status = spi_sync(spi_device, &ad1939_rate_msg);
+    if (status)
+        goto out;
 
-    strcat2(buf, "\n");
+    //The message went around the regmap, bring the cache up to date
+    regcache_cache_only(ad1939_regmap, true);
+    regmap_write(ad1939_regmap, AD1939_PLL_CLK_CTRL0, pll_ctrl0 | AD1939_CLK_ENABLE);
+    regmap_write(ad1939_regmap, AD1939_DAC_CTRL0, dac_ctrl0);
+    regmap_write(ad1939_regmap, AD1939_ADC_CTRL0, adc_ctrl0);
+    regcache_cache_only(ad1939_regmap, false);
 
-    //Return the length of the buffer so it will print in the console
-    return strlen(buf);
+    ad1939_rate_index = index;
+
+    status = AD1939_wait_pll_lock();
+    ad1939_switch_ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+
+out:
+    mutex_unlock(&ad1939_rate_lock);
+
+    return status;
 }
-static ssize_t dac1_left_volume_write(struct device *dev, struct device_attribute *attr, const char *buf, size_t count)
-{
-    uint32_t tempValue = 0;
-    uint8_t volume_level;
-    char cmd[3] = {0x08,0x06,0x00};
 
-    char substring[80];
-    int substring_count = 0;
+static ssize_t sample_frequency_write(struct device *dev, struct device_attribute *attr, const char *buf, size_t count)
+{
+    uint32_t fs = 0;
+    int status;
     int i;
 
-    fe_AD1939_dev_t *devp = (fe_AD1939_dev_t *)dev_get_drvdata(dev);
-
-    for (i = 0; i < count; i++)
-    {
-        //If its not a space or a comma, add the digit to the substring
-        if ((buf[i] != ',') && (buf[i] != ' ') && (buf[i] != '\0') && (buf[i] != '\r') && (buf[i] != '\n'))
-        {
-            substring[substring_count] = buf[i];
-            substring_count++;
-        }
-    }
+    //Convert the buffer to a fixed point value in kHz
+    status = fe_fixed_from_string(buf, count, FE_UQ16, &fs);
+    if (status)
+        return status;
 
-    substring[substring_count] = '\0';
+    //Take the table entry within half a kHz, whatever rounding the conversion did
+    for (i = 0; i < ARRAY_SIZE(ad1939_rates); i++)
+        if (abs((int32_t)(fs - ad1939_rates[i].fs)) < (1 << 15))
+            break;
 
-    // If the first character is a negative sign
-    if (buf[0] == '-')
+    if (i == ARRAY_SIZE(ad1939_rates))
     {
-      // Shift all the values "left" to remove it
-      for (i=0;i<79;i++)
-        substring[i] = substring[i+1];
+      printk("Invalid value.  Please enter either '48', '96', or '192'\n");
+      return -EINVAL;
     }
 
-    //Convert the buffer to a fixed point value
-    tempValue = set_fixed_num(substring);
-
-    //printk("Entering conversion function\n");
-    volume_level = find_volume_level(tempValue);
-    tempValue = decode_volume(volume_level);
-    
-    //Write the value into the shadow register (and pray it works...)
-    devp->dac1_left_volume = -1*tempValue;
-
-    // Write the SPI commands to the DAC
-    cmd[2] = volume_level;
-    spi_write(spi_device,&cmd, sizeof(cmd));
+    status = AD1939_set_rate(i);
+    if (status)
+        return status;
 
     return count;
 }
-static ssize_t dac1_left_volume_read(struct device *dev, struct device_attribute *attr, char *buf)
+static ssize_t sample_frequency_read(struct device *dev, struct device_attribute *attr, char *buf)
 {
-    fe_AD1939_dev_t *devp = (fe_AD1939_dev_t *)dev_get_drvdata(dev);
-
-    //Copy the name into the output buffer
-    //sprintf(buf, "%d\n", fe_HA_devp->threshold);
-    fp_to_string(buf, devp->dac1_left_volume);
+    //Copy the value into the output buffer and return its length so it will print in the console
+    return fe_fixed_show(buf, ad1939_rates[ad1939_rate_index].fs, FE_UQ16);
+}
 
-    strcat2(buf, "\n");
+/** Function to display how long the last sample rate switch took, in microseconds, until the PLL locked
 
-    //Return the length of the buffer so it will print in the console
-    return strlen(buf);
-}
-static ssize_t dac2_left_volume_write(struct device *dev, struct device_attribute *attr, const char *buf, size_t count)
+    @param dev
+    @param attr
+    @param buf charactor buffer for the sysfs return
+    @returns Length of the buffer
+*/
+static ssize_t switch_time_read(struct device *dev, struct device_attribute *attr, char *buf)
 {
-    uint32_t tempValue = 0;
+    return sprintf(buf, "%lld\n", div_s64(ad1939_switch_ns, NSEC_PER_USEC));
+}
 
-    char substring[80];
-    int substring_count = 0;
+/** Sends every pending DAC volume of a device to the codec
+
+    The pending registers are taken out of the table and sent as one spi_message, one 3 byte command per register with
+    chip select released in between.  Registers written again while the message is on the bus stay pending and the
+    completion queues the worker again, so a register written several times only goes out with its last value.
+
+    @param work volume_work of the device
+*/
+static void AD1939_volume_work(struct work_struct *work)
+{
+    fe_AD1939_dev_t *devp = container_of(work, fe_AD1939_dev_t, volume_work);
+    unsigned long flags;
+    int num_xfers = 0;
+    int status;
     int i;
-    uint8_t volume_level;
-    char cmd[3] = {0x08,0x08,0x00};
 
-    fe_AD1939_dev_t *devp = (fe_AD1939_dev_t *)dev_get_drvdata(dev);
+    spin_lock_irqsave(&devp->volume_lock, flags);
 
-    for (i = 0; i < count; i++)
+    //Nothing to do, or the completion will queue the worker again
+    if (devp->volume_busy || !devp->volume_dirty)
     {
-        //If its not a space or a comma, add the digit to the substring
-        if ((buf[i] != ',') && (buf[i] != ' ') && (buf[i] != '\0') && (buf[i] != '\r') && (buf[i] != '\n'))
-        {
-            substring[substring_count] = buf[i];
-            substring_count++;
-        }
+        spin_unlock_irqrestore(&devp->volume_lock, flags);
+        return;
     }
 
-    substring[substring_count] = '\0';
-
-    // If the first character is a negative sign
-    if (buf[0] == '-')
+    spi_message_init(&devp->volume_msg);
+    for_each_set_bit(i, &devp->volume_dirty, AD1939_NUM_VOLUMES)
     {
-      // Shift all the values "left" to remove it
-      for (i=0;i<79;i++)
-        substring[i] = substring[i+1];
+        uint8_t *cmd = devp->volume_cmd[num_xfers];
+        struct spi_transfer *xfer = &devp->volume_xfer[num_xfers];
+
+        cmd[0] = AD1939_SPI_WRITE;
+        cmd[1] = AD1939_DAC1_LEFT_VOL + i;
+        cmd[2] = devp->volume_level[i];
+
+        memset(xfer, 0, sizeof(*xfer));
+        xfer->tx_buf = cmd;
+        xfer->len = sizeof(devp->volume_cmd[0]);
+        xfer->cs_change = 1;
+        spi_message_add_tail(xfer, &devp->volume_msg);
+        num_xfers++;
     }
 
-    //Convert the buffer to a fixed point value
-    tempValue = set_fixed_num(substring);
+    //The end of the message releases chip select by itself
+    devp->volume_xfer[num_xfers - 1].cs_change = 0;
 
-    //printk("Entering conversion function\n");
-    volume_level = find_volume_level(tempValue);
-    tempValue = decode_volume(volume_level);
-    
-    //Write the value into the shadow register (and pray it works...)
-    devp->dac2_left_volume = -1*tempValue;
+    devp->volume_dirty = 0;
+    devp->volume_busy = true;
+    spin_unlock_irqrestore(&devp->volume_lock, flags);
 
-    // Write the SPI commands to the DAC
-    cmd[2] = volume_level;
-    spi_write(spi_device,&cmd, sizeof(cmd));
+    devp->volume_msg.complete = AD1939_volume_complete;
+    devp->volume_msg.context = devp;
 
-    return count;
+    status = spi_async(spi_device, &devp->volume_msg);
+    if (status)
+    {
+        spin_lock_irqsave(&devp->volume_lock, flags);
+        devp->volume_busy = false;
+        if (!devp->volume_status)
+            devp->volume_status = status;
+        spin_unlock_irqrestore(&devp->volume_lock, flags);
+
+        wake_up_all(&devp->volume_wait);
+    }
 }
-static ssize_t dac2_left_volume_read(struct device *dev, struct device_attribute *attr, char *buf)
+
+/** Completion of the volume message, called by the SPI controller (possibly in interrupt context)
+
+    @param context Device that sent the message
+*/
+static void AD1939_volume_complete(void *context)
 {
-    fe_AD1939_dev_t *devp = (fe_AD1939_dev_t *)dev_get_drvdata(dev);
+    fe_AD1939_dev_t *devp = context;
+    unsigned long flags;
+    bool pending;
 
-    //Copy the name into the output buffer
-    //sprintf(buf, "%d\n", fe_HA_devp->threshold);
-    fp_to_string(buf, devp->dac2_left_volume);
+    spin_lock_irqsave(&devp->volume_lock, flags);
+    devp->volume_busy = false;
+    if (devp->volume_msg.status && !devp->volume_status)
+        devp->volume_status = devp->volume_msg.status;
+    pending = devp->volume_dirty != 0;
+    spin_unlock_irqrestore(&devp->volume_lock, flags);
 
-    strcat2(buf, "\n");
+    if (pending)
+        schedule_work(&devp->volume_work);
 
-    //Return the length of the buffer so it will print in the console
-    return strlen(buf);
+    wake_up_all(&devp->volume_wait);
 }
-static ssize_t dac3_left_volume_write(struct device *dev, struct device_attribute *attr, const char *buf, size_t count)
-{
-    uint32_t tempValue = 0;
-    uint8_t volume_level;
-    char cmd[3] = {0x08,0x0A,0x00};
-    char substring[80];
-    int substring_count = 0;
-    int i;
 
-    fe_AD1939_dev_t *devp = (fe_AD1939_dev_t *)dev_get_drvdata(dev);
+/** Puts new attenuation codes in the table and wakes the worker, codes that don't change are dropped
+
+    @param devp Device of the AD1939
+    @param first First channel (0 is DAC1 left, 7 is DAC4 right)
+    @param levels Attenuation codes starting at channel first
+    @param num_levels Number of codes
+*/
+static void AD1939_volume_queue(fe_AD1939_dev_t *devp, unsigned int first, const uint8_t *levels, unsigned int num_levels)
+{
+    unsigned long flags;
+    bool changed = false;
+    unsigned int i;
 
-    for (i = 0; i < count; i++)
+    spin_lock_irqsave(&devp->volume_lock, flags);
+    for (i = 0; i < num_levels; i++)
     {
-        //If its not a space or a comma, add the digit to the substring
-        if ((buf[i] != ',') && (buf[i] != ' ') && (buf[i] != '\0') && (buf[i] != '\r') && (buf[i] != '\n'))
+        //A volume written by hand ends the fade of the channel
+        __clear_bit(first + i, &devp->fade_mask);
+
+        if (devp->volume_level[first + i] != levels[i])
         {
-            substring[substring_count] = buf[i];
-            substring_count++;
+            devp->volume_level[first + i] = levels[i];
+            __set_bit(first + i, &devp->volume_dirty);
+            changed = true;
         }
     }
+    spin_unlock_irqrestore(&devp->volume_lock, flags);
 
-    substring[substring_count] = '\0';
-
-    // If the first character is a negative sign
-    if (buf[0] == '-')
-    {
-      // Shift all the values "left" to remove it
-      for (i=0;i<79;i++)
-        substring[i] = substring[i+1];
-    }
+    if (changed)
+        schedule_work(&devp->volume_work);
+}
 
-    //Convert the buffer to a fixed point value
-    tempValue = set_fixed_num(substring);
+/** True once every queued volume has been sent and no fade is running */
+static bool AD1939_volume_idle(fe_AD1939_dev_t *devp)
+{
+    unsigned long flags;
+    bool idle;
 
-    //printk("Entering conversion function\n");
-    volume_level = find_volume_level(tempValue);
-    tempValue = decode_volume(volume_level);
-    
-    //Write the value into the shadow register (and pray it works...)
-    devp->dac3_left_volume = -1*tempValue;
+    spin_lock_irqsave(&devp->volume_lock, flags);
+    idle = !devp->volume_busy && !devp->volume_dirty && !devp->fade_mask;
+    spin_unlock_irqrestore(&devp->volume_lock, flags);
 
-    // Write the SPI commands to the DAC
-    cmd[2] = volume_level;
-    spi_write(spi_device,&cmd, sizeof(cmd));
-    return count;
+    return idle;
 }
-static ssize_t dac3_left_volume_read(struct device *dev, struct device_attribute *attr, char *buf)
-{
-    fe_AD1939_dev_t *devp = (fe_AD1939_dev_t *)dev_get_drvdata(dev);
 
-    //Copy the name into the output buffer
-    //sprintf(buf, "%d\n", fe_HA_devp->threshold);
-    fp_to_string(buf, devp->dac3_left_volume);
+/** Steps every fading channel, called by the fade timer
 
-    strcat2(buf, "\n");
+    The new codes go in the volume table like any other write, so all the channels of one step share a single SPI
+    message (and steps that come faster than the bus can take collapse into the latest one).
 
-    //Return the length of the buffer so it will print in the console
-    return strlen(buf);
-}
-static ssize_t dac4_left_volume_write(struct device *dev, struct device_attribute *attr, const char *buf, size_t count)
+    @param timer fade_timer of the device
+    @returns HRTIMER_RESTART until the last step
+*/
+static enum hrtimer_restart AD1939_fade_tick(struct hrtimer *timer)
 {
-    uint32_t tempValue = 0;
-    uint8_t volume_level;
-    char cmd[3] = {0x08,0x0C,0x00};
-    char substring[80];
-    int substring_count = 0;
+    fe_AD1939_dev_t *devp = container_of(timer, fe_AD1939_dev_t, fade_timer);
+    unsigned long flags;
+    bool changed = false;
+    bool done;
+    uint8_t level;
     int i;
 
-    fe_AD1939_dev_t *devp = (fe_AD1939_dev_t *)dev_get_drvdata(dev);
-
-    for (i = 0; i < count; i++)
+    spin_lock_irqsave(&devp->volume_lock, flags);
+    devp->fade_step++;
+    for_each_set_bit(i, &devp->fade_mask, AD1939_NUM_VOLUMES)
     {
-        //If its not a space or a comma, add the digit to the substring
-        if ((buf[i] != ',') && (buf[i] != ' ') && (buf[i] != '\0') && (buf[i] != '\r') && (buf[i] != '\n'))
+        //The codes are 0.375 dB apart, so stepping them linearly makes the fade linear in dB
+        level = devp->fade_start[i] + ((int)devp->fade_target - devp->fade_start[i]) * (int)devp->fade_step /
+                (int)devp->fade_steps;
+
+        if (devp->volume_level[i] != level)
         {
-            substring[substring_count] = buf[i];
-            substring_count++;
+            devp->volume_level[i] = level;
+            __set_bit(i, &devp->volume_dirty);
+            changed = true;
         }
     }
 
-    substring[substring_count] = '\0';
+    done = devp->fade_step >= devp->fade_steps || !devp->fade_mask;
+    if (done)
+        devp->fade_mask = 0;
+    spin_unlock_irqrestore(&devp->volume_lock, flags);
+
+    if (changed)
+        schedule_work(&devp->volume_work);
 
-    // If the first character is a negative sign
-    if (buf[0] == '-')
+    if (done)
     {
-      // Shift all the values "left" to remove it
-      for (i=0;i<79;i++)
-        substring[i] = substring[i+1];
+        //Flushes wait for the end of the fade too
+        wake_up_all(&devp->volume_wait);
+        return HRTIMER_NORESTART;
     }
 
-    //Convert the buffer to a fixed point value
-    tempValue = set_fixed_num(substring);
-    //printk("Entering conversion function\n");
-    volume_level = find_volume_level(tempValue);
-    tempValue = decode_volume(volume_level);
-    
-    //Write the value into the shadow register (and pray it works...)
-    devp->dac4_left_volume = -1*tempValue;
-
-    // Write the SPI commands to the DAC
-    cmd[2] = volume_level;
-    spi_write(spi_device,&cmd, sizeof(cmd));
-    return count;
+    hrtimer_forward_now(timer, devp->fade_period);
+    return HRTIMER_RESTART;
 }
-static ssize_t dac4_left_volume_read(struct device *dev, struct device_attribute *attr, char *buf)
-{
-    fe_AD1939_dev_t *devp = (fe_AD1939_dev_t *)dev_get_drvdata(dev);
 
-    //Copy the name into the output buffer
-    //sprintf(buf, "%d\n", fe_HA_devp->threshold);
-    fp_to_string(buf, devp->dac4_left_volume);
+/** Starts a fade of a set of DAC channels, replacing the fade in progress
 
-    strcat2(buf, "\n");
+    The fade takes one step per attenuation code of the channel that moves the most, unless that would step faster
+    than AD1939_FADE_MIN_PERIOD_US.
 
-    //Return the length of the buffer so it will print in the console
-    return strlen(buf);
-}
-static ssize_t dac1_right_volume_write(struct device *dev, struct device_attribute *attr, const char *buf, size_t count)
+    @param devp Device of the AD1939
+    @param channels Or of the FE_AD1939_DAC* bits
+    @param target Attenuation in dB as signed Q16, the sign is ignored
+    @param duration_ms Length of the fade
+    @returns SUCCESS or -EINVAL
+*/
+static int AD1939_fade(fe_AD1939_dev_t *devp, uint32_t channels, uint32_t target, uint32_t duration_ms)
 {
-    uint32_t tempValue = 0;
-    uint8_t volume_level;
-    char cmd[3] = {0x08,0x07,0x00};
-    char substring[80];
-    int substring_count = 0;
+    unsigned long mask = channels;
+    unsigned long flags;
+    unsigned int max_delta = 0;
+    unsigned int max_steps;
+    unsigned int steps;
+    uint8_t level;
     int i;
 
-    fe_AD1939_dev_t *devp = (fe_AD1939_dev_t *)dev_get_drvdata(dev);
+    if (!channels || channels > FE_AD1939_DAC_ALL || duration_ms > FE_AD1939_MAX_FADE_MS)
+        return -EINVAL;
 
-    for (i = 0; i < count; i++)
-    {
-        //If its not a space or a comma, add the digit to the substring
-        if ((buf[i] != ',') && (buf[i] != ' ') && (buf[i] != '\0') && (buf[i] != '\r') && (buf[i] != '\n'))
-        {
-            substring[substring_count] = buf[i];
-            substring_count++;
-        }
-    }
+    if (target & 0x80000000)
+        target = -target;
+    level = find_volume_level(target);
 
-    substring[substring_count] = '\0';
+    hrtimer_cancel(&devp->fade_timer);
 
-    // If the first character is a negative sign
-    if (buf[0] == '-')
+    spin_lock_irqsave(&devp->volume_lock, flags);
+    for_each_set_bit(i, &mask, AD1939_NUM_VOLUMES)
     {
-      // Shift all the values "left" to remove it
-      for (i=0;i<79;i++)
-        substring[i] = substring[i+1];
+        devp->fade_start[i] = devp->volume_level[i];
+        max_delta = max(max_delta, (unsigned int)abs((int)level - devp->volume_level[i]));
     }
 
-    //Convert the buffer to a fixed point value
-    tempValue = set_fixed_num(substring);
+    max_steps = duration_ms * USEC_PER_MSEC / AD1939_FADE_MIN_PERIOD_US;
+    steps = clamp(min(max_delta, max_steps), 1U, 255U);
 
-    //printk("Entering conversion function\n");
-    volume_level = find_volume_level(tempValue);
-    tempValue = decode_volume(volume_level);
-    
-    //Write the value into the shadow register (and pray it works...)
-    devp->dac1_right_volume = -1*tempValue;
+    devp->fade_mask = mask;
+    devp->fade_target = level;
+    devp->fade_step = 0;
+    devp->fade_steps = steps;
+    devp->fade_period = ns_to_ktime((u64)duration_ms * NSEC_PER_MSEC / steps);
+    spin_unlock_irqrestore(&devp->volume_lock, flags);
 
-    // Write the SPI commands to the DAC
-    cmd[2] = volume_level;
-    spi_write(spi_device,&cmd, sizeof(cmd));
-    return count;
+    hrtimer_start(&devp->fade_timer, devp->fade_period, HRTIMER_MODE_REL);
+
+    return 0;
 }
-static ssize_t dac1_right_volume_read(struct device *dev, struct device_attribute *attr, char *buf)
+
+/** Waits for the volume queue of a device to drain
+
+    @param devp Device of the AD1939
+    @returns 0, or the first SPI error since the last flush
+*/
+static int AD1939_volume_flush(fe_AD1939_dev_t *devp)
 {
-    fe_AD1939_dev_t *devp = (fe_AD1939_dev_t *)dev_get_drvdata(dev);
+    unsigned long flags;
+    int status;
 
-    //Copy the name into the output buffer
-    //sprintf(buf, "%d\n", fe_HA_devp->threshold);
-    fp_to_string(buf, devp->dac1_right_volume);
+    status = wait_event_interruptible(devp->volume_wait, AD1939_volume_idle(devp));
+    if (status)
+        return status;
 
-    strcat2(buf, "\n");
+    spin_lock_irqsave(&devp->volume_lock, flags);
+    status = devp->volume_status;
+    devp->volume_status = 0;
+    spin_unlock_irqrestore(&devp->volume_lock, flags);
 
-    //Return the length of the buffer so it will print in the console
-    return strlen(buf);
+    return status;
 }
-static ssize_t dac2_right_volume_write(struct device *dev, struct device_attribute *attr, const char *buf, size_t count)
+
+/** Sets the attenuation of one DAC channel
+
+    The store only queues the new code, it doesn't wait for the SPI bus (write the flush attribute or fsync the device
+    to wait for it).
+
+    @param dev Device of the AD1939
+    @param reg Volume register of the channel (AD1939_DAC1_LEFT_VOL .. AD1939_DAC4_RIGHT_VOL)
+    @param buf Attenuation in dB, the sign is ignored
+    @param count Length of buf
+    @returns count on success, or a negative error code
+*/
+static ssize_t AD1939_volume_write(struct device *dev, unsigned int reg, const char *buf, size_t count)
 {
     uint32_t tempValue = 0;
     uint8_t volume_level;
-    char cmd[3] = {0x08,0x09,0x00};
-    char substring[80];
-    int substring_count = 0;
-    int i;
+    int status;
 
     fe_AD1939_dev_t *devp = (fe_AD1939_dev_t *)dev_get_drvdata(dev);
 
-    for (i = 0; i < count; i++)
-    {
-        //If its not a space or a comma, add the digit to the substring
-        if ((buf[i] != ',') && (buf[i] != ' ') && (buf[i] != '\0') && (buf[i] != '\r') && (buf[i] != '\n'))
-        {
-            substring[substring_count] = buf[i];
-            substring_count++;
-        }
-    }
-
-    substring[substring_count] = '\0';
-
-    // If the first character is a negative sign
-    if (buf[0] == '-')
-    {
-      // Shift all the values "left" to remove it
-      for (i=0;i<79;i++)
-        substring[i] = substring[i+1];
-    }
+    //Convert the buffer to a fixed point value, the sign is ignored since the DAC volume is an attenuation
+    status = fe_fixed_from_string(buf, count, FE_SQ16, &tempValue);
+    if (status)
+        return status;
 
-    //Convert the buffer to a fixed point value
-    tempValue = set_fixed_num(substring);
+    if (tempValue & 0x80000000)
+        tempValue = -tempValue;
 
-    //printk("Entering conversion function\n");
     volume_level = find_volume_level(tempValue);
-    tempValue = decode_volume(volume_level);
-    
-    //Write the value into the shadow register (and pray it works...)
-    devp->dac2_right_volume = -1*tempValue;
+    AD1939_volume_queue(devp, reg - AD1939_DAC1_LEFT_VOL, &volume_level, 1);
 
-    // Write the SPI commands to the DAC
-    cmd[2] = volume_level;
-    spi_write(spi_device,&cmd, sizeof(cmd));
     return count;
 }
-static ssize_t dac2_right_volume_read(struct device *dev, struct device_attribute *attr, char *buf)
-{
-    fe_AD1939_dev_t *devp = (fe_AD1939_dev_t *)dev_get_drvdata(dev);
 
-    //Copy the name into the output buffer
-    //sprintf(buf, "%d\n", fe_HA_devp->threshold);
-    fp_to_string(buf, devp->dac2_right_volume);
+/** Shows the attenuation of one DAC channel, the last value written even if it is still queued
 
-    strcat2(buf, "\n");
-
-    //Return the length of the buffer so it will print in the console
-    return strlen(buf);
-}
-static ssize_t dac3_right_volume_write(struct device *dev, struct device_attribute *attr, const char *buf, size_t count)
+    @param dev Device of the AD1939
+    @param reg Volume register of the channel (AD1939_DAC1_LEFT_VOL .. AD1939_DAC4_RIGHT_VOL)
+    @param buf charactor buffer for the sysfs return
+    @returns Length of the buffer
+*/
+static ssize_t AD1939_volume_read(struct device *dev, unsigned int reg, char *buf)
 {
-    uint32_t tempValue = 0;
     uint8_t volume_level;
-    char cmd[3] = {0x08,0x0B,0x00};
-    char substring[80];
-    int substring_count = 0;
-    int i;
+    unsigned long flags;
 
     fe_AD1939_dev_t *devp = (fe_AD1939_dev_t *)dev_get_drvdata(dev);
 
-    for (i = 0; i < count; i++)
-    {
-        //If its not a space or a comma, add the digit to the substring
-        if ((buf[i] != ',') && (buf[i] != ' ') && (buf[i] != '\0') && (buf[i] != '\r') && (buf[i] != '\n'))
-        {
-            substring[substring_count] = buf[i];
-            substring_count++;
-        }
-    }
+    spin_lock_irqsave(&devp->volume_lock, flags);
+    volume_level = devp->volume_level[reg - AD1939_DAC1_LEFT_VOL];
+    spin_unlock_irqrestore(&devp->volume_lock, flags);
 
-    substring[substring_count] = '\0';
-
-    // If the first character is a negative sign
-    if (buf[0] == '-')
-    {
-      // Shift all the values "left" to remove it
-      for (i=0;i<79;i++)
-        substring[i] = substring[i+1];
-    }
-
-    //Convert the buffer to a fixed point value
-    tempValue = set_fixed_num(substring);
-
-    //printk("Entering conversion function\n");
-    volume_level = find_volume_level(tempValue);
-    tempValue = decode_volume(volume_level);
-    
-    //Write the value into the shadow register (and pray it works...)
-    devp->dac3_right_volume = -1*tempValue;
-
-    // Write the SPI commands to the DAC
-    cmd[2] = volume_level;
-    spi_write(spi_device,&cmd, sizeof(cmd));
-    return count;
+    //Copy the value into the output buffer and return its length so it will print in the console
+    return fe_fixed_show(buf, -decode_volume(volume_level), FE_SQ16);
+}
+static ssize_t dac1_left_volume_write(struct device *dev, struct device_attribute *attr, const char *buf, size_t count)
+{
+    return AD1939_volume_write(dev, AD1939_DAC1_LEFT_VOL, buf, count);
+}
+static ssize_t dac1_left_volume_read(struct device *dev, struct device_attribute *attr, char *buf)
+{
+    return AD1939_volume_read(dev, AD1939_DAC1_LEFT_VOL, buf);
+}
+static ssize_t dac2_left_volume_write(struct device *dev, struct device_attribute *attr, const char *buf, size_t count)
+{
+    return AD1939_volume_write(dev, AD1939_DAC2_LEFT_VOL, buf, count);
+}
+static ssize_t dac2_left_volume_read(struct device *dev, struct device_attribute *attr, char *buf)
+{
+    return AD1939_volume_read(dev, AD1939_DAC2_LEFT_VOL, buf);
+}
+static ssize_t dac3_left_volume_write(struct device *dev, struct device_attribute *attr, const char *buf, size_t count)
+{
+    return AD1939_volume_write(dev, AD1939_DAC3_LEFT_VOL, buf, count);
+}
+static ssize_t dac3_left_volume_read(struct device *dev, struct device_attribute *attr, char *buf)
+{
+    return AD1939_volume_read(dev, AD1939_DAC3_LEFT_VOL, buf);
+}
+static ssize_t dac4_left_volume_write(struct device *dev, struct device_attribute *attr, const char *buf, size_t count)
+{
+    return AD1939_volume_write(dev, AD1939_DAC4_LEFT_VOL, buf, count);
+}
+static ssize_t dac4_left_volume_read(struct device *dev, struct device_attribute *attr, char *buf)
+{
+    return AD1939_volume_read(dev, AD1939_DAC4_LEFT_VOL, buf);
+}
+static ssize_t dac1_right_volume_write(struct device *dev, struct device_attribute *attr, const char *buf, size_t count)
+{
+    return AD1939_volume_write(dev, AD1939_DAC1_RIGHT_VOL, buf, count);
+}
+static ssize_t dac1_right_volume_read(struct device *dev, struct device_attribute *attr, char *buf)
+{
+    return AD1939_volume_read(dev, AD1939_DAC1_RIGHT_VOL, buf);
+}
+static ssize_t dac2_right_volume_write(struct device *dev, struct device_attribute *attr, const char *buf, size_t count)
+{
+    return AD1939_volume_write(dev, AD1939_DAC2_RIGHT_VOL, buf, count);
+}
+static ssize_t dac2_right_volume_read(struct device *dev, struct device_attribute *attr, char *buf)
+{
+    return AD1939_volume_read(dev, AD1939_DAC2_RIGHT_VOL, buf);
+}
+static ssize_t dac3_right_volume_write(struct device *dev, struct device_attribute *attr, const char *buf, size_t count)
+{
+    return AD1939_volume_write(dev, AD1939_DAC3_RIGHT_VOL, buf, count);
 }
 static ssize_t dac3_right_volume_read(struct device *dev, struct device_attribute *attr, char *buf)
 {
-    fe_AD1939_dev_t *devp = (fe_AD1939_dev_t *)dev_get_drvdata(dev);
-
-    //Copy the name into the output buffer
-    //sprintf(buf, "%d\n", fe_HA_devp->threshold);
-    fp_to_string(buf, devp->dac3_right_volume);
-
-    strcat2(buf, "\n");
-
-    //Return the length of the buffer so it will print in the console
-    return strlen(buf);
+    return AD1939_volume_read(dev, AD1939_DAC3_RIGHT_VOL, buf);
 }
 static ssize_t dac4_right_volume_write(struct device *dev, struct device_attribute *attr, const char *buf, size_t count)
 {
-    uint32_t tempValue = 0;
-    uint8_t volume_level;
-    char cmd[3] = {0x08,0x0D,0x00};
-    char substring[80];
-    int substring_count = 0;
+    return AD1939_volume_write(dev, AD1939_DAC4_RIGHT_VOL, buf, count);
+}
+static ssize_t dac4_right_volume_read(struct device *dev, struct device_attribute *attr, char *buf)
+{
+    return AD1939_volume_read(dev, AD1939_DAC4_RIGHT_VOL, buf);
+}
+
+/** Sets the attenuation of all eight DAC channels at once
+
+    The values are given in register order (DAC1 left, DAC1 right, ... DAC4 right).  The channels that changed are
+    queued together and go out in the same SPI message.
+*/
+static ssize_t dac_volumes_write(struct device *dev, struct device_attribute *attr, const char *buf, size_t count)
+{
+    uint32_t volumes[AD1939_NUM_VOLUMES];
+    uint8_t levels[AD1939_NUM_VOLUMES];
+    int num_volumes;
     int i;
 
     fe_AD1939_dev_t *devp = (fe_AD1939_dev_t *)dev_get_drvdata(dev);
 
-    for (i = 0; i < count; i++)
-    {
-        //If its not a space or a comma, add the digit to the substring
-        if ((buf[i] != ',') && (buf[i] != ' ') && (buf[i] != '\0') && (buf[i] != '\r') && (buf[i] != '\n'))
-        {
-            substring[substring_count] = buf[i];
-            substring_count++;
-        }
-    }
-
-    substring[substring_count] = '\0';
+    //Convert the buffer to one fixed point value per channel, nothing is written unless every channel is given
+    num_volumes = fe_fixed_parse_vector(buf, count, FE_SQ16, volumes, AD1939_NUM_VOLUMES);
+    if (num_volumes < 0)
+        return num_volumes;
+    if (num_volumes != AD1939_NUM_VOLUMES)
+        return -EINVAL;
 
-    // If the first character is a negative sign
-    if (buf[0] == '-')
+    for (i = 0; i < AD1939_NUM_VOLUMES; i++)
     {
-      // Shift all the values "left" to remove it
-      for (i=0;i<79;i++)
-        substring[i] = substring[i+1];
+        if (volumes[i] & 0x80000000)
+            volumes[i] = -volumes[i];
+        levels[i] = find_volume_level(volumes[i]);
     }
 
-    //Convert the buffer to a fixed point value
-    tempValue = set_fixed_num(substring);
+    AD1939_volume_queue(devp, 0, levels, AD1939_NUM_VOLUMES);
 
-    //printk("Entering conversion function\n");
-    volume_level = find_volume_level(tempValue);
-    tempValue = decode_volume(volume_level);
-    
-    //Write the value into the shadow register (and pray it works...)
-    devp->dac4_right_volume = -1*tempValue;
-
-    // Write the SPI commands to the DAC
-    cmd[2] = volume_level;
-    spi_write(spi_device,&cmd, sizeof(cmd));
     return count;
 }
-static ssize_t dac4_right_volume_read(struct device *dev, struct device_attribute *attr, char *buf)
+static ssize_t dac_volumes_read(struct device *dev, struct device_attribute *attr, char *buf)
 {
-    fe_AD1939_dev_t *devp = (fe_AD1939_dev_t *)dev_get_drvdata(dev);
-
-    //Copy the name into the output buffer
-    //sprintf(buf, "%d\n", fe_HA_devp->threshold);
-    fp_to_string(buf, devp->dac4_right_volume);
-
-    strcat2(buf, "\n");
-
-    //Return the length of the buffer so it will print in the console
-    return strlen(buf);
-}
-//---------------------------------------------------------------
+    uint32_t volumes[AD1939_NUM_VOLUMES];
+    uint8_t levels[AD1939_NUM_VOLUMES];
+    unsigned long flags;
+    int i;
 
-char *strcat2(char *dst, char *src)
-{
-    char *cp = dst;
+    fe_AD1939_dev_t *devp = (fe_AD1939_dev_t *)dev_get_drvdata(dev);
 
-    while (*cp)
-        cp++; /* find end of dst */
+    spin_lock_irqsave(&devp->volume_lock, flags);
+    memcpy(levels, devp->volume_level, sizeof(levels));
+    spin_unlock_irqrestore(&devp->volume_lock, flags);
 
-    while (( *cp++ = *src++ ) != 0); /* Copy src to end of dst */
+    for (i = 0; i < AD1939_NUM_VOLUMES; i++)
+        volumes[i] = -decode_volume(levels[i]);
 
-    return dst; /* return dst */
+    //Copy the values into the output buffer and return its length so it will print in the console
+    return fe_fixed_show_vector(buf, volumes, AD1939_NUM_VOLUMES, FE_SQ16);
 }
 
-/** Convert a string to a fixed point number structure
-    @param s String containing the string to convert to 32F16 representation
-    @return SUCCESS
+/** Starts a fade, the input is "<channels> <attenuation in dB> <duration in ms>"
 
-    @todo This function is really ugly and could be cleaned up to make it clear what is happening....
+    channels is the mask of FE_AD1939_DAC* bits (1 is DAC1 left, 255 all eight), eg: "255 -40 500" fades every DAC
+    channel to -40 dB in half a second.
 */
-uint32_t set_fixed_num(const char *s)
+static ssize_t fade_write(struct device *dev, struct device_attribute *attr, const char *buf, size_t count)
 {
-    struct fixed_num num = {0, 0, 0};
-    int seen_point = 0;
-    int pointIndex;
-    int i;
-    int ii;
-    int frac_comp;
-    uint32_t acc = 0;
-    char s2[80];
-    int pointsSeen = 0;
-    int charIndex = 0;
-
-    //If no leading 0, add one (eg: .25 -> 0.25)
-    if (s[0] == '.')
-    {
-        s2[0] = '0';
-        charIndex++;
-    }
-
-    //This is a strcpy() to move the data a "const char *" to a "char *" and validate the data
-    for (i = 0; i < strlen(s); i++)
-    {
-        //Make sure the string contains an non-valid char (eg: not a number or a decimal point)
-        if ((s[i] == '.') || (s[i] >= '0' && s[i] <= '9'))
-        {
-            //Copy the data over and increment the pointer
-            s2[charIndex] = s[i];
-            charIndex++;
-        }
-        else
-        {
-            pr_info("Invalid char (c:%c x:%X) in number %s\n", s[i], s[i], s);
-            return 0x00000000;
-        }
-
-        //Count the number of decimals in the string
-        if (s[i] == '.')
-            pointsSeen++;
-    }
-
-    //If multiple decimals points in the number (eg: 1.1.4)
-    if (pointsSeen > 1)
-        pr_info("Invalid number format: %s\n", s);
-
-    //Turn 1 into 1.0
-    //if (pointsSeen == 0)
-    // {
-    //    printk("Adding the decimal...\n");
-    //    s2[i] = char(".");
-    //    s2[i+1] = char("0");
-    //    //strcat2(".0",s2);
-    //    i=i+2;
-    // }
-    //Make sure the string is terminated
-    s2[i] = '\0';
-
-    //Count the fractional digits
-    for (pointIndex = 0; pointIndex < strlen(s2); pointIndex++)
-    {
-        if (s2[pointIndex] == '.')
-            break;
-    }
-
-    //String extend so that the output is accurate
-    while (strlen(s2) - pointIndex < 9)
-        strcat2(s2, "0");
+    uint32_t values[3];
+    int num_values;
+    int status;
 
-    //Truncate the string if its longer
-    s2[strlen(s2) - pointIndex + 9] = '\0';
+    fe_AD1939_dev_t *devp = (fe_AD1939_dev_t *)dev_get_drvdata(dev);
 
-    //Covert to fixed point
-    for (i = 0; i < 10; i++)
-    {
-        if (s2[i] == '.')
-        {
-            seen_point = 1;
-            continue;
-        }
-        if (!seen_point)
-        {
-            num.integer *= 10;
-            num.integer += (int)(s2[i] - '0');
-        }
-        else
-        {
-            num.fraction_len++;
-            num.fraction *= 10;
-            num.fraction += (int)(s2[i] - '0');
-        }
-    }
+    num_values = fe_fixed_parse_vector(buf, count, FE_SQ16, values, 3);
+    if (num_values < 0)
+        return num_values;
+    if (num_values != 3 || (values[0] & 0x8000FFFF) || (values[2] & 0x8000FFFF))
+        return -EINVAL;
 
-    //Turn the fixed point conversion into binary digits
-    for (ii = 0, frac_comp = 1; ii < num.fraction_len; ii++) frac_comp *= 10;
-    frac_comp /= 2;
+    status = AD1939_fade(devp, values[0] >> 16, values[1], values[2] >> 16);
+    if (status)
+        return status;
 
-    // Get the fractional part (f28 hopefully)
-    for (ii = 0; i <= 36; i++)
-    {
-        if (num.fraction >= frac_comp)
-        {
-            acc |= 0x00000001;
-            num.fraction -= frac_comp;
-        }
-        frac_comp /= 2;
+    return count;
+}
 
-        acc = acc << 1;
-    }
+/** Shows the mask of the channels still fading */
+static ssize_t fade_read(struct device *dev, struct device_attribute *attr, char *buf)
+{
+    unsigned long flags;
+    unsigned long mask;
 
-    acc = acc >> 12;
+    fe_AD1939_dev_t *devp = (fe_AD1939_dev_t *)dev_get_drvdata(dev);
 
-    //Combine the fractional part with the integer
-    acc += num.integer << 16;
+    spin_lock_irqsave(&devp->volume_lock, flags);
+    mask = devp->fade_mask;
+    spin_unlock_irqrestore(&devp->volume_lock, flags);
 
-    return acc;
+    return sprintf(buf, "%lu\n", mask);
 }
 
-/** Function to convert a fp16 to a string representation
-    @todo doesn't handle negative numbers
+/** Any write waits for the queued DAC volumes (and any fade in progress) to reach the codec
+
+    @returns count, or the first SPI error since the last flush
 */
-int fp_to_string(char *buf, uint32_t fp28_num)
+static ssize_t flush_write(struct device *dev, struct device_attribute *attr, const char *buf, size_t count)
 {
-    int buf_pos = 0;
-    int i;
-    int fractionPart;
-    //int isNegative = 0;
-    int intPart = 1;
-    int i16 = 0;
-
-    if (fp28_num & 0x80000000)
-    {
-        fp28_num *= -1;
-
-        buf[buf_pos] = '-';
-        buf_pos++;
-    }
+    int status;
 
-    //Convert the integer part
-    i16 = (fp28_num >> 16);
-    while ( (i16 / intPart) > 9)
-    {
-        intPart *= 10;
-    }
+    fe_AD1939_dev_t *devp = (fe_AD1939_dev_t *)dev_get_drvdata(dev);
 
-    while (intPart > 0)
-    {
-        buf[buf_pos] = (char)((i16 / intPart) + '0');
-        buf_pos++;
+    status = AD1939_volume_flush(devp);
+    if (status)
+        return status;
 
-        i16 = i16 % intPart;
-        intPart = intPart / 10;
-    }
+    return count;
+}
+//---------------------------------------------------------------
 
-    //buf[buf_pos] = (char)((fp28_num>>16) + '0');
-    //buf_pos++;
+/** Link check of the SPI calibration, writes test patterns into the DAC1 left volume register and reads them back
 
-    buf[buf_pos] = '.';
-    buf_pos++;
+    The register is put back to 0 dB (its power on value, which is what the volume queue starts from) at the end, and
+    again by the initialization sequence once the rate is chosen.
 
-    //Mask the integer bits and dump 1 bit to make the conversion easier....
-    fractionPart = (0x0000FFFF & fp28_num) >> 1; // 32F27 so that 0-9 can fit in the high 5 bits)
+    @param spi SPI device of the codec
+    @returns 0 when every pattern was read back, -EIO on a mismatch or the SPI error
+*/
+static int AD1939_spi_verify(struct spi_device *spi)
+{
+    static const uint8_t patterns[] = { 0x55, 0xAA, 0x0F, 0xF0, 0xFF, 0x01 };
+    uint8_t cmd[3];
+    uint8_t value;
+    int status;
+    int i;
 
-    for (i = 0; i < 8; i++)
+    for (i = 0; i < ARRAY_SIZE(patterns); i++)
     {
-        fractionPart *= 10;
-        buf[buf_pos] = (fractionPart >> 15) + '0';
-        buf_pos++;
-        fractionPart &= 0x00007FFF;
+        cmd[0] = AD1939_SPI_WRITE;
+        cmd[1] = AD1939_DAC1_LEFT_VOL;
+        cmd[2] = patterns[i];
+        status = spi_write(spi, cmd, sizeof(cmd));
+        if (status)
+            return status;
+
+        cmd[0] = AD1939_SPI_READ;
+        status = spi_write_then_read(spi, cmd, 2, &value, 1);
+        if (status)
+            return status;
+
+        if (value != patterns[i])
+            return -EIO;
     }
 
-    buf[buf_pos] = '\0';
-
-    return 0;
+    cmd[0] = AD1939_SPI_WRITE;
+    cmd[2] = 0x00;
+    return spi_write(spi, cmd, sizeof(cmd));
 }
 
-/** Converts a 32 bit integer into an 8 bit volume level
-    @param fp28_num 32 bit representation of a fixed point number
+/** Finds the volume level nearest to an attenuation
+    @param fp28_num Attenuation in dB as an unsigned Q16 fixed point word, attenuations above 95.625 dB give 95.625 dB
     @return volume_level an 8 bit representation of the attenuation
 */
 uint8_t find_volume_level(uint32_t fp28_num)
 {
-  // Initialize the volume level
-  uint8_t volume_level = 0;
-
-  // Divide the input number by the reciprocal of the step size
-  uint32_t inputnum = fp28_num*10*8/3;
-  
-  // Find the integer portion and the tenths portion
-  // (Steps are in 3/8 increments so only that position is needed)
-  uint16_t upperval = (uint16_t)((inputnum)>>=16)/10;
-  uint16_t lowerval = inputnum-upperval*10;
-
-  // Catch whether the user exceeded the maximum attenuation
-  if (upperval > 255)
-  {
-    upperval = 255;
-    lowerval = 0;
-    printk("Input exceeds the maximum codec attenuation of -95.625 dB.\n");
-    printk("Setting attenuation to -95.625 dB.\n");
-  }
-
-  // Set the volume level to the integer portion
-  volume_level = (uint8_t)(upperval);
-  
-  // If the tenths portion is greater than five, round up
-  if (lowerval > 5)
-    volume_level += 1;
-
-  return volume_level;
+  // Attenuations above the Q16 range of the map are past 95.625 dB anyway
+  if (fp28_num > INT_MAX)
+    fp28_num = INT_MAX;
+
+  return fe_gain_map_code(&ad1939_volume_map, fp28_num);
 }
 
-/** Converts an 8 bit volume level representation to a 32 bit fixed point 28 number
+/** Converts an 8 bit volume level to its attenuation
     @param volume_level an 8 bit representation of the attenuation
-    @return fp28_num 32 bit representation of a fixed point number
+    @return Attenuation in dB as an unsigned Q16 fixed point word
 */
 uint32_t decode_volume(uint8_t volume_level)
 {
-  // Cast the volume level to a 32 bit number
-  uint32_t decodedDb = (uint32_t)volume_level;
+  int32_t value = 0;
+
+  fe_gain_map_decode(&ad1939_volume_map, volume_level, &value);
 
-  // Return the shifted and scaled number to keep with convention
-  return (decodedDb<<=16)*3/8;
+  return value;
 }
 
 /** Tell the kernel what the initialization function is */
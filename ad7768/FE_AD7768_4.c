@@ -19,8 +19,22 @@
 #include <linux/uaccess.h>
 #include <linux/init.h>
 #include<linux/cdev.h>
+#include <linux/idr.h>
 #include <linux/spi/spi.h>
 #include <linux/regmap.h>
+#include <linux/mutex.h>
+#include <linux/log2.h>
+#include <linux/math64.h>
+#include <linux/firmware.h>
+#include <linux/of.h>
+
+#include "fe_fixedpoint.h"
+#include "fe_spi_calibrate.h"
+#include "fe_ad7768_ioctl.h"
+#include "fe_gain_map.h"
+
+#define CREATE_TRACE_POINTS
+#include "fe_ad7768_trace.h"
 
 
 // Define information about this kernel module
@@ -31,6 +45,9 @@ MODULE_VERSION("1.0");
 
 static uint8_t bits = 8;
 static uint32_t speed = 500000;
+
+// Control port clocks tried by the link calibration, slowest first
+static const uint32_t ad7768_spi_speeds[] = { 500000, 1000000, 2000000, 5000000, 10000000, 15000000, 20000000 };
 static struct spi_device *spi_device;
 
 #define AD7768_WRITE       	0x00
@@ -40,6 +57,7 @@ static struct spi_device *spi_device;
 #define MODEA_ADDR      		0x01
 #define CHMODE_SEL      		0x03
 #define POWER_MODE_ADDR			0x04
+#define DATA_CONTROL_ADDR   0x06
 #define INTFACE_CFG     		0x07
 #define ADC0_GAIN_ADDR_MSB  0x36
 #define ADC0_GAIN_ADDR_MID  0x37
@@ -48,16 +66,89 @@ static struct spi_device *spi_device;
 #define ADC1_GAIN_ADDR_MID  0x3A
 #define ADC1_GAIN_ADDR_LSB  0x3B
 
-
-struct fixed_num
+// Number of ADC channels.  The AD7768-4 uses the register map of the eight channel AD7768 with its channels 2 and 3
+// in the slots of channels 4 and 5 (standby bits 4 and 5, gains at 0x42 and 0x45, ...)
+#define AD7768_NUM_CHANNELS     4
+#define AD7768_CH_SLOT(ch)      ((ch) < 2 ? (ch) : (ch) + 2)
+#define AD7768_CH_STANDBY(ch)   (1 << AD7768_CH_SLOT(ch))
+
+// Each slot has a 24 bit gain in three registers (MSB first) following the slot before
+#define ADC_GAIN_ADDR_MSB(ch)   (ADC0_GAIN_ADDR_MSB + 3 * AD7768_CH_SLOT(ch))
+
+// The 24 bit offsets are laid out like the gains, the sync offsets (phase delay) are one register per slot
+#define ADC0_OFFSET_ADDR_MSB    0x1E
+#define ADC0_SYNC_OFFSET_ADDR   0x4E
+#define ADC_OFFSET_ADDR_MSB(ch) (ADC0_OFFSET_ADDR_MSB + 3 * AD7768_CH_SLOT(ch))
+#define ADC_SYNC_OFFSET_ADDR(ch) (ADC0_SYNC_OFFSET_ADDR + AD7768_CH_SLOT(ch))
+
+// Calibration file loaded at probe when the device tree doesn't name one
+#define AD7768_CAL_FIRMWARE     "fe_ad7768_4_cal.bin"
+
+// Factory default gain code (a relative gain of 1), and the code of the largest relative gain (4)
+#define AD7768_DEFAULT_GAIN     0x555555
+#define AD7768_MAX_GAIN         0xFFFFFF
+
+// Gain writes of every channel at once, one 16 bit frame per register in a single message
+static DEFINE_MUTEX(ad7768_gain_lock);
+static struct spi_message ad7768_gain_msg;
+static struct spi_transfer ad7768_gain_xfer[3 * AD7768_NUM_CHANNELS];
+static uint8_t ad7768_gain_cmd[3 * AD7768_NUM_CHANNELS][2];
+
+// Calibration loads, the offset, gain and sync offset registers of every channel in a single message (also under
+// ad7768_gain_lock since it rewrites the gains)
+#define AD7768_CAL_FRAMES       (7 * AD7768_NUM_CHANNELS)
+static struct spi_message ad7768_cal_msg;
+static struct spi_transfer ad7768_cal_xfer[AD7768_CAL_FRAMES];
+static uint8_t ad7768_cal_cmd[AD7768_CAL_FRAMES][2];
+
+// Master clock of the ADC, the modulator runs at MCLK / mclk_div and the output data rate is that over the decimation
+#define AD7768_MCLK_HZ          32768000
+// Bits of a sample on DOUT, DCLK has to shift a whole one out every output data period
+#define AD7768_FRAME_BITS       32
+// Sinc5 filter bit of a channel mode register, and the software synchronization bit of the data control register
+#define AD7768_FILTER_SINC5     0x08
+#define AD7768_SPI_SYNC         0x80
+
+// Fields of the mode taken by AD7768_4_change_mode
+#define AD7768_MODE_POWER       0x01
+#define AD7768_MODE_MCLK_DIV    0x02
+#define AD7768_MODE_DECIMATION  0x04
+#define AD7768_MODE_FILTER      0x08
+#define AD7768_MODE_ALL         0x0F
+
+// Power mode field of the power mode register and its sysfs name, indexed by FE_AD7768_POWER_*
+static const uint8_t ad7768_power_codes[] = { 0x00, 0x20, 0x30 };
+static const char * const ad7768_power_names[] = { "eco", "median", "fast" };
+// sysfs names of the filters, indexed by FE_AD7768_FILTER_*
+static const char * const ad7768_filter_names[] = { "wideband", "sinc5" };
+
+// Mode of the ADC, the initialization commands start it in fast mode with MCLK/32 and the sinc5 filter decimating by 64
+static DEFINE_MUTEX(ad7768_mode_lock);
+static struct fe_ad7768_mode ad7768_mode =
 {
-    int integer;
-    int fraction;
-    int fraction_len;
+    .power_mode = FE_AD7768_POWER_FAST,
+    .mclk_div = 32,
+    .decimation = 64,
+    .filter = FE_AD7768_FILTER_SINC5,
+    .output_data_rate = AD7768_MCLK_HZ / 32 / 64,
 };
 
-static struct class *cl; // Global variable for the device class
-static dev_t dev_num;
+// Mode changes are one message: power mode, interface configuration, channel mode A, channel mode select and the
+// two writes of the synchronization pulse
+#define AD7768_MODE_FRAMES      6
+static struct spi_message ad7768_mode_msg;
+static struct spi_transfer ad7768_mode_xfer[AD7768_MODE_FRAMES];
+static uint8_t ad7768_mode_cmd[AD7768_MODE_FRAMES][2];
+
+
+// Largest number of AD7768-4s the driver can handle, each one gets a minor number
+#define FE_AD7768_4_MAX_DEVICES 16
+
+static struct class *cl; // Global variable for the device class, shared by every AD7768-4
+static dev_t dev_num;    // First device number of the region reserved for the AD7768-4s
+static DEFINE_IDA(fe_AD7768_4_ida); // Minor numbers in use
+
+struct fe_AD7768_4_dev;
 
 // Function Prototypes
 static int AD7768_4_probe(struct platform_device *pdev);
@@ -66,23 +157,81 @@ static ssize_t AD7768_4_read(struct file *file, char *buffer, size_t len, loff_t
 static ssize_t AD7768_4_write(struct file *file, const char *buffer, size_t len, loff_t *offset);
 static int AD7768_4_open(struct inode *inode, struct file *file);
 static int AD7768_4_release(struct inode *inode, struct file *file);
+static long AD7768_4_ioctl(struct file *file, unsigned int cmd, unsigned long arg);
 static ssize_t name_read(struct device *dev, struct device_attribute *attr, char *buf);
+static ssize_t spi_speed_read(struct device *dev, struct device_attribute *attr, char *buf);
+static int AD7768_4_spi_verify(struct spi_device *spi);
 
 // SPI operation prototypes
 static ssize_t adc0_gain_write(struct device *dev, struct device_attribute *attr, const char *buf, size_t count);
 static ssize_t adc0_gain_read(struct device *dev, struct device_attribute *attr, char *buf);
 static ssize_t adc1_gain_write(struct device *dev, struct device_attribute *attr, const char *buf, size_t count);
 static ssize_t adc1_gain_read(struct device *dev, struct device_attribute *attr, char *buf);
+static ssize_t adc2_gain_write(struct device *dev, struct device_attribute *attr, const char *buf, size_t count);
+static ssize_t adc2_gain_read(struct device *dev, struct device_attribute *attr, char *buf);
+static ssize_t adc3_gain_write(struct device *dev, struct device_attribute *attr, const char *buf, size_t count);
+static ssize_t adc3_gain_read(struct device *dev, struct device_attribute *attr, char *buf);
+static ssize_t adc_gains_write(struct device *dev, struct device_attribute *attr, const char *buf, size_t count);
+static ssize_t adc_gains_read(struct device *dev, struct device_attribute *attr, char *buf);
+static int AD7768_4_write_gains(unsigned int first, const uint32_t *codes, unsigned int num_codes);
+static ssize_t power_mode_write(struct device *dev, struct device_attribute *attr, const char *buf, size_t count);
+static ssize_t power_mode_read(struct device *dev, struct device_attribute *attr, char *buf);
+static ssize_t mclk_div_write(struct device *dev, struct device_attribute *attr, const char *buf, size_t count);
+static ssize_t mclk_div_read(struct device *dev, struct device_attribute *attr, char *buf);
+static ssize_t decimation_write(struct device *dev, struct device_attribute *attr, const char *buf, size_t count);
+static ssize_t decimation_read(struct device *dev, struct device_attribute *attr, char *buf);
+static ssize_t filter_write(struct device *dev, struct device_attribute *attr, const char *buf, size_t count);
+static ssize_t filter_read(struct device *dev, struct device_attribute *attr, char *buf);
+static ssize_t output_data_rate_read(struct device *dev, struct device_attribute *attr, char *buf);
+static int AD7768_4_write_mode(struct fe_ad7768_mode *mode);
+static int AD7768_4_change_mode(struct fe_AD7768_4_dev *devp, struct fe_ad7768_mode *mode, unsigned int fields);
+static int AD7768_4_load_calibration(struct fe_AD7768_4_dev *devp, const struct fe_ad7768_calibration *cal);
+static void AD7768_4_load_firmware(struct platform_device *pdev, struct fe_AD7768_4_dev *devp);
+
+/** Gain code of every relative gain from 0 to 4 in steps of 0.1 (values in tenths)
+
+    The ADC gain is 0x555555 for a relative gain of 1, scaled linearly below 1 (0x555555 * G) and with a steeper slope
+    above it (0x38E38E * G + 0x1C71C7) so that 4 reaches full scale.
+*/
+static const struct fe_gain_step ad7768_gain_steps[] =
+{
+    {0,  0x000000}, {1,  0x088888}, {2,  0x111111}, {3,  0x199999}, {4,  0x222222},     // 0.0
+    {5,  0x2AAAAA}, {6,  0x333333}, {7,  0x3BBBBB}, {8,  0x444444}, {9,  0x4CCCCC},     // 0.5
+    {10, 0x555555}, {11, 0x5B05B0}, {12, 0x60B60B}, {13, 0x666666}, {14, 0x6C16C1},     // 1.0
+    {15, 0x71C71C}, {16, 0x777777}, {17, 0x7D27D2}, {18, 0x82D82D}, {19, 0x888888},     // 1.5
+    {20, 0x8E38E3}, {21, 0x93E93E}, {22, 0x999999}, {23, 0x9F49F4}, {24, 0xA4FA4F},     // 2.0
+    {25, 0xAAAAAA}, {26, 0xB05B05}, {27, 0xB60B60}, {28, 0xBBBBBB}, {29, 0xC16C16},     // 2.5
+    {30, 0xC71C71}, {31, 0xCCCCCC}, {32, 0xD27D27}, {33, 0xD82D82}, {34, 0xDDDDDD},     // 3.0
+    {35, 0xE38E38}, {36, 0xE93E93}, {37, 0xEEEEEE}, {38, 0xF49F49}, {39, 0xFA4FA4},     // 3.5
+    {40, AD7768_MAX_GAIN}                                                               // 4.0
+};
+
+static const struct fe_gain_map_desc ad7768_gain_desc =
+{
+    .num_codes = ARRAY_SIZE(ad7768_gain_steps),
+    .steps = ad7768_gain_steps,
+    .scale = 10,
+};
+
+static struct fe_gain_map ad7768_gain_map;
 
 // Custom function declarations
-char *strcat2(char *dst, char *src);
-uint32_t set_fixed_num(const char *s);
-int fp_to_string(char *buf, uint32_t fp28_num);
 uint32_t determine_relative_gain(uint32_t fp28_num);
+uint32_t decode_relative_gain(uint32_t code);
 
 //Create the attributes that show up in /dev/class
 static DEVICE_ATTR(adc0_gain,                 0664, adc0_gain_read,               adc0_gain_write);
 static DEVICE_ATTR(adc1_gain,                 0664, adc1_gain_read,               adc1_gain_write);
+static DEVICE_ATTR(adc2_gain,                 0664, adc2_gain_read,               adc2_gain_write);
+static DEVICE_ATTR(adc3_gain,                 0664, adc3_gain_read,               adc3_gain_write);
+static DEVICE_ATTR(adc_gains,                 0664, adc_gains_read,               adc_gains_write);
+static DEVICE_ATTR(power_mode,                0664, power_mode_read,              power_mode_write);
+static DEVICE_ATTR(mclk_div,                  0664, mclk_div_read,                mclk_div_write);
+static DEVICE_ATTR(decimation,                0664, decimation_read,              decimation_write);
+static DEVICE_ATTR(filter,                    0664, filter_read,                  filter_write);
+static DEVICE_ATTR(output_data_rate,          0444, output_data_rate_read,        NULL);
+
+static DEVICE_ATTR(spi_speed,                 0444, spi_speed_read,               NULL);
 
 static DEVICE_ATTR(name, 0444, name_read, NULL);
 
@@ -93,10 +242,13 @@ static DEVICE_ATTR(name, 0444, name_read, NULL);
 struct fe_AD7768_4_dev
 {
     struct cdev cdev;           ///< The driver structure containing major/minor, etc
+    dev_t devt;                 ///< Device number of this AD7768-4
     char *name;                 ///< This gets the name of the device when loading the driver
-    void __iomem *regs;         ///< Pointer to the registers on the device
-    int adc0_gain;
-    int adc1_gain;
+    void __iomem *regs;         ///< Registers of the FE_AD7768_v1 block (the output data rate), NULL when not mapped
+    uint32_t gain[AD7768_NUM_CHANNELS];     ///< Relative gain of each channel as unsigned Q16
+    uint32_t gain_code[AD7768_NUM_CHANNELS];        ///< Gain register of each channel
+    uint32_t offset_code[AD7768_NUM_CHANNELS];      ///< Offset register of each channel (24 bit two's complement)
+    uint8_t sync_offset[AD7768_NUM_CHANNELS];       ///< Sync offset register of each channel
 };
 
 
@@ -131,10 +283,11 @@ static struct platform_driver AD7768_4_platform =
 static const struct file_operations fe_AD7768_4_fops =
 {
     .owner = THIS_MODULE,
-    .read = AD7768_4_read,               ///< Read the device contents for the entry in /dev
-    .write = AD7768_4_write,             ///< Write the device contents for the entry in /dev
+    .read = AD7768_4_read,               ///< Read the calibration blob of the channels
+    .write = AD7768_4_write,             ///< Load a calibration blob into the channels
     .open = AD7768_4_open,               ///< Called when the device is opened
     .release = AD7768_4_release,         ///< Called when the device is closes
+    .unlocked_ioctl = AD7768_4_ioctl,    ///< Conversion mode, see fe_ad7768_ioctl.h
 };
 
 /** Function called initially on the driver loads
@@ -147,20 +300,39 @@ static int AD7768_4_init(void)
 {
     int ret_val = 0;
     char cmd[2] = {0x00,0x00};
+    char className[20];
+    uint32_t codes[AD7768_NUM_CHANNELS];
+    int i;
     
     // Add the spi master 
     struct spi_master *master;
     
     pr_info("Initializing the Audio Logic AD7768_4 module\n");
 
-    // Register our driver with the "Platform Driver" bus
-    ret_val = platform_driver_register(&AD7768_4_platform);
+    ret_val = fe_gain_map_init(&ad7768_gain_map, &ad7768_gain_desc);
     if (ret_val != 0)
     {
-        pr_err("platform_driver_register returned %d\n", ret_val);
+        pr_err("fe_gain_map_init returned %d\n", ret_val);
         return ret_val;
     }
-    
+
+    //Reserve a Major number and enough Minor numbers for every AD7768-4 in the system
+    ret_val = alloc_chrdev_region(&dev_num, 0, FE_AD7768_4_MAX_DEVICES, "fe_AD7768_4_");
+    if (ret_val != 0)
+    {
+        pr_err("alloc_chrdev_region returned %d\n", ret_val);
+        return ret_val;
+    }
+
+    //One class for all the AD7768-4s, named after the Major number like the per device classes used to be
+    sprintf(className, "fe_AD7768_4_%d", MAJOR(dev_num));
+    cl = class_create(THIS_MODULE, className);
+    if (IS_ERR(cl))
+    {
+        ret_val = PTR_ERR(cl);
+        goto bad_class_create;
+    }
+
     /*------------------------------------------------------------------
     This SPI initialization is based off code written by Piktas Zuikis
     ------------------------------------------------------------------*/
@@ -179,7 +351,8 @@ static int AD7768_4_init(void)
     master = spi_busnum_to_master( spi_device_info.bus_num );
     if( !master ){
         printk("MASTER not found.\n");
-            return -ENODEV;
+        ret_val = -ENODEV;
+        goto bad_spi;
     }
      
     // create a new slave device, given the master and device info
@@ -188,7 +361,8 @@ static int AD7768_4_init(void)
     printk("Setting up new slave device\n");
     if( !spi_device ) {
         printk("FAILED to create slave.\n");
-        return -ENODEV;
+        ret_val = -ENODEV;
+        goto bad_spi;
     }
      
     printk("Set the bits per word\n");
@@ -200,79 +374,65 @@ static int AD7768_4_init(void)
     if( ret_val ){
         printk("FAILED to setup slave.\n");
         spi_unregister_device( spi_device );
-        return -ENODEV;
+        spi_device = NULL;
+        ret_val = -ENODEV;
+        goto bad_spi;
     }  
 
+    // Run the control port as fast as it reliably goes
+    speed = fe_spi_calibrate(spi_device, ad7768_spi_speeds, ARRAY_SIZE(ad7768_spi_speeds), AD7768_4_spi_verify);
+    printk("SPI clock set to %u Hz\n", speed);
+
     printk("Sending SPI initialization commands...\n");
 
-    // Set the channel standby
+    // Power up every channel, the slots the AD7768-4 doesn't have stay in standby
     printk("\tSetting standby parameters\n");
     cmd[0] = AD7768_WRITE | CH_STNDBY_ADDR;
-    cmd[1] = 0xFC;
-    ret_val = spi_write(spi_device,&cmd, sizeof(cmd));
-
-    // Set the channel mode parameters
-    printk("\tSetting Mode A parameters\n");
-    cmd[0] = AD7768_WRITE | MODEA_ADDR;
-    cmd[1] = 0x09;
-    ret_val = spi_write(spi_device,&cmd, sizeof(cmd));
-    //printk("%d\n",ret_val);
-
-    // Set the power mode
-    printk("\tSetting power parameters\n");
-    cmd[0] = AD7768_WRITE | POWER_MODE_ADDR;
-    cmd[1] = 0x30;
-    ret_val = spi_write(spi_device,&cmd, sizeof(cmd));
-    //printk("%d\n",ret_val);
-
-//    // Set the mode for the different channels
-//    printk("\tSetting channel mode\n");
-//    cmd[0] =  write | CHMODE_SEL;
-//    cmd[1] = 0x00;
-//    ret_val = spi_write(spi_device,&cmd, sizeof(cmd));
-    //printk("%d\n",ret_val);			
-
-    // Set the interface configuration (clock divider)
-    printk("\tSetting channel interface configuration\n");
-    cmd[0] = AD7768_WRITE | INTFACE_CFG;
-    cmd[1] = 0x00;
-    ret_val = spi_write(spi_device,&cmd, sizeof(cmd));
-    //printk("%d\n",ret_val); 
-
-    // Set the channel 0 gain.  (0x555555 is factory default)
-    printk("\tSetting channel 0 gain\n");
-    cmd[0]  = AD7768_WRITE | ADC0_GAIN_ADDR_MSB;
-    cmd[1]  =  0x55;
-    ret_val = spi_write(spi_device,&cmd, sizeof(cmd));
-    cmd[0]  = AD7768_WRITE | ADC0_GAIN_ADDR_MID;
-    cmd[1]  = 0x55;
-    ret_val = spi_write(spi_device,&cmd, sizeof(cmd));
-    cmd[0]  = AD7768_WRITE | ADC0_GAIN_ADDR_LSB;
-    cmd[1]  = 0x55;
+    cmd[1] = 0xFF;
+    for (i = 0; i < AD7768_NUM_CHANNELS; i++)
+        cmd[1] &= ~AD7768_CH_STANDBY(i);
     ret_val = spi_write(spi_device,&cmd, sizeof(cmd));
-    //printk("%d\n",ret_val); 
 
-    // Set the channel 1 gain.  (0x555555 is factory default)
-    printk("\tSetting channel 1 gain\n");
-    cmd[0] = AD7768_WRITE | ADC1_GAIN_ADDR_MSB;
-    cmd[1] = 0x55;
-    ret_val = spi_write(spi_device,&cmd, sizeof(cmd));
-    cmd[0] = AD7768_WRITE | ADC1_GAIN_ADDR_MID;
-    cmd[1] = 0x55;
-    ret_val = spi_write(spi_device,&cmd, sizeof(cmd));
-    cmd[0] = AD7768_WRITE | ADC1_GAIN_ADDR_LSB;
-    cmd[1] = 0x55;
-    ret_val = spi_write(spi_device,&cmd, sizeof(cmd));
-    //printk("%d\n",ret_val); 
+    // Set the power mode, the clock dividers and the channel mode, then synchronize the ADC
+    printk("\tSetting conversion mode\n");
+    mutex_lock(&ad7768_mode_lock);
+    ret_val = AD7768_4_write_mode(&ad7768_mode);
+    mutex_unlock(&ad7768_mode_lock);
+
+    // Set the gain of every channel to the factory default
+    printk("\tSetting channel gains\n");
+    for (i = 0; i < AD7768_NUM_CHANNELS; i++)
+        codes[i] = AD7768_DEFAULT_GAIN;
+    ret_val = AD7768_4_write_gains(0, codes, AD7768_NUM_CHANNELS);
     
 
     /*------------------------------------------------------------------
     --------------------------------------------------------------------
     ------------------------------------------------------------------*/
+
+    // Register our driver with the "Platform Driver" bus, once the SPI device is up since probe loads the calibration
+    ret_val = platform_driver_register(&AD7768_4_platform);
+    if (ret_val != 0)
+    {
+        pr_err("platform_driver_register returned %d\n", ret_val);
+        goto bad_platform_driver_register;
+    }
     
     pr_info("Audio Logic AD7768-4 module successfully initialized!\n");
 
     return 0;
+
+bad_platform_driver_register:
+    spi_unregister_device(spi_device);
+    spi_device = NULL;
+
+bad_spi:
+    class_destroy(cl);
+
+bad_class_create:
+    unregister_chrdev_region(dev_num, FE_AD7768_4_MAX_DEVICES);
+
+    return ret_val;
 }
 
 
@@ -289,10 +449,12 @@ static int AD7768_4_probe(struct platform_device *pdev)
 {
     int ret_val = -EBUSY;
 
-    char deviceName[20] = "fe_AD7768_4_";
-    char deviceMinor[20];
+    char deviceName[24];
+    int minor;
     int status;
+    int i;
 
+    struct resource *r;
     struct device *deviceObj;
     fe_AD7768_4_dev_t *fe_AD7768_4_devp;
 
@@ -300,6 +462,8 @@ static int AD7768_4_probe(struct platform_device *pdev)
 
     // Create structure to hold device-specific information (like the registers). Make size of &pdev->dev + sizeof(struct(fe_AD7768_4_dev)).
     fe_AD7768_4_devp = devm_kzalloc(&pdev->dev, sizeof(fe_AD7768_4_dev_t), GFP_KERNEL);
+    if (fe_AD7768_4_devp == NULL)
+        return -ENOMEM;
 
     // Give a pointer to the instance-specific data to the generic platform_device structure
     // so we can access this data later on (for instance, in the read and write functions)
@@ -314,37 +478,65 @@ static int AD7768_4_probe(struct platform_device *pdev)
     strcpy(fe_AD7768_4_devp->name, (char *)pdev->name);
     pr_info("%s\n", (char *)pdev->name);
 
-    //Request a Major/Minor number for the driver
-    status = alloc_chrdev_region(&dev_num, 0, 1, "fe_HA");
-    if (status != 0)
-        goto bad_alloc_chrdev_region;
+    //The FE_AD7768_v1 block takes the output data rate in its first register, overlays from before it had one don't map it
+    r = platform_get_resource(pdev, IORESOURCE_MEM, 0);
+    if (r != NULL)
+    {
+        fe_AD7768_4_devp->regs = devm_ioremap_resource(&pdev->dev, r);
+        if (IS_ERR(fe_AD7768_4_devp->regs))
+        {
+            ret_val = PTR_ERR(fe_AD7768_4_devp->regs);
+            goto bad_ioremap;
+        }
 
-    //Create the device name with the information reserved above
-    sprintf(deviceMinor, "%d", MAJOR(dev_num));
-    strcat(deviceName, deviceMinor);
-    pr_info("%s\n", deviceName);
+        mutex_lock(&ad7768_mode_lock);
+        iowrite32(ad7768_mode.output_data_rate, fe_AD7768_4_devp->regs);
+        mutex_unlock(&ad7768_mode_lock);
+    }
 
-    //Create sysfs entries
-    cl = class_create(THIS_MODULE, deviceName); //"fe_HA");
-    if (cl == NULL)
-        goto bad_class_create;
+    //Take the lowest free Minor number from the region reserved in AD7768_4_init
+    minor = ida_alloc_max(&fe_AD7768_4_ida, FE_AD7768_4_MAX_DEVICES - 1, GFP_KERNEL);
+    if (minor < 0)
+    {
+        pr_err("No free minor numbers, only %d AD7768-4s are supported\n", FE_AD7768_4_MAX_DEVICES);
+        ret_val = minor;
+        goto bad_ida_alloc;
+    }
+    fe_AD7768_4_devp->devt = MKDEV(MAJOR(dev_num), minor);
+
+    //Create the device name, the first AD7768-4 keeps the fe_AD7768_4_NNN name so existing scripts still find it
+    if (minor == 0)
+        sprintf(deviceName, "fe_AD7768_4_%d", MAJOR(dev_num));
+    else
+        sprintf(deviceName, "fe_AD7768_4_%d_%d", MAJOR(dev_num), minor);
+    pr_info("%s\n", deviceName);
 
     //Initialize a char dev structure
     cdev_init(&fe_AD7768_4_devp->cdev, &fe_AD7768_4_fops);
 
     //Registers the char driver with the kernel
-    status = cdev_add(&fe_AD7768_4_devp->cdev, dev_num, 1);
+    status = cdev_add(&fe_AD7768_4_devp->cdev, fe_AD7768_4_devp->devt, 1);
     if (status != 0)
         goto bad_cdev_add;
 
     //Creates the device entries in sysfs
-    deviceObj = device_create(cl, NULL, dev_num, NULL, deviceName);
-    if (deviceObj == NULL)
+    deviceObj = device_create(cl, NULL, fe_AD7768_4_devp->devt, NULL, deviceName);
+    if (IS_ERR(deviceObj))
         goto bad_device_create;
 
     //Put a pointer to the fe_fir_dev struct that is created into the driver object so it can be accessed uniquely from elsewhere
     dev_set_drvdata(deviceObj, fe_AD7768_4_devp);
 
+    //The initialization commands leave every channel at the factory default gain of 1 and the reset calibration
+    for (i = 0; i < AD7768_NUM_CHANNELS; i++)
+    {
+        fe_AD7768_4_devp->gain[i] = 1 << 16;
+        fe_AD7768_4_devp->gain_code[i] = AD7768_DEFAULT_GAIN;
+    }
+
+    //Apply the factory calibration of the channels if there is one
+    AD7768_4_load_firmware(pdev, fe_AD7768_4_devp);
+
     //---------------------------------------------------------
 
     status = device_create_file(deviceObj, &dev_attr_adc0_gain);
@@ -362,10 +554,82 @@ static int AD7768_4_probe(struct platform_device *pdev)
     if (status)
         goto bad_device_create_file_3;
 
+    //---------------------------------------------------------
+    status = device_create_file(deviceObj, &dev_attr_spi_speed);
+    if (status)
+        goto bad_device_create_file_4;
+
+    //---------------------------------------------------------
+    status = device_create_file(deviceObj, &dev_attr_adc2_gain);
+    if (status)
+        goto bad_device_create_file_5;
+
+    //---------------------------------------------------------
+    status = device_create_file(deviceObj, &dev_attr_adc3_gain);
+    if (status)
+        goto bad_device_create_file_6;
+
+    //---------------------------------------------------------
+    status = device_create_file(deviceObj, &dev_attr_adc_gains);
+    if (status)
+        goto bad_device_create_file_7;
+
+    //---------------------------------------------------------
+    status = device_create_file(deviceObj, &dev_attr_power_mode);
+    if (status)
+        goto bad_device_create_file_8;
+
+    //---------------------------------------------------------
+    status = device_create_file(deviceObj, &dev_attr_mclk_div);
+    if (status)
+        goto bad_device_create_file_9;
+
+    //---------------------------------------------------------
+    status = device_create_file(deviceObj, &dev_attr_decimation);
+    if (status)
+        goto bad_device_create_file_10;
+
+    //---------------------------------------------------------
+    status = device_create_file(deviceObj, &dev_attr_filter);
+    if (status)
+        goto bad_device_create_file_11;
+
+    //---------------------------------------------------------
+    status = device_create_file(deviceObj, &dev_attr_output_data_rate);
+    if (status)
+        goto bad_device_create_file_12;
+
     pr_info("AD7768_4_probe exit\n");
 
     return 0;
 
+bad_device_create_file_12:
+    device_remove_file(deviceObj, &dev_attr_output_data_rate);
+
+bad_device_create_file_11:
+    device_remove_file(deviceObj, &dev_attr_filter);
+
+bad_device_create_file_10:
+    device_remove_file(deviceObj, &dev_attr_decimation);
+
+bad_device_create_file_9:
+    device_remove_file(deviceObj, &dev_attr_mclk_div);
+
+bad_device_create_file_8:
+    device_remove_file(deviceObj, &dev_attr_power_mode);
+
+bad_device_create_file_7:
+    device_remove_file(deviceObj, &dev_attr_adc_gains);
+
+bad_device_create_file_6:
+    device_remove_file(deviceObj, &dev_attr_adc3_gain);
+
+bad_device_create_file_5:
+    device_remove_file(deviceObj, &dev_attr_adc2_gain);
+
+bad_device_create_file_4:
+    device_remove_file(deviceObj, &dev_attr_spi_speed);
+
 bad_device_create_file_3:
     device_remove_file(deviceObj, &dev_attr_name);
     
@@ -374,22 +638,18 @@ bad_device_create_file_2:
         
 bad_device_create_file_1:
     device_remove_file(deviceObj, &dev_attr_adc0_gain);
+    device_destroy(cl, fe_AD7768_4_devp->devt);
         
 bad_device_create:
     cdev_del(&fe_AD7768_4_devp->cdev);
 
 bad_cdev_add:
-    class_destroy(cl);
-
-bad_class_create:
-    unregister_chrdev_region(dev_num, 1);
+    ida_free(&fe_AD7768_4_ida, minor);
 
-bad_alloc_chrdev_region:
+bad_ida_alloc:
+bad_ioremap:
 bad_mem_alloc:
 
-//bad_ioremap:
-//    ret_val = PTR_ERR(fe_AD7768_4_devp->regs);
-
     return ret_val;
 }
 
@@ -411,10 +671,6 @@ static int AD7768_4_open(struct inode *inode, struct file *file)
     devp = container_of(inode->i_cdev, fe_AD7768_4_dev_t, cdev);
     file->private_data = devp;
 
-    //Instantiate default values for the ADC
-
-    devp->adc0_gain       = 0.0;
-    devp->adc1_gain       = 0.0;
     return 0;
 }
 
@@ -435,41 +691,129 @@ static int AD7768_4_release(struct inode *inode, struct file *file)
 
 
 
-/** Read the contents of the coefficients stucture
+/** Gets or sets the conversion mode of the ADC, see fe_ad7768_ioctl.h
 
-    This function will read the contents of the coefficient memory as stored in the shadow register and return then
-    to the calling function as a binary array of 32 length fixed point values.  If done in the terminal window, hexdump
-    can be used to see the values.
+    @param file Pointer to the file of the AD7768-4
+    @param cmd FE_AD7768_IOC_GET_MODE or FE_AD7768_IOC_SET_MODE
+    @param arg Userspace pointer to a struct fe_ad7768_mode
+    @returns SUCCESS, -ENOTTY for an unknown command or the error of the command
+*/
+static long AD7768_4_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
+{
+    struct fe_ad7768_mode mode;
+    int status;
+
+    fe_AD7768_4_dev_t *devp = (fe_AD7768_4_dev_t *)file->private_data;
+
+    switch (cmd)
+    {
+        case FE_AD7768_IOC_GET_MODE:
+            mutex_lock(&ad7768_mode_lock);
+            mode = ad7768_mode;
+            mutex_unlock(&ad7768_mode_lock);
+
+            if (copy_to_user((void __user *)arg, &mode, sizeof(mode)))
+                return -EFAULT;
+
+            return 0;
+
+        case FE_AD7768_IOC_SET_MODE:
+            if (copy_from_user(&mode, (void __user *)arg, sizeof(mode)))
+                return -EFAULT;
+
+            if (mode.reserved)
+                return -EINVAL;
+
+            status = AD7768_4_change_mode(devp, &mode, AD7768_MODE_ALL);
+            if (status)
+                return status;
+
+            if (copy_to_user((void __user *)arg, &mode, sizeof(mode)))
+                return -EFAULT;
+
+            return 0;
+
+        default:
+            return -ENOTTY;
+    }
+}
+
+
+
+/** Read the calibration of the channels
+
+    This function returns the offset, gain and sync offset registers of every channel as a struct
+    fe_ad7768_calibration (see fe_ad7768_ioctl.h), so the blob can be saved and written back later.  If done in the
+    terminal window, hexdump can be used to see the values.
 
     @param file Pointer to the file being accessed
     @param buffer Pointer to a buffer array to return the data on
-    @len Unused
+    @len Size of buffer
     @offset Pass-by-reference variable to hold where to start transmitting from in the array.
-    @returns AD7768_4_read Number of bits sent in buffer, and will return 0 for the last transaction.
+    @returns AD7768_4_read Number of bytes sent in buffer, and will return 0 for the last transaction.
 */
 static ssize_t AD7768_4_read(struct file *file, char *buffer, size_t len, loff_t *offset)
 {
-    return 0;
+    struct fe_ad7768_calibration cal;
+    int i;
+
+    fe_AD7768_4_dev_t *devp = (fe_AD7768_4_dev_t *)file->private_data;
+
+    if (*offset >= sizeof(cal))
+        return 0;
+
+    memset(&cal, 0, sizeof(cal));
+    cal.magic = cpu_to_le32(FE_AD7768_CAL_MAGIC);
+    cal.version = cpu_to_le32(FE_AD7768_CAL_VERSION);
+    cal.num_channels = cpu_to_le32(FE_AD7768_CAL_CHANNELS);
+
+    mutex_lock(&ad7768_gain_lock);
+    for (i = 0; i < AD7768_NUM_CHANNELS; i++)
+    {
+        //Sign extend the 24 bit offset
+        cal.channels[i].offset = cpu_to_le32((int32_t)(devp->offset_code[i] << 8) >> 8);
+        cal.channels[i].gain = cpu_to_le32(devp->gain_code[i]);
+        cal.channels[i].sync_offset = cpu_to_le32(devp->sync_offset[i]);
+    }
+    mutex_unlock(&ad7768_gain_lock);
+
+    return simple_read_from_buffer(buffer, len, offset, &cal, sizeof(cal));
 }
 
 
 
-/** Write the contents of the coefficients stucture
+/** Load a calibration blob into the channels
 
-    This function will write the contents of the buffer as binary values to the coefficients register.
-    The length variable is used to set the length of the filter itself.  After updating the shadow register,
-    the values are then written to the device.  If the size of buffer is not a 4 bit multiple, the extra bytes
-    are ignored.
+    The buffer has to hold one whole struct fe_ad7768_calibration (see fe_ad7768_ioctl.h) written at the start of
+    the file.  The blob is checked before anything is written, then the offset, gain and sync offset registers of
+    every channel are loaded in one SPI message.
 
     @param file Pointer to the file being written to
     @param buffer Pointer to a buffer array containing the data to write
     @len Number of bytes in the buffer variable
     @offset Pass-by-reference variable to hold where to start transmitting from in the array.
-    @returns AD7768_4_read Number of bytes written
+    @returns AD7768_4_write Number of bytes written, -EINVAL for a partial or invalid blob or the SPI error
 */
 static ssize_t AD7768_4_write(struct file *file, const char *buffer, size_t len, loff_t *offset)
 {
-    return 0;
+    struct fe_ad7768_calibration cal;
+    int status;
+
+    fe_AD7768_4_dev_t *devp = (fe_AD7768_4_dev_t *)file->private_data;
+
+    if (*offset != 0 || len != sizeof(cal))
+        return -EINVAL;
+
+    if (copy_from_user(&cal, buffer, sizeof(cal)))
+        return -EFAULT;
+
+    status = AD7768_4_load_calibration(devp, &cal);
+    if (status)
+        return status;
+
+    *offset += len;
+
+    return len;
 }
 
 
@@ -489,24 +833,19 @@ static int AD7768_4_remove(struct platform_device *pdev)
     // Grab the instance-specific information out of the platform device
     fe_AD7768_4_dev_t *dev = (fe_AD7768_4_dev_t *)platform_get_drvdata(pdev);
 
-    //device_remove_file(deviceObj, &dev_attr_numCoefs);
-    //device_remove_file(deviceObj, &dev_attr_name);
-    //device_remove_file(deviceObj, &dev_attr_name);
-
-    //device_destroy(cl, dev_num);
-    //class_destroy(cl);
-
-
     pr_info("AD7768_4_remove enter\n");
 
     // Turn the HA off
     //iowrite32(0x00, dev->regs);
 
+    // Remove the sysfs entries (and their attributes) of this AD7768-4
+    device_destroy(cl, dev->devt);
+
     // Unregister the character file (remove it from /dev)
     cdev_del(&dev->cdev);
 
-    //Tell the os that the major/minor pair is avalible again
-    unregister_chrdev_region(dev_num, 2);
+    //Tell the os that the minor number is avalible again, the region is released in AD7768_4_exit
+    ida_free(&fe_AD7768_4_ida, MINOR(dev->devt));
 
     //Remove the pointer to the registers so it doesn't leak
     //iounmap(dev->regs);
@@ -531,6 +870,11 @@ static void AD7768_4_exit(void)
         spi_unregister_device( spi_device );
     }
 
+    // Every AD7768-4 is gone, release the class and the device numbers
+    class_destroy(cl);
+    unregister_chrdev_region(dev_num, FE_AD7768_4_MAX_DEVICES);
+    ida_destroy(&fe_AD7768_4_ida);
+
     pr_info("Audio Logic AD7768_4 module successfully unregistered\n");
 }
 
@@ -554,388 +898,584 @@ static ssize_t name_read(struct device *dev, struct device_attribute *attr, char
     return strlen(buf);
 }
 
-static ssize_t adc0_gain_write(struct device *dev, struct device_attribute *attr, const char *buf, size_t count)
+/** Function to display the SPI clock chosen by the link calibration
+
+    @param dev
+    @param attr
+    @param buf charactor buffer for the sysfs return
+    @returns Length of the buffer
+*/
+static ssize_t spi_speed_read(struct device *dev, struct device_attribute *attr, char *buf)
 {
-    uint32_t tempValue = 0;
-    uint32_t volume_level;
-    char cmd[2] = {0x00,0x00};
+    return sprintf(buf, "%u\n", speed);
+}
 
-    char substring[80];
-    int substring_count = 0;
-    int i;
-    int ret_val;
+/** Link check of the SPI calibration, writes test patterns into the LSB of the channel 0 gain and reads them back
 
-    fe_AD7768_4_dev_t *devp = (fe_AD7768_4_dev_t *)dev_get_drvdata(dev);
+    The initialization commands set the gain back to the factory default once the rate is chosen.
+
+    @param spi SPI device of the ADC
+    @returns 0 when every pattern was read back, -EIO on a mismatch or the SPI error
+*/
+static int AD7768_4_spi_verify(struct spi_device *spi)
+{
+    static const uint8_t patterns[] = { 0x55, 0xAA, 0x0F, 0xF0, 0xFF, 0x01 };
+    uint8_t cmd[2];
+    uint8_t value;
+    int status;
+    int i;
 
-    for (i = 0; i < count; i++)
+    for (i = 0; i < ARRAY_SIZE(patterns); i++)
     {
-        //If its not a space or a comma, add the digit to the substring
-        if ((buf[i] != ',') && (buf[i] != ' ') && (buf[i] != '\0') && (buf[i] != '\r') && (buf[i] != '\n'))
-        {
-            substring[substring_count] = buf[i];
-            substring_count++;
-        }
+        cmd[0] = AD7768_WRITE | ADC0_GAIN_ADDR_LSB;
+        cmd[1] = patterns[i];
+        status = spi_write(spi, cmd, sizeof(cmd));
+        if (status)
+            return status;
+
+        cmd[0] = AD7768_READ | ADC0_GAIN_ADDR_LSB;
+        status = spi_write_then_read(spi, cmd, 1, &value, 1);
+        if (status)
+            return status;
+
+        if (value != patterns[i])
+            return -EIO;
     }
 
-    substring[substring_count] = '\0';
+    return 0;
+}
+
+/** Writes the gain codes of consecutive channels in a single SPI message
 
-    // If the first character is a negative sign
-    if (buf[0] == '-')
+    Each 24 bit code is three register writes (MSB, MID, LSB), one 16 bit frame each with chip select released in
+    between, so a full update of the four channels is one message of twelve frames.
+
+    @param first First channel
+    @param codes Gain codes starting at channel first
+    @param num_codes Number of channels
+    @returns SUCCESS or the SPI error
+*/
+static int AD7768_4_write_gains(unsigned int first, const uint32_t *codes, unsigned int num_codes)
+{
+    unsigned int num_xfers = 3 * num_codes;
+    unsigned int i;
+    int status;
+
+    mutex_lock(&ad7768_gain_lock);
+
+    memset(ad7768_gain_xfer, 0, sizeof(ad7768_gain_xfer));
+    spi_message_init(&ad7768_gain_msg);
+    for (i = 0; i < num_xfers; i++)
     {
-      // Shift all the values "left" to remove it
-      for (i=0;i<79;i++)
-        substring[i] = substring[i+1];
+        ad7768_gain_cmd[i][0] = AD7768_WRITE | (ADC_GAIN_ADDR_MSB(first + i / 3) + i % 3);
+        ad7768_gain_cmd[i][1] = (uint8_t)(codes[i / 3] >> (16 - 8 * (i % 3)));
+
+        ad7768_gain_xfer[i].tx_buf = ad7768_gain_cmd[i];
+        ad7768_gain_xfer[i].len = sizeof(ad7768_gain_cmd[i]);
+        ad7768_gain_xfer[i].cs_change = (i != num_xfers - 1);
+        spi_message_add_tail(&ad7768_gain_xfer[i], &ad7768_gain_msg);
     }
 
-    //Convert the buffer to a fixed point value
-    tempValue = set_fixed_num(substring);
+    status = spi_sync(spi_device, &ad7768_gain_msg);
 
-    //printk("Entering conversion function\n");
-    volume_level = determine_relative_gain(tempValue);
-    
-    //Write the value into the shadow register (and pray it works...)
-    devp->adc0_gain = tempValue;
+    mutex_unlock(&ad7768_gain_lock);
 
-    printk("\tSetting channel 0 gain\n");
-    cmd[0]  = AD7768_WRITE | ADC0_GAIN_ADDR_MSB;
-    cmd[1]  =  (uint8_t)(volume_level>>16);
-    ret_val = spi_write(spi_device,&cmd, sizeof(cmd));
-    cmd[0]  = AD7768_WRITE | ADC0_GAIN_ADDR_MID;
-    cmd[1]  = (uint8_t)(volume_level>>8);
-    ret_val = spi_write(spi_device,&cmd, sizeof(cmd));
-    cmd[0]  = AD7768_WRITE | ADC0_GAIN_ADDR_LSB;
-    cmd[1]  = (uint8_t)volume_level;
-    ret_val = spi_write(spi_device,&cmd, sizeof(cmd));
+    return status;
+}
 
- //   // Write the SPI commands to the DAC
- //  cmd[2] = volume_level;
- //   spi_write(spi_device,&cmd, sizeof(cmd));
+/** Checks a calibration blob and loads it into the channels in a single SPI message
 
-    return count;
-}
-static ssize_t adc0_gain_read(struct device *dev, struct device_attribute *attr, char *buf)
+    @param devp AD7768-4 the blob is for
+    @param cal Calibration blob, see fe_ad7768_ioctl.h
+    @returns SUCCESS, -EINVAL if the blob is invalid (nothing is written) or the SPI error
+*/
+static int AD7768_4_load_calibration(fe_AD7768_4_dev_t *devp, const struct fe_ad7768_calibration *cal)
 {
-    fe_AD7768_4_dev_t *devp = (fe_AD7768_4_dev_t *)dev_get_drvdata(dev);
+    uint32_t offsets[AD7768_NUM_CHANNELS];
+    uint32_t gains[AD7768_NUM_CHANNELS];
+    uint8_t sync_offsets[AD7768_NUM_CHANNELS];
+    int32_t offset;
+    uint32_t gain;
+    uint32_t sync_offset;
+    unsigned int frame = 0;
+    unsigned int i;
+    unsigned int j;
+    int status;
 
-    //Copy the name into the output buffer
-    //sprintf(buf, "%d\n", fe_HA_devp->threshold);
-    fp_to_string(buf, devp->adc0_gain);
+    if (le32_to_cpu(cal->magic) != FE_AD7768_CAL_MAGIC || le32_to_cpu(cal->version) != FE_AD7768_CAL_VERSION ||
+        le32_to_cpu(cal->num_channels) != FE_AD7768_CAL_CHANNELS || cal->reserved)
+        return -EINVAL;
 
-    strcat2(buf, "\n");
+    for (i = 0; i < AD7768_NUM_CHANNELS; i++)
+    {
+        offset = (int32_t)le32_to_cpu(cal->channels[i].offset);
+        gain = le32_to_cpu(cal->channels[i].gain);
+        sync_offset = le32_to_cpu(cal->channels[i].sync_offset);
 
-    //Return the length of the buffer so it will print in the console
-    return strlen(buf);
-}
+        if (offset < -0x800000 || offset > 0x7FFFFF || gain > AD7768_MAX_GAIN || sync_offset > 0xFF)
+            return -EINVAL;
 
-static ssize_t adc1_gain_write(struct device *dev, struct device_attribute *attr, const char *buf, size_t count)
-{
-    uint32_t tempValue = 0;
-    uint32_t volume_level;
-    char cmd[2] = {0x00,0x00};
-    
-    char substring[80];
-    int substring_count = 0;
-    int i;
-    int ret_val;
+        offsets[i] = (uint32_t)offset & 0xFFFFFF;
+        gains[i] = gain;
+        sync_offsets[i] = sync_offset;
+    }
 
-    fe_AD7768_4_dev_t *devp = (fe_AD7768_4_dev_t *)dev_get_drvdata(dev);
+    mutex_lock(&ad7768_gain_lock);
 
-    for (i = 0; i < count; i++)
+    //Offsets and gains are three frames each (MSB, MID, LSB), the sync offset is one
+    memset(ad7768_cal_xfer, 0, sizeof(ad7768_cal_xfer));
+    spi_message_init(&ad7768_cal_msg);
+    for (i = 0; i < AD7768_NUM_CHANNELS; i++)
     {
-        //If its not a space or a comma, add the digit to the substring
-        if ((buf[i] != ',') && (buf[i] != ' ') && (buf[i] != '\0') && (buf[i] != '\r') && (buf[i] != '\n'))
+        for (j = 0; j < 3; j++, frame++)
         {
-            substring[substring_count] = buf[i];
-            substring_count++;
+            ad7768_cal_cmd[frame][0] = AD7768_WRITE | (ADC_OFFSET_ADDR_MSB(i) + j);
+            ad7768_cal_cmd[frame][1] = (uint8_t)(offsets[i] >> (16 - 8 * j));
         }
+        for (j = 0; j < 3; j++, frame++)
+        {
+            ad7768_cal_cmd[frame][0] = AD7768_WRITE | (ADC_GAIN_ADDR_MSB(i) + j);
+            ad7768_cal_cmd[frame][1] = (uint8_t)(gains[i] >> (16 - 8 * j));
+        }
+        ad7768_cal_cmd[frame][0] = AD7768_WRITE | ADC_SYNC_OFFSET_ADDR(i);
+        ad7768_cal_cmd[frame][1] = sync_offsets[i];
+        frame++;
     }
 
-    substring[substring_count] = '\0';
+    for (i = 0; i < AD7768_CAL_FRAMES; i++)
+    {
+        ad7768_cal_xfer[i].tx_buf = ad7768_cal_cmd[i];
+        ad7768_cal_xfer[i].len = sizeof(ad7768_cal_cmd[i]);
+        ad7768_cal_xfer[i].cs_change = (i != AD7768_CAL_FRAMES - 1);
+        spi_message_add_tail(&ad7768_cal_xfer[i], &ad7768_cal_msg);
+    }
 
-    // If the first character is a negative sign
-    if (buf[0] == '-')
+    status = spi_sync(spi_device, &ad7768_cal_msg);
+    if (status == 0)
     {
-      // Shift all the values "left" to remove it
-      for (i=0;i<79;i++)
-        substring[i] = substring[i+1];
+        for (i = 0; i < AD7768_NUM_CHANNELS; i++)
+        {
+            devp->offset_code[i] = offsets[i];
+            devp->gain_code[i] = gains[i];
+            devp->sync_offset[i] = sync_offsets[i];
+            devp->gain[i] = decode_relative_gain(gains[i]);
+        }
     }
 
-    //Convert the buffer to a fixed point value
-    tempValue = set_fixed_num(substring);
+    mutex_unlock(&ad7768_gain_lock);
 
-    //printk("Entering conversion function\n");
-    volume_level = determine_relative_gain(tempValue);
-    
-    //Write the value into the shadow register (and pray it works...)
-    devp->adc1_gain = tempValue;
+    return status;
+}
 
-    printk("\tSetting channel 0 gain\n");
-    cmd[0]  = AD7768_WRITE | ADC1_GAIN_ADDR_MSB;
-    cmd[1]  =  (uint8_t)(volume_level>>16);
-    ret_val = spi_write(spi_device,&cmd, sizeof(cmd));
-    cmd[0]  = AD7768_WRITE | ADC1_GAIN_ADDR_MID;
-    cmd[1]  = (uint8_t)(volume_level>>8);
-    ret_val = spi_write(spi_device,&cmd, sizeof(cmd));
-    cmd[0]  = AD7768_WRITE | ADC1_GAIN_ADDR_LSB;
-    cmd[1]  = (uint8_t)volume_level;
-    ret_val = spi_write(spi_device,&cmd, sizeof(cmd));
+/** Loads the factory calibration of the channels from a firmware file, if there is one
 
-    return count;
-}
-static ssize_t adc1_gain_read(struct device *dev, struct device_attribute *attr, char *buf)
+    The file is the firmware-name of the device tree node, or AD7768_CAL_FIRMWARE.  A missing or invalid file leaves
+    the channels at their reset calibration and doesn't stop the probe.
+
+    @param pdev Platform device of the AD7768-4
+    @param devp AD7768-4 the calibration is for
+*/
+static void AD7768_4_load_firmware(struct platform_device *pdev, fe_AD7768_4_dev_t *devp)
 {
-    fe_AD7768_4_dev_t *devp = (fe_AD7768_4_dev_t *)dev_get_drvdata(dev);
+    const struct firmware *fw;
+    const char *fw_name = AD7768_CAL_FIRMWARE;
+    int status;
 
-    //Copy the name into the output buffer
-    //sprintf(buf, "%d\n", fe_HA_devp->threshold);
-    fp_to_string(buf, devp->adc1_gain);
+    of_property_read_string(pdev->dev.of_node, "firmware-name", &fw_name);
 
-    strcat2(buf, "\n");
+    status = request_firmware_direct(&fw, fw_name, &pdev->dev);
+    if (status)
+        return;
 
-    //Return the length of the buffer so it will print in the console
-    return strlen(buf);
+    if (fw->size == sizeof(struct fe_ad7768_calibration))
+        status = AD7768_4_load_calibration(devp, (const struct fe_ad7768_calibration *)fw->data);
+    else
+        status = -EINVAL;
+
+    if (status)
+        dev_warn(&pdev->dev, "Calibration %s not loaded (%d)\n", fw_name, status);
+    else
+        dev_info(&pdev->dev, "Calibration %s loaded\n", fw_name);
+
+    release_firmware(fw);
 }
 
-//---------------------------------------------------------------
+/** Sets the relative gain of one channel
 
-char *strcat2(char *dst, char *src)
+    @param dev Device of the AD7768-4
+    @param channel Channel 0 to 3
+    @param buf Relative gain (0 to 4), the sign is ignored
+    @param count Length of buf
+    @returns count on success, or a negative error code
+*/
+static ssize_t AD7768_4_gain_write(struct device *dev, unsigned int channel, const char *buf, size_t count)
 {
-    char *cp = dst;
+    uint32_t tempValue = 0;
+    uint32_t code;
+    int status;
 
-    while (*cp)
-        cp++; /* find end of dst */
+    fe_AD7768_4_dev_t *devp = (fe_AD7768_4_dev_t *)dev_get_drvdata(dev);
 
-    while (( *cp++ = *src++ ) != 0); /* Copy src to end of dst */
+    //Convert the buffer to a fixed point value, the sign is ignored since the gain is a relative magnitude
+    status = fe_fixed_from_string(buf, count, FE_SQ16, &tempValue);
+    if (status)
+        return status;
+
+    if (tempValue & 0x80000000)
+        tempValue = -tempValue;
+
+    code = determine_relative_gain(tempValue);
+    trace_fe_ad7768_gain(devp->name, channel, tempValue, code);
+
+    status = AD7768_4_write_gains(channel, &code, 1);
+    if (status)
+        return status;
+
+    //Write the value into the shadow register
+    devp->gain[channel] = tempValue;
+    devp->gain_code[channel] = code;
 
-    return dst; /* return dst */
+    return count;
 }
 
-/** Convert a string to a fixed point number structure
-    @param s String containing the string to convert to 32F16 representation
-    @return SUCCESS
+/** Shows the relative gain of one channel
 
-    @todo This function is really ugly and could be cleaned up to make it clear what is happening....
+    @param dev Device of the AD7768-4
+    @param channel Channel 0 to 3
+    @param buf charactor buffer for the sysfs return
+    @returns Length of the buffer
 */
-uint32_t set_fixed_num(const char *s)
+static ssize_t AD7768_4_gain_read(struct device *dev, unsigned int channel, char *buf)
+{
+    fe_AD7768_4_dev_t *devp = (fe_AD7768_4_dev_t *)dev_get_drvdata(dev);
+
+    //Copy the value into the output buffer and return its length so it will print in the console
+    return fe_fixed_show(buf, devp->gain[channel], FE_SQ16);
+}
+
+static ssize_t adc0_gain_write(struct device *dev, struct device_attribute *attr, const char *buf, size_t count)
+{
+    return AD7768_4_gain_write(dev, 0, buf, count);
+}
+static ssize_t adc0_gain_read(struct device *dev, struct device_attribute *attr, char *buf)
+{
+    return AD7768_4_gain_read(dev, 0, buf);
+}
+static ssize_t adc1_gain_write(struct device *dev, struct device_attribute *attr, const char *buf, size_t count)
+{
+    return AD7768_4_gain_write(dev, 1, buf, count);
+}
+static ssize_t adc1_gain_read(struct device *dev, struct device_attribute *attr, char *buf)
 {
-    struct fixed_num num = {0, 0, 0};
-    int seen_point = 0;
-    int pointIndex;
+    return AD7768_4_gain_read(dev, 1, buf);
+}
+static ssize_t adc2_gain_write(struct device *dev, struct device_attribute *attr, const char *buf, size_t count)
+{
+    return AD7768_4_gain_write(dev, 2, buf, count);
+}
+static ssize_t adc2_gain_read(struct device *dev, struct device_attribute *attr, char *buf)
+{
+    return AD7768_4_gain_read(dev, 2, buf);
+}
+static ssize_t adc3_gain_write(struct device *dev, struct device_attribute *attr, const char *buf, size_t count)
+{
+    return AD7768_4_gain_write(dev, 3, buf, count);
+}
+static ssize_t adc3_gain_read(struct device *dev, struct device_attribute *attr, char *buf)
+{
+    return AD7768_4_gain_read(dev, 3, buf);
+}
+
+/** Sets the relative gain of all four channels in one SPI message, the values are given in channel order */
+static ssize_t adc_gains_write(struct device *dev, struct device_attribute *attr, const char *buf, size_t count)
+{
+    uint32_t gains[AD7768_NUM_CHANNELS];
+    uint32_t codes[AD7768_NUM_CHANNELS];
+    int num_gains;
+    int status;
     int i;
-    int ii;
-    int frac_comp;
-    uint32_t acc = 0;
-    char s2[80];
-    int pointsSeen = 0;
-    int charIndex = 0;
-
-    //If no leading 0, add one (eg: .25 -> 0.25)
-    if (s[0] == '.')
+
+    fe_AD7768_4_dev_t *devp = (fe_AD7768_4_dev_t *)dev_get_drvdata(dev);
+
+    //Convert the buffer to one fixed point value per channel, nothing is written unless every channel is given
+    num_gains = fe_fixed_parse_vector(buf, count, FE_SQ16, gains, AD7768_NUM_CHANNELS);
+    if (num_gains < 0)
+        return num_gains;
+    if (num_gains != AD7768_NUM_CHANNELS)
+        return -EINVAL;
+
+    for (i = 0; i < AD7768_NUM_CHANNELS; i++)
     {
-        s2[0] = '0';
-        charIndex++;
+        if (gains[i] & 0x80000000)
+            gains[i] = -gains[i];
+        codes[i] = determine_relative_gain(gains[i]);
+        trace_fe_ad7768_gain(devp->name, i, gains[i], codes[i]);
     }
 
-    //This is a strcpy() to move the data a "const char *" to a "char *" and validate the data
-    for (i = 0; i < strlen(s); i++)
-    {
-        //Make sure the string contains an non-valid char (eg: not a number or a decimal point)
-        if ((s[i] == '.') || (s[i] >= '0' && s[i] <= '9'))
-        {
-            //Copy the data over and increment the pointer
-            s2[charIndex] = s[i];
-            charIndex++;
-        }
-        else
-        {
-            pr_info("Invalid char (c:%c x:%X) in number %s\n", s[i], s[i], s);
-            return 0x00000000;
-        }
+    status = AD7768_4_write_gains(0, codes, AD7768_NUM_CHANNELS);
+    if (status)
+        return status;
 
-        //Count the number of decimals in the string
-        if (s[i] == '.')
-            pointsSeen++;
-    }
+    memcpy(devp->gain, gains, sizeof(devp->gain));
+    memcpy(devp->gain_code, codes, sizeof(devp->gain_code));
+
+    return count;
+}
+static ssize_t adc_gains_read(struct device *dev, struct device_attribute *attr, char *buf)
+{
+    fe_AD7768_4_dev_t *devp = (fe_AD7768_4_dev_t *)dev_get_drvdata(dev);
+
+    //Copy the values into the output buffer and return its length so it will print in the console
+    return fe_fixed_show_vector(buf, devp->gain, AD7768_NUM_CHANNELS, FE_SQ16);
+}
+
+/** Writes a conversion mode to the ADC in a single SPI message
+
+    The power mode, interface configuration (DCLK divider), channel mode A and channel mode select registers are
+    written back to back and the message ends with a pulse of SPI_SYNC, which restarts the digital filters of every
+    channel together in the new mode.  DCLK is set to the slowest rate that still shifts a whole sample out each output
+    data period.  The caller holds ad7768_mode_lock.
+
+    @param mode Mode to write, its output_data_rate is filled in
+    @returns SUCCESS, -EINVAL if a field is out of range or the SPI error
+*/
+static int AD7768_4_write_mode(struct fe_ad7768_mode *mode)
+{
+    uint8_t power;
+    uint8_t dclk_div;
+    uint8_t channel_mode;
+    unsigned int i;
+
+    if (mode->power_mode >= ARRAY_SIZE(ad7768_power_codes) || mode->filter >= ARRAY_SIZE(ad7768_filter_names))
+        return -EINVAL;
+
+    if (mode->decimation < FE_AD7768_MIN_DECIMATION || mode->decimation > FE_AD7768_MAX_DECIMATION ||
+        !is_power_of_2(mode->decimation))
+        return -EINVAL;
 
-    //If multiple decimals points in the number (eg: 1.1.4)
-    if (pointsSeen > 1)
-        pr_info("Invalid number format: %s\n", s);
-
-    //Turn 1 into 1.0
-    //if (pointsSeen == 0)
-    // {
-    //    printk("Adding the decimal...\n");
-    //    s2[i] = char(".");
-    //    s2[i+1] = char("0");
-    //    //strcat2(".0",s2);
-    //    i=i+2;
-    // }
-    //Make sure the string is terminated
-    s2[i] = '\0';
-
-    //Count the fractional digits
-    for (pointIndex = 0; pointIndex < strlen(s2); pointIndex++)
+    //MCLK_DIV field of the power mode register
+    switch (mode->mclk_div)
     {
-        if (s2[pointIndex] == '.')
+        case 4:
+            power = 0x03;
             break;
+        case 8:
+            power = 0x02;
+            break;
+        case 32:
+            power = 0x00;
+            break;
+        default:
+            return -EINVAL;
     }
+    power |= ad7768_power_codes[mode->power_mode];
 
-    //String extend so that the output is accurate
-    while (strlen(s2) - pointIndex < 9)
-        strcat2(s2, "0");
-
-    //Truncate the string if its longer
-    s2[strlen(s2) - pointIndex + 9] = '\0';
+    mode->output_data_rate = AD7768_MCLK_HZ / mode->mclk_div / mode->decimation;
 
-    //Covert to fixed point
-    for (i = 0; i < 10; i++)
+    //DCLK_DIV 0 is MCLK/8 and every step after it doubles DCLK up to MCLK/1
+    for (dclk_div = 0; dclk_div < 4; dclk_div++)
+        if (((AD7768_MCLK_HZ / 8) << dclk_div) >= AD7768_FRAME_BITS * mode->output_data_rate)
+            break;
+    if (dclk_div == 4)
+        return -EINVAL;
+
+    //DEC_RATE 0 is a decimation of 32 and every step after it doubles it
+    channel_mode = ilog2(mode->decimation / FE_AD7768_MIN_DECIMATION);
+    if (mode->filter == FE_AD7768_FILTER_SINC5)
+        channel_mode |= AD7768_FILTER_SINC5;
+
+    ad7768_mode_cmd[0][0] = AD7768_WRITE | POWER_MODE_ADDR;
+    ad7768_mode_cmd[0][1] = power;
+    ad7768_mode_cmd[1][0] = AD7768_WRITE | INTFACE_CFG;
+    ad7768_mode_cmd[1][1] = dclk_div;
+    ad7768_mode_cmd[2][0] = AD7768_WRITE | MODEA_ADDR;
+    ad7768_mode_cmd[2][1] = channel_mode;
+    ad7768_mode_cmd[3][0] = AD7768_WRITE | CHMODE_SEL;   //Every channel on mode A
+    ad7768_mode_cmd[3][1] = 0x00;
+    ad7768_mode_cmd[4][0] = AD7768_WRITE | DATA_CONTROL_ADDR;
+    ad7768_mode_cmd[4][1] = 0x00;
+    ad7768_mode_cmd[5][0] = AD7768_WRITE | DATA_CONTROL_ADDR;
+    ad7768_mode_cmd[5][1] = AD7768_SPI_SYNC;
+
+    memset(ad7768_mode_xfer, 0, sizeof(ad7768_mode_xfer));
+    spi_message_init(&ad7768_mode_msg);
+    for (i = 0; i < AD7768_MODE_FRAMES; i++)
     {
-        if (s2[i] == '.')
-        {
-            seen_point = 1;
-            continue;
-        }
-        if (!seen_point)
-        {
-            num.integer *= 10;
-            num.integer += (int)(s2[i] - '0');
-        }
-        else
-        {
-            num.fraction_len++;
-            num.fraction *= 10;
-            num.fraction += (int)(s2[i] - '0');
-        }
+        ad7768_mode_xfer[i].tx_buf = ad7768_mode_cmd[i];
+        ad7768_mode_xfer[i].len = sizeof(ad7768_mode_cmd[i]);
+        ad7768_mode_xfer[i].cs_change = (i != AD7768_MODE_FRAMES - 1);
+        spi_message_add_tail(&ad7768_mode_xfer[i], &ad7768_mode_msg);
     }
 
-    //Turn the fixed point conversion into binary digits
-    for (ii = 0, frac_comp = 1; ii < num.fraction_len; ii++) frac_comp *= 10;
-    frac_comp /= 2;
+    return spi_sync(spi_device, &ad7768_mode_msg);
+}
 
-    // Get the fractional part (f28 hopefully)
-    for (ii = 0; i <= 36; i++)
-    {
-        if (num.fraction >= frac_comp)
-        {
-            acc |= 0x00000001;
-            num.fraction -= frac_comp;
-        }
-        frac_comp /= 2;
+/** Changes some fields of the conversion mode and tells the FPGA the new output data rate
+
+    @param devp AD7768-4 whose FE_AD7768_v1 block gets the output data rate
+    @param mode New values of the fields to change, holds the mode of the ADC on return
+    @param fields Or of AD7768_MODE_* bits, the other fields keep their current value
+    @returns SUCCESS, -EINVAL if the new mode is out of range (nothing is written) or the SPI error
+*/
+static int AD7768_4_change_mode(struct fe_AD7768_4_dev *devp, struct fe_ad7768_mode *mode, unsigned int fields)
+{
+    struct fe_ad7768_mode next;
+    int status;
 
-        acc = acc << 1;
+    mutex_lock(&ad7768_mode_lock);
+
+    next = ad7768_mode;
+    if (fields & AD7768_MODE_POWER)
+        next.power_mode = mode->power_mode;
+    if (fields & AD7768_MODE_MCLK_DIV)
+        next.mclk_div = mode->mclk_div;
+    if (fields & AD7768_MODE_DECIMATION)
+        next.decimation = mode->decimation;
+    if (fields & AD7768_MODE_FILTER)
+        next.filter = mode->filter;
+
+    status = AD7768_4_write_mode(&next);
+    if (status == 0)
+    {
+        ad7768_mode = next;
+        if (devp->regs)
+            iowrite32(ad7768_mode.output_data_rate, devp->regs);
     }
 
-    acc = acc >> 12;
+    *mode = ad7768_mode;
 
-    //Combine the fractional part with the integer
-    acc += num.integer << 16;
+    mutex_unlock(&ad7768_mode_lock);
 
-    return acc;
+    return status;
 }
 
-/** Function to convert a fp16 to a string representation
-    @todo doesn't handle negative numbers
-*/
-int fp_to_string(char *buf, uint32_t fp28_num)
+/** Sets the power mode of the ADC (eco, median or fast) */
+static ssize_t power_mode_write(struct device *dev, struct device_attribute *attr, const char *buf, size_t count)
 {
-    int buf_pos = 0;
-    int i;
-    int fractionPart;
-    //int isNegative = 0;
-    int intPart = 1;
-    int i16 = 0;
+    struct fe_ad7768_mode mode;
+    int status;
 
-    if (fp28_num & 0x80000000)
-    {
-        fp28_num *= -1;
+    fe_AD7768_4_dev_t *devp = (fe_AD7768_4_dev_t *)dev_get_drvdata(dev);
 
-        buf[buf_pos] = '-';
-        buf_pos++;
-    }
+    status = sysfs_match_string(ad7768_power_names, buf);
+    if (status < 0)
+        return status;
 
-    //Convert the integer part
-    i16 = (fp28_num >> 16);
-    while ( (i16 / intPart) > 9)
-    {
-        intPart *= 10;
-    }
+    mode.power_mode = status;
+    status = AD7768_4_change_mode(devp, &mode, AD7768_MODE_POWER);
+    if (status)
+        return status;
 
-    while (intPart > 0)
-    {
-        buf[buf_pos] = (char)((i16 / intPart) + '0');
-        buf_pos++;
+    return count;
+}
+static ssize_t power_mode_read(struct device *dev, struct device_attribute *attr, char *buf)
+{
+    return sprintf(buf, "%s\n", ad7768_power_names[ad7768_mode.power_mode]);
+}
 
-        i16 = i16 % intPart;
-        intPart = intPart / 10;
-    }
+/** Sets the divider from MCLK to the modulator clock (4, 8 or 32) */
+static ssize_t mclk_div_write(struct device *dev, struct device_attribute *attr, const char *buf, size_t count)
+{
+    struct fe_ad7768_mode mode;
+    int status;
 
-    //buf[buf_pos] = (char)((fp28_num>>16) + '0');
-    //buf_pos++;
+    fe_AD7768_4_dev_t *devp = (fe_AD7768_4_dev_t *)dev_get_drvdata(dev);
 
-    buf[buf_pos] = '.';
-    buf_pos++;
+    status = kstrtou32(buf, 0, &mode.mclk_div);
+    if (status)
+        return status;
 
-    //Mask the integer bits and dump 1 bit to make the conversion easier....
-    fractionPart = (0x0000FFFF & fp28_num) >> 1; // 32F27 so that 0-9 can fit in the high 5 bits)
+    status = AD7768_4_change_mode(devp, &mode, AD7768_MODE_MCLK_DIV);
+    if (status)
+        return status;
 
-    for (i = 0; i < 8; i++)
-    {
-        fractionPart *= 10;
-        buf[buf_pos] = (fractionPart >> 15) + '0';
-        buf_pos++;
-        fractionPart &= 0x00007FFF;
-    }
+    return count;
+}
+static ssize_t mclk_div_read(struct device *dev, struct device_attribute *attr, char *buf)
+{
+    return sprintf(buf, "%u\n", ad7768_mode.mclk_div);
+}
+
+/** Sets the decimation rate of every channel (a power of two from 32 to 1024) */
+static ssize_t decimation_write(struct device *dev, struct device_attribute *attr, const char *buf, size_t count)
+{
+    struct fe_ad7768_mode mode;
+    int status;
+
+    fe_AD7768_4_dev_t *devp = (fe_AD7768_4_dev_t *)dev_get_drvdata(dev);
 
-    buf[buf_pos] = '\0';
+    status = kstrtou32(buf, 0, &mode.decimation);
+    if (status)
+        return status;
 
-    return 0;
+    status = AD7768_4_change_mode(devp, &mode, AD7768_MODE_DECIMATION);
+    if (status)
+        return status;
+
+    return count;
+}
+static ssize_t decimation_read(struct device *dev, struct device_attribute *attr, char *buf)
+{
+    return sprintf(buf, "%u\n", ad7768_mode.decimation);
+}
+
+/** Sets the decimation filter of every channel (wideband or sinc5) */
+static ssize_t filter_write(struct device *dev, struct device_attribute *attr, const char *buf, size_t count)
+{
+    struct fe_ad7768_mode mode;
+    int status;
+
+    fe_AD7768_4_dev_t *devp = (fe_AD7768_4_dev_t *)dev_get_drvdata(dev);
+
+    status = sysfs_match_string(ad7768_filter_names, buf);
+    if (status < 0)
+        return status;
+
+    mode.filter = status;
+    status = AD7768_4_change_mode(devp, &mode, AD7768_MODE_FILTER);
+    if (status)
+        return status;
+
+    return count;
+}
+static ssize_t filter_read(struct device *dev, struct device_attribute *attr, char *buf)
+{
+    return sprintf(buf, "%s\n", ad7768_filter_names[ad7768_mode.filter]);
 }
 
-/** Converts a 32 bit integer into an 8 bit volume level
-    @param 32f16representation of a fixed point number
-    @return volume_level an 8 bit representation of the attenuation
+/** Shows the output data rate of every channel in samples per second */
+static ssize_t output_data_rate_read(struct device *dev, struct device_attribute *attr, char *buf)
+{
+    return sprintf(buf, "%u\n", ad7768_mode.output_data_rate);
+}
+
+//---------------------------------------------------------------
+
+/** Converts a relative gain into the 24 bit gain code of the ADC
+    @param fp32_num Relative gain as unsigned Q16, rounded to the nearest tenth
+    @return The gain code, gains over 4 get the largest code
 */
 uint32_t determine_relative_gain(uint32_t fp32_num)
 {
-  // Initialize the volume level
-  uint32_t relative_gain_level = 0;
-
-  // slope and intercept for when 1 <= G_rel < 4;
-  uint32_t upper_m = 0x0038E38E;
-  uint32_t upper_b = 0x001C71C7;
-
-  // slope for when 0 <= G_rel < 1 (no intercept)
-  uint32_t lower_m = 0x00555555;
-
-  // Shift the data to match the representation 
-  uint16_t dec_val = fp32_num>>16;
-  uint32_t inputnum = (fp32_num*10)>>16;
-
-  printk("inputnum: %d, inputnum/10: %d, fp32_num: %d\n",inputnum,inputnum/10,fp32_num);
-  
-  // If the gain is over the maximum, set the return to the maximum value
-  if (dec_val > 4)
-  {
-  	relative_gain_level = 0x00FFFFFF;
-  }
-  // If the gain value is less than "1", use the equation with no intercept
-  // to calculate the relative gain value
-  else if (dec_val < 1)
-  {
-  	printk("dec_val < 1\n");
-  	relative_gain_level = lower_m * inputnum / 10 ;
-  }
-  else
-  {
-  	printk("1 < dec_val < 4\n");
-  	relative_gain_level = upper_m * inputnum / 10 + upper_b;
-  	printk("m term: %x, +b term: %x\n",upper_m*inputnum/10,upper_m * inputnum / 10 + upper_b);
-  }
-
-  printk("dec_val: %d\n");
-  printk("The new gain is %x\n",relative_gain_level);
-
-  return relative_gain_level;
+  if (fp32_num > (4 << 16))
+    return AD7768_MAX_GAIN;
+
+  return fe_gain_map_code(&ad7768_gain_map, fp32_num);
+}
+
+/** Converts a gain code of the ADC back into a relative gain, the inverse of the two slopes of ad7768_gain_steps
+
+    The code comes from a calibration as often as from determine_relative_gain, so it is decoded from the slopes
+    rather than looked up in ad7768_gain_map.
+    @param code 24 bit gain code
+    @return Relative gain as unsigned Q16
+*/
+uint32_t decode_relative_gain(uint32_t code)
+{
+  if (code <= AD7768_DEFAULT_GAIN)
+    return (uint32_t)div_u64((uint64_t)code << 16, AD7768_DEFAULT_GAIN);
+
+  return (uint32_t)div_u64((uint64_t)(code - 0x1C71C7) << 16, 0x38E38E);
 }
 
 /** Tell the kernel what the initialization function is */
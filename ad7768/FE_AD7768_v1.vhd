@@ -1,7 +1,10 @@
 ----------------------------------------------------------------------------
 --! @file FE_AD7768_v1.vhd
 --! @brief Implements serial/streaming data transfer for the AD7768 ADC.
---! @details This 
+--! @details The driver writes the output data rate of the ADC (samples per second per channel) into register 0 of the
+--!          Avalon slave whenever it changes the conversion mode, the rate is passed on to sample_rate_out for the
+--!          blocks downstream.  The first frame after a rate change straddles the resynchronization of the ADC and is
+--!          dropped.
 --! @author Tyler Davis
 --! @date 2020
 --! @copyright Copyright 2020 Audio Logic
@@ -25,12 +28,22 @@ use IEEE.numeric_std.all;
 
 entity FE_AD7768_v1 is
   generic (
-    n_channels   : integer := 4
+    n_channels          : integer := 4;
+    default_sample_rate : integer := 16000    -- Output data rate set up by the driver when it loads
   );
 	port (
 		sys_clk               : in  std_logic;
 		sys_reset_n           : in  std_logic;
 
+    -----------------------------------------------------------------------------------------------------------
+    -- Avalon Memory Mapped Slave Signals
+    -----------------------------------------------------------------------------------------------------------
+    avs_s1_address         : in  std_logic_vector(0 downto 0);
+    avs_s1_write           : in  std_logic;
+    avs_s1_writedata       : in  std_logic_vector(31 downto 0);
+    avs_s1_read            : in  std_logic;
+    avs_s1_readdata        : out std_logic_vector(31 downto 0);
+
     -----------------------------------------------------------------------------------------------------------
     -- Avalon Streaming Interface
     -----------------------------------------------------------------------------------------------------------
@@ -38,6 +51,11 @@ entity FE_AD7768_v1 is
     AD7768_valid_out       : out  std_logic;
     AD7768_error_out       : out  std_logic_vector(1 downto 0);
     AD7768_channel_out     : out  std_logic_vector(2 downto 0);
+
+    -----------------------------------------------------------------------------------------------------------
+    -- Output data rate of the ADC in samples per second
+    -----------------------------------------------------------------------------------------------------------
+    AD7768_sample_rate_out : out  std_logic_vector(31 downto 0);
     
     -----------------------------------------------------------------------------------------------------------
     -- AD7768 Physical Layer
@@ -81,6 +99,10 @@ architecture rtl of FE_AD7768_v1 is
   -- Data read and write commands
   signal data_valid                     : std_logic := '0';
   signal data_reg_start                 : std_logic := '0';
+
+  -- Output data rate register, and the flag that drops the frame caught in a rate change
+  signal sample_rate_r                  : std_logic_vector(31 downto 0) := std_logic_vector(to_unsigned(default_sample_rate, 32));
+  signal drop_frame                     : std_logic := '0';
       
   type data_state_type is 
   (
@@ -137,7 +159,11 @@ begin
     elsif (rising_edge(sys_clk)) then
       case data_state is  
         when read_data_capture =>
+          if drop_frame = '1' then 
+            data_state <= data_hold;
+          else
             data_state <= read_data_register;
+          end if;
           
         when read_data_register =>       
             data_state <= read_data_convert;
@@ -219,11 +245,42 @@ begin
     end if;
   end process;
   
+  --------------------------------------------------------------
+  -- Avalon memory mapped registers
+  --------------------------------------------------------------
+  process (sys_clk, sys_reset_n)
+  begin
+    if sys_reset_n = '0' then
+      sample_rate_r <= std_logic_vector(to_unsigned(default_sample_rate, 32));
+      drop_frame    <= '0';
+      
+    elsif (rising_edge(sys_clk)) then
+      -- read the registers
+      if avs_s1_read = '1' then 
+        case avs_s1_address is
+          when "0"    => avs_s1_readdata <= sample_rate_r;
+          when others => avs_s1_readdata <= (others => '0');
+        end case;
+      -- write the registers, a new rate means the ADC was just resynchronized
+      elsif avs_s1_write = '1' then 
+        case avs_s1_address is
+          when "0"    => 
+            sample_rate_r <= avs_s1_writedata;
+            drop_frame    <= '1';
+          when others => null;
+        end case;
+      elsif data_state = read_data_capture then 
+        drop_frame <= '0';
+      end if;
+    end if;
+  end process;
+  
   -- Mapping for the Avalon streaming interface
   AD7768_channel_out  <= AD7768_channel_out_r;
   AD7768_data_out     <= AD7768_data_r;
   AD7768_valid_out    <= AD7768_valid_r;
   AD7768_error_out    <= (others => '0');
+  AD7768_sample_rate_out <= sample_rate_r;
   
 end architecture rtl; -- of FE_AD7768_v1
 
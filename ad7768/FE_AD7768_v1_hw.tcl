@@ -52,6 +52,13 @@ set_parameter_property n_channels TYPE INTEGER
 set_parameter_property n_channels UNITS None
 set_parameter_property n_channels ALLOWED_RANGES -2147483648:2147483647
 set_parameter_property n_channels HDL_PARAMETER true
+add_parameter default_sample_rate INTEGER 16000
+set_parameter_property default_sample_rate DEFAULT_VALUE 16000
+set_parameter_property default_sample_rate DISPLAY_NAME default_sample_rate
+set_parameter_property default_sample_rate TYPE INTEGER
+set_parameter_property default_sample_rate UNITS Hertz
+set_parameter_property default_sample_rate ALLOWED_RANGES 0:2147483647
+set_parameter_property default_sample_rate HDL_PARAMETER true
 
 
 # 
@@ -90,6 +97,58 @@ add_interface_port AD7768_physical AD7768_DRDY_in ad7768_drdy_in Input 1
 add_interface_port AD7768_physical AD7768_DCLK_in ad7768_dclk_in Input 1
 
 
+# 
+# connection point s1
+# 
+add_interface s1 avalon end
+set_interface_property s1 addressUnits WORDS
+set_interface_property s1 associatedClock sys_clk
+set_interface_property s1 associatedReset sys_reset
+set_interface_property s1 bitsPerSymbol 8
+set_interface_property s1 burstOnBurstBoundariesOnly false
+set_interface_property s1 burstcountUnits WORDS
+set_interface_property s1 explicitAddressSpan 0
+set_interface_property s1 holdTime 0
+set_interface_property s1 linewrapBursts false
+set_interface_property s1 maximumPendingReadTransactions 0
+set_interface_property s1 maximumPendingWriteTransactions 0
+set_interface_property s1 readLatency 0
+set_interface_property s1 readWaitTime 1
+set_interface_property s1 setupTime 0
+set_interface_property s1 timingUnits Cycles
+set_interface_property s1 writeWaitTime 0
+set_interface_property s1 ENABLED true
+set_interface_property s1 EXPORT_OF ""
+set_interface_property s1 PORT_NAME_MAP ""
+set_interface_property s1 CMSIS_SVD_VARIABLES ""
+set_interface_property s1 SVD_ADDRESS_GROUP ""
+
+add_interface_port s1 avs_s1_address address Input 1
+add_interface_port s1 avs_s1_write write Input 1
+add_interface_port s1 avs_s1_writedata writedata Input 32
+add_interface_port s1 avs_s1_read read Input 1
+add_interface_port s1 avs_s1_readdata readdata Output 32
+set_interface_assignment s1 embeddedsw.configuration.isFlash 0
+set_interface_assignment s1 embeddedsw.configuration.isMemoryDevice 0
+set_interface_assignment s1 embeddedsw.configuration.isNonVolatileStorage 0
+set_interface_assignment s1 embeddedsw.configuration.isPrintableDevice 0
+
+
+# 
+# connection point sample_rate
+# 
+add_interface sample_rate conduit end
+set_interface_property sample_rate associatedClock sys_clk
+set_interface_property sample_rate associatedReset ""
+set_interface_property sample_rate ENABLED true
+set_interface_property sample_rate EXPORT_OF ""
+set_interface_property sample_rate PORT_NAME_MAP ""
+set_interface_property sample_rate CMSIS_SVD_VARIABLES ""
+set_interface_property sample_rate SVD_ADDRESS_GROUP ""
+
+add_interface_port sample_rate AD7768_sample_rate_out sample_rate Output 32
+
+
 # 
 # connection point data_out
 # 
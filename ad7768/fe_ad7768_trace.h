@@ -0,0 +1,52 @@
+/** @file fe_ad7768_trace.h
+
+    Tracepoints of the FE AD7768-4 driver.
+
+    fe_ad7768:fe_ad7768_gain fires for every channel whose gain is set from sysfs, with the relative gain that was
+    asked for and the 24 bit code sent to the ADC.  It replaces the printk calls the gain path used to make.  Enable it
+    with echo 1 > /sys/kernel/debug/tracing/events/fe_ad7768/enable and read the trace buffer with ftrace.
+
+    @copyright 2020 Audio Logic
+*/
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM fe_ad7768
+
+#if !defined(FE_AD7768_TRACE_H_) || defined(TRACE_HEADER_MULTI_READ)
+#define FE_AD7768_TRACE_H_
+
+#include <linux/tracepoint.h>
+
+TRACE_EVENT(fe_ad7768_gain,
+
+    TP_PROTO(const char *device, unsigned int channel, u32 gain, u32 code),
+
+    TP_ARGS(device, channel, gain, code),
+
+    TP_STRUCT__entry(
+        __string(device, device)
+        __field(unsigned int, channel)
+        __field(u32, gain)
+        __field(u32, code)
+    ),
+
+    TP_fast_assign(
+        __assign_str(device, device);
+        __entry->channel = channel;
+        __entry->gain = gain;
+        __entry->code = code;
+    ),
+
+    TP_printk("%s channel=%u gain=0x%08x code=0x%06x", __get_str(device), __entry->channel, __entry->gain,
+              __entry->code)
+);
+
+#endif
+
+// The trace header lives next to the driver rather than in include/trace/events
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE fe_ad7768_trace
+
+#include <trace/define_trace.h>
@@ -0,0 +1,337 @@
+/** @file
+
+    This kernel module exports the fixed point to/from string conversions used by the sysfs attributes of the
+    other drivers in this library.  See include/fe_fixedpoint.h for a description of the Q format parameter.
+
+    @copyright 2020 Audio Logic Inc
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+    Audio Logic Inc
+    985 Technology Blvd
+    Bozeman, MT 59718
+    openspeech@flatearthinc.com
+*/
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/types.h>
+#include <linux/ctype.h>
+#include <linux/string.h>
+#include <linux/errno.h>
+#include <linux/math64.h>
+
+#include "fe_fixedpoint.h"
+
+// Define information about this kernel module
+MODULE_LICENSE("GPL");
+MODULE_AUTHOR("Audio Logic <openspeech@flatearthinc.com>");
+MODULE_DESCRIPTION("Fixed point conversion functions shared by the FE drivers");
+MODULE_VERSION("1.0");
+
+/** Powers of ten used to scale between decimal and binary fractions (up to FE_FIXED_MAX_DECIMALS) */
+static const uint32_t fe_pow10[FE_FIXED_MAX_DECIMALS + 1] =
+{
+    1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000, 1000000000
+};
+
+/** Parse a decimal string (eg: "-1.25") into a fixed point number
+
+    Leading whitespace and an optional sign are accepted, followed by the integer digits, an optional point and the
+    fractional digits.  Only the first FE_FIXED_MAX_DECIMALS fractional digits are significant, any extra digits are
+    consumed and ignored.  The fraction is rounded to the nearest representable value.  Parsing stops at the first
+    character that can't be part of the number, so several numbers can be parsed out of one buffer.
+
+    @param s String to parse, does not need to be null terminated
+    @param len Maximum number of characters to look at in s
+    @param qfmt Q format of the result (number of fractional bits, optionally OR'd with FE_FIXED_SIGNED)
+    @param result Where the fixed point number is stored on success
+    @returns The number of characters consumed, -EINVAL if there isn't a number or -ERANGE if it doesn't fit the format
+*/
+int fe_fixed_parse(const char *s, size_t len, unsigned int qfmt, uint32_t *result)
+{
+    unsigned int frac_bits = qfmt & FE_FIXED_FRAC_MASK;
+    bool is_signed = (qfmt & FE_FIXED_SIGNED) != 0;
+    bool negative = false;
+    size_t i = 0;
+    int num_digits = 0;
+    int frac_len = 0;
+    uint64_t int_part = 0;
+    uint32_t frac_part = 0;
+    uint64_t magnitude;
+    uint64_t limit;
+
+    if (frac_bits > FE_FIXED_MAX_FRAC_BITS)
+        return -EINVAL;
+
+    while (i < len && isspace(s[i]))
+        i++;
+
+    if (i < len && (s[i] == '-' || s[i] == '+'))
+    {
+        negative = (s[i] == '-');
+        i++;
+    }
+
+    // Integer part, bail out as soon as it can't fit in any 32 bit format
+    while (i < len && isdigit(s[i]))
+    {
+        int_part = int_part * 10 + (s[i] - '0');
+        if (int_part > U32_MAX)
+            return -ERANGE;
+        num_digits++;
+        i++;
+    }
+
+    // Fractional part
+    if (i < len && s[i] == '.')
+    {
+        i++;
+        while (i < len && isdigit(s[i]))
+        {
+            if (frac_len < FE_FIXED_MAX_DECIMALS)
+            {
+                frac_part = frac_part * 10 + (s[i] - '0');
+                frac_len++;
+            }
+            num_digits++;
+            i++;
+        }
+    }
+
+    if (num_digits == 0)
+        return -EINVAL;
+
+    // Convert the decimal fraction to binary with a single rounded division (frac_part / 10^frac_len * 2^frac_bits)
+    magnitude = (int_part << frac_bits) +
+                div_u64(((uint64_t)frac_part << frac_bits) + fe_pow10[frac_len] / 2, fe_pow10[frac_len]);
+
+    if (!is_signed)
+        limit = negative ? 0 : U32_MAX;
+    else
+        limit = negative ? 0x80000000ULL : 0x7FFFFFFFULL;
+
+    if (magnitude > limit)
+        return -ERANGE;
+
+    *result = negative ? (uint32_t)(0 - (uint32_t)magnitude) : (uint32_t)magnitude;
+
+    return i;
+}
+EXPORT_SYMBOL_GPL(fe_fixed_parse);
+
+/** Parse a string holding exactly one number, as written to a sysfs attribute
+
+    Same as fe_fixed_parse(), but anything other than whitespace (eg: the trailing newline from echo) after the number
+    is rejected.
+
+    @param s String to parse, does not need to be null terminated
+    @param len Number of characters in s
+    @param qfmt Q format of the result (number of fractional bits, optionally OR'd with FE_FIXED_SIGNED)
+    @param result Where the fixed point number is stored on success
+    @returns 0 on success or a negative error code
+*/
+int fe_fixed_from_string(const char *s, size_t len, unsigned int qfmt, uint32_t *result)
+{
+    int consumed;
+    size_t i;
+
+    consumed = fe_fixed_parse(s, len, qfmt, result);
+    if (consumed < 0)
+        return consumed;
+
+    for (i = consumed; i < len && s[i] != '\0'; i++)
+    {
+        if (!isspace(s[i]))
+            return -EINVAL;
+    }
+
+    return 0;
+}
+EXPORT_SYMBOL_GPL(fe_fixed_from_string);
+
+/** Format a fixed point number as a decimal string
+
+    The fraction is rounded to num_decimals digits (carrying into the integer part when needed), so a value
+    printed with enough decimals parses back to the same fixed point number.
+
+    @param buf Buffer in which to write the string
+    @param size Size of buf, the output is truncated to fit and is always null terminated
+    @param value The fixed point number to format
+    @param qfmt Q format of value (number of fractional bits, optionally OR'd with FE_FIXED_SIGNED)
+    @param num_decimals Number of decimals to write, capped at FE_FIXED_MAX_DECIMALS
+    @returns The length of the string written to buf, or -EINVAL for an invalid format
+*/
+int fe_fixed_format(char *buf, size_t size, uint32_t value, unsigned int qfmt, unsigned int num_decimals)
+{
+    unsigned int frac_bits = qfmt & FE_FIXED_FRAC_MASK;
+    bool negative = (qfmt & FE_FIXED_SIGNED) && (value & 0x80000000);
+    uint32_t magnitude;
+    uint64_t int_part;
+    uint64_t frac_part;
+    char digits[24];
+    size_t pos;
+    size_t len;
+    unsigned int i;
+
+    if (frac_bits > FE_FIXED_MAX_FRAC_BITS)
+        return -EINVAL;
+
+    if (num_decimals > FE_FIXED_MAX_DECIMALS)
+        num_decimals = FE_FIXED_MAX_DECIMALS;
+
+    // Make 2's complement value positive since only the magnitude is printed
+    magnitude = negative ? 0 - value : value;
+
+    int_part = magnitude >> frac_bits;
+    frac_part = magnitude & (uint32_t)((1ULL << frac_bits) - 1);
+
+    // Convert the binary fraction to decimal with a single rounded multiply (frac_part * 10^num_decimals / 2^frac_bits)
+    frac_part *= fe_pow10[num_decimals];
+    if (frac_bits > 0)
+        frac_part = (frac_part + (1ULL << (frac_bits - 1))) >> frac_bits;
+
+    // Rounding can carry into the integer part (eg: 0.9999999999 -> 1.00000000)
+    if (frac_part >= fe_pow10[num_decimals])
+    {
+        frac_part -= fe_pow10[num_decimals];
+        int_part++;
+    }
+
+    // Don't print "-0.00" for tiny negative values that round to zero
+    if (int_part == 0 && frac_part == 0)
+        negative = false;
+
+    // Write the digits backwards into a scratch buffer, this is several times faster than going through scnprintf
+    pos = sizeof(digits);
+    for (i = 0; i < num_decimals; i++)
+    {
+        digits[--pos] = '0' + (uint32_t)frac_part % 10;
+        frac_part = (uint32_t)frac_part / 10;
+    }
+    if (num_decimals > 0)
+        digits[--pos] = '.';
+    do
+    {
+        digits[--pos] = '0' + (uint32_t)int_part % 10;
+        int_part = (uint32_t)int_part / 10;
+    } while (int_part);
+    if (negative)
+        digits[--pos] = '-';
+
+    if (size == 0)
+        return 0;
+
+    // Truncate to fit like scnprintf would
+    len = min(sizeof(digits) - pos, size - 1);
+    memcpy(buf, &digits[pos], len);
+    buf[len] = '\0';
+
+    return len;
+}
+EXPORT_SYMBOL_GPL(fe_fixed_format);
+
+/** Format a fixed point number for a sysfs show function
+
+    Writes the value with FE_FIXED_SHOW_DECIMALS decimals followed by a newline, like the old fp_to_string/strcat2
+    pair did.
+
+    @param buf The PAGE_SIZE sysfs buffer
+    @param value The fixed point number to format
+    @param qfmt Q format of value (number of fractional bits, optionally OR'd with FE_FIXED_SIGNED)
+    @returns Length of the buffer
+*/
+ssize_t fe_fixed_show(char *buf, uint32_t value, unsigned int qfmt)
+{
+    int len;
+
+    len = fe_fixed_format(buf, PAGE_SIZE - 1, value, qfmt, FE_FIXED_SHOW_DECIMALS);
+    if (len < 0)
+        return len;
+
+    buf[len++] = '\n';
+    buf[len] = '\0';
+
+    return len;
+}
+EXPORT_SYMBOL_GPL(fe_fixed_show);
+
+/** Parse a list of numbers separated by commas and/or whitespace (eg: "1.0, 0.5 -2")
+
+    Every number is parsed with fe_fixed_parse(), nothing is written past values[max_values - 1].
+
+    @param s String to parse, does not need to be null terminated
+    @param len Number of characters in s
+    @param qfmt Q format of the results (number of fractional bits, optionally OR'd with FE_FIXED_SIGNED)
+    @param values Array where the fixed point numbers are stored
+    @param max_values Size of the values array
+    @returns The number of values parsed, -EINVAL for a malformed list or too many values, or -ERANGE if a value
+             doesn't fit the format
+*/
+int fe_fixed_parse_vector(const char *s, size_t len, unsigned int qfmt, uint32_t *values, size_t max_values)
+{
+    size_t num_values = 0;
+    size_t i = 0;
+    int consumed;
+
+    while (i < len && s[i] != '\0')
+    {
+        // Skip the separators in front of the next number
+        if (s[i] == ',' || isspace(s[i]))
+        {
+            i++;
+            continue;
+        }
+
+        if (num_values == max_values)
+            return -EINVAL;
+
+        consumed = fe_fixed_parse(&s[i], len - i, qfmt, &values[num_values]);
+        if (consumed < 0)
+            return consumed;
+        i += consumed;
+        num_values++;
+
+        // Numbers have to be separated (eg: "1.0.5" is an error, not 1.0 and 0.5)
+        if (i < len && s[i] != '\0' && s[i] != ',' && !isspace(s[i]))
+            return -EINVAL;
+    }
+
+    return num_values;
+}
+EXPORT_SYMBOL_GPL(fe_fixed_parse_vector);
+
+/** Format a list of fixed point numbers for a sysfs show function
+
+    The values are written with FE_FIXED_SHOW_DECIMALS decimals, separated by ", " and followed by a newline, so
+    the output can be written back to an attribute that takes a vector.
+
+    @param buf The PAGE_SIZE sysfs buffer
+    @param values The fixed point numbers to format
+    @param num_values Number of values
+    @param qfmt Q format of the values (number of fractional bits, optionally OR'd with FE_FIXED_SIGNED)
+    @returns Length of the buffer
+*/
+ssize_t fe_fixed_show_vector(char *buf, const uint32_t *values, size_t num_values, unsigned int qfmt)
+{
+    size_t len = 0;
+    size_t i;
+    int status;
+
+    for (i = 0; i < num_values; i++)
+    {
+        if (i > 0)
+            len += scnprintf(&buf[len], PAGE_SIZE - 1 - len, ", ");
+
+        status = fe_fixed_format(&buf[len], PAGE_SIZE - 1 - len, values[i], qfmt, FE_FIXED_SHOW_DECIMALS);
+        if (status < 0)
+            return status;
+        len += status;
+    }
+
+    buf[len++] = '\n';
+    buf[len] = '\0';
+
+    return len;
+}
+EXPORT_SYMBOL_GPL(fe_fixed_show_vector);
@@ -0,0 +1,167 @@
+/** @file
+
+    This kernel module exports the gain to register code mapping used by the PGA2505, TPA613A2, AD1939 and AD7768-4
+    drivers.  See include/fe_gain_map.h for a description of the chip descriptions and the rounding.
+
+    @copyright 2020 Audio Logic Inc
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+    Audio Logic Inc
+    985 Technology Blvd
+    Bozeman, MT 59718
+    openspeech@flatearthinc.com
+*/
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/types.h>
+#include <linux/errno.h>
+#include <linux/math64.h>
+
+#include "fe_gain_map.h"
+
+// Define information about this kernel module
+MODULE_LICENSE("GPL");
+MODULE_AUTHOR("Audio Logic <openspeech@flatearthinc.com>");
+MODULE_DESCRIPTION("Gain to register code mapping shared by the FE drivers");
+MODULE_VERSION("1.0");
+
+/** Builds the sorted code table of a chip
+
+    @param map Table to fill
+    @param desc Description of the gain steps of the chip
+    @returns 0, or -EINVAL if the description is empty, too long, a value doesn't fit in Q16 or two values are alike
+*/
+int fe_gain_map_init(struct fe_gain_map *map, const struct fe_gain_map_desc *desc)
+{
+    unsigned int n = desc->num_codes;
+    unsigned int i;
+    unsigned int j;
+    int64_t value;
+    uint32_t code;
+    uint32_t code_max;
+
+    if (n == 0 || n > FE_GAIN_MAP_MAX_CODES)
+        return -EINVAL;
+
+    //Fill the table in the order of the description, then insertion sort it by value (only done once at load)
+    for (i = 0; i < n; i++)
+    {
+        if (desc->steps == NULL)
+        {
+            value = (int64_t)desc->first_value + (int64_t)i * desc->step;
+            code = desc->first_code + i * desc->code_step;
+        }
+        else
+        {
+            value = desc->steps[i].value;
+            if (desc->scale)
+                value = div_s64(value * 65536, desc->scale);
+            code = desc->steps[i].code;
+        }
+
+        if (value < INT_MIN || value > INT_MAX)
+            return -EINVAL;
+
+        for (j = i; j > 0 && map->value[j - 1] > value; j--)
+        {
+            map->value[j] = map->value[j - 1];
+            map->code[j] = map->code[j - 1];
+        }
+        map->value[j] = (int32_t)value;
+        map->code[j] = code;
+    }
+
+    for (i = 1; i < n; i++)
+        if (map->value[i] == map->value[i - 1])
+            return -EINVAL;
+
+    map->num_entries = n;
+
+    //Index the entries by code when the codes are close enough together
+    map->code_base = map->code[0];
+    code_max = map->code[0];
+    for (i = 1; i < n; i++)
+    {
+        if (map->code[i] < map->code_base)
+            map->code_base = map->code[i];
+        if (map->code[i] > code_max)
+            code_max = map->code[i];
+    }
+
+    map->dense = (code_max - map->code_base < FE_GAIN_MAP_MAX_CODES);
+    if (map->dense)
+    {
+        for (i = 0; i < FE_GAIN_MAP_MAX_CODES; i++)
+            map->by_code[i] = FE_GAIN_MAP_NO_CODE;
+
+        for (i = 0; i < n; i++)
+        {
+            if (map->by_code[map->code[i] - map->code_base] != FE_GAIN_MAP_NO_CODE)
+                return -EINVAL;
+            map->by_code[map->code[i] - map->code_base] = i;
+        }
+    }
+
+    return 0;
+}
+EXPORT_SYMBOL_GPL(fe_gain_map_init);
+
+/** Finds the step nearest to a value
+
+    @param map Table built by fe_gain_map_init
+    @param value Signed Q16 value, values past either end of the table give the first or last step
+    @returns Index of the step in the table, ties go to the lower value
+*/
+unsigned int fe_gain_map_lookup(const struct fe_gain_map *map, int32_t value)
+{
+    unsigned int lo = 0;
+    unsigned int hi = map->num_entries;
+    unsigned int mid;
+
+    //First entry that isn't below the value
+    while (lo < hi)
+    {
+        mid = lo + (hi - lo) / 2;
+        if (map->value[mid] < value)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    if (lo == 0)
+        return 0;
+    if (lo == map->num_entries)
+        return lo - 1;
+
+    if ((int64_t)value - map->value[lo - 1] <= (int64_t)map->value[lo] - value)
+        return lo - 1;
+
+    return lo;
+}
+EXPORT_SYMBOL_GPL(fe_gain_map_lookup);
+
+/** Gives the value of a code
+
+    @param map Table built by fe_gain_map_init
+    @param code Register code
+    @param value Set to the signed Q16 value of the code
+    @returns 0, or -EINVAL if the code isn't in the table or the codes of the table are too far apart to be indexed
+*/
+int fe_gain_map_decode(const struct fe_gain_map *map, uint32_t code, int32_t *value)
+{
+    uint16_t entry;
+
+    if (!map->dense || code < map->code_base || code - map->code_base >= FE_GAIN_MAP_MAX_CODES)
+        return -EINVAL;
+
+    entry = map->by_code[code - map->code_base];
+    if (entry == FE_GAIN_MAP_NO_CODE)
+        return -EINVAL;
+
+    *value = map->value[entry];
+
+    return 0;
+}
+EXPORT_SYMBOL_GPL(fe_gain_map_decode);
@@ -0,0 +1,75 @@
+/** @file
+
+    This kernel module exports the SPI clock calibration used by the AD1939, AD7768-4 and PGA2505 drivers.  See
+    include/fe_spi_calibrate.h for how the rate is chosen.
+
+    @copyright 2020 Audio Logic Inc
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+    Audio Logic Inc
+    985 Technology Blvd
+    Bozeman, MT 59718
+    openspeech@flatearthinc.com
+*/
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/types.h>
+#include <linux/spi/spi.h>
+
+#include "fe_spi_calibrate.h"
+
+// Define information about this kernel module
+MODULE_LICENSE("GPL");
+MODULE_AUTHOR("Audio Logic <openspeech@flatearthinc.com>");
+MODULE_DESCRIPTION("SPI clock calibration shared by the FE drivers");
+MODULE_VERSION("1.0");
+
+/** Finds the fastest SPI clock that verifies with margin
+
+    @param spi SPI device to calibrate, it is left set up at the chosen rate
+    @param speeds Clock rates in Hz, slowest first (the slowest is used when nothing verifies)
+    @param num_speeds Number of rates in speeds
+    @param verify Round trip check of the driver
+    @returns The chosen clock rate in Hz
+*/
+uint32_t fe_spi_calibrate(struct spi_device *spi, const uint32_t *speeds, unsigned int num_speeds,
+                          fe_spi_verify_t verify)
+{
+    int best = -1;
+    unsigned int i;
+    unsigned int pass;
+
+    for (i = 0; i < num_speeds; i++)
+    {
+        spi->max_speed_hz = speeds[i];
+        if (spi_setup(spi))
+            break;
+
+        for (pass = 0; pass < FE_SPI_CAL_PASSES; pass++)
+            if (verify(spi))
+                break;
+
+        if (pass < FE_SPI_CAL_PASSES)
+            break;
+
+        best = i;
+    }
+
+    //Back off from a rate that passed right below a failing one
+    if (i < num_speeds && best > 0)
+        best--;
+
+    if (best < 0)
+    {
+        dev_warn(&spi->dev, "SPI link could not be verified, staying at %u Hz\n", speeds[0]);
+        best = 0;
+    }
+
+    spi->max_speed_hz = speeds[best];
+    spi_setup(spi);
+
+    return speeds[best];
+}
+EXPORT_SYMBOL_GPL(fe_spi_calibrate);
@@ -0,0 +1,12 @@
+/** @file custom_functions.c
+
+    Builds include/custom_functions.h as is, with prefixed names, for the benchmark.
+*/
+
+#include "fixedpoint_bench.h"
+
+#define fp_to_string  cf_fp_to_string
+#define set_fixed_num cf_set_fixed_num
+#define strcat2       cf_strcat2
+
+#include "custom_functions.h"
@@ -0,0 +1,497 @@
+/** @file fixedpoint_bench.c
+
+    Host side correctness and speed benchmark for the fixed point to/from string conversions.
+
+    Every 32 bit input (or every n-th one with -s) is formatted with FE_FIXED_SHOW_DECIMALS decimals and parsed
+    back by each implementation:
+        - reference:         exact 128 bit arithmetic, round half up in both directions
+        - legacy_driver:     the set_fixed_num/fp_to_string copy that was pasted into the drivers (32F16 only)
+        - custom_functions:  include/custom_functions.h
+        - fe_fixedpoint:     fixedpoint/fe_fixedpoint.c
+
+    For each Q format and implementation the program reports the time per format and per parse, how many strings
+    differ from the reference, how many reference strings parse to a different value than the reference, and the
+    format->parse round trip error in LSBs.  The sweep is split over all host cores.
+
+    The program returns non zero if fe_fixedpoint differs from the reference anywhere, so it can be used as a
+    regression gate for changes to the conversions.
+
+    @copyright 2020 Audio Logic Inc
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+    Audio Logic Inc
+    985 Technology Blvd
+    Bozeman, MT 59718
+    openspeech@flatearthinc.com
+*/
+
+#include <errno.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "fe_fixedpoint.h"
+#include "fixedpoint_bench.h"
+
+// Number of inputs handled between two timestamps
+#define CHUNK_SIZE 4096
+
+// Large enough for any of the implementations with FE_FIXED_SHOW_DECIMALS decimals
+#define STR_SIZE 32
+
+#define NUM_INPUTS (1ULL << 32)
+
+/** Typedef for one conversion implementation */
+typedef struct
+{
+    const char *name;
+    bool (*supports)(unsigned int qfmt);
+    int (*format)(char *buf, uint32_t value, unsigned int qfmt);
+    int (*parse)(const char *s, unsigned int qfmt, uint32_t *result);
+} bench_impl_t;
+
+/** Typedef for a Q format under test */
+typedef struct
+{
+    const char *name;
+    unsigned int qfmt;
+} bench_format_t;
+
+/** Typedef for the results of one implementation on one Q format */
+typedef struct
+{
+    uint64_t count;
+    uint64_t format_ns;
+    uint64_t parse_ns;
+    uint64_t format_mismatch;
+    uint64_t parse_mismatch;
+    uint64_t roundtrip_mismatch;
+    uint64_t roundtrip_max_err;
+    uint64_t parse_error;
+    uint32_t first_mismatch;
+    bool has_mismatch;
+} bench_stats_t;
+
+static const uint64_t pow10_table[FE_FIXED_MAX_DECIMALS + 1] =
+{
+    1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000, 1000000000
+};
+
+//---------------------------------------------------------------
+// Reference implementation
+
+static int reference_format(char *buf, uint32_t value, unsigned int qfmt)
+{
+    unsigned int frac_bits = qfmt & FE_FIXED_FRAC_MASK;
+    bool negative = (qfmt & FE_FIXED_SIGNED) && (value & 0x80000000);
+    uint64_t magnitude = negative ? (uint64_t)(0 - value) : value;
+    uint64_t scale = pow10_table[FE_FIXED_SHOW_DECIMALS];
+    unsigned __int128 scaled;
+
+    // round(magnitude * 10^d / 2^f), half up
+    scaled = ((unsigned __int128)magnitude * scale * 2 + ((unsigned __int128)1 << frac_bits)) /
+             ((unsigned __int128)2 << frac_bits);
+
+    if (scaled == 0)
+        negative = false;
+
+    return sprintf(buf, "%s%llu.%0*llu", negative ? "-" : "", (unsigned long long)(scaled / scale),
+                   FE_FIXED_SHOW_DECIMALS, (unsigned long long)(scaled % scale));
+}
+
+static int reference_parse(const char *s, unsigned int qfmt, uint32_t *result)
+{
+    unsigned int frac_bits = qfmt & FE_FIXED_FRAC_MASK;
+    bool negative = false;
+    bool seen_point = false;
+    unsigned __int128 digits = 0;
+    unsigned __int128 scale = 1;
+    unsigned __int128 magnitude;
+    unsigned __int128 limit;
+
+    if (*s == '-' || *s == '+')
+        negative = (*s++ == '-');
+
+    for (; *s; s++)
+    {
+        if (*s == '.' && !seen_point)
+        {
+            seen_point = true;
+            continue;
+        }
+        if (*s < '0' || *s > '9')
+            return -EINVAL;
+
+        digits = digits * 10 + (*s - '0');
+        if (seen_point)
+            scale *= 10;
+    }
+
+    // round(digits / 10^k * 2^f), half up
+    magnitude = ((digits << (frac_bits + 1)) + scale) / (scale * 2);
+
+    if (!(qfmt & FE_FIXED_SIGNED))
+        limit = negative ? 0 : 0xFFFFFFFF;
+    else
+        limit = negative ? 0x80000000 : 0x7FFFFFFF;
+
+    if (magnitude > limit)
+        return -ERANGE;
+
+    *result = negative ? (uint32_t)(0 - (uint32_t)magnitude) : (uint32_t)magnitude;
+
+    return 0;
+}
+
+static bool reference_supports(unsigned int qfmt)
+{
+    return true;
+}
+
+//---------------------------------------------------------------
+// Copy that was in the drivers, only ever used for signed 32F16.  The drivers stripped the sign before parsing.
+
+static bool legacy_driver_supports(unsigned int qfmt)
+{
+    return qfmt == FE_SQ16;
+}
+
+static int legacy_driver_format(char *buf, uint32_t value, unsigned int qfmt)
+{
+    legacy_driver_fp_to_string(buf, value);
+    return strlen(buf);
+}
+
+static int legacy_driver_parse(const char *s, unsigned int qfmt, uint32_t *result)
+{
+    if (s[0] == '-')
+        *result = 0 - legacy_driver_set_fixed_num(s + 1);
+    else
+        *result = legacy_driver_set_fixed_num(s);
+
+    return 0;
+}
+
+//---------------------------------------------------------------
+// include/custom_functions.h
+
+static bool custom_functions_supports(unsigned int qfmt)
+{
+    return true;
+}
+
+static int custom_functions_format(char *buf, uint32_t value, unsigned int qfmt)
+{
+    return cf_fp_to_string(buf, value, qfmt & FE_FIXED_FRAC_MASK, (qfmt & FE_FIXED_SIGNED) != 0,
+                           FE_FIXED_SHOW_DECIMALS);
+}
+
+static int custom_functions_parse(const char *s, unsigned int qfmt, uint32_t *result)
+{
+    *result = cf_set_fixed_num(s, qfmt & FE_FIXED_FRAC_MASK, (qfmt & FE_FIXED_SIGNED) != 0);
+    return 0;
+}
+
+//---------------------------------------------------------------
+// fixedpoint/fe_fixedpoint.c
+
+static bool fe_fixedpoint_supports(unsigned int qfmt)
+{
+    return true;
+}
+
+static int fe_fixedpoint_format(char *buf, uint32_t value, unsigned int qfmt)
+{
+    return fe_fixed_format(buf, STR_SIZE, value, qfmt, FE_FIXED_SHOW_DECIMALS);
+}
+
+static int fe_fixedpoint_parse(const char *s, unsigned int qfmt, uint32_t *result)
+{
+    return fe_fixed_from_string(s, strlen(s), qfmt, result);
+}
+
+//---------------------------------------------------------------
+
+static const bench_impl_t impls[] =
+{
+    {"reference",        reference_supports,        reference_format,        reference_parse},
+    {"legacy_driver",    legacy_driver_supports,    legacy_driver_format,    legacy_driver_parse},
+    {"custom_functions", custom_functions_supports, custom_functions_format, custom_functions_parse},
+    {"fe_fixedpoint",    fe_fixedpoint_supports,    fe_fixedpoint_format,    fe_fixedpoint_parse},
+};
+#define NUM_IMPLS (sizeof(impls) / sizeof(impls[0]))
+#define GATED_IMPL (NUM_IMPLS - 1)
+
+static const bench_format_t formats[] =
+{
+    {"UQ16", FE_UQ16},
+    {"SQ16", FE_SQ16},
+    {"UQ28", FE_UQ28},
+    {"SQ28", FE_SQ28},
+};
+#define NUM_FORMATS (sizeof(formats) / sizeof(formats[0]))
+
+// Sweep parameters shared by the worker threads
+static uint64_t stride = 1;
+static uint64_t num_chunks;
+static uint64_t next_chunk;
+static unsigned int format_index;
+static bench_stats_t results[NUM_IMPLS];
+static pthread_mutex_t results_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/** Difference between two fixed point values in LSBs */
+static uint64_t lsb_error(uint32_t a, uint32_t b, unsigned int qfmt)
+{
+    int64_t diff;
+
+    if (qfmt & FE_FIXED_SIGNED)
+        diff = (int64_t)(int32_t)a - (int32_t)b;
+    else
+        diff = (int64_t)a - b;
+
+    return diff < 0 ? -diff : diff;
+}
+
+static void note_mismatch(bench_stats_t *stats, uint32_t value)
+{
+    if (!stats->has_mismatch || value < stats->first_mismatch)
+        stats->first_mismatch = value;
+    stats->has_mismatch = true;
+}
+
+/** Worker thread: grabs chunks of inputs until the sweep is done and merges its results at the end */
+static void *bench_worker(void *arg)
+{
+    static __thread char ref_str[CHUNK_SIZE][STR_SIZE];
+    static __thread char str[CHUNK_SIZE][STR_SIZE];
+    static __thread uint32_t ref_value[CHUNK_SIZE];
+    static __thread int ref_status[CHUNK_SIZE];
+    static __thread uint32_t parsed[CHUNK_SIZE];
+    static __thread int parse_status[CHUNK_SIZE];
+    bench_stats_t local[NUM_IMPLS];
+    unsigned int qfmt = formats[format_index].qfmt;
+    uint64_t chunk;
+    unsigned int impl;
+    int i;
+
+    memset(local, 0, sizeof(local));
+
+    while ((chunk = __atomic_fetch_add(&next_chunk, 1, __ATOMIC_RELAXED)) < num_chunks)
+    {
+        uint64_t first = chunk * CHUNK_SIZE;
+        uint64_t total = (NUM_INPUTS + stride - 1) / stride;
+        int n = (total - first < CHUNK_SIZE) ? (int)(total - first) : CHUNK_SIZE;
+
+        // The reference strings and values every implementation is checked against
+        for (i = 0; i < n; i++)
+        {
+            reference_format(ref_str[i], (uint32_t)((first + i) * stride), qfmt);
+            ref_status[i] = reference_parse(ref_str[i], qfmt, &ref_value[i]);
+        }
+
+        for (impl = 0; impl < NUM_IMPLS; impl++)
+        {
+            bench_stats_t *stats = &local[impl];
+            uint64_t t0, t1, t2;
+
+            if (!impls[impl].supports(qfmt))
+                continue;
+
+            t0 = now_ns();
+            for (i = 0; i < n; i++)
+                impls[impl].format(str[i], (uint32_t)((first + i) * stride), qfmt);
+            t1 = now_ns();
+            for (i = 0; i < n; i++)
+                parse_status[i] = impls[impl].parse(str[i], qfmt, &parsed[i]);
+            t2 = now_ns();
+
+            stats->count += n;
+            stats->format_ns += t1 - t0;
+            stats->parse_ns += t2 - t1;
+
+            for (i = 0; i < n; i++)
+            {
+                uint32_t value = (uint32_t)((first + i) * stride);
+                uint32_t check;
+                uint64_t err;
+
+                if (strcmp(str[i], ref_str[i]) != 0)
+                {
+                    stats->format_mismatch++;
+                    note_mismatch(stats, value);
+                }
+
+                // A value that rounds out of range (eg: 0xFFFFFFFF in UQ28) can't make the round trip at all
+                if (parse_status[i])
+                    stats->roundtrip_mismatch++;
+                else
+                {
+                    err = lsb_error(parsed[i], value, qfmt);
+                    if (err)
+                        stats->roundtrip_mismatch++;
+                    if (err > stats->roundtrip_max_err)
+                        stats->roundtrip_max_err = err;
+                }
+
+                // Parse the reference string so format and parse errors are reported separately, an error is only
+                // a difference when the reference accepted the string
+                if (impls[impl].parse(ref_str[i], qfmt, &check))
+                {
+                    if (ref_status[i] == 0)
+                    {
+                        stats->parse_error++;
+                        note_mismatch(stats, value);
+                    }
+                }
+                else if (ref_status[i] != 0 || check != ref_value[i])
+                {
+                    stats->parse_mismatch++;
+                    note_mismatch(stats, value);
+                }
+            }
+        }
+    }
+
+    pthread_mutex_lock(&results_lock);
+    for (impl = 0; impl < NUM_IMPLS; impl++)
+    {
+        results[impl].count += local[impl].count;
+        results[impl].format_ns += local[impl].format_ns;
+        results[impl].parse_ns += local[impl].parse_ns;
+        results[impl].format_mismatch += local[impl].format_mismatch;
+        results[impl].parse_mismatch += local[impl].parse_mismatch;
+        results[impl].roundtrip_mismatch += local[impl].roundtrip_mismatch;
+        results[impl].parse_error += local[impl].parse_error;
+        if (local[impl].roundtrip_max_err > results[impl].roundtrip_max_err)
+            results[impl].roundtrip_max_err = local[impl].roundtrip_max_err;
+        if (local[impl].has_mismatch)
+            note_mismatch(&results[impl], local[impl].first_mismatch);
+    }
+    pthread_mutex_unlock(&results_lock);
+
+    return NULL;
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+            "Usage: %s [-j threads] [-s stride] [-q format]\n"
+            "  -j threads  number of worker threads (default: all online cores)\n"
+            "  -s stride   only test every stride-th input, 1 tests all 2^32 inputs (default: 1)\n"
+            "  -q format   only test one Q format (UQ16, SQ16, UQ28 or SQ28)\n",
+            prog);
+}
+
+int main(int argc, char **argv)
+{
+    long num_threads = sysconf(_SC_NPROCESSORS_ONLN);
+    const char *only_format = NULL;
+    pthread_t *threads;
+    bool failed = false;
+    unsigned int impl;
+    long t;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "j:s:q:h")) != -1)
+    {
+        switch (opt)
+        {
+            case 'j':
+                num_threads = strtol(optarg, NULL, 0);
+                break;
+            case 's':
+                stride = strtoull(optarg, NULL, 0);
+                break;
+            case 'q':
+                only_format = optarg;
+                break;
+            default:
+                usage(argv[0]);
+                return 2;
+        }
+    }
+
+    if (num_threads < 1 || stride < 1 || stride >= NUM_INPUTS)
+    {
+        usage(argv[0]);
+        return 2;
+    }
+
+    threads = calloc(num_threads, sizeof(*threads));
+    if (!threads)
+        return 2;
+
+    num_chunks = ((NUM_INPUTS + stride - 1) / stride + CHUNK_SIZE - 1) / CHUNK_SIZE;
+
+    printf("Sweeping %llu inputs per format (stride %llu) on %ld threads, %d decimals\n\n",
+           (unsigned long long)((NUM_INPUTS + stride - 1) / stride), (unsigned long long)stride, num_threads,
+           FE_FIXED_SHOW_DECIMALS);
+    printf("%-6s %-18s %10s %10s %12s %12s %12s %12s %10s\n", "format", "implementation", "fmt ns/op",
+           "parse ns/op", "fmt diff", "parse diff", "parse fail", "rt diff", "rt max lsb");
+
+    for (format_index = 0; format_index < NUM_FORMATS; format_index++)
+    {
+        if (only_format && strcmp(only_format, formats[format_index].name) != 0)
+            continue;
+
+        memset(results, 0, sizeof(results));
+        next_chunk = 0;
+
+        for (t = 0; t < num_threads; t++)
+        {
+            if (pthread_create(&threads[t], NULL, bench_worker, NULL))
+            {
+                perror("pthread_create");
+                return 2;
+            }
+        }
+        for (t = 0; t < num_threads; t++)
+            pthread_join(threads[t], NULL);
+
+        for (impl = 0; impl < NUM_IMPLS; impl++)
+        {
+            bench_stats_t *stats = &results[impl];
+
+            if (!stats->count)
+            {
+                printf("%-6s %-18s %10s\n", formats[format_index].name, impls[impl].name, "n/a");
+                continue;
+            }
+
+            printf("%-6s %-18s %10.1f %10.1f %12llu %12llu %12llu %12llu %10llu\n",
+                   formats[format_index].name, impls[impl].name,
+                   (double)stats->format_ns / stats->count, (double)stats->parse_ns / stats->count,
+                   (unsigned long long)stats->format_mismatch, (unsigned long long)stats->parse_mismatch,
+                   (unsigned long long)stats->parse_error, (unsigned long long)stats->roundtrip_mismatch,
+                   (unsigned long long)stats->roundtrip_max_err);
+
+            // The reference can't differ from itself, so the gate only needs to look at the new implementation
+            if (impl == GATED_IMPL && stats->has_mismatch)
+            {
+                printf("       first difference from the reference at input 0x%08X\n", stats->first_mismatch);
+                failed = true;
+            }
+        }
+        printf("\n");
+    }
+
+    free(threads);
+
+    printf("%s: %s %s the reference\n", failed ? "FAIL" : "PASS", impls[GATED_IMPL].name,
+           failed ? "differs from" : "matches");
+
+    return failed ? 1 : 0;
+}
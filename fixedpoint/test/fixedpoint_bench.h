@@ -0,0 +1,33 @@
+/** @file fixedpoint_bench.h
+
+    Prototypes for the conversion implementations compared by fixedpoint_bench.  The legacy implementations are
+    built from their original sources with prefixed names so they can be linked into one program.
+
+    @copyright 2020 Audio Logic Inc
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+    INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+    PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+    FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+    ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+    Audio Logic
+    985 Technology Blvd
+    Bozeman, MT 59718
+    openspeech@flatearthinc.com
+*/
+
+#ifndef FIXEDPOINT_BENCH_H_
+#define FIXEDPOINT_BENCH_H_
+
+#include <linux/types.h>
+
+// Copy that was pasted into the drivers (legacy_driver.c), always 32F16
+uint32_t legacy_driver_set_fixed_num(const char *s);
+int legacy_driver_fp_to_string(char *buf, uint32_t fp28_num);
+
+// include/custom_functions.h (custom_functions.c)
+int cf_fp_to_string(char *buf, uint32_t fp_num, size_t fractional_bits, bool is_signed, uint8_t num_decimals);
+uint32_t cf_set_fixed_num(const char *s, int num_fractional_bits, bool is_signed);
+
+#endif
@@ -0,0 +1,200 @@
+/** @file gain_map_check.c
+
+    Host side regression check for the gain to register code mapping (fixedpoint/fe_gain_map.c).
+
+    A few chip descriptions in the shapes the drivers use (an evenly spaced attenuator, an amplifier table
+    with an irregular first step, and an unsorted table with a mute code far from the others) are turned into maps,
+    then:
+        - every value of the map must decode from its code
+        - the binary search must give the same step as a linear scan for the nearest step (ties to the lower value)
+          for every n-th Q16 value, and for every value within two LSBs of each step and of each midpoint
+        - descriptions with two identical values or two identical codes must be rejected
+
+    The program returns non zero on the first difference so it can be used by make check.
+
+    @copyright 2020 Audio Logic Inc
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+    Audio Logic Inc
+    985 Technology Blvd
+    Bozeman, MT 59718
+    openspeech@flatearthinc.com
+*/
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "fe_gain_map.h"
+
+// Every 65537th Q16 value, every step and midpoint is also checked
+#define SWEEP_STRIDE 65537
+
+// 0 to -95.625 dB in -0.375 dB steps, like the AD1939 DAC attenuators
+static const struct fe_gain_map_desc attenuator_desc =
+{
+    .num_codes = 256,
+    .first_value = 0,
+    .step = -24576,
+    .first_code = 0,
+    .code_step = 1,
+};
+
+// 0, 9, then 12 to 60 dB in 3 dB steps, like the PGA2505
+static const struct fe_gain_step amplifier_steps[] =
+{
+    {.value = 0,  .code = 0},  {.value = 9,  .code = 1},  {.value = 12, .code = 2},  {.value = 15, .code = 3},
+    {.value = 18, .code = 4},  {.value = 21, .code = 5},  {.value = 24, .code = 6},  {.value = 27, .code = 7},
+    {.value = 30, .code = 8},  {.value = 33, .code = 9},  {.value = 36, .code = 10}, {.value = 39, .code = 11},
+    {.value = 42, .code = 12}, {.value = 45, .code = 13}, {.value = 48, .code = 14}, {.value = 51, .code = 15},
+    {.value = 54, .code = 16}, {.value = 57, .code = 17}, {.value = 60, .code = 18},
+};
+
+static const struct fe_gain_map_desc amplifier_desc =
+{
+    .num_codes = sizeof(amplifier_steps) / sizeof(amplifier_steps[0]),
+    .steps = amplifier_steps,
+    .scale = 1,
+};
+
+// Unsorted tenths of a dB with a mute code, like the TPA6130A2
+static const struct fe_gain_step headphone_steps[] =
+{
+    {.value = 40,   .code = 0x3F}, {.value = -1000, .code = 0xFF}, {.value = -595, .code = 0x00},
+    {.value = 1,    .code = 0x35}, {.value = -3,    .code = 0x34}, {.value = -535, .code = 0x01},
+    {.value = 5,    .code = 0x36}, {.value = -26,   .code = 0x2F}, {.value = -31,  .code = 0x2E},
+};
+
+static const struct fe_gain_map_desc headphone_desc =
+{
+    .num_codes = sizeof(headphone_steps) / sizeof(headphone_steps[0]),
+    .steps = headphone_steps,
+    .scale = 10,
+};
+
+static const struct fe_gain_step same_value_steps[] = { {.value = 1, .code = 0}, {.value = 1, .code = 1} };
+static const struct fe_gain_step same_code_steps[] = { {.value = 1, .code = 0}, {.value = 2, .code = 0} };
+
+static const struct fe_gain_map_desc bad_descs[] =
+{
+    {.num_codes = 0, .step = 1, .code_step = 1},
+    {.num_codes = FE_GAIN_MAP_MAX_CODES + 1, .step = 1, .code_step = 1},
+    {.num_codes = 2, .steps = same_value_steps},
+    {.num_codes = 2, .steps = same_code_steps},
+};
+
+static struct fe_gain_map map;
+
+/** Index of the step nearest to a value found by a linear scan, ties to the lower value */
+static unsigned int linear_lookup(const struct fe_gain_map *m, int32_t value)
+{
+    unsigned int best = 0;
+    int64_t best_diff = INT64_MAX;
+    int64_t diff;
+    unsigned int i;
+
+    for (i = 0; i < m->num_entries; i++)
+    {
+        diff = (int64_t)value - m->value[i];
+        if (diff < 0)
+            diff = -diff;
+        if (diff < best_diff)
+        {
+            best_diff = diff;
+            best = i;
+        }
+    }
+
+    return best;
+}
+
+static int check_value(const char *name, int32_t value)
+{
+    unsigned int expected = linear_lookup(&map, value);
+    unsigned int found = fe_gain_map_lookup(&map, value);
+
+    if (found != expected)
+    {
+        printf("%s: value 0x%08X gives step %u, the nearest step is %u\n", name, (uint32_t)value, found, expected);
+        return 1;
+    }
+
+    return 0;
+}
+
+static int check_map(const char *name, const struct fe_gain_map_desc *desc)
+{
+    int64_t value;
+    int32_t decoded;
+    unsigned int i;
+    int d;
+
+    if (fe_gain_map_init(&map, desc))
+    {
+        printf("%s: description rejected\n", name);
+        return 1;
+    }
+
+    for (i = 0; i < map.num_entries; i++)
+    {
+        if (i > 0 && map.value[i] <= map.value[i - 1])
+        {
+            printf("%s: step %u isn't above step %u\n", name, i, i - 1);
+            return 1;
+        }
+
+        if (fe_gain_map_decode(&map, map.code[i], &decoded) || decoded != map.value[i])
+        {
+            printf("%s: code 0x%X doesn't decode to step %u\n", name, map.code[i], i);
+            return 1;
+        }
+
+        for (d = -2; d <= 2; d++)
+        {
+            if (check_value(name, map.value[i] + d))
+                return 1;
+            if (i > 0 && check_value(name, (int32_t)(((int64_t)map.value[i - 1] + map.value[i]) / 2) + d))
+                return 1;
+        }
+    }
+
+    for (value = INT32_MIN; value <= INT32_MAX; value += SWEEP_STRIDE)
+        if (check_value(name, (int32_t)value))
+            return 1;
+
+    printf("%s: %u steps from %d to %d (Q16) ok\n", name, map.num_entries, map.value[0], map.value[map.num_entries - 1]);
+
+    return 0;
+}
+
+int main(void)
+{
+    int32_t decoded;
+    unsigned int i;
+    int failed = 0;
+
+    failed |= check_map("attenuator", &attenuator_desc);
+    failed |= check_map("amplifier", &amplifier_desc);
+    failed |= check_map("headphone", &headphone_desc);
+
+    //Codes that aren't steps of the chip
+    if (fe_gain_map_decode(&map, 0x10, &decoded) != -EINVAL || fe_gain_map_decode(&map, 0x100, &decoded) != -EINVAL)
+    {
+        printf("headphone: decoded a code that isn't in the map\n");
+        failed = 1;
+    }
+
+    for (i = 0; i < sizeof(bad_descs) / sizeof(bad_descs[0]); i++)
+    {
+        if (fe_gain_map_init(&map, &bad_descs[i]) != -EINVAL)
+        {
+            printf("bad description %u accepted\n", i);
+            failed = 1;
+        }
+    }
+
+    printf("%s: fe_gain_map\n", failed ? "FAIL" : "PASS");
+
+    return failed;
+}
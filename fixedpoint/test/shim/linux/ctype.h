@@ -0,0 +1,12 @@
+/** @file ctype.h
+
+    Userspace stand-in for <linux/ctype.h>.  Unlike the libc versions these take any char, like the kernel ones.
+*/
+
+#ifndef FE_SHIM_LINUX_CTYPE_H_
+#define FE_SHIM_LINUX_CTYPE_H_
+
+#define isdigit(c) ((unsigned char)(c) >= '0' && (unsigned char)(c) <= '9')
+#define isspace(c) ((c) == ' ' || ((unsigned char)(c) >= '\t' && (unsigned char)(c) <= '\r'))
+
+#endif
@@ -0,0 +1,12 @@
+/** @file errno.h
+
+    Userspace stand-in for <linux/errno.h>.  libc's <errno.h> includes <linux/errno.h> itself, so this has to pull
+    in the error numbers the same way the uapi header does.
+*/
+
+#ifndef FE_SHIM_LINUX_ERRNO_H_
+#define FE_SHIM_LINUX_ERRNO_H_
+
+#include <asm/errno.h>
+
+#endif
@@ -0,0 +1,43 @@
+/** @file kernel.h
+
+    Userspace stand-in for <linux/kernel.h>, only the helpers used by the conversion functions are provided.
+*/
+
+#ifndef FE_SHIM_LINUX_KERNEL_H_
+#define FE_SHIM_LINUX_KERNEL_H_
+
+#include <limits.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <linux/types.h>
+
+#define PAGE_SIZE 4096
+
+#define min(a, b) ((a) < (b) ? (a) : (b))
+
+// The legacy conversions complain about bad characters, keep the sweep quiet
+#define pr_info(...) do { } while (0)
+#define printk(...)  do { } while (0)
+
+/** Same as the kernel scnprintf: returns the number of characters actually written, not the untruncated length */
+static inline int scnprintf(char *buf, size_t size, const char *fmt, ...)
+{
+    va_list args;
+    int len;
+
+    if (size == 0)
+        return 0;
+
+    va_start(args, fmt);
+    len = vsnprintf(buf, size, fmt, args);
+    va_end(args);
+
+    if (len < 0)
+        return 0;
+
+    return ((size_t)len >= size) ? (int)(size - 1) : len;
+}
+
+#endif
@@ -0,0 +1,21 @@
+/** @file math64.h
+
+    Userspace stand-in for <linux/math64.h>.
+*/
+
+#ifndef FE_SHIM_LINUX_MATH64_H_
+#define FE_SHIM_LINUX_MATH64_H_
+
+#include <linux/types.h>
+
+static inline u64 div_u64(u64 dividend, u32 divisor)
+{
+    return dividend / divisor;
+}
+
+static inline s64 div_s64(s64 dividend, s32 divisor)
+{
+    return dividend / divisor;
+}
+
+#endif
@@ -0,0 +1,18 @@
+/** @file module.h
+
+    Userspace stand-in for <linux/module.h>, the module macros expand to nothing.
+*/
+
+#ifndef FE_SHIM_LINUX_MODULE_H_
+#define FE_SHIM_LINUX_MODULE_H_
+
+#include <linux/kernel.h>
+
+#define MODULE_LICENSE(x)
+#define MODULE_AUTHOR(x)
+#define MODULE_DESCRIPTION(x)
+#define MODULE_VERSION(x)
+#define EXPORT_SYMBOL(x)
+#define EXPORT_SYMBOL_GPL(x)
+
+#endif
@@ -0,0 +1,11 @@
+/** @file string.h
+
+    Userspace stand-in for <linux/string.h>.
+*/
+
+#ifndef FE_SHIM_LINUX_STRING_H_
+#define FE_SHIM_LINUX_STRING_H_
+
+#include <string.h>
+
+#endif
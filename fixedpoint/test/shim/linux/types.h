@@ -0,0 +1,23 @@
+/** @file types.h
+
+    Userspace stand-in for <linux/types.h> so the driver conversion code can be built on the host.
+*/
+
+#ifndef FE_SHIM_LINUX_TYPES_H_
+#define FE_SHIM_LINUX_TYPES_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+typedef uint8_t  u8;
+typedef uint16_t u16;
+typedef uint32_t u32;
+typedef uint64_t u64;
+typedef int32_t  s32;
+typedef int64_t  s64;
+
+#define U32_MAX ((u32)~0U)
+
+#endif
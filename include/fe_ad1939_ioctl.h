@@ -0,0 +1,75 @@
+/** @file fe_ad1939_ioctl.h
+
+    Register image interface of the AD1939 driver (/dev/fe_AD1939_N).
+
+    A read() of the device and FE_AD1939_IOC_GET_REGS both return the 17 control registers of the codec, one byte per
+    register indexed by its address (0x00 PLL and clock control 0 .. 0x10 ADC control 2).  The image comes from the
+    driver's register cache, the DAC volumes are the last ones written (including any still queued for the SPI bus)
+    and only PLL and clock control 1, which holds the PLL lock bit, is read from the codec.
+
+    FE_AD1939_IOC_FADE starts a timed fade of a set of DAC channels to a common attenuation, stepped by the driver.
+
+    The header is shared by the driver and userspace programs, so it only uses the fixed size __u8/__u32 types.
+
+    @copyright 2020 Audio Logic
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+    INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+    PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+    FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+    ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+    Audio Logic
+    985 Technology Blvd
+    Bozeman, MT 59718
+    openspeech@flatearthinc.com
+*/
+
+#ifndef FE_AD1939_IOCTL_H_
+#define FE_AD1939_IOCTL_H_
+
+#include <linux/types.h>
+#include <linux/ioctl.h>
+
+// Number of control registers in the image (addresses 0x00 to 0x10)
+#define FE_AD1939_NUM_REGS      17
+
+/** Argument of FE_AD1939_IOC_GET_REGS */
+struct fe_ad1939_regs
+{
+    __u8 regs[FE_AD1939_NUM_REGS];  ///< Register values, indexed by register address
+    __u8 reserved[3];               ///< Set to 0
+};
+
+// DAC channels of a fade, in register order
+#define FE_AD1939_DAC1_LEFT     0x01
+#define FE_AD1939_DAC1_RIGHT    0x02
+#define FE_AD1939_DAC2_LEFT     0x04
+#define FE_AD1939_DAC2_RIGHT    0x08
+#define FE_AD1939_DAC3_LEFT     0x10
+#define FE_AD1939_DAC3_RIGHT    0x20
+#define FE_AD1939_DAC4_LEFT     0x40
+#define FE_AD1939_DAC4_RIGHT    0x80
+#define FE_AD1939_DAC_ALL       0xFF
+
+// Longest fade
+#define FE_AD1939_MAX_FADE_MS   60000
+
+/** Argument of FE_AD1939_IOC_FADE
+
+    A new fade replaces the one in progress, the channels of the old fade stay where they got to.  Writing the volume of
+    a channel takes it out of the fade.
+*/
+struct fe_ad1939_fade
+{
+    __u32 channels;             ///< Or of FE_AD1939_DAC* bits
+    __u32 target;               ///< Attenuation to fade to in dB, as a signed Q16 fixed point word (the sign is ignored)
+    __u32 duration_ms;          ///< Length of the fade, 0 .. FE_AD1939_MAX_FADE_MS
+    __u32 reserved;             ///< Must be 0
+};
+
+#define FE_AD1939_IOC_MAGIC     'a'
+#define FE_AD1939_IOC_GET_REGS  _IOR(FE_AD1939_IOC_MAGIC, 1, struct fe_ad1939_regs)
+#define FE_AD1939_IOC_FADE      _IOW(FE_AD1939_IOC_MAGIC, 2, struct fe_ad1939_fade)
+
+#endif
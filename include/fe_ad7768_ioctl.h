@@ -0,0 +1,92 @@
+/** @file fe_ad7768_ioctl.h
+
+    Conversion mode and calibration interface of the AD7768-4 driver (/dev/fe_AD7768_4_N).
+
+    The mode of the ADC is its power mode, the MCLK divider that sets the modulator clock, the decimation rate and the
+    type of the decimation filter.  FE_AD7768_IOC_SET_MODE changes all of them at once: the power mode, interface,
+    channel mode A and channel mode select registers are written in one SPI message that ends with a software
+    synchronization of the ADC, so the channels never run with half of a mode.  The output data rate that results is
+    MCLK / mclk_div / decimation, it is returned in output_data_rate and handed to the FE_AD7768_v1 block in the FPGA.
+
+    Every channel runs from channel mode A, so all four channels share the decimation rate and the output data rate.
+
+    The calibration of the channels (offset, gain and sync offset registers) is a struct fe_ad7768_calibration.  A
+    write() of one whole blob at offset 0 checks it and loads all 28 channel registers in a single SPI message, a
+    read() returns the registers as they are now (including gains set through the adcN_gain attributes).  The driver
+    also loads the blob from the firmware file fe_ad7768_4_cal.bin, or the one named by the firmware-name property of
+    the device tree node, when the device is probed.  The fields of the blob are little endian.
+
+    The header is shared by the driver and userspace programs, so it only uses the fixed size __u32/__le32 types.
+
+    @copyright 2020 Audio Logic
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+    INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+    PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+    FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+    ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+    Audio Logic
+    985 Technology Blvd
+    Bozeman, MT 59718
+    openspeech@flatearthinc.com
+*/
+
+#ifndef FE_AD7768_IOCTL_H_
+#define FE_AD7768_IOCTL_H_
+
+#include <linux/types.h>
+#include <linux/ioctl.h>
+
+// Power modes
+#define FE_AD7768_POWER_ECO         0
+#define FE_AD7768_POWER_MEDIAN      1
+#define FE_AD7768_POWER_FAST        2
+
+// Decimation filters, the wideband filter has the flatter passband and the sinc5 filter the lower latency
+#define FE_AD7768_FILTER_WIDEBAND   0
+#define FE_AD7768_FILTER_SINC5      1
+
+// Range of the decimation rate (a power of two)
+#define FE_AD7768_MIN_DECIMATION    32
+#define FE_AD7768_MAX_DECIMATION    1024
+
+/** Argument of FE_AD7768_IOC_GET_MODE and FE_AD7768_IOC_SET_MODE */
+struct fe_ad7768_mode
+{
+    __u32 power_mode;           ///< FE_AD7768_POWER_*
+    __u32 mclk_div;             ///< Modulator clock divider, 4, 8 or 32
+    __u32 decimation;           ///< FE_AD7768_MIN_DECIMATION .. FE_AD7768_MAX_DECIMATION
+    __u32 filter;               ///< FE_AD7768_FILTER_*
+    __u32 output_data_rate;     ///< Samples per second per channel, ignored by SET_MODE and filled in on return
+    __u32 reserved;             ///< Must be 0
+};
+
+// Blob identification, the magic is "AD77" in the first four bytes of the blob
+#define FE_AD7768_CAL_MAGIC         0x37374441
+#define FE_AD7768_CAL_VERSION       1
+#define FE_AD7768_CAL_CHANNELS      4
+
+/** Calibration of one channel */
+struct fe_ad7768_channel_cal
+{
+    __le32 offset;              ///< Offset register, a 24 bit two's complement code sign extended to 32 bits
+    __le32 gain;                ///< Gain register, 0 .. 0xFFFFFF (0x555555 is the factory default)
+    __le32 sync_offset;         ///< Sync offset register (phase delay), 0 .. 255
+};
+
+/** Calibration blob read and written through /dev/fe_AD7768_4_N */
+struct fe_ad7768_calibration
+{
+    __le32 magic;               ///< FE_AD7768_CAL_MAGIC
+    __le32 version;             ///< FE_AD7768_CAL_VERSION
+    __le32 num_channels;        ///< FE_AD7768_CAL_CHANNELS
+    __le32 reserved;            ///< Must be 0
+    struct fe_ad7768_channel_cal channels[FE_AD7768_CAL_CHANNELS];  ///< Channels 0 to 3
+};
+
+#define FE_AD7768_IOC_MAGIC     'd'
+#define FE_AD7768_IOC_GET_MODE  _IOR(FE_AD7768_IOC_MAGIC, 1, struct fe_ad7768_mode)
+#define FE_AD7768_IOC_SET_MODE  _IOWR(FE_AD7768_IOC_MAGIC, 2, struct fe_ad7768_mode)
+
+#endif
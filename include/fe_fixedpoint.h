@@ -0,0 +1,59 @@
+/** @file fe_fixedpoint.h
+
+    Fixed point to/from string conversions shared by the FPGA Open Speech Tools drivers.
+
+    The conversions live in the fe_fixedpoint kernel module (fixedpoint/fe_fixedpoint.c) and are exported
+    to the other drivers, which replaces the set_fixed_num/fp_to_string copies that used to be pasted
+    into every driver.  The Q format is passed as a parameter, built from the number of fractional bits
+    and an optional FE_FIXED_SIGNED flag (eg: FE_SQ16 is a signed 32 bit word with 16 fractional bits).
+
+    Both directions are done in a single pass over the string: the decimal fraction is converted to binary
+    with one rounded division and back to decimal with one rounded multiply, instead of looping over every
+    fractional bit.
+
+    @copyright 2020 Audio Logic Inc
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+    INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+    PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+    FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+    ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+    Audio Logic
+    985 Technology Blvd
+    Bozeman, MT 59718
+    openspeech@flatearthinc.com
+*/
+
+#ifndef FE_FIXEDPOINT_H_
+#define FE_FIXEDPOINT_H_
+
+#include <linux/types.h>
+
+// Q format flags, OR'd with the number of fractional bits
+#define FE_FIXED_FRAC_MASK      0x03F
+#define FE_FIXED_SIGNED         0x100
+
+// Q formats used by the drivers in this library
+#define FE_UQ16                 (16)
+#define FE_SQ16                 (16 | FE_FIXED_SIGNED)
+#define FE_UQ28                 (28)
+#define FE_SQ28                 (28 | FE_FIXED_SIGNED)
+
+// Largest number of fractional bits that can be converted
+#define FE_FIXED_MAX_FRAC_BITS  31
+
+// Number of decimal digits that are significant when parsing or formatting
+#define FE_FIXED_MAX_DECIMALS   9
+
+// Number of decimals printed by fe_fixed_show (matches the old fp_to_string output)
+#define FE_FIXED_SHOW_DECIMALS  8
+
+int fe_fixed_parse(const char *s, size_t len, unsigned int qfmt, uint32_t *result);
+int fe_fixed_from_string(const char *s, size_t len, unsigned int qfmt, uint32_t *result);
+int fe_fixed_format(char *buf, size_t size, uint32_t value, unsigned int qfmt, unsigned int num_decimals);
+ssize_t fe_fixed_show(char *buf, uint32_t value, unsigned int qfmt);
+int fe_fixed_parse_vector(const char *s, size_t len, unsigned int qfmt, uint32_t *values, size_t max_values);
+ssize_t fe_fixed_show_vector(char *buf, const uint32_t *values, size_t num_values, unsigned int qfmt);
+
+#endif
@@ -0,0 +1,84 @@
+/** @file fe_gain_map.h
+
+    Gain to register code mapping shared by the PGA2505, TPA613A2, AD1939 and AD7768-4 drivers.
+
+    Each driver describes the gain steps of its chip once, either as evenly spaced steps (first value, step, first
+    code and code step) or as an explicit table of values and codes in any order.  fe_gain_map_init() turns the
+    description into a table sorted by value when the driver loads.  fe_gain_map_lookup() then finds the code nearest
+    to a value with a binary search and fe_gain_map_decode() gives the value of a code with one table access, so every
+    driver rounds the same way: to the nearest step, ties to the lower value, and values outside the range of the chip
+    go to the first or last step.
+
+    Values are signed Q16 fixed point words (dB for the amplifiers and the DAC, a relative gain for the AD7768-4).
+    The functions live in the fe_gain_map kernel module (fixedpoint/fe_gain_map.c).
+
+    @copyright 2020 Audio Logic Inc
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+    INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+    PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+    FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+    ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+    Audio Logic
+    985 Technology Blvd
+    Bozeman, MT 59718
+    openspeech@flatearthinc.com
+*/
+
+#ifndef FE_GAIN_MAP_H_
+#define FE_GAIN_MAP_H_
+
+#include <linux/types.h>
+
+// Largest number of codes of a chip, codes spanning up to this many values can be decoded
+#define FE_GAIN_MAP_MAX_CODES   256
+
+// Entry of by_code for a code that isn't in the map
+#define FE_GAIN_MAP_NO_CODE     0xFFFF
+
+/** One gain step of a chip */
+struct fe_gain_step
+{
+    int32_t value;              ///< Gain in 1/scale units of the description
+    uint32_t code;              ///< Register code of the gain
+};
+
+/** Description of the gain steps of a chip */
+struct fe_gain_map_desc
+{
+    unsigned int num_codes;     ///< Number of codes, 1 .. FE_GAIN_MAP_MAX_CODES
+
+    // Evenly spaced steps, used when steps is NULL: code first_code + i * code_step is first_value + i * step
+    int32_t first_value;        ///< Value of first_code as signed Q16
+    int32_t step;               ///< Value between two codes as signed Q16, negative for attenuators
+    uint32_t first_code;        ///< Code of first_value
+    int32_t code_step;          ///< Code between two steps (usually 1)
+
+    // Explicit table
+    const struct fe_gain_step *steps;   ///< Steps in any order, no two values alike
+    int32_t scale;              ///< Values of steps are in 1/scale units (eg: 10 for tenths of a dB), 0 when they are Q16
+};
+
+/** Sorted code table built from a struct fe_gain_map_desc */
+struct fe_gain_map
+{
+    unsigned int num_entries;                   ///< Number of codes
+    int32_t value[FE_GAIN_MAP_MAX_CODES];       ///< Values as signed Q16, ascending
+    uint32_t code[FE_GAIN_MAP_MAX_CODES];       ///< Code of each value
+    uint32_t code_base;                         ///< Smallest code
+    bool dense;                                 ///< The codes span at most FE_GAIN_MAP_MAX_CODES, by_code is valid
+    uint16_t by_code[FE_GAIN_MAP_MAX_CODES];    ///< Entry of each code from code_base, or FE_GAIN_MAP_NO_CODE
+};
+
+int fe_gain_map_init(struct fe_gain_map *map, const struct fe_gain_map_desc *desc);
+unsigned int fe_gain_map_lookup(const struct fe_gain_map *map, int32_t value);
+int fe_gain_map_decode(const struct fe_gain_map *map, uint32_t code, int32_t *value);
+
+/** Code of the step nearest to a value */
+static inline uint32_t fe_gain_map_code(const struct fe_gain_map *map, int32_t value)
+{
+    return map->code[fe_gain_map_lookup(map, value)];
+}
+
+#endif
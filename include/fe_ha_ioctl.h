@@ -0,0 +1,66 @@
+/** @file fe_ha_ioctl.h
+
+    ioctl interface of the FE Qsys Simple HA driver (/dev/fe_HANNN).
+
+    FE_HA_IOC_SET_GAINS applies a batch of gains in one system call.  Every entry is checked before anything is
+    written, then all the gains are written back to back under the driver lock and committed together, so the whole
+    batch takes effect on the same sample.  On return the value of every entry holds the gain that was in the
+    register before the batch (entries that repeat a register see the value left by the entry before them).
+
+    The header is shared by the driver and userspace programs, so it only uses the fixed size __u32/__u64 types.
+
+    @copyright 2020 Audio Logic
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+    INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+    PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+    FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+    ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+    Audio Logic
+    985 Technology Blvd
+    Bozeman, MT 59718
+    openspeech@flatearthinc.com
+*/
+
+#ifndef FE_HA_IOCTL_H_
+#define FE_HA_IOCTL_H_
+
+#include <linux/types.h>
+#include <linux/ioctl.h>
+
+// Bands, in register order
+#define FE_HA_BAND_ALL          0
+#define FE_HA_BAND1             1
+#define FE_HA_BAND2             2
+#define FE_HA_BAND3             3
+#define FE_HA_BAND4             4
+#define FE_HA_NUM_BANDS         5
+
+// Channels
+#define FE_HA_LEFT              0
+#define FE_HA_RIGHT             1
+
+// Largest number of entries in one batch
+#define FE_HA_MAX_BATCH         64
+
+/** One gain of a batch */
+struct fe_ha_gain
+{
+    __u32 band;                 ///< FE_HA_BAND_ALL .. FE_HA_BAND4
+    __u32 channel;              ///< FE_HA_LEFT or FE_HA_RIGHT
+    __u32 value;                ///< Gain as a signed Q16 fixed point word (sfix32_En16), the previous gain on return
+};
+
+/** Argument of FE_HA_IOC_SET_GAINS */
+struct fe_ha_gain_batch
+{
+    __u64 gains;                ///< Userspace pointer to an array of struct fe_ha_gain
+    __u32 count;                ///< Number of entries in the array, 1 .. FE_HA_MAX_BATCH
+    __u32 reserved;             ///< Must be 0
+};
+
+#define FE_HA_IOC_MAGIC         'h'
+#define FE_HA_IOC_SET_GAINS     _IOWR(FE_HA_IOC_MAGIC, 1, struct fe_ha_gain_batch)
+
+#endif
@@ -0,0 +1,48 @@
+/** @file fe_pga2505_ioctl.h
+
+    ioctl interface of the PGA2505 driver (/dev/fe_PGA2505_N).
+
+    The PGA2505s are daisy chained on one SPI chip select, the num-amplifiers property of the device tree node gives
+    the length of the chain (2 when it is missing).  FE_PGA2505_IOC_SET_GAINS sets the gain of every amplifier of the
+    chain: the command words of the whole chain are built and shifted out in a single SPI write, so all the gains
+    change together.  Gains are rounded to the nearest step of the PGA2505 and FE_PGA2505_IOC_GET_GAINS returns the
+    gains that were applied.
+
+    The header is shared by the driver and userspace programs, so it only uses the fixed size __u32 type.
+
+    @copyright 2020 Audio Logic
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+    INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+    PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+    FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+    ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+    Audio Logic
+    985 Technology Blvd
+    Bozeman, MT 59718
+    openspeech@flatearthinc.com
+*/
+
+#ifndef FE_PGA2505_IOCTL_H_
+#define FE_PGA2505_IOCTL_H_
+
+#include <linux/types.h>
+#include <linux/ioctl.h>
+
+// Longest daisy chain
+#define FE_PGA2505_MAX_AMPS     64
+
+/** Argument of FE_PGA2505_IOC_GET_GAINS and FE_PGA2505_IOC_SET_GAINS */
+struct fe_pga2505_gains
+{
+    __u32 num_amps;             ///< Length of the chain, SET_GAINS has to match it
+    __u32 reserved;             ///< Must be 0
+    __u32 gains[FE_PGA2505_MAX_AMPS];   ///< Gain of each amplifier in dB as an unsigned Q16 fixed point word
+};
+
+#define FE_PGA2505_IOC_MAGIC        'p'
+#define FE_PGA2505_IOC_GET_GAINS    _IOR(FE_PGA2505_IOC_MAGIC, 1, struct fe_pga2505_gains)
+#define FE_PGA2505_IOC_SET_GAINS    _IOW(FE_PGA2505_IOC_MAGIC, 2, struct fe_pga2505_gains)
+
+#endif
@@ -0,0 +1,43 @@
+/** @file fe_spi_calibrate.h
+
+    SPI clock calibration shared by the codec and preamp drivers.
+
+    The control ports of the AD1939, AD7768-4 and PGA2505 used to run at a fixed 500 kHz.  fe_spi_calibrate() steps the
+    clock of the SPI device up through a table of rates, checking each one with a driver supplied round trip (write a
+    register and read it back), and stops at the first rate that fails.  A rate that passes just below a failing one is
+    too close to the edge, so the link settles one step lower; the last rate of the table is the fastest the part is
+    rated for and is kept when it passes.  If even the first rate of the table can't be verified (eg: MISO isn't wired)
+    the link stays at that first rate.
+
+    The function lives in the fe_spi_calibrate kernel module (fixedpoint/fe_spi_calibrate.c).
+
+    @copyright 2020 Audio Logic
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+    INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+    PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+    FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+    ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+    Audio Logic
+    985 Technology Blvd
+    Bozeman, MT 59718
+    openspeech@flatearthinc.com
+*/
+
+#ifndef FE_SPI_CALIBRATE_H_
+#define FE_SPI_CALIBRATE_H_
+
+#include <linux/types.h>
+#include <linux/spi/spi.h>
+
+// Number of round trips a rate has to pass
+#define FE_SPI_CAL_PASSES       4
+
+/** Round trip check of a driver, returns 0 when everything written was read back */
+typedef int (*fe_spi_verify_t)(struct spi_device *spi);
+
+uint32_t fe_spi_calibrate(struct spi_device *spi, const uint32_t *speeds, unsigned int num_speeds,
+                          fe_spi_verify_t verify);
+
+#endif
@@ -107,7 +107,7 @@ set_interface_property s1 PORT_NAME_MAP ""
 set_interface_property s1 CMSIS_SVD_VARIABLES ""
 set_interface_property s1 SVD_ADDRESS_GROUP ""
 
-add_interface_port s1 avs_s1_address address Input 3
+add_interface_port s1 avs_s1_address address Input 4
 add_interface_port s1 avs_s1_write write Input 1
 add_interface_port s1 avs_s1_writedata writedata Input 32
 add_interface_port s1 avs_s1_read read Input 1
@@ -136,6 +136,23 @@ add_interface_port gains band_3_gain band_3_gain Output 32
 add_interface_port gains band_4_gain band_4_gain Output 32
 add_interface_port gains band_5_gain band_5_gain Output 32
 
+
+# 
+# connection point sample
+# One clock pulse per audio sample (eg: data_in_left_valid of the stream), the
+# ramp steps are per pulse.  Must be connected or exported, there is no default.
+# 
+add_interface sample conduit end
+set_interface_property sample associatedClock clock
+set_interface_property sample associatedReset ""
+set_interface_property sample ENABLED true
+set_interface_property sample EXPORT_OF ""
+set_interface_property sample PORT_NAME_MAP ""
+set_interface_property sample CMSIS_SVD_VARIABLES ""
+set_interface_property sample SVD_ADDRESS_GROUP ""
+
+add_interface_port sample sample_strobe sample_strobe Input 1
+
 # +-----------------------------------
 # | Device tree generation
 # |
@@ -21,8 +21,17 @@
 #include <linux/uaccess.h>
 #include <linux/init.h>
 #include <linux/cdev.h>
+#include <linux/idr.h>
 #include <linux/regmap.h>
 #include <linux/spi/spi.h>
+#include <linux/mutex.h>
+#include <linux/slab.h>
+#include <linux/of.h>
+
+#include "fe_fixedpoint.h"
+#include "fe_spi_calibrate.h"
+#include "fe_pga2505_ioctl.h"
+#include "fe_gain_map.h"
 
 // Define information about this kernel module
 MODULE_LICENSE("GPL");
@@ -30,25 +39,45 @@ MODULE_AUTHOR("Tyler Davis <openspeech@flatearthinc.com>");
 MODULE_DESCRIPTION("Loadable kernel module for the PGA2505");
 MODULE_VERSION("1.0");
 
-// Define the number of amplifiers on the hardware
-#define NAMP 2
+// Number of amplifiers in the daisy chain when the device tree doesn't give num-amplifiers
+#define PGA2505_DEFAULT_NAMP 2
 
 // Define the number of bytes to make the command
 #define NCMD 2
 
-struct fixed_num
-{
-    int integer;
-    int fraction;
-    int fraction_len;
-};
+// Command word of one PGA2505 (one 16 bit SPI word): GPO4..GPO1 in D11..D8, the DC servo disable in D7 and the gain
+// code in D4..D0
+#define PGA2505_SERVO_DISABLE   0x0080
+#define PGA2505_GAIN_MASK       0x001F
+#define PGA2505_GPO_SHIFT       8
+
+// Amplifiers in the chain, set from the device tree at probe.  There is a single SPI chain, so only one device tree
+// node is bound at a time and a second probe fails with -EBUSY
+static unsigned int namp = PGA2505_DEFAULT_NAMP;
+static bool pga2505_bound;
+
+// Command words of the whole chain, word N goes to amplifier N and the chain is always written in one spi_write.  The
+// echo holds what the chain shifts back out during the link check.  Both are kmalloc'd in PGA2505_init so the SPI
+// controller can DMA them
+static DEFINE_MUTEX(pga2505_lock);
+static uint16_t *pga2505_cmd;
+static uint16_t *pga2505_echo;
 
 static uint8_t bits = 16;
 static uint32_t speed = 500000;
+
+// Serial port clocks tried by the link calibration, slowest first (kept under the 6.25 MHz limit of the PGA2505)
+static const uint32_t pga2505_spi_speeds[] = { 500000, 1000000, 2000000, 3125000, 5000000 };
 static struct spi_device *spi_device;
 
-static struct class *cl; // Global variable for the device class
-static dev_t dev_num;
+// Largest number of PGA2505s the driver can handle, each one gets a minor number
+#define FE_PGA2505_MAX_DEVICES 16
+
+static struct class *cl; // Global variable for the device class, shared by every PGA2505
+static dev_t dev_num;    // First device number of the region reserved for the PGA2505s
+static DEFINE_IDA(fe_PGA2505_ida); // Minor numbers in use
+
+struct fe_PGA2505_dev;
 
 // Function Prototypes
 static int PGA2505_probe(struct platform_device *pdev);
@@ -57,23 +86,50 @@ static ssize_t PGA2505_read(struct file *file, char *buffer, size_t len, loff_t
 static ssize_t PGA2505_write(struct file *file, const char *buffer, size_t len, loff_t *offset);
 static int PGA2505_open(struct inode *inode, struct file *file);
 static int PGA2505_release(struct inode *inode, struct file *file);
+static long PGA2505_ioctl(struct file *file, unsigned int cmd, unsigned long arg);
+static int PGA2505_set_gains(struct fe_PGA2505_dev *devp, const uint32_t *gains);
 static ssize_t name_show(struct device *dev, struct device_attribute *attr, char *buf);
+static ssize_t spi_speed_show(struct device *dev, struct device_attribute *attr, char *buf);
+static int PGA2505_spi_verify(struct spi_device *spi);
 
 // SPI operation prototypes
 static ssize_t volume_write(struct device *dev, struct device_attribute *attr, const char *buf, size_t count);
 static ssize_t volume_read(struct device *dev, struct device_attribute *attr, char *buf);
+static ssize_t gains_write(struct device *dev, struct device_attribute *attr, const char *buf, size_t count);
+static ssize_t gains_read(struct device *dev, struct device_attribute *attr, char *buf);
+static ssize_t num_amplifiers_show(struct device *dev, struct device_attribute *attr, char *buf);
+
+// Gains of the PGA2505 in dB: 0 dB (code 0), 9 dB (code 1) then 12 to 60 dB in 3 dB steps
+static const struct fe_gain_step pga2505_gain_steps[] =
+{
+    {.value = 0,  .code = 0},  {.value = 9,  .code = 1},  {.value = 12, .code = 2},  {.value = 15, .code = 3},
+    {.value = 18, .code = 4},  {.value = 21, .code = 5},  {.value = 24, .code = 6},  {.value = 27, .code = 7},
+    {.value = 30, .code = 8},  {.value = 33, .code = 9},  {.value = 36, .code = 10}, {.value = 39, .code = 11},
+    {.value = 42, .code = 12}, {.value = 45, .code = 13}, {.value = 48, .code = 14}, {.value = 51, .code = 15},
+    {.value = 54, .code = 16}, {.value = 57, .code = 17}, {.value = 60, .code = 18},
+};
+
+static const struct fe_gain_map_desc pga2505_gain_desc =
+{
+    .num_codes = ARRAY_SIZE(pga2505_gain_steps),
+    .steps = pga2505_gain_steps,
+    .scale = 1,
+};
+
+static struct fe_gain_map pga2505_gain_map;
 
 // Custom function declarations
-char *strcat2(char *dst, char *src);
-uint32_t set_fixed_num(const char *s);
-int fp_to_string(char *buf, uint32_t fp28_num);
 uint8_t find_volume_level(uint32_t fp28_num);
 uint32_t decode_volume(uint8_t code);
 uint8_t encode_gpio(uint8_t code);
-void fill_cmd_array(char *cmd, uint8_t code, uint8_t defreg);
+void fill_cmd_array(uint16_t *cmd, const uint8_t *codes, uint8_t gpio, uint16_t defreg);
 
 //Create the attributes that show up in /sys/class
 static DEVICE_ATTR(volume,          0664, volume_read,          volume_write);
+static DEVICE_ATTR(gains,           0664, gains_read,           gains_write);
+static DEVICE_ATTR(num_amplifiers,  0444, num_amplifiers_show,  NULL);
+
+static DEVICE_ATTR(spi_speed,       0444, spi_speed_show,       NULL);
 
 static DEVICE_ATTR(name, 0444, name_show, NULL);
 
@@ -84,9 +140,11 @@ static DEVICE_ATTR(name, 0444, name_show, NULL);
 struct fe_PGA2505_dev
 {
     struct cdev cdev;           ///< The driver structure containing major/minor, etc
+    dev_t devt;                 ///< Device number of this PGA2505
     char *name;                 ///< This gets the name of the device when loading the driver
     void __iomem *regs;         ///< Pointer to the registers on the device
-    uint32_t volume;
+    uint32_t volume;            ///< Last gain given to every amplifier through volume, as unsigned Q16 dB
+    uint32_t gain[FE_PGA2505_MAX_AMPS];     ///< Gain of each amplifier as unsigned Q16 dB
 };
 
 
@@ -126,6 +184,7 @@ static const struct file_operations fe_PGA2505_fops =
     .write = PGA2505_write,             ///< Write the device contents for the entry in /dev
     .open = PGA2505_open,               ///< Called when the device is opened
     .release = PGA2505_release,         ///< Called when the device is closes
+    .unlocked_ioctl = PGA2505_ioctl,    ///< Gains of the chain, see fe_pga2505_ioctl.h
 };
 
 
@@ -139,31 +198,45 @@ static const struct file_operations fe_PGA2505_fops =
 static int PGA2505_init(void)
 {
     int ret_val = 0;
-    int i = 0;
 
     // Add the spi master
     struct spi_master *master;
 
-    // Initialize the command array, disable all servos, zero crossing, and over range detection
-    char cmd[NAMP*NCMD];
-    
-    for (i = 0; i < NAMP*NCMD; i++)
-      cmd[i] = 0x00;
-    
-    uint8_t def_config = 0x80;
-    uint8_t code = 0x00;
+    char className[24];
     
 
     pr_info("Initializing the Audio Logic PGA2505 module\n");
 
-    // Register our driver with the "Platform Driver" bus
-    ret_val = platform_driver_register(&PGA2505_platform);
+    ret_val = fe_gain_map_init(&pga2505_gain_map, &pga2505_gain_desc);
     if (ret_val != 0)
     {
-        pr_err("platform_driver_register returned %d\n", ret_val);
+        pr_err("fe_gain_map_init returned %d\n", ret_val);
         return ret_val;
     }
 
+    //SPI buffers of the chain, the command words followed by the echo
+    pga2505_cmd = kcalloc(2 * FE_PGA2505_MAX_AMPS, sizeof(*pga2505_cmd), GFP_KERNEL);
+    if (pga2505_cmd == NULL)
+        return -ENOMEM;
+    pga2505_echo = pga2505_cmd + FE_PGA2505_MAX_AMPS;
+
+    //Reserve a Major number and enough Minor numbers for every PGA2505 in the system
+    ret_val = alloc_chrdev_region(&dev_num, 0, FE_PGA2505_MAX_DEVICES, "fe_PGA2505_");
+    if (ret_val != 0)
+    {
+        pr_err("alloc_chrdev_region returned %d\n", ret_val);
+        goto bad_alloc_chrdev_region;
+    }
+
+    //One class for all the PGA2505s, named after the Major number like the per device classes used to be
+    sprintf(className, "fe_PGA2505_%d", MAJOR(dev_num));
+    cl = class_create(THIS_MODULE, className);
+    if (IS_ERR(cl))
+    {
+        ret_val = PTR_ERR(cl);
+        goto bad_class_create;
+    }
+
     // Register the device
     struct spi_board_info spi_device_info = {
         .modalias = "fe_PGA2505_",
@@ -178,7 +251,8 @@ static int PGA2505_init(void)
     master = spi_busnum_to_master( spi_device_info.bus_num );
     if( !master ){
         printk("MASTER not found.\n");
-            return -ENODEV;
+        ret_val = -ENODEV;
+        goto bad_spi;
     }
 
     // create a new slave device, given the master and device info
@@ -187,7 +261,8 @@ static int PGA2505_init(void)
     printk("Setting up new slave device\n");
     if( !spi_device ) {
         printk("FAILED to create slave.\n");
-        return -ENODEV;
+        ret_val = -ENODEV;
+        goto bad_spi;
     }
 
     printk("Setting the bits per word\n");
@@ -199,18 +274,39 @@ static int PGA2505_init(void)
     if( ret_val ){
         printk("FAILED to setup slave.\n");
         spi_unregister_device( spi_device );
-        return -ENODEV;
+        spi_device = NULL;
+        ret_val = -ENODEV;
+        goto bad_spi;
     }
 
-    printk("Sending SPI initialization commands...\n");
-
-    // Set the gain to 0 dB
-    fill_cmd_array(cmd,encode_gpio(code),def_config);
-    ret_val = spi_write(spi_device,&cmd, sizeof(cmd));
+    // Register our driver with the "Platform Driver" bus, the chain is calibrated and set up in probe once its length
+    // is known from the device tree
+    ret_val = platform_driver_register(&PGA2505_platform);
+    if (ret_val != 0)
+    {
+        pr_err("platform_driver_register returned %d\n", ret_val);
+        goto bad_platform_driver_register;
+    }
 
     pr_info("Audio Logic PGA2505 module successfully initialized!\n");
 
     return 0;
+
+bad_platform_driver_register:
+    spi_unregister_device(spi_device);
+    spi_device = NULL;
+
+bad_spi:
+    class_destroy(cl);
+
+bad_class_create:
+    unregister_chrdev_region(dev_num, FE_PGA2505_MAX_DEVICES);
+
+bad_alloc_chrdev_region:
+    kfree(pga2505_cmd);
+    pga2505_cmd = NULL;
+
+    return ret_val;
 }
 
 
@@ -227,17 +323,42 @@ static int PGA2505_probe(struct platform_device *pdev)
 {
     int ret_val = -EBUSY;
 
-    char deviceName[20] = "fe_PGA2505_";
-    char deviceMinor[20];
+    char deviceName[24];
+    int minor;
     int status;
+    u32 num_amps = PGA2505_DEFAULT_NAMP;
 
     struct device *deviceObj;
     fe_PGA2505_dev_t *fe_PGA2505_devp;
 
     pr_info("PGA2505_probe enter\n");
 
+    //Length of the daisy chain
+    of_property_read_u32(pdev->dev.of_node, "num-amplifiers", &num_amps);
+    if (num_amps < 1 || num_amps > FE_PGA2505_MAX_AMPS)
+    {
+        pr_err("num-amplifiers is %u, it has to be 1 to %d\n", num_amps, FE_PGA2505_MAX_AMPS);
+        return -EINVAL;
+    }
+
+    //Claim the chain, a second node would resize and reconfigure the amplifiers of the first one
+    mutex_lock(&pga2505_lock);
+    if (pga2505_bound)
+    {
+        mutex_unlock(&pga2505_lock);
+        pr_err("%s: the PGA2505 chain is already bound, only one num-amplifiers node is supported\n", pdev->name);
+        return -EBUSY;
+    }
+    pga2505_bound = true;
+    mutex_unlock(&pga2505_lock);
+
     // Create structure to hold device-specific information (like the registers). Make size of &pdev->dev + sizeof(struct(fe_PGA2505_dev)).
     fe_PGA2505_devp = devm_kzalloc(&pdev->dev, sizeof(fe_PGA2505_dev_t), GFP_KERNEL);
+    if (fe_PGA2505_devp == NULL)
+    {
+        ret_val = -ENOMEM;
+        goto bad_mem_alloc;
+    }
 
     // Give a pointer to the instance-specific data to the generic platform_device structure
     // so we can access this data later on (for instance, in the read and write functions)
@@ -252,37 +373,51 @@ static int PGA2505_probe(struct platform_device *pdev)
     strcpy(fe_PGA2505_devp->name, (char *)pdev->name);
     pr_info("%s\n", (char *)pdev->name);
 
-    //Request a Major/Minor number for the driver
-    status = alloc_chrdev_region(&dev_num, 0, 1, "fe_PGA2505_");
-    if (status != 0)
-        goto bad_alloc_chrdev_region;
+    //Take the lowest free Minor number from the region reserved in PGA2505_init
+    minor = ida_alloc_max(&fe_PGA2505_ida, FE_PGA2505_MAX_DEVICES - 1, GFP_KERNEL);
+    if (minor < 0)
+    {
+        pr_err("No free minor numbers, only %d PGA2505s are supported\n", FE_PGA2505_MAX_DEVICES);
+        ret_val = minor;
+        goto bad_ida_alloc;
+    }
+    fe_PGA2505_devp->devt = MKDEV(MAJOR(dev_num), minor);
 
-    //Create the device name with the information reserved above
-    sprintf(deviceMinor, "%d", MAJOR(dev_num));
-    strcat(deviceName, deviceMinor);
+    //Create the device name, the first PGA2505 keeps the fe_PGA2505_NNN name so existing scripts still find it
+    if (minor == 0)
+        sprintf(deviceName, "fe_PGA2505_%d", MAJOR(dev_num));
+    else
+        sprintf(deviceName, "fe_PGA2505_%d_%d", MAJOR(dev_num), minor);
     pr_info("%s\n", deviceName);
 
-    //Create sysfs entries
-    cl = class_create(THIS_MODULE, deviceName);
-    if (cl == NULL)
-        goto bad_class_create;
-
     //Initialize a char dev structure
     cdev_init(&fe_PGA2505_devp->cdev, &fe_PGA2505_fops);
 
     //Registers the char driver with the kernel
-    status = cdev_add(&fe_PGA2505_devp->cdev, dev_num, 1);
+    status = cdev_add(&fe_PGA2505_devp->cdev, fe_PGA2505_devp->devt, 1);
     if (status != 0)
         goto bad_cdev_add;
 
     //Creates the device entries in sysfs
-    deviceObj = device_create(cl, NULL, dev_num, NULL, deviceName);
-    if (deviceObj == NULL)
+    deviceObj = device_create(cl, NULL, fe_PGA2505_devp->devt, NULL, deviceName);
+    if (IS_ERR(deviceObj))
         goto bad_device_create;
 
     //Put a pointer to the fe_fir_dev struct that is created into the driver object so it can be accessed uniquely from elsewhere
     dev_set_drvdata(deviceObj, fe_PGA2505_devp);
 
+    //Run the serial port as fast as the chain reliably goes, the link check needs the length of the chain
+    mutex_lock(&pga2505_lock);
+    namp = num_amps;
+    speed = fe_spi_calibrate(spi_device, pga2505_spi_speeds, ARRAY_SIZE(pga2505_spi_speeds), PGA2505_spi_verify);
+    mutex_unlock(&pga2505_lock);
+    pr_info("%u PGA2505s, SPI clock set to %u Hz\n", num_amps, speed);
+
+    //Set every amplifier to 0 dB (the gains are already zeroed)
+    status = PGA2505_set_gains(fe_PGA2505_devp, fe_PGA2505_devp->gain);
+    if (status)
+        pr_err("Setting the PGA2505 gains failed (%d)\n", status);
+
     //---------------------------------------------------------
     status = device_create_file(deviceObj, &dev_attr_volume);
     if (status)
@@ -293,27 +428,52 @@ static int PGA2505_probe(struct platform_device *pdev)
     if (status)
         goto bad_device_create_file_2;
 
+    //---------------------------------------------------------
+    status = device_create_file(deviceObj, &dev_attr_spi_speed);
+    if (status)
+        goto bad_device_create_file_3;
+
+    //---------------------------------------------------------
+    status = device_create_file(deviceObj, &dev_attr_gains);
+    if (status)
+        goto bad_device_create_file_4;
+
+    //---------------------------------------------------------
+    status = device_create_file(deviceObj, &dev_attr_num_amplifiers);
+    if (status)
+        goto bad_device_create_file_5;
+
     pr_info("PGA2505_probe exit\n");
 
     return 0;
 
+  bad_device_create_file_5:
+      device_remove_file(deviceObj, &dev_attr_num_amplifiers);
+
+  bad_device_create_file_4:
+      device_remove_file(deviceObj, &dev_attr_gains);
+
+  bad_device_create_file_3:
+      device_remove_file(deviceObj, &dev_attr_spi_speed);
+
   bad_device_create_file_2:
       device_remove_file(deviceObj, &dev_attr_name);
 
   bad_device_create_file_1:
       device_remove_file(deviceObj, &dev_attr_volume);
+      device_destroy(cl, fe_PGA2505_devp->devt);
 
   bad_device_create:
       cdev_del(&fe_PGA2505_devp->cdev);
 
   bad_cdev_add:
-      class_destroy(cl);
-
-  bad_class_create:
-      unregister_chrdev_region(dev_num, 1);
+      ida_free(&fe_PGA2505_ida, minor);
 
-  bad_alloc_chrdev_region:
+  bad_ida_alloc:
   bad_mem_alloc:
+      mutex_lock(&pga2505_lock);
+      pga2505_bound = false;
+      mutex_unlock(&pga2505_lock);
 
     return ret_val;
 }
@@ -336,9 +496,6 @@ static int PGA2505_open(struct inode *inode, struct file *file)
     devp = container_of(inode->i_cdev, fe_PGA2505_dev_t, cdev);
     file->private_data = devp;
 
-    //Instantiate default values for the codec
-    devp->volume       = 0;
-
     return 0;
 }
 
@@ -359,6 +516,50 @@ static int PGA2505_release(struct inode *inode, struct file *file)
 
 
 
+/** Gets or sets the gains of the whole chain, see fe_pga2505_ioctl.h
+
+    @param file Pointer to the file of the PGA2505 chain
+    @param cmd FE_PGA2505_IOC_GET_GAINS or FE_PGA2505_IOC_SET_GAINS
+    @param arg Userspace pointer to a struct fe_pga2505_gains
+    @returns SUCCESS, -ENOTTY for an unknown command or the error of the command
+*/
+static long PGA2505_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
+{
+    struct fe_pga2505_gains gains;
+
+    fe_PGA2505_dev_t *devp = (fe_PGA2505_dev_t *)file->private_data;
+
+    switch (cmd)
+    {
+        case FE_PGA2505_IOC_GET_GAINS:
+            memset(&gains, 0, sizeof(gains));
+
+            mutex_lock(&pga2505_lock);
+            gains.num_amps = namp;
+            memcpy(gains.gains, devp->gain, namp * sizeof(gains.gains[0]));
+            mutex_unlock(&pga2505_lock);
+
+            if (copy_to_user((void __user *)arg, &gains, sizeof(gains)))
+                return -EFAULT;
+
+            return 0;
+
+        case FE_PGA2505_IOC_SET_GAINS:
+            if (copy_from_user(&gains, (void __user *)arg, sizeof(gains)))
+                return -EFAULT;
+
+            if (gains.reserved || gains.num_amps != namp)
+                return -EINVAL;
+
+            return PGA2505_set_gains(devp, gains.gains);
+
+        default:
+            return -ENOTTY;
+    }
+}
+
+
+
 /** Read the contents of the coefficients stucture
 
     This function will read the contents of the coefficient memory as stored in the shadow register and return then
@@ -415,11 +616,19 @@ static int PGA2505_remove(struct platform_device *pdev)
 
     pr_info("PGA2505_remove enter\n");
 
+    // Remove the sysfs entries (and their attributes) of this PGA2505
+    device_destroy(cl, dev->devt);
+
     // Unregister the character file (remove it from /dev)
     cdev_del(&dev->cdev);
 
-    //Tell the os that the major/minor pair is avalible again
-    unregister_chrdev_region(dev_num, 2);
+    //Tell the os that the minor number is avalible again, the region is released in PGA2505_exit
+    ida_free(&fe_PGA2505_ida, MINOR(dev->devt));
+
+    //The chain can be bound again
+    mutex_lock(&pga2505_lock);
+    pga2505_bound = false;
+    mutex_unlock(&pga2505_lock);
 
     pr_info("PGA2505_remove exit\n");
 
@@ -441,6 +650,12 @@ static void PGA2505_exit(void)
         spi_unregister_device( spi_device );
     }
 
+    // Every PGA2505 is gone, release the class and the device numbers
+    class_destroy(cl);
+    unregister_chrdev_region(dev_num, FE_PGA2505_MAX_DEVICES);
+    ida_destroy(&fe_PGA2505_ida);
+    kfree(pga2505_cmd);
+
     pr_info("Audio Logic PGA2505 module successfully unregistered\n");
 }
 
@@ -464,329 +679,195 @@ static ssize_t name_show(struct device *dev, struct device_attribute *attr, char
     return strlen(buf);
 }
 
-static ssize_t volume_write(struct device *dev, struct device_attribute *attr, const char *buf, size_t count)
-{
-    // Initialize some variables
-    uint32_t tempValue = 0;
-    char substring[80];
-    int substring_count = 0;
-    int i;
-    int ret_val;
-    
-    uint8_t def_config = 0x80;
-    uint8_t code = 0x00;
-
-    char cmd[NAMP * NCMD];
-    
-    for (i = 0; i < NAMP*NCMD; i++)
-      cmd[i] = 0x00;
-    
-
-    // Create a new instance of the PGA
-    fe_PGA2505_dev_t *devp = (fe_PGA2505_dev_t *)dev_get_drvdata(dev);
-
-    for (i = 0; i < count; i++)
-    {
-        //If its not a space or a comma, add the digit to the substring
-        if ((buf[i] != ',') && (buf[i] != ' ') && (buf[i] != '\0') && (buf[i] != '\r') && (buf[i] != '\n'))
-        {
-            substring[substring_count] = buf[i];
-            substring_count++;
-        }
-    }
-
-    substring[substring_count] = '\0';
-    tempValue = set_fixed_num(substring);
+/** Function to display the SPI clock chosen by the link calibration
 
-    // Determine the code for the volume level
-    code = find_volume_level(tempValue);
-
-    // Determine the closest volume level
-    tempValue = decode_volume(code);
-
-    // Record the volume level to the volume variable
-    devp->volume = tempValue;
-
-    // Populate the SPI command and send it
-    fill_cmd_array(cmd,encode_gpio(code),def_config);
-    ret_val = spi_write(spi_device,&cmd, sizeof(cmd));
-
-    return count;
-}
-static ssize_t volume_read(struct device *dev, struct device_attribute *attr, char *buf)
+    @param dev
+    @param attr
+    @param buf charactor buffer for the sysfs return
+    @returns Length of the buffer
+*/
+static ssize_t spi_speed_show(struct device *dev, struct device_attribute *attr, char *buf)
 {
-    fe_PGA2505_dev_t *devp = (fe_PGA2505_dev_t *)dev_get_drvdata(dev);
-
-    fp_to_string(buf, devp->volume);
-
-    strcat2(buf, "\n");
-
-    //Return the length of the buffer so it will print in the console
-    return strlen(buf);
+    return sprintf(buf, "%u\n", speed);
 }
 
-char *strcat2(char *dst, char *src)
-{
-    char *cp = dst;
-
-    while (*cp)
-        cp++; /* find end of dst */
-
-    while (( *cp++ = *src++ ) != 0); /* Copy src to end of dst */
+/** Link check of the SPI calibration
 
-    return dst; /* return dst */
-}
-
-/** Convert a string to a fixed point number structure
-    @param s String containing the string to convert to 32F16 representation
-    @return SUCCESS
+    The PGA2505s are write only, but the serial output of the chain shifts out the previous command while a new one
+    is shifted in.  A few different GPIO settings (all used by volume_write) are sent back to back and each one has to
+    come back out with the next.  The initialization command overwrites the last one once the rate is chosen.  The
+    commands and the echo go through the kmalloc'd chain buffers, the stack can't be used for SPI DMA.  The caller
+    holds pga2505_lock.
 
-    @todo This function is really ugly and could be cleaned up to make it clear what is happening....
+    @param spi SPI device of the PGA2505 chain
+    @returns 0 when every command came back, -EIO on a mismatch or the SPI error
 */
-uint32_t set_fixed_num(const char *s)
+static int PGA2505_spi_verify(struct spi_device *spi)
 {
-    struct fixed_num num = {0, 0, 0};
-    int seen_point = 0;
-    int pointIndex;
+    static const uint8_t gpio_codes[] = { 0xBF, 0xA0, 0xBB, 0x80, 0xB3 };
+    static const uint8_t codes[FE_PGA2505_MAX_AMPS];
+    uint16_t prev[FE_PGA2505_MAX_AMPS];
+    struct spi_transfer xfer = {
+        .tx_buf = pga2505_cmd,
+        .rx_buf = pga2505_echo,
+        .len = namp * NCMD,
+    };
+    int status;
     int i;
-    int ii;
-    int frac_comp;
-    uint32_t acc = 0;
-    char s2[80];
-    int pointsSeen = 0;
-    int charIndex = 0;
-
-    //If no leading 0, add one (eg: .25 -> 0.25)
-    if (s[0] == '.')
-    {
-        s2[0] = '0';
-        charIndex++;
-    }
 
-    //This is a strcpy() to move the data a "const char *" to a "char *" and validate the data
-    for (i = 0; i < strlen(s); i++)
+    for (i = 0; i < ARRAY_SIZE(gpio_codes); i++)
     {
-        //Make sure the string contains an non-valid char (eg: not a number or a decimal point)
-        if ((s[i] == '.') || (s[i] >= '0' && s[i] <= '9'))
-        {
-            //Copy the data over and increment the pointer
-            s2[charIndex] = s[i];
-            charIndex++;
-        }
-        else
-        {
-            pr_info("Invalid char (c:%c x:%X) in number %s\n", s[i], s[i], s);
-            return 0x00000000;
-        }
-
-        //Count the number of decimals in the string
-        if (s[i] == '.')
-            pointsSeen++;
-    }
+        // Same configuration as the initialization command, the whole chain has to be shifted for the echo
+        fill_cmd_array(pga2505_cmd, codes, gpio_codes[i], PGA2505_SERVO_DISABLE);
 
-    //If multiple decimals points in the number (eg: 1.1.4)
-    if (pointsSeen > 1)
-        pr_info("Invalid number format: %s\n", s);
-
-    //Turn 1 into 1.0
-    //if (pointsSeen == 0)
-    // {
-    //    printk("Adding the decimal...\n");
-    //    s2[i] = char(".");
-    //    s2[i+1] = char("0");
-    //    //strcat2(".0",s2);
-    //    i=i+2;
-    // }
-    //Make sure the string is terminated
-    s2[i] = '\0';
-
-    //Count the fractional digits
-    for (pointIndex = 0; pointIndex < strlen(s2); pointIndex++)
-    {
-        if (s2[pointIndex] == '.')
-            break;
+        status = spi_sync_transfer(spi, &xfer, 1);
+        if (status)
+            return status;
+
+        if (i > 0 && memcmp(pga2505_echo, prev, namp * NCMD))
+            return -EIO;
+
+        memcpy(prev, pga2505_cmd, namp * NCMD);
     }
 
-    //String extend so that the output is accurate
-    while (strlen(s2) - pointIndex < 9)
-        strcat2(s2, "0");
+    return 0;
+}
+
+/** Sets the gain of every amplifier in the chain with a single spi_write
 
-    //Truncate the string if its longer
-    s2[strlen(s2) - pointIndex + 9] = '\0';
+    The gain LEDs show the highest gain of the chain.
 
-    //Covert to fixed point
-    for (i = 0; i < 10; i++)
-    {
-        if (s2[i] == '.')
-        {
-            seen_point = 1;
-            continue;
-        }
-        if (!seen_point)
-        {
-            num.integer *= 10;
-            num.integer += (int)(s2[i] - '0');
-        }
-        else
-        {
-            num.fraction_len++;
-            num.fraction *= 10;
-            num.fraction += (int)(s2[i] - '0');
-        }
-    }
+    @param devp PGA2505 chain
+    @param gains Gain of each amplifier in dB as unsigned Q16, namp entries
+    @returns SUCCESS or the SPI error
+*/
+static int PGA2505_set_gains(fe_PGA2505_dev_t *devp, const uint32_t *gains)
+{
+    uint8_t codes[FE_PGA2505_MAX_AMPS];
+    uint8_t top = 0;
+    unsigned int i;
+    int status;
 
-    //Turn the fixed point conversion into binary digits
-    for (ii = 0, frac_comp = 1; ii < num.fraction_len; ii++) frac_comp *= 10;
-    frac_comp /= 2;
+    mutex_lock(&pga2505_lock);
 
-    // Get the fractional part (f28 hopefully)
-    for (ii = 0; i <= 36; i++)
+    for (i = 0; i < namp; i++)
     {
-        if (num.fraction >= frac_comp)
-        {
-            acc |= 0x00000001;
-            num.fraction -= frac_comp;
-        }
-        frac_comp /= 2;
-
-        acc = acc << 1;
+        codes[i] = find_volume_level(gains[i]);
+        if (codes[i] > top)
+            top = codes[i];
     }
 
-    acc = acc >> 12;
+    // Populate the SPI commands of the whole chain and send them
+    fill_cmd_array(pga2505_cmd, codes, encode_gpio(top), PGA2505_SERVO_DISABLE);
+    status = spi_write(spi_device, pga2505_cmd, namp * NCMD);
 
-    //Combine the fractional part with the integer
-    acc += num.integer << 16;
+    // Record the closest gain levels
+    if (status == 0)
+        for (i = 0; i < namp; i++)
+            devp->gain[i] = decode_volume(codes[i]);
 
-    return acc;
+    mutex_unlock(&pga2505_lock);
+
+    return status;
 }
 
-/** Function to convert a fp16 to a string representation
-    @todo doesn't handle negative numbers
-*/
-int fp_to_string(char *buf, uint32_t fp28_num)
+/** Sets every amplifier of the chain to the same gain */
+static ssize_t volume_write(struct device *dev, struct device_attribute *attr, const char *buf, size_t count)
 {
-    int buf_pos = 0;
+    uint32_t gains[FE_PGA2505_MAX_AMPS];
+    uint32_t tempValue = 0;
+    int status;
     int i;
-    int fractionPart;
-    //int isNegative = 0;
-    int intPart = 1;
-    int i16 = 0;
 
-    if (fp28_num & 0x80000000)
-    {
-        fp28_num *= -1;
+    fe_PGA2505_dev_t *devp = (fe_PGA2505_dev_t *)dev_get_drvdata(dev);
 
-        buf[buf_pos] = '-';
-        buf_pos++;
-    }
+    //Convert the buffer to a fixed point value, negative gains are rejected since the PGA only amplifies
+    status = fe_fixed_from_string(buf, count, FE_UQ16, &tempValue);
+    if (status)
+        return status;
 
-    //Convert the integer part
-    i16 = (fp28_num >> 16);
-    while ( (i16 / intPart) > 9)
-    {
-        intPart *= 10;
-    }
+    for (i = 0; i < FE_PGA2505_MAX_AMPS; i++)
+        gains[i] = tempValue;
 
-    while (intPart > 0)
-    {
-        buf[buf_pos] = (char)((i16 / intPart) + '0');
-        buf_pos++;
+    status = PGA2505_set_gains(devp, gains);
+    if (status)
+        return status;
 
-        i16 = i16 % intPart;
-        intPart = intPart / 10;
-    }
+    // Record the closest volume level
+    devp->volume = decode_volume(find_volume_level(tempValue));
+
+    return count;
+}
+static ssize_t volume_read(struct device *dev, struct device_attribute *attr, char *buf)
+{
+    fe_PGA2505_dev_t *devp = (fe_PGA2505_dev_t *)dev_get_drvdata(dev);
+
+    //Copy the value into the output buffer and return its length so it will print in the console
+    return fe_fixed_show(buf, devp->volume, FE_SQ16);
+}
 
-    //buf[buf_pos] = (char)((fp28_num>>16) + '0');
-    //buf_pos++;
+/** Sets the gain of each amplifier, one value per amplifier of the chain in chain order */
+static ssize_t gains_write(struct device *dev, struct device_attribute *attr, const char *buf, size_t count)
+{
+    uint32_t gains[FE_PGA2505_MAX_AMPS];
+    int num_gains;
+    int status;
 
-    buf[buf_pos] = '.';
-    buf_pos++;
+    fe_PGA2505_dev_t *devp = (fe_PGA2505_dev_t *)dev_get_drvdata(dev);
 
-    //Mask the integer bits and dump 1 bit to make the conversion easier....
-    fractionPart = (0x0000FFFF & fp28_num) >> 1; // 32F27 so that 0-9 can fit in the high 5 bits)
+    //Convert the buffer to one fixed point value per amplifier, nothing is written unless every amplifier is given
+    num_gains = fe_fixed_parse_vector(buf, count, FE_UQ16, gains, FE_PGA2505_MAX_AMPS);
+    if (num_gains < 0)
+        return num_gains;
+    if (num_gains != namp)
+        return -EINVAL;
 
-    for (i = 0; i < 8; i++)
-    {
-        fractionPart *= 10;
-        buf[buf_pos] = (fractionPart >> 15) + '0';
-        buf_pos++;
-        fractionPart &= 0x00007FFF;
-    }
+    status = PGA2505_set_gains(devp, gains);
+    if (status)
+        return status;
 
-    buf[buf_pos] = '\0';
+    return count;
+}
+static ssize_t gains_read(struct device *dev, struct device_attribute *attr, char *buf)
+{
+    fe_PGA2505_dev_t *devp = (fe_PGA2505_dev_t *)dev_get_drvdata(dev);
 
-    return 0;
+    //Copy the values into the output buffer and return its length so it will print in the console
+    return fe_fixed_show_vector(buf, devp->gain, namp, FE_SQ16);
 }
 
-/** Converts a 32 bit integer into an 8 bit volume level
-    @param fp28_num 32 bit representation of a fixed point number
-    @return volume_level an 8 bit representation of the attenuation
+/** Function to display the length of the daisy chain */
+static ssize_t num_amplifiers_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+    return sprintf(buf, "%u\n", namp);
+}
+
+/** Finds the gain code nearest to a gain
+    @param fp28_num Gain in dB as an unsigned Q16 fixed point word, gains above 60 dB give the 60 dB code
+    @return Gain code of the PGA2505
 */
 uint8_t find_volume_level(uint32_t fp28_num)
 {
-  // Initialize the volume level
-  uint8_t volume_level = 0;
-
-  // Divide the input number by the reciprocal of the step size
-  uint32_t inputnum = (fp28_num*10)/3;
-
-  // Find the integer portion and the tenths portion
-  // (Steps are in 3/8 increments so only that position is needed)
-  uint16_t upperval = (uint16_t)((inputnum)>>16)/10;
-  uint16_t lowerval = inputnum-upperval*10;
-
-  // Catch whether the user exceeded the maximum attenuation
-  // This number includes the 6 dB offset (2)
-  if (upperval > 20)
-  {
-    // Set the upper value to the 60 dB code (18 is the start)
-    upperval = 18;
-    lowerval = 0;
-    printk("Input exceeds the maximum amplification of 60 dB.\n");
-    printk("Setting amplification to 60 dB.\n");
-  }
-  // If the input is less than one step below the minimum attenuation,
-  // set the code to zero
-  else if (upperval < 2)
-  {
-    upperval = 0;
-    lowerval = 0;
-    printk("Input is below minimum amplification of 6 dB.\n");
-    printk("Setting amplification to 9 dB.\n");
-  }
-  // Otherwise, the gain is between 9 and 60 dB
-  else
-    upperval = upperval - 2; // Subtract the 6 dB offset
-
-  // Set the volume level to the integer portion
-  volume_level = (uint8_t)(upperval);
-
-  // If the tenths portion is greater than five, round up
-  if (lowerval > 5)
-    volume_level += 1;
+    // Gains above the Q16 range of the map are above 60 dB anyway
+    if (fp28_num > INT_MAX)
+        fp28_num = INT_MAX;
 
-  return volume_level;
+    return fe_gain_map_code(&pga2505_gain_map, fp28_num);
 }
 
-/** Converts an 8 bit volume level representation to a 32 bit fixed point 28 number
-    @param volume_level an 8 bit representation of the attenuation
-    @return fp28_num 32 bit representation of a fixed point number
+/** Converts a gain code to its gain
+    @param code Gain code of the PGA2505
+    @return Gain in dB as an unsigned Q16 fixed point word, 0 for codes that aren't gains
 */
 uint32_t decode_volume(uint8_t code)
 {
+    int32_t value = 0;
 
-  uint32_t decodedDb;
-  // Cast the volume level to a 32 bit number
-  if (code > 1)
-    decodedDb = (uint32_t)code*3+6;
-  else
-    decodedDb = 0;
+    fe_gain_map_decode(&pga2505_gain_map, code, &value);
 
-  // Return the shifted and scaled number to keep with convention
-  return (decodedDb<<16);
+    return value;
 }
 
-
 /** Converts an 8 bit volume level representation to a 6 bit LED code.  This code is
     tied to the hardware configuration of the AD1939 Expansion card for the Audio 
     Blade.  The mapping of GPIO to LEDs is as follows:
@@ -822,21 +903,23 @@ uint8_t encode_gpio(uint8_t code)
 /** Custom function to fill the command array to map the custom GPIO behaviors.
     This function should be overwritten for other designs.
 
-   @param code an 8 bit integer representing the GPIO configuration
-   @param defreg an 8 bit integer representing the default configuration of the PGA2505
+   @param cmd Command words of the chain, one per amplifier
+   @param codes Gain code of each amplifier
+   @param gpio an 8 bit integer representing the GPIO configuration, the LEDs hang off the first two amplifiers
+   @param defreg the default configuration of the PGA2505
 */
-void fill_cmd_array(char* cmd, uint8_t code,uint8_t defreg)
+void fill_cmd_array(uint16_t *cmd, const uint8_t *codes, uint8_t gpio, uint16_t defreg)
 {
-    int i;
+    unsigned int i;
     uint8_t bitmask = 0x0F;
-    
 
-    // Set the default configuration for all PGA2505s in the chain
-    for (i=0; i < NAMP; i++)
-      cmd[i*NCMD] = cmd[i*NCMD] | defreg;
-    
-    cmd[1] = cmd[1] | (bitmask & code);
-    cmd[3] = cmd[3] | code>>4;
+    // Set the default configuration and the gain of every PGA2505 in the chain
+    for (i = 0; i < namp; i++)
+      cmd[i] = defreg | (codes[i] & PGA2505_GAIN_MASK);
+
+    cmd[0] |= (uint16_t)(bitmask & gpio) << PGA2505_GPO_SHIFT;
+    if (namp > 1)
+      cmd[1] |= (uint16_t)(gpio >> 4) << PGA2505_GPO_SHIFT;
 }
 
 /** Tell the kernel what the initialization function is */
@@ -10,10 +10,24 @@
 -- Tool versions: 
 -- Description: 
 --
+--                  Each band has a ramp engine so a fade is one register write instead of
+--                  a stream of intermediate gains.  The band gain registers ("0000"-"0100")
+--                  hold the target gain and the ramp step registers ("1000"-"1100") hold
+--                  how far the gain moves towards its target on every sample_strobe (unsigned
+--                  W32F16).
+--                  sample_strobe has to be a one clock pulse per audio sample, eg: the
+--                  left valid of the stream the gains are applied to.  It has no default:
+--                  left open the step would no longer be per sample (tied to '1') or the
+--                  ramps would never move (tied to '0').
+--                  A step of 0 (the reset value) jumps straight to the target, which is the
+--                  original behaviour.  The ramp status register ("0101") has bit n set
+--                  while band n+1 is still moving.
+--
 -- Dependencies: 
 --
 -- Revision: 
 -- Revision 0.01 - File Created
+-- Revision 0.02 - Per band gain ramping
 -- Additional Comments: 
 --
 ----------------------------------------------------------------------------------
@@ -35,11 +49,17 @@ entity FE_Qsys_HA_Gain_Control is
         band_3_gain             : out std_logic_vector(31 downto 0);
         band_4_gain             : out std_logic_vector(31 downto 0);
         band_5_gain             : out std_logic_vector(31 downto 0);
+
+        ------------------------------------------------------------
+        -- Sample rate strobe, the ramps move one step per strobe.
+        -- Required, connect it to the valid of the audio stream.
+        ------------------------------------------------------------
+        sample_strobe           : in  std_logic;
                 
         ------------------------------------------------------------
         -- Avalon Memory Mapped Slave Signals
         ------------------------------------------------------------
-        avs_s1_address 	        : in  std_logic_vector( 2 downto 0);   --! Avalon MM Slave address
+        avs_s1_address 	        : in  std_logic_vector( 3 downto 0);   --! Avalon MM Slave address
         avs_s1_write 		    : in  std_logic;                       --! Avalon MM Slave write
         avs_s1_writedata 	    : in  std_logic_vector(31 downto 0);   --! Avalon MM Slave write data
         avs_s1_read 		    : in  std_logic;                       --! Avalon MM Slave read
@@ -50,11 +70,14 @@ end FE_Qsys_HA_Gain_Control;
 
 architecture behavior of FE_Qsys_HA_Gain_Control is
 
-    signal band_1_gain_int    :  std_logic_vector(31 downto 0);
-    signal band_2_gain_int    :  std_logic_vector(31 downto 0);
-    signal band_3_gain_int    :  std_logic_vector(31 downto 0);
-    signal band_4_gain_int    :  std_logic_vector(31 downto 0);
-    signal band_5_gain_int    :  std_logic_vector(31 downto 0);
+    constant NUM_BANDS        : integer := 5;
+
+    type gain_array is array (0 to NUM_BANDS-1) of signed(31 downto 0);
+
+    signal target_gain        : gain_array;   -- Written by the HPS
+    signal ramp_step          : gain_array;   -- Amount the gain moves per sample, 0 to jump
+    signal current_gain       : gain_array;   -- Gain sent to the bands
+    signal ramping            : std_logic_vector(NUM_BANDS-1 downto 0);
 
 begin
 
@@ -62,11 +85,17 @@ begin
 	begin
 		if rising_edge(clk) and (avs_s1_read = '1') then  -- all registers can be read. 
 			case avs_s1_address is
-                when "000"  => avs_s1_readdata <= band_1_gain_int;
-				when "001"  => avs_s1_readdata <= band_2_gain_int;
-                when "010"  => avs_s1_readdata <= band_3_gain_int;
-                when "011"  => avs_s1_readdata <= band_4_gain_int;
-                when "100"  => avs_s1_readdata <= band_5_gain_int;
+                when "0000" => avs_s1_readdata <= std_logic_vector(target_gain(0));
+				when "0001" => avs_s1_readdata <= std_logic_vector(target_gain(1));
+                when "0010" => avs_s1_readdata <= std_logic_vector(target_gain(2));
+                when "0011" => avs_s1_readdata <= std_logic_vector(target_gain(3));
+                when "0100" => avs_s1_readdata <= std_logic_vector(target_gain(4));
+                when "0101" => avs_s1_readdata <= std_logic_vector(resize(unsigned(ramping), 32));
+                when "1000" => avs_s1_readdata <= std_logic_vector(ramp_step(0));
+                when "1001" => avs_s1_readdata <= std_logic_vector(ramp_step(1));
+                when "1010" => avs_s1_readdata <= std_logic_vector(ramp_step(2));
+                when "1011" => avs_s1_readdata <= std_logic_vector(ramp_step(3));
+                when "1100" => avs_s1_readdata <= std_logic_vector(ramp_step(4));
 				when others => avs_s1_readdata <= (others => '0');
             end case;
 		end if;
@@ -75,28 +104,70 @@ begin
     process(clk)
 	begin
         if (reset_n = '0') then
-            band_1_gain_int   <= x"00010000";  -- W32F16
-            band_2_gain_int   <= x"00010000";  -- W32F16
-            band_3_gain_int   <= x"00010000";  -- W32F16
-            band_4_gain_int   <= x"00010000";  -- W32F16
-            band_5_gain_int   <= x"00010000";  -- W32F16
+            target_gain       <= (others => x"00010000");  -- W32F16
+            ramp_step         <= (others => (others => '0'));
 		elsif rising_edge(clk) and (avs_s1_write = '1') then  -- write the registers
             case avs_s1_address is
-                when "000"  => band_1_gain_int <= avs_s1_writedata;
-                when "001"  => band_2_gain_int <= avs_s1_writedata;
-                when "010"  => band_3_gain_int <= avs_s1_writedata;
-                when "011"  => band_4_gain_int <= avs_s1_writedata;
-                when "100"  => band_5_gain_int <= avs_s1_writedata;
+                when "0000" => target_gain(0) <= signed(avs_s1_writedata);
+                when "0001" => target_gain(1) <= signed(avs_s1_writedata);
+                when "0010" => target_gain(2) <= signed(avs_s1_writedata);
+                when "0011" => target_gain(3) <= signed(avs_s1_writedata);
+                when "0100" => target_gain(4) <= signed(avs_s1_writedata);
+                when "1000" => ramp_step(0)   <= signed(avs_s1_writedata);
+                when "1001" => ramp_step(1)   <= signed(avs_s1_writedata);
+                when "1010" => ramp_step(2)   <= signed(avs_s1_writedata);
+                when "1011" => ramp_step(3)   <= signed(avs_s1_writedata);
+                when "1100" => ramp_step(4)   <= signed(avs_s1_writedata);
                 when others  => null ;
             end case;
         end if;    
 	end process;
+
+    ------------------------------------------------------------------------
+    -- Ramp engines, move each gain one step towards its target per sample
+    ------------------------------------------------------------------------
+    process(clk)
+        variable up   : signed(32 downto 0);
+        variable down : signed(32 downto 0);
+    begin
+        if (reset_n = '0') then
+            current_gain      <= (others => x"00010000");  -- W32F16
+        elsif rising_edge(clk) then
+            for i in 0 to NUM_BANDS-1 loop
+                -- The step is a magnitude, one extra bit so it can't wrap the gain around
+                up   := resize(current_gain(i), 33) + ('0' & ramp_step(i));
+                down := resize(current_gain(i), 33) - ('0' & ramp_step(i));
+
+                if (ramp_step(i) = 0) then
+                    current_gain(i) <= target_gain(i);
+                elsif (sample_strobe = '1') then
+                    if (current_gain(i) < target_gain(i)) then
+                        if (up >= resize(target_gain(i), 33)) then
+                            current_gain(i) <= target_gain(i);
+                        else
+                            current_gain(i) <= up(31 downto 0);
+                        end if;
+                    elsif (current_gain(i) > target_gain(i)) then
+                        if (down <= resize(target_gain(i), 33)) then
+                            current_gain(i) <= target_gain(i);
+                        else
+                            current_gain(i) <= down(31 downto 0);
+                        end if;
+                    end if;
+                end if;
+            end loop;
+        end if;
+    end process;
+
+    ramp_status : for i in 0 to NUM_BANDS-1 generate
+        ramping(i) <= '0' when (current_gain(i) = target_gain(i)) else '1';
+    end generate;
       
-    band_1_gain <= band_1_gain_int;
-    band_2_gain <= band_2_gain_int;
-    band_3_gain <= band_3_gain_int;
-    band_4_gain <= band_4_gain_int;
-    band_5_gain <= band_5_gain_int;
+    band_1_gain <= std_logic_vector(current_gain(0));
+    band_2_gain <= std_logic_vector(current_gain(1));
+    band_3_gain <= std_logic_vector(current_gain(2));
+    band_4_gain <= std_logic_vector(current_gain(3));
+    band_5_gain <= std_logic_vector(current_gain(4));
       
 
 end behavior;
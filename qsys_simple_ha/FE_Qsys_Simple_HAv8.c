@@ -6,6 +6,26 @@
 
     1)  The devices will load in /dev as fe_HANNN and little endian files containing 32bit fixed point values can be passed into this
     to update the cofficient files.  Number of coefficients are automatically computed from the length of this file.  Conversly, this entry can be read to read out the values currently loaded in the the hardware.
+    The file is an image of the gain registers: the left channel (gain_all, band1 .. band4) followed by the right channel, so
+    reading the whole file and writing it back restores every gain.  The file offset selects the first register to write.
+    The register page can also be mmap'ed (uncached) so gains can be written straight to the hardware without a system call.
+
+    The gain registers are double buffered in the hardware: writes land in a pending bank and the whole bank is copied to
+    the gains in use on a sample boundary when the control register (word CONTROL_OFFSET) is written with
+    CONTROL_HOLD | CONTROL_COMMIT.  The driver puts the block in hold mode at probe and, with auto_commit set (the default),
+    commits after every write through /dev or sysfs, so a vector or image write changes all its gains on the same sample.
+    With auto_commit cleared the writes are only staged until 1 is written to the commit attribute.  mmap users write the
+    control register themselves (or clear CONTROL_HOLD to have every register write take effect right away).
+
+    2)  The sysfs attributes in /sys/class/fe_HANNN/fe_HANNN take one gain per register (eg: band1_gain_left), or a comma separated
+    vector of gains in register order (gain_all, band1 .. band4) to update a whole channel in one write with gains_left and gains_right,
+    or both channels (left then right) with gains_all.
+
+    3)  An ioctl on /dev/fe_HANNN (FE_HA_IOC_SET_GAINS, see fe_ha_ioctl.h) takes an array of {band, channel, value} entries
+    and applies them all as one update, returning the previous values.  This is the cheapest way to retune many bands.
+
+    Every HA block in the system gets its own device: the first one is fe_HANNN (NNN is the Major number) and the
+    others are fe_HANNN_M, M being the Minor number, all under the one fe_HANNN class.
 
     @author Tyler Davis (adapted from code written by Raymond Weber)
     @copyright 2018 FlatEarth Inc, Bozeman MT
@@ -19,9 +39,24 @@
 #include <linux/uaccess.h>
 #include <linux/init.h>
 #include<linux/cdev.h>
+#include <linux/idr.h>
+#include <linux/mutex.h>
+#include <linux/slab.h>
+#include <linux/kref.h>
+#include <linux/ktime.h>
+#include <linux/log2.h>
+#include <linux/spinlock.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
 #include <linux/spi/spi.h>
 #include <linux/regmap.h>
 
+#include "fe_fixedpoint.h"
+#include "fe_ha_ioctl.h"
+
+#define CREATE_TRACE_POINTS
+#include "fe_ha_trace.h"
+
 // Define information about this kernel module
 MODULE_LICENSE("GPL");
 MODULE_AUTHOR("Tyler Davis <openspeech@flatearthinc.com>");
@@ -35,6 +70,12 @@ MODULE_VERSION("1.0");
 #define BAND3_OFFSET 0x03
 #define BAND4_OFFSET 0x04
 
+// Number of gain registers per channel (gain_all and bands 1-4), FE_HA_NUM_BANDS in the ioctl interface
+#define NUM_BANDS FE_HA_NUM_BANDS
+
+// Number of 32 bit words in the /dev/fe_HANNN image (left channel then right channel)
+#define IMAGE_WORDS (2 * NUM_BANDS)
+
 
 // LR offset
 #define LEFT_OFFSET 0x00
@@ -42,22 +83,82 @@ MODULE_VERSION("1.0");
 
 #define GAIN_OFFSET 0
 
-struct fixed_num
+// Control register for the double buffered gains
+#define CONTROL_OFFSET 0x07
+#define CONTROL_HOLD 0x01       // The gains in use only change on a commit
+#define CONTROL_COMMIT 0x02     // Copy the pending gains on the next sample, reads back set until done
+
+// Largest number of HA blocks the driver can handle, each one gets a minor number
+#define FE_HA_MAX_DEVICES 64
+
+static struct class *cl; // Global variable for the device class, shared by every HA
+static dev_t dev_num;    // First device number of the region reserved for the HAs
+static DEFINE_IDA(fe_HA_ida); // Minor numbers in use
+static struct dentry *fe_HA_debugfs; // debugfs directory holding one directory per HA
+
+// Number of log2 buckets in the latency histograms, bucket n counts updates that took [2^n, 2^(n+1)) ns
+#define HIST_BUCKETS 32
+
+/** Gain update paths that are timed, one histogram each */
+enum HA_stat
 {
-    int integer;
-    int fraction;
-    int fraction_len;
+    STAT_GAIN_ALL_LEFT,
+    STAT_BAND1_LEFT,
+    STAT_BAND2_LEFT,
+    STAT_BAND3_LEFT,
+    STAT_BAND4_LEFT,
+    STAT_GAIN_ALL_RIGHT,
+    STAT_BAND1_RIGHT,
+    STAT_BAND2_RIGHT,
+    STAT_BAND3_RIGHT,
+    STAT_BAND4_RIGHT,
+    STAT_GAINS_LEFT,
+    STAT_GAINS_RIGHT,
+    STAT_GAINS_ALL,
+    STAT_DEV_WRITE,
+    STAT_IOCTL,
+    NUM_STATS
 };
 
+/** Names of the timed paths, the sysfs attribute names where there is one */
+static const char * const HA_stat_names[NUM_STATS] =
+{
+    [STAT_GAIN_ALL_LEFT]  = "gain_all_left",
+    [STAT_BAND1_LEFT]     = "band1_gain_left",
+    [STAT_BAND2_LEFT]     = "band2_gain_left",
+    [STAT_BAND3_LEFT]     = "band3_gain_left",
+    [STAT_BAND4_LEFT]     = "band4_gain_left",
+    [STAT_GAIN_ALL_RIGHT] = "gain_all_right",
+    [STAT_BAND1_RIGHT]    = "band1_gain_right",
+    [STAT_BAND2_RIGHT]    = "band2_gain_right",
+    [STAT_BAND3_RIGHT]    = "band3_gain_right",
+    [STAT_BAND4_RIGHT]    = "band4_gain_right",
+    [STAT_GAINS_LEFT]     = "gains_left",
+    [STAT_GAINS_RIGHT]    = "gains_right",
+    [STAT_GAINS_ALL]      = "gains_all",
+    [STAT_DEV_WRITE]      = "dev_write",
+    [STAT_IOCTL]          = "ioctl",
+};
 
-static struct class *cl; // Global variable for the device class
-static dev_t dev_num;
+/** Latency histograms of one gain update path */
+struct HA_latency
+{
+    u64 count;                      ///< Number of updates
+    u64 parse_max;                  ///< Longest time spent converting the input (ns)
+    u64 write_max;                  ///< Longest time spent from the end of the conversion to the last register write (ns)
+    u32 parse[HIST_BUCKETS];        ///< log2 histogram of the conversion time
+    u32 write[HIST_BUCKETS];        ///< log2 histogram of the register write time
+};
 
 // Function Prototypes
 static int HA_probe(struct platform_device *pdev);
 static int HA_remove(struct platform_device *pdev);
 static ssize_t HA_read(struct file *file, char *buffer, size_t len, loff_t *offset);
 static ssize_t HA_write(struct file *file, const char *buffer, size_t len, loff_t *offset);
+static loff_t HA_llseek(struct file *file, loff_t offset, int whence);
+static long HA_ioctl(struct file *file, unsigned int cmd, unsigned long arg);
+static int HA_mmap(struct file *file, struct vm_area_struct *vma);
+static void HA_free(struct kref *ref);
 static int HA_open(struct inode *inode, struct file *file);
 static int HA_release(struct inode *inode, struct file *file);
 static ssize_t name_show(struct device *dev, struct device_attribute *attr, char *buf);
@@ -86,10 +187,19 @@ static ssize_t band3_gain_store_right(struct device *dev, struct device_attribut
 static ssize_t band4_gain_show_right(struct device *dev, struct device_attribute *attr, char *buf);
 static ssize_t band4_gain_store_right(struct device *dev, struct device_attribute *attr, const char *buf, size_t count);
 
+// Vector prototypes
+static ssize_t gains_show_left(struct device *dev, struct device_attribute *attr, char *buf);
+static ssize_t gains_store_left(struct device *dev, struct device_attribute *attr, const char *buf, size_t count);
+static ssize_t gains_show_right(struct device *dev, struct device_attribute *attr, char *buf);
+static ssize_t gains_store_right(struct device *dev, struct device_attribute *attr, const char *buf, size_t count);
+static ssize_t gains_show_all(struct device *dev, struct device_attribute *attr, char *buf);
+static ssize_t gains_store_all(struct device *dev, struct device_attribute *attr, const char *buf, size_t count);
 
-char *strcat2(char *dst, char *src);
-uint32_t set_fixed_num(const char *s);
-int fp_to_string(char *buf, uint32_t fp28_num);
+// Commit attributes
+static ssize_t commit_show(struct device *dev, struct device_attribute *attr, char *buf);
+static ssize_t commit_store(struct device *dev, struct device_attribute *attr, const char *buf, size_t count);
+static ssize_t auto_commit_show(struct device *dev, struct device_attribute *attr, char *buf);
+static ssize_t auto_commit_store(struct device *dev, struct device_attribute *attr, const char *buf, size_t count);
 
 //Create the attributes that show up in /dev/class
 static DEVICE_ATTR(gain_all_left,            0664, gain_all_show_left,       gain_all_store_left);
@@ -103,6 +213,12 @@ static DEVICE_ATTR(band1_gain_right,         0664, band1_gain_show_right,
 static DEVICE_ATTR(band2_gain_right,         0664, band2_gain_show_right,         band2_gain_store_right);
 static DEVICE_ATTR(band3_gain_right,         0664, band3_gain_show_right,         band3_gain_store_right);
 static DEVICE_ATTR(band4_gain_right,         0664, band4_gain_show_right,         band4_gain_store_right);
+
+static DEVICE_ATTR(gains_left,               0664, gains_show_left,          gains_store_left);
+static DEVICE_ATTR(gains_right,              0664, gains_show_right,         gains_store_right);
+static DEVICE_ATTR(gains_all,                0664, gains_show_all,           gains_store_all);
+static DEVICE_ATTR(commit,                   0664, commit_show,              commit_store);
+static DEVICE_ATTR(auto_commit,              0664, auto_commit_show,         auto_commit_store);
 static DEVICE_ATTR(name, 0444, name_show, NULL);
 
 /** An instance of this structure will be created for every fe_HA IP in the system
@@ -112,18 +228,24 @@ static DEVICE_ATTR(name, 0444, name_show, NULL);
 struct fe_HA_dev
 {
     struct cdev cdev;           ///< The driver structure containing major/minor, etc
+    dev_t devt;                 ///< Device number of this HA
     char *name;                 ///< This gets the name of the device when loading the driver
     void __iomem *regs;         ///< Pointer to the registers on the device
-    int gain_all_left;
-    int band1_gain_left;
-    int band2_gain_left;
-    int band3_gain_left;
-    int band4_gain_left;
-    int gain_all_right;
-    int band1_gain_right;
-    int band2_gain_right;
-    int band3_gain_right;
-    int band4_gain_right;
+    phys_addr_t regs_phys;      ///< Physical address of the registers, for mmap
+    resource_size_t regs_size;  ///< Size of the register span
+    atomic_t mmap_count;        ///< Number of userspace mappings of the registers, the shadow is stale while there are any
+    struct kref ref;            ///< Held by the device, the open files and the mappings, the structure goes with the last one
+    struct mutex map_lock;      ///< Protects mapping and removed (not lock, mmap runs with the mm lock held)
+    struct address_space *mapping;  ///< Address space shared by the open files, so HA_remove can zap every mapping
+    bool removed;               ///< The device is gone, no new mappings
+    u32 gain_left[NUM_BANDS];   ///< Shadow of the left gain registers, indexed by BAND_ALL_OFFSET..BAND4_OFFSET
+    u32 gain_right[NUM_BANDS];  ///< Shadow of the right gain registers, indexed by BAND_ALL_OFFSET..BAND4_OFFSET
+    bool auto_commit;           ///< Commit the pending gains after every write from the driver
+    struct mutex lock;          ///< Serializes the gain writers so a batch or a vector is applied as one update
+    char node_name[20];         ///< Name of the device node, used by the tracepoints and debugfs
+    struct dentry *debugfs;     ///< debugfs directory of this HA
+    spinlock_t latency_lock;    ///< Protects the latency histograms
+    struct HA_latency latency[NUM_STATS]; ///< Latency histograms of the gain update paths, indexed by enum HA_stat
 
 };
 
@@ -131,6 +253,16 @@ struct fe_HA_dev
 /** Typedef of the driver structure */
 typedef struct fe_HA_dev fe_HA_dev_t;   //Annoying but makes sonarqube not crash during the analysis in the container_of() lines
 
+// Shadow register prototypes
+static void HA_load_shadow(fe_HA_dev_t *devp);
+static void HA_sync_shadow(fe_HA_dev_t *devp);
+static void HA_commit(fe_HA_dev_t *devp);
+static void HA_auto_commit(fe_HA_dev_t *devp);
+
+// Instrumentation prototypes
+static void HA_record_latency(fe_HA_dev_t *devp, enum HA_stat stat, unsigned int num_gains, ktime_t start, ktime_t parsed);
+static void HA_debugfs_create(fe_HA_dev_t *devp);
+
 /** Id matching structure for use in driver/device matching */
 static struct of_device_id fe_HA_dt_ids[] =
 {
@@ -160,6 +292,9 @@ static const struct file_operations fe_HA_fops =
     .owner = THIS_MODULE,
     .read = HA_read,               ///< Read the device contents for the entry in /dev
     .write = HA_write,             ///< Write the device contents for the entry in /dev
+    .llseek = HA_llseek,           ///< Move around the register image in /dev
+    .mmap = HA_mmap,               ///< Map the registers into userspace
+    .unlocked_ioctl = HA_ioctl,    ///< Batch gain updates, see fe_ha_ioctl.h
     .open = HA_open,               ///< Called when the device is opened
     .release = HA_release,         ///< Called when the device is closes
 };
@@ -175,19 +310,50 @@ static const struct file_operations fe_HA_fops =
 static int HA_init(void)
 {
     int ret_val = 0;
+    char className[20];
+
     pr_info("Initializing the Audio Logic HA module\n");
 
+    //Reserve a Major number and enough Minor numbers for every HA in the system
+    ret_val = alloc_chrdev_region(&dev_num, 0, FE_HA_MAX_DEVICES, "fe_HA");
+    if (ret_val != 0)
+    {
+        pr_err("alloc_chrdev_region returned %d\n", ret_val);
+        return ret_val;
+    }
+
+    //One class for all the HAs, named after the Major number like the per device classes used to be
+    sprintf(className, "fe_HA%d", MAJOR(dev_num));
+    cl = class_create(THIS_MODULE, className);
+    if (IS_ERR(cl))
+    {
+        ret_val = PTR_ERR(cl);
+        goto bad_class_create;
+    }
+
+    //Home of the latency histograms, the driver works without it
+    fe_HA_debugfs = debugfs_create_dir("fe_HA", NULL);
+
     // Register our driver with the "Platform Driver" bus
     ret_val = platform_driver_register(&HA_platform);
     if (ret_val != 0)
     {
         pr_err("platform_driver_register returned %d\n", ret_val);
-        return ret_val;
+        goto bad_platform_driver_register;
     }
 
     pr_info("Audio Logic HA module successfully initialized!\n");
 
     return 0;
+
+bad_platform_driver_register:
+    debugfs_remove_recursive(fe_HA_debugfs);
+    class_destroy(cl);
+
+bad_class_create:
+    unregister_chrdev_region(dev_num, FE_HA_MAX_DEVICES);
+
+    return ret_val;
 }
 
 
@@ -205,8 +371,8 @@ static int HA_probe(struct platform_device *pdev)
     int ret_val = -EBUSY;
     struct resource *r = 0;
 
-    char deviceName[20] = "fe_HA";
-    char deviceMinor[20];
+    char deviceName[20];
+    int minor;
     int status;
 
     struct device *deviceObj;
@@ -222,15 +388,37 @@ static int HA_probe(struct platform_device *pdev)
         goto bad_exit_return;
     }
 
-    // Create structure to hold device-specific information (like the registers). Make size of &pdev->dev + sizeof(struct(fe_HA_dev)).
-    fe_HA_devp = devm_kzalloc(&pdev->dev, sizeof(fe_HA_dev_t), GFP_KERNEL);
+    // Create structure to hold device-specific information (like the registers).  It isn't device managed since
+    // userspace mappings of the registers can outlive the device, it is freed when the last reference is dropped.
+    fe_HA_devp = kzalloc(sizeof(fe_HA_dev_t), GFP_KERNEL);
+    if (fe_HA_devp == NULL)
+    {
+        ret_val = -ENOMEM;
+        goto bad_exit_return;
+    }
 
     // Both request and ioremap a memory region
     // This makes sure nobody else can grab this memory region
     // as well as moving it into our address space so we can actually use it
     fe_HA_devp->regs = devm_ioremap_resource(&pdev->dev, r);
     if (IS_ERR(fe_HA_devp->regs))
+    {
+        ret_val = PTR_ERR(fe_HA_devp->regs);
         goto bad_ioremap;
+    }
+
+    // Remember where the registers are so they can be mapped into userspace
+    fe_HA_devp->regs_phys = r->start;
+    fe_HA_devp->regs_size = resource_size(r);
+    atomic_set(&fe_HA_devp->mmap_count, 0);
+    kref_init(&fe_HA_devp->ref);
+    mutex_init(&fe_HA_devp->map_lock);
+    mutex_init(&fe_HA_devp->lock);
+    spin_lock_init(&fe_HA_devp->latency_lock);
+
+    // Hold the gains in use so a set of writes switches in together, everything written so far is committed
+    fe_HA_devp->auto_commit = true;
+    HA_commit(fe_HA_devp);
 
     // Give a pointer to the instance-specific data to the generic platform_device structure
     // so we can access this data later on (for instance, in the read and write functions)
@@ -245,32 +433,35 @@ static int HA_probe(struct platform_device *pdev)
     strcpy(fe_HA_devp->name, (char *)pdev->name);
     pr_info("%s\n", (char *)pdev->name);
 
-    //Request a Major/Minor number for the driver
-    status = alloc_chrdev_region(&dev_num, 0, 1, "fe_HA");
-    if (status != 0)
-        goto bad_alloc_chrdev_region;
+    //Take the lowest free Minor number from the region reserved in HA_init
+    minor = ida_alloc_max(&fe_HA_ida, FE_HA_MAX_DEVICES - 1, GFP_KERNEL);
+    if (minor < 0)
+    {
+        pr_err("No free minor numbers, only %d HAs are supported\n", FE_HA_MAX_DEVICES);
+        ret_val = minor;
+        goto bad_ida_alloc;
+    }
+    fe_HA_devp->devt = MKDEV(MAJOR(dev_num), minor);
 
-    //Create the device name with the information reserved above
-    sprintf(deviceMinor, "%d", MAJOR(dev_num));
-    strcat(deviceName, deviceMinor);
+    //Create the device name, the first HA keeps the fe_HANNN name so existing scripts still find it
+    if (minor == 0)
+        sprintf(deviceName, "fe_HA%d", MAJOR(dev_num));
+    else
+        sprintf(deviceName, "fe_HA%d_%d", MAJOR(dev_num), minor);
     pr_info("%s\n", deviceName);
-
-    //Create sysfs entries
-    cl = class_create(THIS_MODULE, deviceName); //"fe_HA");
-    if (cl == NULL)
-        goto bad_class_create;
+    strcpy(fe_HA_devp->node_name, deviceName);
 
     //Initialize a char dev structure
     cdev_init(&fe_HA_devp->cdev, &fe_HA_fops);
 
     //Registers the char driver with the kernel
-    status = cdev_add(&fe_HA_devp->cdev, dev_num, 1);
+    status = cdev_add(&fe_HA_devp->cdev, fe_HA_devp->devt, 1);
     if (status != 0)
         goto bad_cdev_add;
 
     //Creates the device entries in sysfs
-    deviceObj = device_create(cl, NULL, dev_num, NULL, deviceName);
-    if (deviceObj == NULL)
+    deviceObj = device_create(cl, NULL, fe_HA_devp->devt, NULL, deviceName);
+    if (IS_ERR(deviceObj))
         goto bad_device_create;
 
     //Put a pointer to the fe_fir_dev struct that is created into the driver object so it can be accessed uniquely from elsewhere
@@ -340,10 +531,53 @@ static int HA_probe(struct platform_device *pdev)
     if (status)
         goto bad_device_create_file_11;
 
+    //---------------------------------------------------------
+
+    status = device_create_file(deviceObj, &dev_attr_gains_left);
+    if (status)
+        goto bad_device_create_file_12;
+
+    //---------------------------------------------------------
+
+    status = device_create_file(deviceObj, &dev_attr_gains_right);
+    if (status)
+        goto bad_device_create_file_13;
+
+    //---------------------------------------------------------
+
+    status = device_create_file(deviceObj, &dev_attr_gains_all);
+    if (status)
+        goto bad_device_create_file_14;
+
+    status = device_create_file(deviceObj, &dev_attr_commit);
+    if (status)
+        goto bad_device_create_file_15;
+
+    status = device_create_file(deviceObj, &dev_attr_auto_commit);
+    if (status)
+        goto bad_device_create_file_16;
+
+    HA_debugfs_create(fe_HA_devp);
+
     pr_info("HA_probe exit\n");
 
     return 0;
 
+bad_device_create_file_16:
+    device_remove_file(deviceObj, &dev_attr_auto_commit);
+
+bad_device_create_file_15:
+    device_remove_file(deviceObj, &dev_attr_commit);
+
+bad_device_create_file_14:
+    device_remove_file(deviceObj, &dev_attr_gains_all);
+
+bad_device_create_file_13:
+    device_remove_file(deviceObj, &dev_attr_gains_right);
+
+bad_device_create_file_12:
+    device_remove_file(deviceObj, &dev_attr_gains_left);
+
 bad_device_create_file_11:
     device_remove_file(deviceObj, &dev_attr_name);
 
@@ -378,22 +612,18 @@ bad_device_create_file_1:
     device_remove_file(deviceObj, &dev_attr_band1_gain_left);
 
 bad_device_create_file_0:
-    device_destroy(cl, dev_num);
+    device_destroy(cl, fe_HA_devp->devt);
 
 bad_device_create:
     cdev_del(&fe_HA_devp->cdev);
 
 bad_cdev_add:
-    class_destroy(cl);
+    ida_free(&fe_HA_ida, minor);
 
-bad_class_create:
-    unregister_chrdev_region(dev_num, 1);
-
-bad_alloc_chrdev_region:
+bad_ida_alloc:
 bad_mem_alloc:
-
 bad_ioremap:
-    ret_val = PTR_ERR(fe_HA_devp->regs);
+    kfree(fe_HA_devp);
 
 bad_exit_return:
     pr_info("HA_probe bad exit\n");
@@ -418,17 +648,19 @@ static int HA_open(struct inode *inode, struct file *file)
     devp = container_of(inode->i_cdev, fe_HA_dev_t, cdev);
     file->private_data = devp;
 
+    //The file keeps the structure around until it is released
+    kref_get(&devp->ref);
+
+    //Every file of this HA shares one address space, so HA_remove can find all the mappings
+    mutex_lock(&devp->map_lock);
+    if (devp->mapping == NULL)
+        devp->mapping = file->f_mapping;
+    else
+        file->f_mapping = devp->mapping;
+    mutex_unlock(&devp->map_lock);
+
     //Load the shadow registers with the values from the hardware registers
-    devp->band1_gain_left       = ioread32((u32 *)devp->regs + BAND1_OFFSET + GAIN_OFFSET + LEFT_OFFSET);
-    devp->band2_gain_left       = ioread32((u32 *)devp->regs + BAND2_OFFSET + GAIN_OFFSET + LEFT_OFFSET);
-    devp->band3_gain_left       = ioread32((u32 *)devp->regs + BAND3_OFFSET + GAIN_OFFSET + LEFT_OFFSET);
-    devp->band4_gain_left       = ioread32((u32 *)devp->regs + BAND4_OFFSET + GAIN_OFFSET + LEFT_OFFSET);
-    devp->gain_all_left         = ioread32((u32 *)devp->regs + BAND_ALL_OFFSET + GAIN_OFFSET + LEFT_OFFSET);
-    devp->band1_gain_right      = ioread32((u32 *)devp->regs + BAND1_OFFSET + GAIN_OFFSET + RIGHT_OFFSET);
-    devp->band2_gain_right      = ioread32((u32 *)devp->regs + BAND2_OFFSET + GAIN_OFFSET + RIGHT_OFFSET);
-    devp->band3_gain_right      = ioread32((u32 *)devp->regs + BAND3_OFFSET + GAIN_OFFSET + RIGHT_OFFSET);
-    devp->band4_gain_right      = ioread32((u32 *)devp->regs + BAND4_OFFSET + GAIN_OFFSET + RIGHT_OFFSET);
-    devp->gain_all_right        = ioread32((u32 *)devp->regs + BAND_ALL_OFFSET + GAIN_OFFSET + RIGHT_OFFSET);
+    HA_load_shadow(devp);
 
     return 0;
 }
@@ -437,7 +669,7 @@ static int HA_open(struct inode *inode, struct file *file)
 
 /** Called when the device is closed
 
-    Currently this doesn't do anything, but as it is the opposite of open I created it for future use
+    Drops the reference taken by HA_open
 
     @param inode Instance of the driver opened
     @param file Pointer to the file for this operation
@@ -445,11 +677,34 @@ static int HA_open(struct inode *inode, struct file *file)
 */
 static int HA_release(struct inode *inode, struct file *file)
 {
+    fe_HA_dev_t *devp = (fe_HA_dev_t *)file->private_data;
+
+    kref_put(&devp->ref, HA_free);
+
     return 0;
 }
 
 
 
+/** Get the shadow register and the hardware address of a word in the /dev/fe_HANNN image
+
+    @param devp Pointer to the driver instance
+    @param index Word in the image (0..IMAGE_WORDS-1), the left channel comes first
+    @param addr Set to the address of the register in the hardware
+    @returns Pointer to the shadow register
+*/
+static u32 *HA_image_reg(fe_HA_dev_t *devp, int index, u32 __iomem **addr)
+{
+    int channel = (index < NUM_BANDS) ? LEFT_OFFSET : RIGHT_OFFSET;
+    int band = index % NUM_BANDS;
+
+    *addr = (u32 *)devp->regs + band + GAIN_OFFSET + channel;
+
+    return (channel == LEFT_OFFSET) ? &devp->gain_left[band] : &devp->gain_right[band];
+}
+
+
+
 /** Read the contents of the coefficients stucture
 
     This function will read the contents of the coefficient memory as stored in the shadow register and return then
@@ -458,13 +713,24 @@ static int HA_release(struct inode *inode, struct file *file)
 
     @param file Pointer to the file being accessed
     @param buffer Pointer to a buffer array to return the data on
-    @len Unused
+    @len Size of buffer
     @offset Pass-by-reference variable to hold where to start transmitting from in the array.
-    @returns HA_read Number of bits sent in buffer, and will return 0 for the last transaction.
+    @returns HA_read Number of bytes sent in buffer, and will return 0 for the last transaction.
 */
 static ssize_t HA_read(struct file *file, char *buffer, size_t len, loff_t *offset)
 {
-    return 0;
+    fe_HA_dev_t *devp = (fe_HA_dev_t *)file->private_data;
+    __le32 image[IMAGE_WORDS];
+    u32 __iomem *addr;
+    int i;
+
+    HA_sync_shadow(devp);
+
+    //Build the little endian image from the shadow registers
+    for (i = 0; i < IMAGE_WORDS; i++)
+        image[i] = cpu_to_le32(*HA_image_reg(devp, i, &addr));
+
+    return simple_read_from_buffer(buffer, len, offset, image, sizeof(image));
 }
 
 
@@ -484,7 +750,278 @@ static ssize_t HA_read(struct file *file, char *buffer, size_t len, loff_t *offs
 */
 static ssize_t HA_write(struct file *file, const char *buffer, size_t len, loff_t *offset)
 {
-    return 0;
+    fe_HA_dev_t *devp = (fe_HA_dev_t *)file->private_data;
+    ktime_t start = ktime_get();
+    ktime_t parsed;
+    __le32 image[IMAGE_WORDS];
+    u32 __iomem *addr;
+    u32 *shadow;
+    int first;
+    int num_words;
+    int i;
+
+    //The image is made of whole registers
+    if (*offset & 3)
+        return -EINVAL;
+    if (*offset >= sizeof(image))
+        return -ENOSPC;
+
+    first = *offset / sizeof(u32);
+    num_words = min_t(size_t, len / sizeof(u32), IMAGE_WORDS - first);
+    if (num_words == 0)
+        return len;
+
+    //Grab all the words in one copy so a bad buffer doesn't leave half the gains updated
+    if (copy_from_user(image, buffer, num_words * sizeof(u32)))
+        return -EFAULT;
+    parsed = ktime_get();
+
+    //Update the shadow registers and the hardware in one pass
+    mutex_lock(&devp->lock);
+    for (i = 0; i < num_words; i++)
+    {
+        shadow = HA_image_reg(devp, first + i, &addr);
+        *shadow = le32_to_cpu(image[i]);
+        iowrite32(*shadow, addr);
+    }
+
+    //Switch the whole write in on one sample
+    HA_auto_commit(devp);
+    mutex_unlock(&devp->lock);
+
+    HA_record_latency(devp, STAT_DEV_WRITE, num_words, start, parsed);
+
+    *offset += num_words * sizeof(u32);
+
+    //A trailing partial word is ignored, but whole words past the end of the image are a short write
+    if (num_words == len / sizeof(u32))
+        return len;
+
+    return num_words * sizeof(u32);
+}
+
+
+
+/** Move the file offset within the register image
+
+    @param file Pointer to the file being accessed
+    @param offset Offset to seek to
+    @param whence SEEK_SET, SEEK_CUR or SEEK_END
+    @returns The new offset or an error code
+*/
+static loff_t HA_llseek(struct file *file, loff_t offset, int whence)
+{
+    return fixed_size_llseek(file, offset, whence, IMAGE_WORDS * sizeof(u32));
+}
+
+
+
+/** Apply a batch of gains (FE_HA_IOC_SET_GAINS)
+
+    The whole batch is copied in and checked before any register is touched, then the gains are written back to back
+    under the driver lock and committed once.  The previous value of each register is returned in place.
+
+    @param devp Pointer to the driver instance
+    @param arg Userspace pointer to a struct fe_ha_gain_batch
+    @returns SUCCESS or error code
+*/
+static long HA_set_gains(fe_HA_dev_t *devp, unsigned long arg)
+{
+    ktime_t start = ktime_get();
+    ktime_t parsed;
+    struct fe_ha_gain_batch batch;
+    struct fe_ha_gain *gains;
+    void __user *user_gains;
+    u32 __iomem *addr;
+    u32 *shadow;
+    long status = 0;
+    u32 i;
+
+    if (copy_from_user(&batch, (void __user *)arg, sizeof(batch)))
+        return -EFAULT;
+    if (batch.reserved != 0 || batch.count == 0 || batch.count > FE_HA_MAX_BATCH)
+        return -EINVAL;
+
+    user_gains = u64_to_user_ptr(batch.gains);
+    gains = memdup_user(user_gains, batch.count * sizeof(*gains));
+    if (IS_ERR(gains))
+        return PTR_ERR(gains);
+
+    //Nothing is written unless every entry is valid
+    for (i = 0; i < batch.count; i++)
+    {
+        if (gains[i].band >= NUM_BANDS || gains[i].channel > FE_HA_RIGHT)
+        {
+            status = -EINVAL;
+            goto out_free;
+        }
+    }
+    parsed = ktime_get();
+
+    mutex_lock(&devp->lock);
+
+    //The registers may have been written through mmap
+    HA_sync_shadow(devp);
+
+    for (i = 0; i < batch.count; i++)
+    {
+        shadow = HA_image_reg(devp, gains[i].band + gains[i].channel * NUM_BANDS, &addr);
+        swap(*shadow, gains[i].value);
+        iowrite32(*shadow, addr);
+    }
+
+    //The whole batch switches in on one sample
+    HA_auto_commit(devp);
+
+    mutex_unlock(&devp->lock);
+
+    HA_record_latency(devp, STAT_IOCTL, batch.count, start, parsed);
+
+    //Hand back the previous values
+    if (copy_to_user(user_gains, gains, batch.count * sizeof(*gains)))
+        status = -EFAULT;
+
+out_free:
+    kfree(gains);
+
+    return status;
+}
+
+
+
+/** ioctl entry point of /dev/fe_HANNN, the commands are defined in fe_ha_ioctl.h
+
+    @param file Pointer to the file being accessed
+    @param cmd ioctl command
+    @param arg Argument of the command
+    @returns SUCCESS or error code
+*/
+static long HA_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
+{
+    fe_HA_dev_t *devp = (fe_HA_dev_t *)file->private_data;
+
+    switch (cmd)
+    {
+        case FE_HA_IOC_SET_GAINS:
+            return HA_set_gains(devp, arg);
+
+        default:
+            return -ENOTTY;
+    }
+}
+
+
+
+/** Reload the shadow registers from the hardware registers
+
+    @param devp Pointer to the driver instance
+*/
+static void HA_load_shadow(fe_HA_dev_t *devp)
+{
+    int band;
+
+    for (band = BAND_ALL_OFFSET; band < NUM_BANDS; band++)
+    {
+        devp->gain_left[band]  = ioread32((u32 *)devp->regs + band + GAIN_OFFSET + LEFT_OFFSET);
+        devp->gain_right[band] = ioread32((u32 *)devp->regs + band + GAIN_OFFSET + RIGHT_OFFSET);
+    }
+}
+
+
+
+/** Make sure the shadow registers match the hardware before they are reported
+
+    While the registers are mapped into userspace the gains can change without the driver knowing, so the shadow
+    registers are read back from the hardware.  Otherwise every write goes through the driver and they are current.
+
+    @param devp Pointer to the driver instance
+*/
+static void HA_sync_shadow(fe_HA_dev_t *devp)
+{
+    if (atomic_read(&devp->mmap_count) > 0)
+        HA_load_shadow(devp);
+}
+
+
+
+/** Frees the driver instance once the device, the open files and the mappings have all let go of it */
+static void HA_free(struct kref *ref)
+{
+    kfree(container_of(ref, fe_HA_dev_t, ref));
+}
+
+
+
+/** Called when a mapping of the registers is duplicated (eg: fork), the mapping holds a reference */
+static void HA_vma_open(struct vm_area_struct *vma)
+{
+    fe_HA_dev_t *devp = (fe_HA_dev_t *)vma->vm_private_data;
+
+    kref_get(&devp->ref);
+    atomic_inc(&devp->mmap_count);
+}
+
+
+
+/** Called when a mapping of the registers is removed, the last one may free the structure after HA_remove */
+static void HA_vma_close(struct vm_area_struct *vma)
+{
+    fe_HA_dev_t *devp = (fe_HA_dev_t *)vma->vm_private_data;
+
+    atomic_dec(&devp->mmap_count);
+    kref_put(&devp->ref, HA_free);
+}
+
+/** Operations on the userspace mappings of the registers, used to know when the shadow registers can be trusted */
+static const struct vm_operations_struct fe_HA_vm_ops =
+{
+    .open = HA_vma_open,
+    .close = HA_vma_close,
+};
+
+
+
+/** Map the HA registers into userspace
+
+    The register span is mapped uncached so writes go straight to the hardware, in the same layout as the hardware
+    (the left gains at word LEFT_OFFSET, the right gains at word RIGHT_OFFSET).  The mapping has to start at offset 0
+    and can't be larger than the register span rounded up to a page.
+
+    @param file Pointer to the file being mapped
+    @param vma The userspace memory area to map the registers into
+    @returns SUCCESS or error code
+*/
+static int HA_mmap(struct file *file, struct vm_area_struct *vma)
+{
+    fe_HA_dev_t *devp = (fe_HA_dev_t *)file->private_data;
+    int status;
+
+    if (vma->vm_pgoff != 0)
+        return -EINVAL;
+
+    //Don't map the registers of a device that is being removed
+    mutex_lock(&devp->map_lock);
+    if (devp->removed)
+    {
+        mutex_unlock(&devp->map_lock);
+        return -ENODEV;
+    }
+
+    vma->vm_page_prot = pgprot_noncached(vma->vm_page_prot);
+    vma->vm_flags |= VM_IO | VM_DONTEXPAND | VM_DONTDUMP;
+    vma->vm_private_data = devp;
+    vma->vm_ops = &fe_HA_vm_ops;
+
+    //Checks the size of the mapping against the register span and maps it
+    status = vm_iomap_memory(vma, devp->regs_phys, devp->regs_size);
+
+    //The open callback isn't called for the initial mapping
+    if (status == 0)
+        HA_vma_open(vma);
+
+    mutex_unlock(&devp->map_lock);
+
+    return status;
 }
 
 
@@ -504,27 +1041,31 @@ static int HA_remove(struct platform_device *pdev)
     // Grab the instance-specific information out of the platform device
     fe_HA_dev_t *dev = (fe_HA_dev_t *)platform_get_drvdata(pdev);
 
-    //device_remove_file(deviceObj, &dev_attr_numCoefs);
-    //device_remove_file(deviceObj, &dev_attr_name);
-    //device_remove_file(deviceObj, &dev_attr_name);
-
-    //device_destroy(cl, dev_num);
-    //class_destroy(cl);
-
-
     pr_info("HA_remove enter\n");
 
+    //Userspace mappings of the registers fault from here on, the mappings themselves still hold the structure
+    mutex_lock(&dev->map_lock);
+    dev->removed = true;
+    if (dev->mapping)
+        unmap_mapping_range(dev->mapping, 0, 0, 1);
+    mutex_unlock(&dev->map_lock);
+
     // Turn the HA off
     //iowrite32(0x00, dev->regs);
 
+    // Remove the sysfs entries (and their attributes) of this HA
+    device_destroy(cl, dev->devt);
+    debugfs_remove_recursive(dev->debugfs);
+
     // Unregister the character file (remove it from /dev)
     cdev_del(&dev->cdev);
 
-    //Tell the os that the major/minor pair is avalible again
-    unregister_chrdev_region(dev_num, 2);
+    //Tell the os that the minor number is avalible again, the region is released in HA_exit
+    ida_free(&fe_HA_ida, MINOR(dev->devt));
 
-    //Remove the pointer to the registers so it doesn't leak
-    iounmap(dev->regs);
+    //The registers are device managed and get released after this returns, the structure goes with the last of the
+    //device, the open files and the mappings
+    kref_put(&dev->ref, HA_free);
 
     pr_info("HA_remove exit\n");
 
@@ -542,6 +1083,12 @@ static void HA_exit(void)
     // This will cause "HA_remove" to be called for each connected device
     platform_driver_unregister(&HA_platform);
 
+    // Every HA is gone, release the debugfs directory, the class and the device numbers
+    debugfs_remove_recursive(fe_HA_debugfs);
+    class_destroy(cl);
+    unregister_chrdev_region(dev_num, FE_HA_MAX_DEVICES);
+    ida_destroy(&fe_HA_ida);
+
     pr_info("Audio Logic HA module successfully unregistered\n");
 }
 
@@ -569,46 +1116,41 @@ static ssize_t band1_gain_show_left(struct device *dev, struct device_attribute
 {
     fe_HA_dev_t *devp = (fe_HA_dev_t *)dev_get_drvdata(dev);
 
-    //Copy the name into the output buffer
-    //sprintf(buf, "%d\n", fe_HA_devp->threshold);
-    fp_to_string(buf, devp->band1_gain_left);
-
-    strcat2(buf, "\n");
+    HA_sync_shadow(devp);
 
-    //Return the length of the buffer so it will print in the console
-    return strlen(buf);
+    //Copy the value into the output buffer and return its length so it will print in the console
+    return fe_fixed_show(buf, devp->gain_left[BAND1_OFFSET], FE_SQ16);
 }
 
 static ssize_t band1_gain_store_left(struct device *dev, struct device_attribute *attr, const char *buf, size_t count)
 {
+    ktime_t start = ktime_get();
+    ktime_t parsed;
     uint32_t tempValue = 0;
-
-    char substring[80];
-    int substring_count = 0;
-    int i;
+    int status;
 
     fe_HA_dev_t *devp = (fe_HA_dev_t *)dev_get_drvdata(dev);
 
-    for (i = 0; i < count; i++)
-    {
-        //If its not a space or a comma, add the digit to the substring
-        if ((buf[i] != ',') && (buf[i] != ' ') && (buf[i] != '\0') && (buf[i] != '\r') && (buf[i] != '\n'))
-        {
-            substring[substring_count] = buf[i];
-            substring_count++;
-        }
-    }
-
-    substring[substring_count] = '\0';
-
     //Convert the buffer to a fixed point value
-    tempValue = set_fixed_num(substring);
+    status = fe_fixed_from_string(buf, count, FE_SQ16, &tempValue);
+    if (status)
+        return status;
+    parsed = ktime_get();
+
+    mutex_lock(&devp->lock);
 
     //Write the value into the shadow register
-    devp->band1_gain_left = tempValue;
+    devp->gain_left[BAND1_OFFSET] = tempValue;
 
     //Write the value into the hardware
-    iowrite32(devp->band1_gain_left, (u32 *)devp->regs + BAND1_OFFSET + GAIN_OFFSET + LEFT_OFFSET);
+    iowrite32(devp->gain_left[BAND1_OFFSET], (u32 *)devp->regs + BAND1_OFFSET + GAIN_OFFSET + LEFT_OFFSET);
+
+    //Switch the new gain in on a sample boundary
+    HA_auto_commit(devp);
+
+    mutex_unlock(&devp->lock);
+
+    HA_record_latency(devp, STAT_BAND1_LEFT, 1, start, parsed);
 
     return count;
 }
@@ -622,46 +1164,41 @@ static ssize_t band2_gain_show_left(struct device *dev, struct device_attribute
 {
     fe_HA_dev_t *devp = (fe_HA_dev_t *)dev_get_drvdata(dev);
 
-    //Copy the name into the output buffer
-    //sprintf(buf, "%d\n", fe_HA_devp->threshold);
-    fp_to_string(buf, devp->band2_gain_left);
-
-    strcat2(buf, "\n");
+    HA_sync_shadow(devp);
 
-    //Return the length of the buffer so it will print in the console
-    return strlen(buf);
+    //Copy the value into the output buffer and return its length so it will print in the console
+    return fe_fixed_show(buf, devp->gain_left[BAND2_OFFSET], FE_SQ16);
 }
 
 static ssize_t band2_gain_store_left(struct device *dev, struct device_attribute *attr, const char *buf, size_t count)
 {
+    ktime_t start = ktime_get();
+    ktime_t parsed;
     uint32_t tempValue = 0;
-
-    char substring[80];
-    int substring_count = 0;
-    int i;
+    int status;
 
     fe_HA_dev_t *devp = (fe_HA_dev_t *)dev_get_drvdata(dev);
 
-    for (i = 0; i < count; i++)
-    {
-        //If its not a space or a comma, add the digit to the substring
-        if ((buf[i] != ',') && (buf[i] != ' ') && (buf[i] != '\0') && (buf[i] != '\r') && (buf[i] != '\n'))
-        {
-            substring[substring_count] = buf[i];
-            substring_count++;
-        }
-    }
-
-    substring[substring_count] = '\0';
-
     //Convert the buffer to a fixed point value
-    tempValue = set_fixed_num(substring);
+    status = fe_fixed_from_string(buf, count, FE_SQ16, &tempValue);
+    if (status)
+        return status;
+    parsed = ktime_get();
+
+    mutex_lock(&devp->lock);
 
     //Write the value into the shadow register
-    devp->band2_gain_left = tempValue;
+    devp->gain_left[BAND2_OFFSET] = tempValue;
 
     //Write the value into the hardware
-    iowrite32(devp->band2_gain_left, (u32 *)devp->regs + BAND2_OFFSET + GAIN_OFFSET + LEFT_OFFSET);
+    iowrite32(devp->gain_left[BAND2_OFFSET], (u32 *)devp->regs + BAND2_OFFSET + GAIN_OFFSET + LEFT_OFFSET);
+
+    //Switch the new gain in on a sample boundary
+    HA_auto_commit(devp);
+
+    mutex_unlock(&devp->lock);
+
+    HA_record_latency(devp, STAT_BAND2_LEFT, 1, start, parsed);
 
     return count;
 }
@@ -672,46 +1209,41 @@ static ssize_t band3_gain_show_left(struct device *dev, struct device_attribute
 {
     fe_HA_dev_t *devp = (fe_HA_dev_t *)dev_get_drvdata(dev);
 
-    //Copy the name into the output buffer
-    //sprintf(buf, "%d\n", fe_HA_devp->threshold);
-    fp_to_string(buf, devp->band3_gain_left);
-
-    strcat2(buf, "\n");
+    HA_sync_shadow(devp);
 
-    //Return the length of the buffer so it will print in the console
-    return strlen(buf);
+    //Copy the value into the output buffer and return its length so it will print in the console
+    return fe_fixed_show(buf, devp->gain_left[BAND3_OFFSET], FE_SQ16);
 }
 
 static ssize_t band3_gain_store_left(struct device *dev, struct device_attribute *attr, const char *buf, size_t count)
 {
+    ktime_t start = ktime_get();
+    ktime_t parsed;
     uint32_t tempValue = 0;
-
-    char substring[80];
-    int substring_count = 0;
-    int i;
+    int status;
 
     fe_HA_dev_t *devp = (fe_HA_dev_t *)dev_get_drvdata(dev);
 
-    for (i = 0; i < count; i++)
-    {
-        //If its not a space or a comma, add the digit to the substring
-        if ((buf[i] != ',') && (buf[i] != ' ') && (buf[i] != '\0') && (buf[i] != '\r') && (buf[i] != '\n'))
-        {
-            substring[substring_count] = buf[i];
-            substring_count++;
-        }
-    }
-
-    substring[substring_count] = '\0';
-
     //Convert the buffer to a fixed point value
-    tempValue = set_fixed_num(substring);
+    status = fe_fixed_from_string(buf, count, FE_SQ16, &tempValue);
+    if (status)
+        return status;
+    parsed = ktime_get();
+
+    mutex_lock(&devp->lock);
 
     //Write the value into the shadow register
-    devp->band3_gain_left = tempValue;
+    devp->gain_left[BAND3_OFFSET] = tempValue;
 
     //Write the value into the hardware
-    iowrite32(devp->band3_gain_left, (u32 *)devp->regs + BAND3_OFFSET + GAIN_OFFSET + LEFT_OFFSET);
+    iowrite32(devp->gain_left[BAND3_OFFSET], (u32 *)devp->regs + BAND3_OFFSET + GAIN_OFFSET + LEFT_OFFSET);
+
+    //Switch the new gain in on a sample boundary
+    HA_auto_commit(devp);
+
+    mutex_unlock(&devp->lock);
+
+    HA_record_latency(devp, STAT_BAND3_LEFT, 1, start, parsed);
 
     return count;
 }
@@ -722,46 +1254,41 @@ static ssize_t band4_gain_show_left(struct device *dev, struct device_attribute
 {
     fe_HA_dev_t *devp = (fe_HA_dev_t *)dev_get_drvdata(dev);
 
-    //Copy the name into the output buffer
-    //sprintf(buf, "%d\n", fe_HA_devp->threshold);
-    fp_to_string(buf, devp->band4_gain_left);
-
-    strcat2(buf, "\n");
+    HA_sync_shadow(devp);
 
-    //Return the length of the buffer so it will print in the console
-    return strlen(buf);
+    //Copy the value into the output buffer and return its length so it will print in the console
+    return fe_fixed_show(buf, devp->gain_left[BAND4_OFFSET], FE_SQ16);
 }
 
 static ssize_t band4_gain_store_left(struct device *dev, struct device_attribute *attr, const char *buf, size_t count)
 {
+    ktime_t start = ktime_get();
+    ktime_t parsed;
     uint32_t tempValue = 0;
-
-    char substring[80];
-    int substring_count = 0;
-    int i;
+    int status;
 
     fe_HA_dev_t *devp = (fe_HA_dev_t *)dev_get_drvdata(dev);
 
-    for (i = 0; i < count; i++)
-    {
-        //If its not a space or a comma, add the digit to the substring
-        if ((buf[i] != ',') && (buf[i] != ' ') && (buf[i] != '\0') && (buf[i] != '\r') && (buf[i] != '\n'))
-        {
-            substring[substring_count] = buf[i];
-            substring_count++;
-        }
-    }
-
-    substring[substring_count] = '\0';
-
     //Convert the buffer to a fixed point value
-    tempValue = set_fixed_num(substring);
+    status = fe_fixed_from_string(buf, count, FE_SQ16, &tempValue);
+    if (status)
+        return status;
+    parsed = ktime_get();
+
+    mutex_lock(&devp->lock);
 
     //Write the value into the shadow register
-    devp->band4_gain_left = tempValue;
+    devp->gain_left[BAND4_OFFSET] = tempValue;
 
     //Write the value into the hardware
-    iowrite32(devp->band4_gain_left, (u32 *)devp->regs + BAND4_OFFSET + GAIN_OFFSET + LEFT_OFFSET);
+    iowrite32(devp->gain_left[BAND4_OFFSET], (u32 *)devp->regs + BAND4_OFFSET + GAIN_OFFSET + LEFT_OFFSET);
+
+    //Switch the new gain in on a sample boundary
+    HA_auto_commit(devp);
+
+    mutex_unlock(&devp->lock);
+
+    HA_record_latency(devp, STAT_BAND4_LEFT, 1, start, parsed);
 
     return count;
 }
@@ -772,46 +1299,41 @@ static ssize_t gain_all_show_left(struct device *dev, struct device_attribute *a
 {
     fe_HA_dev_t *devp = (fe_HA_dev_t *)dev_get_drvdata(dev);
 
-    //Copy the name into the output buffer
-    //sprintf(buf, "%d\n", fe_HA_devp->threshold);
-    fp_to_string(buf, devp->gain_all_left);
-
-    strcat2(buf, "\n");
+    HA_sync_shadow(devp);
 
-    //Return the length of the buffer so it will print in the console
-    return strlen(buf);
+    //Copy the value into the output buffer and return its length so it will print in the console
+    return fe_fixed_show(buf, devp->gain_left[BAND_ALL_OFFSET], FE_SQ16);
 }
 
 static ssize_t gain_all_store_left(struct device *dev, struct device_attribute *attr, const char *buf, size_t count)
 {
+    ktime_t start = ktime_get();
+    ktime_t parsed;
     uint32_t tempValue = 0;
-
-    char substring[80];
-    int substring_count = 0;
-    int i;
+    int status;
 
     fe_HA_dev_t *devp = (fe_HA_dev_t *)dev_get_drvdata(dev);
 
-    for (i = 0; i < count; i++)
-    {
-        //If its not a space or a comma, add the digit to the substring
-        if ((buf[i] != ',') && (buf[i] != ' ') && (buf[i] != '\0') && (buf[i] != '\r') && (buf[i] != '\n'))
-        {
-            substring[substring_count] = buf[i];
-            substring_count++;
-        }
-    }
-
-    substring[substring_count] = '\0';
-
     //Convert the buffer to a fixed point value
-    tempValue = set_fixed_num(substring);
+    status = fe_fixed_from_string(buf, count, FE_SQ16, &tempValue);
+    if (status)
+        return status;
+    parsed = ktime_get();
+
+    mutex_lock(&devp->lock);
 
     //Write the value into the shadow register
-    devp->gain_all_left = tempValue;
+    devp->gain_left[BAND_ALL_OFFSET] = tempValue;
 
     //Write the value into the hardware
-    iowrite32(devp->gain_all_left, (u32 *)devp->regs + BAND_ALL_OFFSET + GAIN_OFFSET + LEFT_OFFSET);
+    iowrite32(devp->gain_left[BAND_ALL_OFFSET], (u32 *)devp->regs + BAND_ALL_OFFSET + GAIN_OFFSET + LEFT_OFFSET);
+
+    //Switch the new gain in on a sample boundary
+    HA_auto_commit(devp);
+
+    mutex_unlock(&devp->lock);
+
+    HA_record_latency(devp, STAT_GAIN_ALL_LEFT, 1, start, parsed);
 
     return count;
 }
@@ -822,46 +1344,41 @@ static ssize_t band1_gain_show_right(struct device *dev, struct device_attribute
 {
     fe_HA_dev_t *devp = (fe_HA_dev_t *)dev_get_drvdata(dev);
 
-    //Copy the name into the output buffer
-    //sprintf(buf, "%d\n", fe_HA_devp->threshold);
-    fp_to_string(buf, devp->band1_gain_right);
-
-    strcat2(buf, "\n");
+    HA_sync_shadow(devp);
 
-    //Return the length of the buffer so it will print in the console
-    return strlen(buf);
+    //Copy the value into the output buffer and return its length so it will print in the console
+    return fe_fixed_show(buf, devp->gain_right[BAND1_OFFSET], FE_SQ16);
 }
 
 static ssize_t band1_gain_store_right(struct device *dev, struct device_attribute *attr, const char *buf, size_t count)
 {
+    ktime_t start = ktime_get();
+    ktime_t parsed;
     uint32_t tempValue = 0;
-
-    char substring[80];
-    int substring_count = 0;
-    int i;
+    int status;
 
     fe_HA_dev_t *devp = (fe_HA_dev_t *)dev_get_drvdata(dev);
 
-    for (i = 0; i < count; i++)
-    {
-        //If its not a space or a comma, add the digit to the substring
-        if ((buf[i] != ',') && (buf[i] != ' ') && (buf[i] != '\0') && (buf[i] != '\r') && (buf[i] != '\n'))
-        {
-            substring[substring_count] = buf[i];
-            substring_count++;
-        }
-    }
-
-    substring[substring_count] = '\0';
-
     //Convert the buffer to a fixed point value
-    tempValue = set_fixed_num(substring);
+    status = fe_fixed_from_string(buf, count, FE_SQ16, &tempValue);
+    if (status)
+        return status;
+    parsed = ktime_get();
+
+    mutex_lock(&devp->lock);
 
     //Write the value into the shadow register
-    devp->band1_gain_right = tempValue;
+    devp->gain_right[BAND1_OFFSET] = tempValue;
 
     //Write the value into the hardware
-    iowrite32(devp->band1_gain_right, (u32 *)devp->regs + BAND1_OFFSET + GAIN_OFFSET + RIGHT_OFFSET);
+    iowrite32(devp->gain_right[BAND1_OFFSET], (u32 *)devp->regs + BAND1_OFFSET + GAIN_OFFSET + RIGHT_OFFSET);
+
+    //Switch the new gain in on a sample boundary
+    HA_auto_commit(devp);
+
+    mutex_unlock(&devp->lock);
+
+    HA_record_latency(devp, STAT_BAND1_RIGHT, 1, start, parsed);
 
     return count;
 }
@@ -875,46 +1392,41 @@ static ssize_t band2_gain_show_right(struct device *dev, struct device_attribute
 {
     fe_HA_dev_t *devp = (fe_HA_dev_t *)dev_get_drvdata(dev);
 
-    //Copy the name into the output buffer
-    //sprintf(buf, "%d\n", fe_HA_devp->threshold);
-    fp_to_string(buf, devp->band2_gain_right);
-
-    strcat2(buf, "\n");
+    HA_sync_shadow(devp);
 
-    //Return the length of the buffer so it will print in the console
-    return strlen(buf);
+    //Copy the value into the output buffer and return its length so it will print in the console
+    return fe_fixed_show(buf, devp->gain_right[BAND2_OFFSET], FE_SQ16);
 }
 
 static ssize_t band2_gain_store_right(struct device *dev, struct device_attribute *attr, const char *buf, size_t count)
 {
+    ktime_t start = ktime_get();
+    ktime_t parsed;
     uint32_t tempValue = 0;
-
-    char substring[80];
-    int substring_count = 0;
-    int i;
+    int status;
 
     fe_HA_dev_t *devp = (fe_HA_dev_t *)dev_get_drvdata(dev);
 
-    for (i = 0; i < count; i++)
-    {
-        //If its not a space or a comma, add the digit to the substring
-        if ((buf[i] != ',') && (buf[i] != ' ') && (buf[i] != '\0') && (buf[i] != '\r') && (buf[i] != '\n'))
-        {
-            substring[substring_count] = buf[i];
-            substring_count++;
-        }
-    }
-
-    substring[substring_count] = '\0';
-
     //Convert the buffer to a fixed point value
-    tempValue = set_fixed_num(substring);
+    status = fe_fixed_from_string(buf, count, FE_SQ16, &tempValue);
+    if (status)
+        return status;
+    parsed = ktime_get();
+
+    mutex_lock(&devp->lock);
 
     //Write the value into the shadow register
-    devp->band2_gain_right = tempValue;
+    devp->gain_right[BAND2_OFFSET] = tempValue;
 
     //Write the value into the hardware
-    iowrite32(devp->band2_gain_right, (u32 *)devp->regs + BAND2_OFFSET + GAIN_OFFSET + RIGHT_OFFSET);
+    iowrite32(devp->gain_right[BAND2_OFFSET], (u32 *)devp->regs + BAND2_OFFSET + GAIN_OFFSET + RIGHT_OFFSET);
+
+    //Switch the new gain in on a sample boundary
+    HA_auto_commit(devp);
+
+    mutex_unlock(&devp->lock);
+
+    HA_record_latency(devp, STAT_BAND2_RIGHT, 1, start, parsed);
 
     return count;
 }
@@ -925,46 +1437,41 @@ static ssize_t band3_gain_show_right(struct device *dev, struct device_attribute
 {
     fe_HA_dev_t *devp = (fe_HA_dev_t *)dev_get_drvdata(dev);
 
-    //Copy the name into the output buffer
-    //sprintf(buf, "%d\n", fe_HA_devp->threshold);
-    fp_to_string(buf, devp->band3_gain_right);
+    HA_sync_shadow(devp);
 
-    strcat2(buf, "\n");
-
-    //Return the length of the buffer so it will print in the console
-    return strlen(buf);
+    //Copy the value into the output buffer and return its length so it will print in the console
+    return fe_fixed_show(buf, devp->gain_right[BAND3_OFFSET], FE_SQ16);
 }
 
 static ssize_t band3_gain_store_right(struct device *dev, struct device_attribute *attr, const char *buf, size_t count)
 {
+    ktime_t start = ktime_get();
+    ktime_t parsed;
     uint32_t tempValue = 0;
-
-    char substring[80];
-    int substring_count = 0;
-    int i;
+    int status;
 
     fe_HA_dev_t *devp = (fe_HA_dev_t *)dev_get_drvdata(dev);
 
-    for (i = 0; i < count; i++)
-    {
-        //If its not a space or a comma, add the digit to the substring
-        if ((buf[i] != ',') && (buf[i] != ' ') && (buf[i] != '\0') && (buf[i] != '\r') && (buf[i] != '\n'))
-        {
-            substring[substring_count] = buf[i];
-            substring_count++;
-        }
-    }
-
-    substring[substring_count] = '\0';
-
     //Convert the buffer to a fixed point value
-    tempValue = set_fixed_num(substring);
+    status = fe_fixed_from_string(buf, count, FE_SQ16, &tempValue);
+    if (status)
+        return status;
+    parsed = ktime_get();
+
+    mutex_lock(&devp->lock);
 
     //Write the value into the shadow register
-    devp->band3_gain_right = tempValue;
+    devp->gain_right[BAND3_OFFSET] = tempValue;
 
     //Write the value into the hardware
-    iowrite32(devp->band3_gain_right, (u32 *)devp->regs + BAND3_OFFSET + GAIN_OFFSET + RIGHT_OFFSET);
+    iowrite32(devp->gain_right[BAND3_OFFSET], (u32 *)devp->regs + BAND3_OFFSET + GAIN_OFFSET + RIGHT_OFFSET);
+
+    //Switch the new gain in on a sample boundary
+    HA_auto_commit(devp);
+
+    mutex_unlock(&devp->lock);
+
+    HA_record_latency(devp, STAT_BAND3_RIGHT, 1, start, parsed);
 
     return count;
 }
@@ -975,46 +1482,41 @@ static ssize_t band4_gain_show_right(struct device *dev, struct device_attribute
 {
     fe_HA_dev_t *devp = (fe_HA_dev_t *)dev_get_drvdata(dev);
 
-    //Copy the name into the output buffer
-    //sprintf(buf, "%d\n", fe_HA_devp->threshold);
-    fp_to_string(buf, devp->band4_gain_right);
-
-    strcat2(buf, "\n");
+    HA_sync_shadow(devp);
 
-    //Return the length of the buffer so it will print in the console
-    return strlen(buf);
+    //Copy the value into the output buffer and return its length so it will print in the console
+    return fe_fixed_show(buf, devp->gain_right[BAND4_OFFSET], FE_SQ16);
 }
 
 static ssize_t band4_gain_store_right(struct device *dev, struct device_attribute *attr, const char *buf, size_t count)
 {
+    ktime_t start = ktime_get();
+    ktime_t parsed;
     uint32_t tempValue = 0;
-
-    char substring[80];
-    int substring_count = 0;
-    int i;
+    int status;
 
     fe_HA_dev_t *devp = (fe_HA_dev_t *)dev_get_drvdata(dev);
 
-    for (i = 0; i < count; i++)
-    {
-        //If its not a space or a comma, add the digit to the substring
-        if ((buf[i] != ',') && (buf[i] != ' ') && (buf[i] != '\0') && (buf[i] != '\r') && (buf[i] != '\n'))
-        {
-            substring[substring_count] = buf[i];
-            substring_count++;
-        }
-    }
-
-    substring[substring_count] = '\0';
-
     //Convert the buffer to a fixed point value
-    tempValue = set_fixed_num(substring);
+    status = fe_fixed_from_string(buf, count, FE_SQ16, &tempValue);
+    if (status)
+        return status;
+    parsed = ktime_get();
+
+    mutex_lock(&devp->lock);
 
     //Write the value into the shadow register
-    devp->band4_gain_right = tempValue;
+    devp->gain_right[BAND4_OFFSET] = tempValue;
 
     //Write the value into the hardware
-    iowrite32(devp->band4_gain_right, (u32 *)devp->regs + BAND4_OFFSET + GAIN_OFFSET + RIGHT_OFFSET);
+    iowrite32(devp->gain_right[BAND4_OFFSET], (u32 *)devp->regs + BAND4_OFFSET + GAIN_OFFSET + RIGHT_OFFSET);
+
+    //Switch the new gain in on a sample boundary
+    HA_auto_commit(devp);
+
+    mutex_unlock(&devp->lock);
+
+    HA_record_latency(devp, STAT_BAND4_RIGHT, 1, start, parsed);
 
     return count;
 }
@@ -1025,245 +1527,392 @@ static ssize_t gain_all_show_right(struct device *dev, struct device_attribute *
 {
     fe_HA_dev_t *devp = (fe_HA_dev_t *)dev_get_drvdata(dev);
 
-    //Copy the name into the output buffer
-    //sprintf(buf, "%d\n", fe_HA_devp->threshold);
-    fp_to_string(buf, devp->gain_all_right);
-
-    strcat2(buf, "\n");
+    HA_sync_shadow(devp);
 
-    //Return the length of the buffer so it will print in the console
-    return strlen(buf);
+    //Copy the value into the output buffer and return its length so it will print in the console
+    return fe_fixed_show(buf, devp->gain_right[BAND_ALL_OFFSET], FE_SQ16);
 }
 
 static ssize_t gain_all_store_right(struct device *dev, struct device_attribute *attr, const char *buf, size_t count)
 {
+    ktime_t start = ktime_get();
+    ktime_t parsed;
     uint32_t tempValue = 0;
-
-    char substring[80];
-    int substring_count = 0;
-    int i;
+    int status;
 
     fe_HA_dev_t *devp = (fe_HA_dev_t *)dev_get_drvdata(dev);
 
-    for (i = 0; i < count; i++)
+    //Convert the buffer to a fixed point value
+    status = fe_fixed_from_string(buf, count, FE_SQ16, &tempValue);
+    if (status)
+        return status;
+    parsed = ktime_get();
+
+    mutex_lock(&devp->lock);
+
+    //Write the value into the shadow register
+    devp->gain_right[BAND_ALL_OFFSET] = tempValue;
+
+    //Write the value into the hardware
+    iowrite32(devp->gain_right[BAND_ALL_OFFSET], (u32 *)devp->regs + BAND_ALL_OFFSET + GAIN_OFFSET + RIGHT_OFFSET);
+
+    //Switch the new gain in on a sample boundary
+    HA_auto_commit(devp);
+
+    mutex_unlock(&devp->lock);
+
+    HA_record_latency(devp, STAT_GAIN_ALL_RIGHT, 1, start, parsed);
+
+    return count;
+}
+
+
+//---------------------------------------------------------------
+
+/** Write the gains of one channel into the shadow registers and the hardware
+
+    @param devp Pointer to the driver instance
+    @param channel LEFT_OFFSET or RIGHT_OFFSET
+    @param gains NUM_BANDS gains in register order (BAND_ALL_OFFSET..BAND4_OFFSET)
+*/
+static void HA_write_gains(fe_HA_dev_t *devp, int channel, const u32 *gains)
+{
+    u32 *shadow = (channel == LEFT_OFFSET) ? devp->gain_left : devp->gain_right;
+    int band;
+
+    for (band = BAND_ALL_OFFSET; band < NUM_BANDS; band++)
     {
-        //If its not a space or a comma, add the digit to the substring
-        if ((buf[i] != ',') && (buf[i] != ' ') && (buf[i] != '\0') && (buf[i] != '\r') && (buf[i] != '\n'))
-        {
-            substring[substring_count] = buf[i];
-            substring_count++;
-        }
+        //Write the value into the shadow register
+        shadow[band] = gains[band];
+
+        //Write the value into the hardware
+        iowrite32(shadow[band], (u32 *)devp->regs + band + GAIN_OFFSET + channel);
     }
+}
 
-    substring[substring_count] = '\0';
+static ssize_t gains_show_left(struct device *dev, struct device_attribute *attr, char *buf)
+{
+    fe_HA_dev_t *devp = (fe_HA_dev_t *)dev_get_drvdata(dev);
 
-    //Convert the buffer to a fixed point value
-    tempValue = set_fixed_num(substring);
+    HA_sync_shadow(devp);
 
-    //Write the value into the shadow register
-    devp->gain_all_right = tempValue;
+    //Copy the values into the output buffer and return its length so it will print in the console
+    return fe_fixed_show_vector(buf, devp->gain_left, NUM_BANDS, FE_SQ16);
+}
 
-    //Write the value into the hardware
-    iowrite32(devp->gain_all_right, (u32 *)devp->regs + BAND_ALL_OFFSET + GAIN_OFFSET + RIGHT_OFFSET);
+static ssize_t gains_store_left(struct device *dev, struct device_attribute *attr, const char *buf, size_t count)
+{
+    ktime_t start = ktime_get();
+    ktime_t parsed;
+    u32 gains[NUM_BANDS];
+    int num_gains;
+
+    fe_HA_dev_t *devp = (fe_HA_dev_t *)dev_get_drvdata(dev);
+
+    //Convert the buffer to one fixed point value per band, nothing is written unless every band is given
+    num_gains = fe_fixed_parse_vector(buf, count, FE_SQ16, gains, NUM_BANDS);
+    if (num_gains < 0)
+        return num_gains;
+    if (num_gains != NUM_BANDS)
+        return -EINVAL;
+    parsed = ktime_get();
+
+    mutex_lock(&devp->lock);
+    HA_write_gains(devp, LEFT_OFFSET, gains);
+    HA_auto_commit(devp);
+    mutex_unlock(&devp->lock);
+
+    HA_record_latency(devp, STAT_GAINS_LEFT, num_gains, start, parsed);
+
+    return count;
+}
+
+//---------------------------------------------------------------
+
+static ssize_t gains_show_right(struct device *dev, struct device_attribute *attr, char *buf)
+{
+    fe_HA_dev_t *devp = (fe_HA_dev_t *)dev_get_drvdata(dev);
+
+    HA_sync_shadow(devp);
+
+    //Copy the values into the output buffer and return its length so it will print in the console
+    return fe_fixed_show_vector(buf, devp->gain_right, NUM_BANDS, FE_SQ16);
+}
+
+static ssize_t gains_store_right(struct device *dev, struct device_attribute *attr, const char *buf, size_t count)
+{
+    ktime_t start = ktime_get();
+    ktime_t parsed;
+    u32 gains[NUM_BANDS];
+    int num_gains;
+
+    fe_HA_dev_t *devp = (fe_HA_dev_t *)dev_get_drvdata(dev);
+
+    //Convert the buffer to one fixed point value per band, nothing is written unless every band is given
+    num_gains = fe_fixed_parse_vector(buf, count, FE_SQ16, gains, NUM_BANDS);
+    if (num_gains < 0)
+        return num_gains;
+    if (num_gains != NUM_BANDS)
+        return -EINVAL;
+    parsed = ktime_get();
+
+    mutex_lock(&devp->lock);
+    HA_write_gains(devp, RIGHT_OFFSET, gains);
+    HA_auto_commit(devp);
+    mutex_unlock(&devp->lock);
+
+    HA_record_latency(devp, STAT_GAINS_RIGHT, num_gains, start, parsed);
 
     return count;
 }
 
 //---------------------------------------------------------------
 
-char *strcat2(char *dst, char *src)
+static ssize_t gains_show_all(struct device *dev, struct device_attribute *attr, char *buf)
+{
+    u32 gains[2 * NUM_BANDS];
+
+    fe_HA_dev_t *devp = (fe_HA_dev_t *)dev_get_drvdata(dev);
+
+    HA_sync_shadow(devp);
+
+    //Left channel first, then the right channel
+    memcpy(&gains[0], devp->gain_left, sizeof(devp->gain_left));
+    memcpy(&gains[NUM_BANDS], devp->gain_right, sizeof(devp->gain_right));
+
+    //Copy the values into the output buffer and return its length so it will print in the console
+    return fe_fixed_show_vector(buf, gains, 2 * NUM_BANDS, FE_SQ16);
+}
+
+static ssize_t gains_store_all(struct device *dev, struct device_attribute *attr, const char *buf, size_t count)
 {
-    char *cp = dst;
+    ktime_t start = ktime_get();
+    ktime_t parsed;
+    u32 gains[2 * NUM_BANDS];
+    int num_gains;
+
+    fe_HA_dev_t *devp = (fe_HA_dev_t *)dev_get_drvdata(dev);
 
-    while (*cp)
-        cp++; /* find end of dst */
+    //Convert the buffer to one fixed point value per band and channel, nothing is written unless every one is given
+    num_gains = fe_fixed_parse_vector(buf, count, FE_SQ16, gains, 2 * NUM_BANDS);
+    if (num_gains < 0)
+        return num_gains;
+    if (num_gains != 2 * NUM_BANDS)
+        return -EINVAL;
+    parsed = ktime_get();
 
-    while (( *cp++ = *src++ ) != 0); /* Copy src to end of dst */
+    mutex_lock(&devp->lock);
+    HA_write_gains(devp, LEFT_OFFSET, &gains[0]);
+    HA_write_gains(devp, RIGHT_OFFSET, &gains[NUM_BANDS]);
 
-    return dst; /* return dst */
+    //Both channels switch in on the same sample
+    HA_auto_commit(devp);
+    mutex_unlock(&devp->lock);
+
+    HA_record_latency(devp, STAT_GAINS_ALL, num_gains, start, parsed);
+
+    return count;
 }
 
-/** Convert a string to a fixed point number structure
-    @param s String containing the string to convert to 32F16 representation
-    @return SUCCESS
+//---------------------------------------------------------------
 
-    @todo This function is really ugly and could be cleaned up to make it clear what is happening....
+/** Copy the pending gains to the gains in use on the next sample
+
+    @param devp Pointer to the driver instance
 */
-uint32_t set_fixed_num(const char *s)
+static void HA_commit(fe_HA_dev_t *devp)
 {
-    struct fixed_num num = {0, 0, 0};
-    int seen_point = 0;
-    int pointIndex;
-    int i;
-    int ii;
-    int frac_comp;
-    uint32_t acc = 0;
-    char s2[80];
-    int pointsSeen = 0;
-    int charIndex = 0;
-
-    //If no leading 0, add one (eg: .25 -> 0.25)
-    if (s[0] == '.')
-    {
-        s2[0] = '0';
-        charIndex++;
-    }
+    iowrite32(CONTROL_HOLD | CONTROL_COMMIT, (u32 *)devp->regs + CONTROL_OFFSET);
+}
 
-    //This is a strcpy() to move the data a "const char *" to a "char *" and validate the data
-    for (i = 0; i < strlen(s); i++)
-    {
-        //Make sure the string contains an non-valid char (eg: not a number or a decimal point)
-        if ((s[i] == '.') || (s[i] >= '0' && s[i] <= '9'))
-        {
-            //Copy the data over and increment the pointer
-            s2[charIndex] = s[i];
-            charIndex++;
-        }
-        else
-        {
-            pr_info("Invalid char (c:%c x:%X) in number %s\n", s[i], s[i], s);
-            return 0x00000000;
-        }
+/** Commit the pending gains if the driver is committing every write
 
-        //Count the number of decimals in the string
-        if (s[i] == '.')
-            pointsSeen++;
-    }
+    @param devp Pointer to the driver instance
+*/
+static void HA_auto_commit(fe_HA_dev_t *devp)
+{
+    if (devp->auto_commit)
+        HA_commit(devp);
+}
 
-    //If multiple decimals points in the number (eg: 1.1.4)
-    if (pointsSeen > 1)
-        pr_info("Invalid number format: %s", s);
+static ssize_t commit_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+    fe_HA_dev_t *devp = (fe_HA_dev_t *)dev_get_drvdata(dev);
+    u32 control;
 
-    //Turn 1 into 1.0
-    /*
-        if (pointsSeen == 0)
-        {
-            strcat2(s2,".0");
-            i=i+2;
-        }
-    */
+    //1 while a commit is waiting for the next sample
+    control = ioread32((u32 *)devp->regs + CONTROL_OFFSET);
 
-    //Make sure the string is terminated
-    s2[i] = '\0';
+    return sprintf(buf, "%d\n", (control & CONTROL_COMMIT) ? 1 : 0);
+}
 
-    //Count the fractional digits
-    for (pointIndex = 0; pointIndex < strlen(s2); pointIndex++)
-    {
-        if (s2[pointIndex] == '.')
-            break;
-    }
+static ssize_t commit_store(struct device *dev, struct device_attribute *attr, const char *buf, size_t count)
+{
+    unsigned int value;
+    int status;
 
-    //String extend so that the output is accurate
-    while (strlen(s2) - pointIndex < 9)
-        strcat2(s2, "0");
+    fe_HA_dev_t *devp = (fe_HA_dev_t *)dev_get_drvdata(dev);
 
-    //Truncate the string if its longer
-    s2[strlen(s2) - pointIndex + 9] = '\0';
+    status = kstrtouint(buf, 0, &value);
+    if (status)
+        return status;
+    if (value != 1)
+        return -EINVAL;
 
-    //Covert to fixed point
-    for (i = 0; i < 10; i++)
-    {
-        if (s2[i] == '.')
-        {
-            seen_point = 1;
-            continue;
-        }
-        if (!seen_point)
-        {
-            num.integer *= 10;
-            num.integer += (int)(s2[i] - '0');
-        }
-        else
-        {
-            num.fraction_len++;
-            num.fraction *= 10;
-            num.fraction += (int)(s2[i] - '0');
-        }
-    }
+    //Don't commit in the middle of a vector store or a FE_HA_IOC_SET_GAINS batch
+    mutex_lock(&devp->lock);
+    HA_commit(devp);
+    mutex_unlock(&devp->lock);
 
-    //Turn the fixed point conversion into binary digits
-    for (ii = 0, frac_comp = 1; ii < num.fraction_len; ii++) frac_comp *= 10;
-    frac_comp /= 2;
+    return count;
+}
 
-    // Get the fractional part (f28 hopefully)
-    for (ii = 0; i <= 36; i++)
-    {
-        if (num.fraction >= frac_comp)
-        {
-            acc |= 0x00000001;
-            num.fraction -= frac_comp;
-        }
-        frac_comp /= 2;
+//---------------------------------------------------------------
 
-        acc = acc << 1;
-    }
+static ssize_t auto_commit_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+    fe_HA_dev_t *devp = (fe_HA_dev_t *)dev_get_drvdata(dev);
+
+    return sprintf(buf, "%d\n", devp->auto_commit ? 1 : 0);
+}
+
+static ssize_t auto_commit_store(struct device *dev, struct device_attribute *attr, const char *buf, size_t count)
+{
+    bool value;
+    int status;
+
+    fe_HA_dev_t *devp = (fe_HA_dev_t *)dev_get_drvdata(dev);
+
+    status = kstrtobool(buf, &value);
+    if (status)
+        return status;
 
-    acc = acc >> 12;
+    mutex_lock(&devp->lock);
+    devp->auto_commit = value;
 
-    //Combine the fractional part with the integer
-    acc += num.integer << 16;
+    //Anything staged while auto_commit was off goes in now
+    HA_auto_commit(devp);
+    mutex_unlock(&devp->lock);
 
-    return acc;
+    return count;
 }
 
-/** Function to convert a fp16 to a string representation
-    @todo doesn't handle negative numbers
+//---------------------------------------------------------------
+
+/** Add one gain update to the latency histograms and fire the tracepoint
+
+    @param devp Pointer to the driver instance
+    @param stat Gain update path
+    @param num_gains Number of gains written
+    @param start Time the update entered the driver
+    @param parsed Time the input was converted, the rest is locking and writing the registers
 */
-int fp_to_string(char *buf, uint32_t fp28_num)
+static void HA_record_latency(fe_HA_dev_t *devp, enum HA_stat stat, unsigned int num_gains, ktime_t start, ktime_t parsed)
 {
-    int buf_pos = 0;
-    int i;
-    int fractionPart;
-    //int isNegative = 0;
-    int intPart = 1;
-    int i16 = 0;
+    struct HA_latency *latency = &devp->latency[stat];
+    ktime_t written = ktime_get();
+    u64 parse_ns = ktime_to_ns(ktime_sub(parsed, start));
+    u64 write_ns = ktime_to_ns(ktime_sub(written, parsed));
+    unsigned long flags;
+
+    trace_fe_ha_gain_store(devp->node_name, HA_stat_names[stat], num_gains, parse_ns, write_ns);
+
+    spin_lock_irqsave(&devp->latency_lock, flags);
+    latency->count++;
+    latency->parse[parse_ns ? min(ilog2(parse_ns), HIST_BUCKETS - 1) : 0]++;
+    latency->write[write_ns ? min(ilog2(write_ns), HIST_BUCKETS - 1) : 0]++;
+    latency->parse_max = max(latency->parse_max, parse_ns);
+    latency->write_max = max(latency->write_max, write_ns);
+    spin_unlock_irqrestore(&devp->latency_lock, flags);
+}
 
-    if (fp28_num & 0x80000000)
-    {
-        fp28_num *= -1;
+/** Print one histogram, only the buckets that have counts
 
-        buf[buf_pos] = '-';
-        buf_pos++;
-    }
+    @param s seq_file being printed
+    @param label Which part of the update the histogram times
+    @param hist The histogram buckets
+*/
+static void HA_show_histogram(struct seq_file *s, const char *label, const u32 *hist)
+{
+    int bucket;
 
-    //Convert the integer part
-    i16 = (fp28_num >> 16);
-    while ( (i16 / intPart) > 9)
+    for (bucket = 0; bucket < HIST_BUCKETS; bucket++)
     {
-        intPart *= 10;
+        if (hist[bucket])
+            seq_printf(s, "  %s %10llu - %10llu ns: %u\n", label, 1ULL << bucket, (2ULL << bucket) - 1, hist[bucket]);
     }
+}
+
+/** Show the latency histograms of every gain update path in debugfs
 
-    while (intPart > 0)
+    @param s seq_file being printed
+    @param unused Not used
+    @returns SUCCESS
+*/
+static int HA_latency_show(struct seq_file *s, void *unused)
+{
+    fe_HA_dev_t *devp = (fe_HA_dev_t *)s->private;
+    struct HA_latency latency;
+    unsigned long flags;
+    int stat;
+
+    for (stat = 0; stat < NUM_STATS; stat++)
     {
-        buf[buf_pos] = (char)((i16 / intPart) + '0');
-        buf_pos++;
+        //Take a copy so the printing isn't done with the lock held
+        spin_lock_irqsave(&devp->latency_lock, flags);
+        latency = devp->latency[stat];
+        spin_unlock_irqrestore(&devp->latency_lock, flags);
 
-        i16 = i16 % intPart;
-        intPart = intPart / 10;
-    }
+        if (latency.count == 0)
+            continue;
 
-    //buf[buf_pos] = (char)((fp28_num>>16) + '0');
-    //buf_pos++;
+        seq_printf(s, "%s: count %llu parse_max %llu ns write_max %llu ns\n", HA_stat_names[stat],
+                   latency.count, latency.parse_max, latency.write_max);
+        HA_show_histogram(s, "parse", latency.parse);
+        HA_show_histogram(s, "write", latency.write);
+    }
 
-    buf[buf_pos] = '.';
-    buf_pos++;
+    return 0;
+}
 
-    //Mask the integer bits and dump 1 bit to make the conversion easier....
-    fractionPart = (0x0000FFFF & fp28_num) >> 1; // 32F27 so that 0-9 can fit in the high 5 bits)
+static int HA_latency_open(struct inode *inode, struct file *file)
+{
+    return single_open(file, HA_latency_show, inode->i_private);
+}
 
-    for (i = 0; i < 8; i++)
-    {
-        fractionPart *= 10;
-        buf[buf_pos] = (fractionPart >> 15) + '0';
-        buf_pos++;
-        fractionPart &= 0x00007FFF;
-    }
+/** Any write to the debugfs file clears the histograms */
+static ssize_t HA_latency_write(struct file *file, const char __user *buffer, size_t len, loff_t *offset)
+{
+    fe_HA_dev_t *devp = (fe_HA_dev_t *)((struct seq_file *)file->private_data)->private;
+    unsigned long flags;
 
-    buf[buf_pos] = '\0';
+    spin_lock_irqsave(&devp->latency_lock, flags);
+    memset(devp->latency, 0, sizeof(devp->latency));
+    spin_unlock_irqrestore(&devp->latency_lock, flags);
 
-    return 0;
+    return len;
 }
 
+/** Operations on the debugfs latency file */
+static const struct file_operations fe_HA_latency_fops =
+{
+    .owner = THIS_MODULE,
+    .open = HA_latency_open,
+    .read = seq_read,
+    .write = HA_latency_write,
+    .llseek = seq_lseek,
+    .release = single_release,
+};
+
+/** Create the debugfs entries of one HA, /sys/kernel/debug/fe_HA/<device>/latency
+
+    @param devp Pointer to the driver instance
+*/
+static void HA_debugfs_create(fe_HA_dev_t *devp)
+{
+    devp->debugfs = debugfs_create_dir(devp->node_name, fe_HA_debugfs);
+    debugfs_create_file("latency", 0644, devp->debugfs, devp, &fe_HA_latency_fops);
+}
 
 /** Tell the kernel what the initialization function is */
 module_init(HA_init);
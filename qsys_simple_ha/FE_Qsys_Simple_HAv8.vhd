@@ -88,6 +88,7 @@ architecture rtl of FE_Qsys_Simple_HAv8 is
     avs_s1_writedata 	      : in  std_logic_vector(31 downto 0);
     avs_s1_read 		        : in  std_logic;
     avs_s1_readdata 	      : out std_logic_vector(31 downto 0);
+    sample_strobe           : in  std_logic;
       
     ------------------------------------------------------------
     -- Left And Right Gain Signals
@@ -167,6 +168,7 @@ begin
     avs_s1_writedata 	      => avalon_slave_writedata,
     avs_s1_read 		        => avalon_slave_read,
     avs_s1_readdata 	      => avalon_slave_readdata,
+    sample_strobe           => data_in_left_valid,     -- commit gains at the start of a sample
       
     band1_gain_left         => band1_gain_left_r,
     band2_gain_left         => band2_gain_left_r,
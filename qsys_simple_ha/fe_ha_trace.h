@@ -0,0 +1,54 @@
+/** @file fe_ha_trace.h
+
+    Tracepoints of the FE Qsys Simple HA driver.
+
+    fe_ha:fe_ha_gain_store fires once per gain update from sysfs, /dev or the batch ioctl with the time spent
+    parsing the input and the time spent writing the registers (lock, iowrite32 and commit).  Enable it with
+    echo 1 > /sys/kernel/debug/tracing/events/fe_ha/enable and read the trace buffer with ftrace.
+
+    @copyright 2020 Audio Logic
+*/
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM fe_ha
+
+#if !defined(FE_HA_TRACE_H_) || defined(TRACE_HEADER_MULTI_READ)
+#define FE_HA_TRACE_H_
+
+#include <linux/tracepoint.h>
+
+TRACE_EVENT(fe_ha_gain_store,
+
+    TP_PROTO(const char *device, const char *attr, unsigned int num_gains, s64 parse_ns, s64 write_ns),
+
+    TP_ARGS(device, attr, num_gains, parse_ns, write_ns),
+
+    TP_STRUCT__entry(
+        __string(device, device)
+        __string(attr, attr)
+        __field(unsigned int, num_gains)
+        __field(s64, parse_ns)
+        __field(s64, write_ns)
+    ),
+
+    TP_fast_assign(
+        __assign_str(device, device);
+        __assign_str(attr, attr);
+        __entry->num_gains = num_gains;
+        __entry->parse_ns = parse_ns;
+        __entry->write_ns = write_ns;
+    ),
+
+    TP_printk("%s %s gains=%u parse=%lldns write=%lldns", __get_str(device), __get_str(attr),
+              __entry->num_gains, __entry->parse_ns, __entry->write_ns)
+);
+
+#endif
+
+// The trace header lives next to the driver rather than in include/trace/events
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE fe_ha_trace
+
+#include <trace/define_trace.h>
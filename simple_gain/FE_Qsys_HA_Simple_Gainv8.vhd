@@ -10,10 +10,24 @@
 -- Tool versions: 
 -- Description:     Hearing Aid Qsys Block with DRC that exports control to top level 
 --
+--                  The gains are double buffered.  Avalon writes go to the pending bank (the
+--                  registers that are read back) and the exported gains come from the active
+--                  bank.  The control register at address "0111" has:
+--                    bit 0 (hold):   '0' the active bank follows the pending bank (each write
+--                                    takes effect right away), '1' the active bank is held
+--                    bit 1 (commit): write '1' to copy the whole pending bank into the active
+--                                    bank on the next sample_strobe, reads '1' until it's done
+--                  so a full parameter set can be written at bus speed and switched in on one
+--                  sample boundary.
+--                  sample_strobe has to be a one clock pulse per audio sample (eg: the left
+--                  valid of the stream, as FE_Qsys_Simple_HAv8 does).  It has no default: tied
+--                  to '1' a commit would land on any clock instead of a sample boundary.
+--
 -- Dependencies: 
 --
 -- Revision: 
 -- Revision 0.01 - File Created
+-- Revision 0.02 - Double buffered gains with hold/commit control register
 -- Additional Comments: 
 --
 ----------------------------------------------------------------------------------
@@ -35,6 +49,11 @@ entity FE_Qsys_HA_Simple_Gainv8 is
     avs_s1_read 		        : in  std_logic;                       --! Avalon MM Slave read
     avs_s1_readdata 	      : out std_logic_vector(31 downto 0);   --! Avalon MM Slave read data
     ------------------------------------------------------------
+    -- Sample boundary, a commit is applied on the next cycle this is high.
+    -- Required, connect it to the valid of the audio stream.
+    ------------------------------------------------------------
+    sample_strobe               : in  std_logic;
+    ------------------------------------------------------------
     -- Exported control words
     ------------------------------------------------------------       
     band1_gain_left             : out std_logic_vector(31 downto 0);
@@ -63,6 +82,22 @@ architecture behavior of FE_Qsys_HA_Simple_Gainv8 is
   signal band4_gain_right_r     : std_logic_vector(31 downto 0);
   signal gain_all_right_r     : std_logic_vector(31 downto 0);
 
+  -- Active bank, drives the exported gains
+  signal band1_gain_left_a      : std_logic_vector(31 downto 0);
+  signal band2_gain_left_a      : std_logic_vector(31 downto 0);
+  signal band3_gain_left_a      : std_logic_vector(31 downto 0);
+  signal band4_gain_left_a      : std_logic_vector(31 downto 0);
+  signal gain_all_left_a        : std_logic_vector(31 downto 0);
+  signal band1_gain_right_a     : std_logic_vector(31 downto 0);
+  signal band2_gain_right_a     : std_logic_vector(31 downto 0);
+  signal band3_gain_right_a     : std_logic_vector(31 downto 0);
+  signal band4_gain_right_a     : std_logic_vector(31 downto 0);
+  signal gain_all_right_a       : std_logic_vector(31 downto 0);
+
+  -- Control register
+  signal hold_r                 : std_logic;
+  signal commit_pending_r       : std_logic;
+
 
 begin
 
@@ -78,6 +113,7 @@ begin
           when "0010"  => avs_s1_readdata <= band2_gain_left_r;         
           when "0011"  => avs_s1_readdata <= band3_gain_left_r;
           when "0100"  => avs_s1_readdata <= band4_gain_left_r; 
+          when "0111"  => avs_s1_readdata <= (0 => hold_r, 1 => commit_pending_r, others => '0');
           when "1000"  => avs_s1_readdata <= gain_all_right_r;
           when "1001"  => avs_s1_readdata <= band1_gain_right_r; 
           when "1010"  => avs_s1_readdata <= band2_gain_right_r;         
@@ -106,6 +142,7 @@ begin
             band3_gain_right_r    <= x"00010000";  -- W32F16
             band4_gain_right_r    <= x"00010000";  -- W32F16
             gain_all_right_r      <= x"00010000";  -- W32F16
+            hold_r                <= '0';
       elsif rising_edge(clk) and (avs_s1_write = '1') then  -- write the registers
         case avs_s1_address is
           when "0000"  => gain_all_left_r             <= avs_s1_writedata;
@@ -113,6 +150,7 @@ begin
           when "0010"  => band2_gain_left_r           <= avs_s1_writedata;            
           when "0011"  => band3_gain_left_r           <= avs_s1_writedata;
           when "0100"  => band4_gain_left_r           <= avs_s1_writedata;
+          when "0111"  => hold_r                      <= avs_s1_writedata(0);
           when "1000"  => gain_all_right_r            <= avs_s1_writedata;
           when "1001"  => band1_gain_right_r          <= avs_s1_writedata;
           when "1010"  => band2_gain_right_r          <= avs_s1_writedata;            
@@ -123,17 +161,58 @@ begin
       end if;    
     end process;
       
-    band1_gain_left           <= band1_gain_left_r;
-    band2_gain_left           <= band2_gain_left_r;  
-    band3_gain_left           <= band3_gain_left_r;  
-    band4_gain_left           <= band4_gain_left_r;  
-    gain_all_left             <= gain_all_left_r;  
-
-    band1_gain_right          <= band1_gain_right_r;
-    band2_gain_right          <= band2_gain_right_r;  
-    band3_gain_right          <= band3_gain_right_r;  
-    band4_gain_right          <= band4_gain_right_r;  
-    gain_all_right            <= gain_all_right_r; 
+    ------------------------------------------------------------------------
+    -- Commit the pending bank to the active bank
+    ------------------------------------------------------------------------ 
+    process(clk)
+    begin
+      if (reset_n = '0') then
+        band1_gain_left_a     <= x"00010000";  -- W32F16
+        band2_gain_left_a     <= x"00010000";  -- W32F16
+        band3_gain_left_a     <= x"00010000";  -- W32F16
+        band4_gain_left_a     <= x"00010000";  -- W32F16
+        gain_all_left_a       <= x"00010000";  -- W32F16
+        band1_gain_right_a    <= x"00010000";  -- W32F16
+        band2_gain_right_a    <= x"00010000";  -- W32F16
+        band3_gain_right_a    <= x"00010000";  -- W32F16
+        band4_gain_right_a    <= x"00010000";  -- W32F16
+        gain_all_right_a      <= x"00010000";  -- W32F16
+        commit_pending_r      <= '0';
+      elsif rising_edge(clk) then
+        -- Remember a commit request until the next sample boundary
+        if (avs_s1_write = '1') and (avs_s1_address = "0111") and (avs_s1_writedata(1) = '1') then
+          commit_pending_r    <= '1';
+        elsif (sample_strobe = '1') then
+          commit_pending_r    <= '0';
+        end if;
+
+        -- All the gains switch on the same clock, either continuously or on the commit
+        if (hold_r = '0') or ((commit_pending_r = '1') and (sample_strobe = '1')) then
+          band1_gain_left_a   <= band1_gain_left_r;
+          band2_gain_left_a   <= band2_gain_left_r;
+          band3_gain_left_a   <= band3_gain_left_r;
+          band4_gain_left_a   <= band4_gain_left_r;
+          gain_all_left_a     <= gain_all_left_r;
+          band1_gain_right_a  <= band1_gain_right_r;
+          band2_gain_right_a  <= band2_gain_right_r;
+          band3_gain_right_a  <= band3_gain_right_r;
+          band4_gain_right_a  <= band4_gain_right_r;
+          gain_all_right_a    <= gain_all_right_r;
+        end if;
+      end if;
+    end process;
+      
+    band1_gain_left           <= band1_gain_left_a;
+    band2_gain_left           <= band2_gain_left_a;  
+    band3_gain_left           <= band3_gain_left_a;  
+    band4_gain_left           <= band4_gain_left_a;  
+    gain_all_left             <= gain_all_left_a;  
+
+    band1_gain_right          <= band1_gain_right_a;
+    band2_gain_right          <= band2_gain_right_a;  
+    band3_gain_right          <= band3_gain_right_a;  
+    band4_gain_right          <= band4_gain_right_a;  
+    gain_all_right            <= gain_all_right_a; 
       
 end behavior;
 
@@ -159,3 +159,20 @@ set_interface_assignment avalon_slave_0 embeddedsw.configuration.isMemoryDevice
 set_interface_assignment avalon_slave_0 embeddedsw.configuration.isNonVolatileStorage 0
 set_interface_assignment avalon_slave_0 embeddedsw.configuration.isPrintableDevice 0
 
+
+# 
+# connection point sample
+# One clock pulse per audio sample (eg: data_in_left_valid of the stream), a
+# commit is applied on it.  Must be connected or exported, there is no default.
+# 
+add_interface sample conduit end
+set_interface_property sample associatedClock clock
+set_interface_property sample associatedReset ""
+set_interface_property sample ENABLED true
+set_interface_property sample EXPORT_OF ""
+set_interface_property sample PORT_NAME_MAP ""
+set_interface_property sample CMSIS_SVD_VARIABLES ""
+set_interface_property sample SVD_ADDRESS_GROUP ""
+
+add_interface_port sample sample_strobe sample_strobe Input 1
+
@@ -17,6 +17,7 @@ module i2s_clkctrl_apb (
 	input				ext_playback_lrclk,
 	input				ext_capture_lrclk,
 	output				master_slave_mode, // 1 = master, 0 (default) = slave
+	output		[1:0]	tdm_mode, // slots per frame: 0 (default) = 2 (I2S), 1 = 4 (TDM4), 2 = 8 (TDM8)
 	// Clock derived outputs
 	output				clk_sel_48_44, // 1 = mclk derived from 44, 0 (default) mclk derived from 48
 	output				mclk,
@@ -34,6 +35,10 @@ module i2s_clkctrl_apb (
  * mclk_divisor = 0 (divide by (0+1)*2=2) => mclk = 16.9344MHz
  * bclk_divisor = 5 (divide by (5+1)*2=12) => bclk = 2.8224MHz
  * lrclk_divisor = 23 (divide by (23*16+15+1)*2=768 => lrclk = 0.0441MHz
+ *
+ * TDM: lrclk stays a 50% duty cycle word clock at fs, the frame starts one bclk after its falling edge and holds
+ * 4 or 8 slots of 32 bits instead of 2.  bclk has to be slots*32*fs, eg. TDM8 at 48kHz from 24.5760MHz:
+ * bclk_divisor = 0 (divide by 2) => bclk = 12.288MHz, lrclk_divisor = 15 as for I2S.
 */
 
 	reg [31:0]		cmd_reg1;
@@ -42,6 +47,7 @@ module i2s_clkctrl_apb (
 	wire			cmd_sel2 = psel && (paddr == 4);
 	assign 			master_slave_mode = cmd_reg1[0]; // 1 = master, 0 (default) = slave
 	assign			clk_sel_48_44 = cmd_reg1[1]; // 1 = mclk derived from 44, 0 (default) mclk derived from 48
+	assign			tdm_mode = cmd_reg1[3:2]; // slots per frame for the shift registers
 	wire			cmd_reg2_wr = cmd_sel2 & pwrite & penable;
 	// Register access
 	always @(posedge clk or negedge reset_n)
@@ -146,6 +146,7 @@ set_interface_property conduit SVD_ADDRESS_GROUP ""
 add_interface_port conduit playback_lrclk playback_lrclk Output 1
 add_interface_port conduit clk_sel_48_44 clk_sel_48_44 Output 1
 add_interface_port conduit master_slave_mode master_slave_mode Output 1
+add_interface_port conduit tdm_mode tdm_mode Output 2
 add_interface_port conduit bclk bclk Output 1
 add_interface_port conduit capture_lrclk capture_lrclk Output 1
 
@@ -18,6 +18,7 @@ module i2s_core_wrapper (
 	input				ext_playback_lrclk_ckctrl,
 	input				ext_capture_lrclk_ckctrl,
 	output			master_slave_mode_ckctrl, // 1 = master, 0 (default) = slave
+	output	[1:0]	tdm_mode_ckctrl, // slots per frame: 0 = 2 (I2S), 1 = 4 (TDM4), 2 = 8 (TDM8)
 	// Clock derived outputs
 	output			clk_sel_48_44_ckctrl, // 1 = mclk derived from 44, 0 (default) mclk derived from 48
 	output			mclk_ckctrl,
@@ -45,6 +46,7 @@ module i2s_core_wrapper (
 	input 			playback_fifo_clk_opt,
 	// DMA interface, SOCFPGA
 	output 			playback_dma_req_opt,
+	output 			playback_dma_single_opt,
 	input 			playback_dma_ack_opt,
 	output 			playback_dma_enable_opt,
 	// FIFO interface to capture shift register
@@ -55,6 +57,7 @@ module i2s_core_wrapper (
 	input 			capture_fifo_clk_opt,
 	// DMA interface, SOCFPGA
 	output 			capture_dma_req_opt,
+	output 			capture_dma_single_opt,
 	input 			capture_dma_ack_opt,
 	output 			capture_dma_enable_opt
 
@@ -75,6 +78,7 @@ module i2s_core_wrapper (
 		.playback_lrclk     (playback_lrclk_ckctrl),              //   conduit.playback_lrclk
 		.clk_sel_48_44      (clk_sel_48_44_ckctrl),               //          .clk_sel_48_44
 		.master_slave_mode  (master_slave_mode_ckctrl),           //          .master_slave_mode
+		.tdm_mode           (tdm_mode_ckctrl),                    //          .tdm_mode
 		.bclk               (bclk_ckctrl),                        //          .bclk
 		.capture_lrclk      (capture_lrclk_ckctrl),               //          .capture_lrclk
 		.mclk               (mclk_ckctrl),                            //      mclk.clk
@@ -99,6 +103,7 @@ module i2s_core_wrapper (
 		.playback_fifo_clk   (playback_fifo_clk_opt),                   //              .clk
 		.playback_fifo_data  (playback_fifo_data_opt),                  //              .data
 		.playback_dma_req    (playback_dma_req_opt),                    //  playback_dma.req
+		.playback_dma_single (playback_dma_single_opt),                 //              .single
 		.playback_dma_ack    (playback_dma_ack_opt),                    //              .ack
 		.playback_dma_enable (playback_dma_enable_opt),                 //              .enable
 		.capture_fifo_data   (capture_fifo_data_opt),                   //  capture_fifo.data
@@ -107,6 +112,7 @@ module i2s_core_wrapper (
 		.capture_fifo_clk    (capture_fifo_clk_opt),                    //              .clk
 		.capture_fifo_empty  (capture_fifo_empty_opt),                  //              .empty
 		.capture_dma_req     (capture_dma_req_opt),                     //   capture_dma.req
+		.capture_dma_single  (capture_dma_single_opt),                  //              .single
 		.capture_dma_ack     (capture_dma_ack_opt),                     //              .ack
 		.capture_dma_enable  (capture_dma_enable_opt)                   //              .enable
 	);
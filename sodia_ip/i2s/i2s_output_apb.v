@@ -16,7 +16,8 @@ module i2s_output_apb (
 	output wire			playback_fifo_full,
 	input wire			playback_fifo_clk,
 	// DMA interface, SOCFPGA
-	output reg			playback_dma_req,
+	output reg			playback_dma_req, // burst request
+	output reg			playback_dma_single, // single request
 	input wire			playback_dma_ack,
 	output wire			playback_dma_enable,
 	// FIFO interface to capture shift register
@@ -26,7 +27,8 @@ module i2s_output_apb (
 	output wire			capture_fifo_full,
 	input wire			capture_fifo_clk,
 	// DMA interface, SOCFPGA
-	output reg			capture_dma_req,
+	output reg			capture_dma_req, // burst request
+	output reg			capture_dma_single, // single request
 	input wire			capture_dma_ack,
 	output wire			capture_dma_enable
 );
@@ -36,21 +38,28 @@ module i2s_output_apb (
 	reg		[31:0]	wr_fifo_data;
 	wire			wr_fifo_empty;
 	wire			wr_fifo_full;
-	wire	[3:0]	wr_fifo_used;
+	wire	[4:0]	wr_fifo_used;
+	wire	[5:0]	wr_fifo_free;
 
 	wire			rd_fifo_read;
 	wire			rd_fifo_clear;
 	wire	[31:0]	rd_fifo_data;
 	wire			rd_fifo_empty;
 	wire			rd_fifo_full;
-	wire	[3:0]	rd_fifo_used;
+	wire	[4:0]	rd_fifo_used;
+	wire	[5:0]	rd_fifo_level;
 
 	reg		[31:0]	cmd_reg;
 	reg		[31:0]	sts_reg;
+	reg		[31:0]	wm_reg; // DMA watermarks, [5:0] playback, [21:16] capture
+
+	wire	[5:0]	playback_wm;
+	wire	[5:0]	capture_wm;
 	
 	wire			data_sel = psel && (paddr == 0);
 	wire			sts_sel = psel && (paddr == 4); // RO
 	wire			cmd_sel = psel && (paddr == 8);
+	wire			wm_sel = psel && (paddr == 12);
 
 	// Register access
 	always @(posedge clk or negedge reset_n)
@@ -59,6 +68,7 @@ module i2s_output_apb (
 		begin
 			wr_fifo_data <= 0;
 			cmd_reg <= 0;
+			wm_reg <= 32'h00010001; // one word, like a single request
 		end
 		else
 		begin
@@ -72,6 +82,10 @@ module i2s_output_apb (
 				cmd_reg <= pwdata;
 			else if (cmd_sel & ~pwrite & ~penable) // cmd readback
 				prdata <= cmd_reg;
+			else if (wm_sel & pwrite & penable) // write watermarks
+				wm_reg <= pwdata & 32'h003F003F;
+			else if (wm_sel & ~pwrite & ~penable) // watermark readback
+				prdata <= wm_reg;
 			else
 			begin
 				cmd_reg[0] <= 0; // FIFO clear is just a pulse
@@ -94,7 +108,8 @@ module i2s_output_apb (
 			sts_reg[2] <= playback_dma_enable;
 			sts_reg[3] <= playback_dma_req;
 			sts_reg[4] <= playback_dma_ack;
-			sts_reg[7:5] <= 3'b0;
+			sts_reg[5] <= playback_dma_single;
+			sts_reg[7:6] <= 2'b0;
 			sts_reg[12:8] <= wr_fifo_used;
 			sts_reg[15:13] <= 3'b0;
 			sts_reg[16] <= rd_fifo_empty;
@@ -102,41 +117,60 @@ module i2s_output_apb (
 			sts_reg[18] <= capture_dma_enable;
 			sts_reg[19] <= capture_dma_req;
 			sts_reg[20] <= capture_dma_ack;
-			sts_reg[23:21] <= 3'b0;
+			sts_reg[21] <= capture_dma_single;
+			sts_reg[23:22] <= 2'b0;
 			sts_reg[28:24] <= rd_fifo_used;
 			sts_reg[31:29] <= 3'b0;
 		end
 	end
 
 	// Playback DMA request
+	// A burst is requested once the FIFO has room for watermark words, a single
+	// transfer as long as it isn't full (for the tail of a transfer).
 	always @(posedge clk or negedge reset_n)
 	begin
 		if (~reset_n)
 		begin
 			playback_dma_req <= 0;
+			playback_dma_single <= 0;
 		end
 		else
 		begin
 			if (playback_dma_ack)
+			begin
 				playback_dma_req <= 0;
+				playback_dma_single <= 0;
+			end
 			else
-				playback_dma_req <= playback_dma_enable & ~wr_fifo_full;
+			begin
+				playback_dma_req <= playback_dma_enable & (wr_fifo_free >= playback_wm);
+				playback_dma_single <= playback_dma_enable & ~wr_fifo_full;
+			end
 		end
 	end
 	
 	// Capture DMA request
+	// A burst is requested once the FIFO holds watermark words, a single
+	// transfer as long as it isn't empty.
 	always @(posedge clk or negedge reset_n)
 	begin
 		if (~reset_n)
 		begin
 			capture_dma_req <= 0;
+			capture_dma_single <= 0;
 		end
 		else
 		begin
 			if (capture_dma_ack)
+			begin
 				capture_dma_req <= 0;
+				capture_dma_single <= 0;
+			end
 			else
-				capture_dma_req <= capture_dma_enable & ~rd_fifo_empty;
+			begin
+				capture_dma_req <= capture_dma_enable & (rd_fifo_level >= capture_wm);
+				capture_dma_single <= capture_dma_enable & ~rd_fifo_empty;
+			end
 		end
 	end
 
@@ -149,6 +183,13 @@ module i2s_output_apb (
 	assign rd_fifo_clear = cmd_reg[2];
 	assign capture_dma_enable = cmd_reg[3];
 
+	// Both FIFOs hold 32 words of 32 bits, usedw wraps to 0 when they are full.
+	// A watermark of 0 behaves like 1.
+	assign wr_fifo_free = wr_fifo_full ? 6'd0 : 6'd32 - {1'b0, wr_fifo_used};
+	assign rd_fifo_level = rd_fifo_full ? 6'd32 : {1'b0, rd_fifo_used};
+	assign playback_wm = (wm_reg[5:0] == 0) ? 6'd1 : wm_reg[5:0];
+	assign capture_wm = (wm_reg[21:16] == 0) ? 6'd1 : wm_reg[21:16];
+
 	// APB
 	assign pready = penable; // always ready (no wait states)
 
@@ -137,6 +137,7 @@ set_interface_property playback_dma CMSIS_SVD_VARIABLES ""
 set_interface_property playback_dma SVD_ADDRESS_GROUP ""
 
 add_interface_port playback_dma playback_dma_req req Output 1
+add_interface_port playback_dma playback_dma_single single Output 1
 add_interface_port playback_dma playback_dma_ack ack Input 1
 add_interface_port playback_dma playback_dma_enable enable Output 1
 
@@ -173,6 +174,7 @@ set_interface_property capture_dma CMSIS_SVD_VARIABLES ""
 set_interface_property capture_dma SVD_ADDRESS_GROUP ""
 
 add_interface_port capture_dma capture_dma_req req Output 1
+add_interface_port capture_dma capture_dma_single single Output 1
 add_interface_port capture_dma capture_dma_ack ack Input 1
 add_interface_port capture_dma capture_dma_enable enable Output 1
 
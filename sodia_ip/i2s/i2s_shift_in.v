@@ -3,6 +3,9 @@
  * There will be no writes if not enabled.
  * New values will be written to FIFO only when fifo_ready.  If enabled, but not ready,
  * the last data sample will be dropped.
+ * In TDM4/TDM8 mode the frame starts one bclk after the falling lrclk edge and holds 4 or 8
+ * 32 bit slots.  Even slots go to the left data and odd slots to the right data, a FIFO
+ * word is written after each odd slot.
  */
 module i2s_shift_in (
 	input				clk,				// Master clock, should be synchronous with bclk/lrclk
@@ -13,6 +16,7 @@ module i2s_shift_in (
 	output reg			fifo_write,			// Fifo write strobe, write only when l+r received
 
 	input				enable,				// Software enable
+	input		[1:0]	tdm_mode,			// Slots per frame: 0 = 2 (I2S), 1 = 4 (TDM4), 2 = 8 (TDM8)
 	input				bclk,				// I2S bclk
 	input				lrclk,				// I2S lrclk (word clock)
 	input				data_in				// Data in from ADC
@@ -92,7 +96,37 @@ module i2s_shift_in (
 		end
 	end
 	wire first_bclk_falling_after_lrclk_falling = first_bclk_falling_after_lrclk_falling_r == 2'b11;
-	
+
+	// TDM slot counter, restarted with each frame.  The rising lrclk edge in the middle of a TDM frame is ignored.
+	// The last slot of a frame completes with the start of the next one.
+	wire tdm = tdm_mode != 2'b00;
+	wire [2:0] last_slot = (tdm_mode == 2'b10) ? 3'd7 : 3'd3;
+	reg [4:0] bit_count;
+	reg [2:0] slot;
+	wire slot_done = tdm & bclk_falling_edge & (bit_count == 5'd31) & (slot != last_slot);
+	always @(posedge clk or negedge reset_n)
+	begin
+		if (~reset_n)
+		begin
+			bit_count <= 0;
+			slot <= 0;
+		end
+		else
+		begin
+			if (~enable | first_bclk_falling_after_lrclk_falling)
+			begin
+				bit_count <= 0;
+				slot <= 0;
+			end
+			else if (bclk_falling_edge)
+			begin
+				bit_count <= bit_count + 1'b1;
+				if (slot_done)
+					slot <= slot + 1'b1;
+			end
+		end
+	end
+
 	// shift-register
 	reg [31:0] shift_register;
 	always @(posedge clk or negedge reset_n)
@@ -125,14 +159,18 @@ module i2s_shift_in (
 				fifo_right_data <= 0;
 				fifo_left_data <= 0;
 			end
-			else if (first_bclk_falling_after_lrclk_rising)
+			else if (first_bclk_falling_after_lrclk_rising & ~tdm)
 				fifo_left_data <= shift_register;
 			else if (first_bclk_falling_after_lrclk_falling)
 				fifo_right_data <= shift_register;
+			else if (slot_done & slot[0])
+				fifo_right_data <= shift_register;
+			else if (slot_done)
+				fifo_left_data <= shift_register;
 		end				
 	end
 
-	// fifo write strobe, one clock after right channel has been loaded to output register
+	// fifo write strobe, one clock after right channel (odd slot) has been loaded to output register
 	always @(posedge clk or negedge reset_n)
 	begin
 		if (~reset_n)
@@ -144,7 +182,7 @@ module i2s_shift_in (
 			if (~enable | ~fifo_ready)
 				fifo_write <= 0;
 			else
-				fifo_write <= first_bclk_falling_after_lrclk_falling;
+				fifo_write <= first_bclk_falling_after_lrclk_falling | (slot_done & slot[0]);
 		end
 	end
 
@@ -5,6 +5,9 @@
  * Output is zero if not enabled.
  * New values will be read from FIFO only when fifo_ready.  If enabled, but not ready,
  * the last data sample will be repeated.
+ * In TDM4/TDM8 mode the frame starts one bclk after the falling lrclk edge and holds 4 or 8
+ * 32 bit slots.  Even slots come from the left data and odd slots from the right data, so
+ * each FIFO word carries a pair of slots and is acked after the odd slot is loaded.
  */
 module i2s_shift_out (
 	input				clk,				// Master clock, should be synchronous with bclk/lrclk
@@ -15,6 +18,7 @@ module i2s_shift_out (
 	output reg			fifo_ack,			// Fifo read ack
 
 	input				enable,				// Software enable
+	input		[1:0]	tdm_mode,			// Slots per frame: 0 = 2 (I2S), 1 = 4 (TDM4), 2 = 8 (TDM8)
 	input				bclk,				// I2S bclk
 	input				lrclk,				// I2S lrclk (word clock)
 	output				data_out			// Data out to DAC
@@ -94,7 +98,36 @@ module i2s_shift_out (
 		end
 	end
 	wire first_bclk_falling_after_lrclk_falling = first_bclk_falling_after_lrclk_falling_r == 2'b11;
-	
+
+	// TDM slot counter, restarted with each frame.  The rising lrclk edge in the middle of a TDM frame is ignored.
+	wire tdm = tdm_mode != 2'b00;
+	wire [2:0] last_slot = (tdm_mode == 2'b10) ? 3'd7 : 3'd3;
+	reg [4:0] bit_count;
+	reg [2:0] slot;
+	wire next_slot = tdm & bclk_falling_edge & (bit_count == 5'd31) & (slot != last_slot);
+	always @(posedge clk or negedge reset_n)
+	begin
+		if (~reset_n)
+		begin
+			bit_count <= 0;
+			slot <= 0;
+		end
+		else
+		begin
+			if (~enable | first_bclk_falling_after_lrclk_falling)
+			begin
+				bit_count <= 0;
+				slot <= 0;
+			end
+			else if (bclk_falling_edge)
+			begin
+				bit_count <= bit_count + 1'b1;
+				if (next_slot)
+					slot <= slot + 1'b1;
+			end
+		end
+	end
+
 	// shift-register
 	reg [31:0] shift_register;
 	always @(posedge clk or negedge reset_n)
@@ -107,17 +140,19 @@ module i2s_shift_out (
 		begin
 			if (~enable)
 				shift_register <= 0;
-			else if (first_bclk_falling_after_lrclk_rising)
+			else if (first_bclk_falling_after_lrclk_rising & ~tdm)
 				shift_register <= fifo_right_data;
 			else if (first_bclk_falling_after_lrclk_falling)
 				shift_register <= fifo_left_data;
+			else if (next_slot)
+				shift_register <= slot[0] ? fifo_left_data : fifo_right_data;
 			else if (bclk_falling_edge)
 				shift_register <= {shift_register[30:0], 1'b0};
 		end
 	end
 	assign data_out = shift_register[31];
 
-	// fifo ack, one clock after right channel has been loaded to shift register
+	// fifo ack, one clock after right channel (odd slot) has been loaded to shift register
 	always @(posedge clk or negedge reset_n)
 	begin
 		if (~reset_n)
@@ -128,6 +163,8 @@ module i2s_shift_out (
 		begin
 			if (~enable | ~fifo_ready)
 				fifo_ack <= 0;
+			else if (tdm)
+				fifo_ack <= next_slot & ~slot[0];
 			else
 				fifo_ack <= first_bclk_falling_after_lrclk_rising;
 		end
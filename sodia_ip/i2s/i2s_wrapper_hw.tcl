@@ -282,6 +282,7 @@ set_interface_property capture_dma SVD_ADDRESS_GROUP ""
 add_interface_port capture_dma capture_dma_ack_opt ack Input 1
 add_interface_port capture_dma capture_dma_enable_opt enable Output 1
 add_interface_port capture_dma capture_dma_req_opt req Output 1
+add_interface_port capture_dma capture_dma_single_opt single Output 1
 
 
 # 
@@ -299,6 +300,7 @@ set_interface_property playback_dma SVD_ADDRESS_GROUP ""
 add_interface_port playback_dma playback_dma_ack_opt ack Input 1
 add_interface_port playback_dma playback_dma_enable_opt enable Output 1
 add_interface_port playback_dma playback_dma_req_opt req Output 1
+add_interface_port playback_dma playback_dma_single_opt single Output 1
 
 
 # 
@@ -332,6 +334,7 @@ add_interface_port conduit bclk_ckctrl bclk Output 1
 add_interface_port conduit capture_lrclk_ckctrl capture_lrclk Output 1
 add_interface_port conduit clk_sel_48_44_ckctrl clk_sel_48_44 Output 1
 add_interface_port conduit master_slave_mode_ckctrl master_slave_mode Output 1
+add_interface_port conduit tdm_mode_ckctrl tdm_mode Output 2
 add_interface_port conduit playback_lrclk_ckctrl playback_lrclk Output 1
 
 
@@ -343,5 +346,6 @@ set_module_assignment embeddedsw.dts.name "i2s"
 set_module_assignment embeddedsw.dts.group "i2s"
 set_module_assignment {embeddedsw.dts.params.#sound-dai-cells} 1
 set_module_assignment embeddedsw.dts.params.dma-names {"tx", "rx"}
+set_module_assignment {embeddedsw.dts.params.opencores,dma-maxburst} 8
 
 
@@ -28,13 +28,22 @@
 #define MCLK_RATE_48K 12288000 /* fs*256 */
 #define MCLK_RATE_44K 12288000 /* fs*384 */
 
+/* I2S for a stereo stream, DSP_A (TDM) when the frame holds 4 or 8 slots */
+static unsigned int de10AMinisoc_fmt(unsigned int channels)
+{
+	return (channels > 2 ? SND_SOC_DAIFMT_DSP_A : SND_SOC_DAIFMT_I2S) |
+		SND_SOC_DAIFMT_NB_NF | SND_SOC_DAIFMT_CBS_CFS;
+}
+
 static int de10AMinisoc_hw_params(struct snd_pcm_substream *substream,
   struct snd_pcm_hw_params *params)
 {
 	struct snd_soc_pcm_runtime *rtd = substream->private_data;
 	struct snd_soc_dai *codec_dai = rtd->codec_dai;
+	struct snd_soc_dai *cpu_dai = rtd->cpu_dai;
 	struct device *dev = rtd->card->dev;
 	unsigned int mclk_freq;
+	unsigned int channels = params_channels(params);
 	int ret;
 
 	if ((params_rate(params) % 44100) == 0) {
@@ -50,6 +59,21 @@ static int de10AMinisoc_hw_params(struct snd_pcm_substream *substream,
 	if (ret < 0)
 		return ret;
 
+	/* both ends switch between I2S and TDM with the number of channels */
+	ret = snd_soc_dai_set_fmt(cpu_dai, de10AMinisoc_fmt(channels));
+	if (ret < 0)
+		return ret;
+
+	ret = snd_soc_dai_set_fmt(codec_dai, de10AMinisoc_fmt(channels));
+	if (ret < 0)
+		return ret;
+
+	/* one 32 bit slot per channel, 4 or 8 channels use the TDM modes of the i2s core */
+	ret = snd_soc_dai_set_tdm_slot(codec_dai, GENMASK(channels - 1, 0),
+		GENMASK(channels - 1, 0), channels, 32);
+	if (ret < 0 && ret != -ENOTSUPP)
+		return ret;
+
 	dev_dbg(dev, "hw_params: mclk_freq=%d\n", mclk_freq);
 	return 0;
 }
@@ -100,8 +124,8 @@ static int de10AMinisoc_AD193x_init(struct snd_soc_pcm_runtime *rtd)
 
 	dev_dbg(dev, "init\n");
 
-	fmt = SND_SOC_DAIFMT_I2S | SND_SOC_DAIFMT_NB_NF |
-	      SND_SOC_DAIFMT_CBS_CFS;
+	/* stereo until hw_params says otherwise */
+	fmt = de10AMinisoc_fmt(2);
 
 	/* set cpu DAI configuration */
 	ret = snd_soc_dai_set_fmt(cpu_dai, fmt);
@@ -23,6 +23,7 @@
 #define DAC_FIFO_ADDR	0x00
 #define STATUS_ADDR	0x04
 #define CMD_ADDR	0x08
+#define DMA_WM_ADDR	0x0C
 #define ADC_FIFO_ADDR	0x00
 
 /* Commands to register at CMD_ADDR */
@@ -31,12 +32,26 @@
 #define CAP_FIFO_CLEAR	BIT(2)
 #define CAP_ENABLE	BIT(3)
 
+/*
+ * Bit-fields of the watermark register: a burst is requested once the FIFO
+ * has room for (playback) or holds (capture) that many words.
+ */
+#define PB_WM_SHIFT	(0)
+#define PB_WM_MASK	GENMASK(PB_WM_SHIFT + 5, PB_WM_SHIFT)
+#define CAP_WM_SHIFT	(16)
+#define CAP_WM_MASK	GENMASK(CAP_WM_SHIFT + 5, CAP_WM_SHIFT)
+
+/* Both FIFOs hold 32 words, a burst may fill half of one */
+#define DMA_MAX_BURST	16
+
 #define CLK_CTRL1	0x00
 #define CLK_CTRL2	0x04
 
 /* Bit-fields of clk control register 1 */
 #define CLK_MASTER_SLAVE  BIT(0)
 #define CLK_SEL_48_44	  BIT(1)
+#define CLK_TDM_SHIFT	  (2)
+#define CLK_TDM_MASK	  GENMASK(CLK_TDM_SHIFT + 1, CLK_TDM_SHIFT)
 #define MCLK_DIV_SHIFT	  (24)
 #define MCLK_DIV_MASK	  GENMASK(MCLK_DIV_SHIFT + 7, MCLK_DIV_SHIFT)
 #define BCLK_DIV_SHIFT	  (16)
@@ -47,8 +62,9 @@
 #define CAP_LRC_DIV_SHIFT (0)
 #define CAP_LRC_DIV_MASK  GENMASK(CAP_LRC_DIV_SHIFT + 7, CAP_LRC_DIV_SHIFT)
 
-/* The frame size is not configurable */
-#define BITS_PER_FRAME 64
+/* Slots are 32 bits wide, a frame holds 2 (I2S), 4 (TDM4) or 8 (TDM8) of them */
+#define BITS_PER_SLOT	32
+#define TDM_MAX_SLOTS	8
 
 struct opencores_i2s {
 	struct regmap *regmap_data;
@@ -63,8 +79,51 @@ struct opencores_i2s {
 
 	struct snd_ratnum ratnum;
 	struct snd_pcm_hw_constraint_ratnums rate_constraints;
+
+	unsigned int tdm_slots;	/* set by set_tdm_slot, 0 = one slot per channel */
+	unsigned int fmt;	/* SND_SOC_DAIFMT_I2S or SND_SOC_DAIFMT_DSP_A */
+	u32 max_burst;		/* opencores,dma-maxburst, 1 = single transfers */
+};
+
+/* Every slot of a frame goes through the FIFO, so a stream has one channel per slot */
+static const unsigned int opencores_i2s_channels[] = { 2, 4, 8 };
+
+static const struct snd_pcm_hw_constraint_list opencores_i2s_channel_constraints = {
+	.count = ARRAY_SIZE(opencores_i2s_channels),
+	.list = opencores_i2s_channels,
 };
 
+/* Value of the TDM field of clk control register 1 for a number of slots */
+static int tdm_mode_value(unsigned int slots)
+{
+	switch (slots) {
+	case 2:
+		return 0;
+	case 4:
+		return 1;
+	case 8:
+		return 2;
+	default:
+		return -EINVAL;
+	}
+}
+
+/*
+ * Largest burst allowed by the device tree that divides a period, so the
+ * transfers of a period end on a burst boundary.
+ */
+static unsigned int opencores_i2s_burst(struct opencores_i2s *i2s,
+	unsigned int period_words)
+{
+	unsigned int burst;
+
+	for (burst = i2s->max_burst; burst >= 4; burst >>= 1)
+		if (period_words % burst == 0)
+			return burst;
+
+	return 1;
+}
+
 static int opencores_i2s_trigger(struct snd_pcm_substream *substream, int cmd,
 	struct snd_soc_dai *dai)
 {
@@ -108,16 +167,32 @@ static int opencores_i2s_hw_params(struct snd_pcm_substream *substream,
 {
 	struct opencores_i2s *i2s = snd_soc_dai_get_drvdata(dai);
 	unsigned long xtal_rate;
+	unsigned int slots;
+	unsigned long bclk_rate;
+	int tdm_mode;
 	int lrclk_div;
 	int mclk_div;
 	int bclk_div;
 	int mask, val;
 	int mask2, val2;
+	unsigned int burst;
 
 	dev_dbg(dai->dev, "hw_params fmt=0x%x\n", params_format(params));
 	dev_dbg(dai->dev, "hw_params rate=%d\n", params_rate(params));
+	dev_dbg(dai->dev, "hw_params channels=%d\n", params_channels(params));
 	if (params_format(params) != SNDRV_PCM_FORMAT_S32_LE)
 		return -EINVAL;
+
+	slots = i2s->tdm_slots ? i2s->tdm_slots : params_channels(params);
+	tdm_mode = tdm_mode_value(slots);
+	if (tdm_mode < 0 || params_channels(params) != slots)
+		return -EINVAL;
+
+	/* I2S only carries 2 slots, the codec has to be told the frame is TDM */
+	if (slots > 2 && i2s->fmt != SND_SOC_DAIFMT_DSP_A) {
+		dev_err(dai->dev, "%u slots need the DSP_A format\n", slots);
+		return -EINVAL;
+	}
 	
 	if ((params_rate(params) % 44100) == 0) {
 		val = CLK_SEL_48_44;
@@ -132,8 +207,15 @@ static int opencores_i2s_hw_params(struct snd_pcm_substream *substream,
 	mask = CLK_SEL_48_44;
 	mask2 = 0;
 
+	/* bclk is xtal_rate / ((bclk_div + 1) * 2), TDM8 needs it 4 times as fast as I2S */
+	bclk_rate = params_rate(params) * slots * BITS_PER_SLOT;
 	lrclk_div = divisor_value(xtal_rate, params_rate(params), 4);
-	bclk_div = divisor_value(xtal_rate, params_rate(params) * BITS_PER_FRAME, 0);
+	bclk_div = divisor_value(xtal_rate, bclk_rate, 0);
+	if (bclk_div < 0 || (slots > 2 && xtal_rate % (bclk_rate * 2))) {
+		dev_err(dai->dev, "Can't make a %lu Hz bclk from %lu Hz\n",
+			bclk_rate, xtal_rate);
+		return -EINVAL;
+	}
 	dev_dbg(dai->dev, "hw_params mclk_div=%d\n", mclk_div);
 	dev_dbg(dai->dev, "hw_params lrclk_div=%d\n", lrclk_div);
 	dev_dbg(dai->dev, "hw_params bclk_div=%d\n", bclk_div);
@@ -141,6 +223,8 @@ static int opencores_i2s_hw_params(struct snd_pcm_substream *substream,
 	mask |= MCLK_DIV_MASK;
 	val |= bclk_div << BCLK_DIV_SHIFT;
 	mask |= BCLK_DIV_MASK;
+	val |= tdm_mode << CLK_TDM_SHIFT;
+	mask |= CLK_TDM_MASK;
 	regmap_update_bits(i2s->regmap_clk, CLK_CTRL1, mask, val);
 	dev_dbg(dai->dev, "hw_params mask=0x%x val=0x%x\n", mask, val);
 	if (substream->stream == SNDRV_PCM_STREAM_CAPTURE) {
@@ -152,17 +236,82 @@ static int opencores_i2s_hw_params(struct snd_pcm_substream *substream,
 	}
 	regmap_update_bits(i2s->regmap_clk, CLK_CTRL2, mask2, val2);
 	dev_dbg(dai->dev, "hw_params mask2=0x%x val2=0x%x\n", mask2, val2);
+
+	/* The dmaengine pcm reads maxburst after this, in its own hw_params */
+	burst = opencores_i2s_burst(i2s,
+		params_period_size(params) * params_channels(params));
+	if (substream->stream == SNDRV_PCM_STREAM_CAPTURE) {
+		i2s->capture_dma_data.maxburst = burst;
+		regmap_update_bits(i2s->regmap_data, DMA_WM_ADDR, CAP_WM_MASK,
+			burst << CAP_WM_SHIFT);
+	} else {
+		i2s->playback_dma_data.maxburst = burst;
+		regmap_update_bits(i2s->regmap_data, DMA_WM_ADDR, PB_WM_MASK,
+			burst << PB_WM_SHIFT);
+	}
+	dev_dbg(dai->dev, "hw_params maxburst=%u\n", burst);
+	return 0;
+}
+
+/*
+ * TDM framing: the frame starts one bclk after the falling lrclk edge, like
+ * I2S, and holds 2, 4 or 8 slots of 32 bits.  All slots of the frame are
+ * moved through the FIFO whatever the masks say, so the stream needs as many
+ * channels as there are slots.  slots = 0 goes back to one slot per channel.
+ */
+static int opencores_i2s_set_tdm_slot(struct snd_soc_dai *dai,
+	unsigned int tx_mask, unsigned int rx_mask, int slots, int slot_width)
+{
+	struct opencores_i2s *i2s = snd_soc_dai_get_drvdata(dai);
+
+	dev_dbg(dai->dev, "set_tdm_slot tx=0x%x rx=0x%x slots=%d width=%d\n",
+		tx_mask, rx_mask, slots, slot_width);
+
+	if (slots == 0) {
+		i2s->tdm_slots = 0;
+		return 0;
+	}
+
+	if (tdm_mode_value(slots) < 0 || slot_width != BITS_PER_SLOT)
+		return -EINVAL;
+
+	if ((tx_mask | rx_mask) & ~GENMASK(slots - 1, 0))
+		return -EINVAL;
+
+	i2s->tdm_slots = slots;
 	return 0;
 }
 
+static int opencores_i2s_startup(struct snd_pcm_substream *substream,
+	struct snd_soc_dai *dai)
+{
+	struct opencores_i2s *i2s = snd_soc_dai_get_drvdata(dai);
+
+	if (i2s->tdm_slots)
+		return snd_pcm_hw_constraint_single(substream->runtime,
+			SNDRV_PCM_HW_PARAM_CHANNELS, i2s->tdm_slots);
+
+	return snd_pcm_hw_constraint_list(substream->runtime, 0,
+		SNDRV_PCM_HW_PARAM_CHANNELS, &opencores_i2s_channel_constraints);
+}
+
 static int opencores_i2s_set_fmt(struct snd_soc_dai *dai, unsigned int fmt)
 {
 	struct opencores_i2s *i2s = snd_soc_dai_get_drvdata(dai);
 	int val = 0;
 	dev_dbg(dai->dev, "set_fmt 0x%x\n", fmt);
 
-	if ((fmt & SND_SOC_DAIFMT_FORMAT_MASK) != SND_SOC_DAIFMT_I2S)
+	/*
+	 * DSP_A is the TDM4/TDM8 frame: same 50% lrclk as I2S, the frame starts
+	 * one bclk after its falling edge, which is how the AD193x reads DSP_A.
+	 */
+	switch (fmt & SND_SOC_DAIFMT_FORMAT_MASK) {
+	case SND_SOC_DAIFMT_I2S:
+	case SND_SOC_DAIFMT_DSP_A:
+		break;
+	default:
 		return -EINVAL;
+	}
 
 	if ((fmt & SND_SOC_DAIFMT_INV_MASK) != SND_SOC_DAIFMT_NB_NF)
 		return -EINVAL;
@@ -178,6 +327,7 @@ static int opencores_i2s_set_fmt(struct snd_soc_dai *dai, unsigned int fmt)
 		return -EINVAL;
 	}
 
+	i2s->fmt = fmt & SND_SOC_DAIFMT_FORMAT_MASK;
 	dev_dbg(dai->dev, "set_fmt master=%d\n", val);
 	regmap_update_bits(i2s->regmap_clk, 0, CLK_MASTER_SLAVE, val);
 	return 0;
@@ -227,14 +377,14 @@ static const struct snd_soc_dai_ops opencores_i2s_dai_ops = {
 	// .set_bclk_ratio
         .set_fmt = opencores_i2s_set_fmt,
         // .xlate_tdm_slot_mask
-        // .set_tdm_slot
+	.set_tdm_slot = opencores_i2s_set_tdm_slot,
         // .set_channel_map
         // .set_tristate
 
         // .digital_mute
         // .mute_stream
 
-	//.startup = opencores_i2s_startup,
+	.startup = opencores_i2s_startup,
 	.shutdown = opencores_i2s_shutdown,
 	.hw_params = opencores_i2s_hw_params,
 	// .hw_free
@@ -248,7 +398,7 @@ static struct snd_soc_dai_driver opencores_i2s_dai = {
 	.probe = opencores_i2s_dai_probe,
 	.playback = {
 		.channels_min = 2,
-		.channels_max = 2,
+		.channels_max = TDM_MAX_SLOTS,
 		.rates = SNDRV_PCM_RATE_44100 | SNDRV_PCM_RATE_48000
 			| SNDRV_PCM_RATE_88200 | SNDRV_PCM_RATE_96000
 			| SNDRV_PCM_RATE_176400 | SNDRV_PCM_RATE_192000,
@@ -256,7 +406,7 @@ static struct snd_soc_dai_driver opencores_i2s_dai = {
 	},
 	.capture = {
 		.channels_min = 2,
-		.channels_max = 2,
+		.channels_max = TDM_MAX_SLOTS,
 		.rates = SNDRV_PCM_RATE_44100 | SNDRV_PCM_RATE_48000
 			| SNDRV_PCM_RATE_88200 | SNDRV_PCM_RATE_96000
 			| SNDRV_PCM_RATE_176400 | SNDRV_PCM_RATE_192000,
@@ -264,6 +414,7 @@ static struct snd_soc_dai_driver opencores_i2s_dai = {
 	},
 	.ops = &opencores_i2s_dai_ops,
 	.symmetric_rates = 1,
+	.symmetric_channels = 1,	/* bclk and the frame are shared */
 };
 
 static const struct snd_soc_component_driver opencores_i2s_component = {
@@ -275,7 +426,7 @@ static const struct regmap_config opencores_i2s_regmap_data_config = {
 	.reg_bits = 32,
 	.reg_stride = 4,
 	.val_bits = 32,
-	.max_register = CMD_ADDR,
+	.max_register = DMA_WM_ADDR,
 };
 
 static const struct regmap_config opencores_i2s_regmap_clk_config = {
@@ -365,17 +516,32 @@ static int opencores_i2s_probe(struct platform_device *pdev)
 	i2s->playback_dma_data.addr = res->start + DAC_FIFO_ADDR;
 	i2s->playback_dma_data.addr_width = 4;
 	i2s->playback_dma_data.maxburst = 1;
-	//i2s->playback_dma_data.maxburst = 2;
 	dev_dbg(&pdev->dev, "probe playback dma addr : %8x\n",
 		i2s->playback_dma_data.addr);
 
 	i2s->capture_dma_data.addr = res->start + ADC_FIFO_ADDR;
 	i2s->capture_dma_data.addr_width = 4;
 	i2s->capture_dma_data.maxburst = 1;
-	//i2s->capture_dma_data.maxburst = 2;
+
+	/* Cores without the watermark register only make single requests */
+	i2s->max_burst = 1;
+	of_property_read_u32(pdev->dev.of_node, "opencores,dma-maxburst",
+		&i2s->max_burst);
+	switch (i2s->max_burst) {
+	case 1:
+	case 4:
+	case 8:
+	case DMA_MAX_BURST:
+		break;
+	default:
+		dev_warn(&pdev->dev, "Bad opencores,dma-maxburst %u, using 1\n",
+			i2s->max_burst);
+		i2s->max_burst = 1;
+	}
+	dev_dbg(&pdev->dev, "probe dma maxburst : %u\n", i2s->max_burst);
 
 /*
-	i2s->ratnum.num = clk_get_rate(i2s->clk_ref) / 2 / BITS_PER_FRAME;
+	i2s->ratnum.num = clk_get_rate(i2s->clk_ref) / 2 / (2 * BITS_PER_SLOT);
 	i2s->ratnum.den_step = 1;
 	i2s->ratnum.den_min = 1;
 	i2s->ratnum.den_max = 64;
@@ -19,8 +19,13 @@
 #include <linux/uaccess.h>
 #include <linux/init.h>
 #include <linux/cdev.h>
+#include <linux/idr.h>
 #include <linux/regmap.h>
 #include <linux/i2c.h>
+#include <linux/mutex.h>
+
+#include "fe_fixedpoint.h"
+#include "fe_gain_map.h"
 
 
 // Define information about this kernel module
@@ -29,104 +34,112 @@ MODULE_AUTHOR("Tyler Davis <openspeech@flatearthinc.com>");
 MODULE_DESCRIPTION("Loadable kernel module for the TPA613A2");
 MODULE_VERSION("1.0");
 
-// Index of the first negative value in the look up table below
-#define PN_INDEX 54
+// TPA6130A2 registers
+#define TPA6130A2_REG_CONTROL       0x01
+#define TPA6130A2_REG_VOLUME        0x02
+#define TPA6130A2_REG_OUT_IMPEDANCE 0x03
+#define TPA6130A2_REG_VERSION       0x04
 
-struct fixed_num
-{
-    int integer;
-    int fraction;
-    int fraction_len;
-};
+#define TPA6130A2_HP_EN             0xC0    // HP_EN_L | HP_EN_R in the control register
+#define TPA6130A2_MUTE              0xC0    // MUTE_L | MUTE_R in the volume register
+#define TPA6130A2_VOLUME_MASK       0x3F
+#define TPA6130A2_DEFAULT_VOLUME    0x34    // -0.3 dB, the closest value to unity
+#define TPA6130A2_MIN_VOLUME        (-((595 << 16) / 10))   // -59.5 dB as signed Q16, the lowest volume above mute
 
-// Volume levels defined in Raymond Weber's userspace code (multiplied by ten to elimiate the
-// decimal and with the negative values multiplied by negative one)
-/** Typedef for a single volume level to hold the db volume level and the matching register value */
-typedef struct
+/** Gain steps of TPA6130A2_register0.volume in tenths of a dB
+    See the TPA6130A2 datasheet, pg 17 Table 2 in section 8.4.9 Volume Control.
+    The value comes from column 2 in the table multiplied by ten, the code field is the register control word.
+    0xFF also sets both mute bits and stands for -100 dB. */
+static const struct fe_gain_step VolumeLevels[] =
 {
-    uint16_t value;
-    uint8_t code;
-} volumeLevel;
+    {.value = -1000, .code = 0xFF},
+    {.value = -595,  .code = 0x00},
+    {.value = -535,  .code = 0x01},
+    {.value = -500,  .code = 0x02},
+    {.value = -475,  .code = 0x03},
+    {.value = -455,  .code = 0x04},
+    {.value = -439,  .code = 0x05},
+    {.value = -414,  .code = 0x06},
+    {.value = -395,  .code = 0x07},
+    {.value = -365,  .code = 0x08},
+    {.value = -353,  .code = 0x09},
+    {.value = -333,  .code = 0x0A},
+    {.value = -317,  .code = 0x0B},
+    {.value = -304,  .code = 0x0C},
+    {.value = -286,  .code = 0x0D},
+    {.value = -271,  .code = 0x0E},
+    {.value = -263,  .code = 0x0F},
+    {.value = -247,  .code = 0x10},
+    {.value = -237,  .code = 0x11},
+    {.value = -225,  .code = 0x12},
+    {.value = -217,  .code = 0x13},
+    {.value = -205,  .code = 0x14},
+    {.value = -196,  .code = 0x15},
+    {.value = -188,  .code = 0x16},
+    {.value = -178,  .code = 0x17},
+    {.value = -170,  .code = 0x18},
+    {.value = -162,  .code = 0x19},
+    {.value = -152,  .code = 0x1A},
+    {.value = -145,  .code = 0x1B},
+    {.value = -137,  .code = 0x1C},
+    {.value = -130,  .code = 0x1D},
+    {.value = -123,  .code = 0x1E},
+    {.value = -116,  .code = 0x1F},
+    {.value = -109,  .code = 0x20},
+    {.value = -103,  .code = 0x21},
+    {.value = -97,   .code = 0x22},
+    {.value = -90,   .code = 0x23},
+    {.value = -85,   .code = 0x24},
+    {.value = -78,   .code = 0x25},
+    {.value = -72,   .code = 0x26},
+    {.value = -67,   .code = 0x27},
+    {.value = -61,   .code = 0x28},
+    {.value = -56,   .code = 0x29},
+    {.value = -51,   .code = 0x2A},
+    {.value = -45,   .code = 0x2B},
+    {.value = -41,   .code = 0x2C},
+    {.value = -35,   .code = 0x2D},
+    {.value = -31,   .code = 0x2E},
+    {.value = -26,   .code = 0x2F},
+    {.value = -21,   .code = 0x30},
+    {.value = -17,   .code = 0x31},
+    {.value = -12,   .code = 0x32},
+    {.value = -8,    .code = 0x33},
+    {.value = -3,    .code = 0x34},
+    {.value = 1,     .code = 0x35},
+    {.value = 5,     .code = 0x36},
+    {.value = 9,     .code = 0x37},
+    {.value = 14,    .code = 0x38},
+    {.value = 17,    .code = 0x39},
+    {.value = 21,    .code = 0x3A},
+    {.value = 25,    .code = 0x3B},
+    {.value = 29,    .code = 0x3C},
+    {.value = 33,    .code = 0x3D},
+    {.value = 36,    .code = 0x3E},
+    {.value = 40,    .code = 0x3F}
+};
 
-/** Structure with all possible volume level codes to use in TPA6130_register0.volume 
-    See the TPA6130A2 datasheet, pg 17 Table 2 in section 8.4.9 Volume Control.
-    The value comes from column 2 in the table.  These volume levels are the absolute 
-    value of the table values multipled by 10  The code field is the register control word*/
-static volumeLevel VolumeLevels[] =
+static const struct fe_gain_map_desc tpa613a2_volume_desc =
 {
-    {.value = 1000,  .code = 0xFF},
-    {.value = 595, .code = 0x00},
-    {.value = 535, .code = 0x01},
-    {.value = 500, .code = 0x02},
-    {.value = 475, .code = 0x03},
-    {.value = 455, .code = 0x04},
-    {.value = 439, .code = 0x05},
-    {.value = 414, .code = 0x06},
-    {.value = 395, .code = 0x07},
-    {.value = 365, .code = 0x08},
-    {.value = 353, .code = 0x09},
-    {.value = 333, .code = 0x0A},
-    {.value = 317, .code = 0x0B},
-    {.value = 304, .code = 0x0C},
-    {.value = 286, .code = 0x0D},
-    {.value = 271, .code = 0x0E},
-    {.value = 263, .code = 0x0F},
-    {.value = 247, .code = 0x10},
-    {.value = 237, .code = 0x11},
-    {.value = 225, .code = 0x12},
-    {.value = 217, .code = 0x13},
-    {.value = 205, .code = 0x14},
-    {.value = 196, .code = 0x15},
-    {.value = 188, .code = 0x16},
-    {.value = 178, .code = 0x17},
-    {.value = 170, .code = 0x18},
-    {.value = 162, .code = 0x19},
-    {.value = 152, .code = 0x1A},
-    {.value = 145, .code = 0x1B},
-    {.value = 137, .code = 0x1C},
-    {.value = 130, .code = 0x1D},
-    {.value = 123, .code = 0x1E},
-    {.value = 116, .code = 0x1F},
-    {.value = 109, .code = 0x20},
-    {.value = 103, .code = 0x21},
-    {.value = 97,  .code = 0x22},
-    {.value = 90,  .code = 0x23},
-    {.value = 85,  .code = 0x24},
-    {.value = 78,  .code = 0x25},
-    {.value = 72,  .code = 0x26},
-    {.value = 67,  .code = 0x27},
-    {.value = 61,  .code = 0x28},
-    {.value = 56,  .code = 0x29},
-    {.value = 51,  .code = 0x2A},
-    {.value = 45,  .code = 0x2B},
-    {.value = 41,  .code = 0x2C},
-    {.value = 35,  .code = 0x2D},
-    {.value = 31,  .code = 0x1E},
-    {.value = 26,  .code = 0x1F},
-    {.value = 21,  .code = 0x30},
-    {.value = 17,  .code = 0x31},
-    {.value = 12,  .code = 0x32},
-    {.value = 8,   .code = 0x33},
-    {.value = 3,   .code = 0x34},
-    {.value = 1,   .code = 0x35},
-    {.value = 5,   .code = 0x36},
-    {.value = 9,   .code = 0x37},
-    {.value = 14,  .code = 0x38},
-    {.value = 17,  .code = 0x39},
-    {.value = 21,  .code = 0x3A},
-    {.value = 25,  .code = 0x3B},
-    {.value = 29,  .code = 0x3C},
-    {.value = 33,  .code = 0x3D},
-    {.value = 36,  .code = 0x3E},
-    {.value = 40,  .code = 0x3F}
+    .num_codes = ARRAY_SIZE(VolumeLevels),
+    .steps = VolumeLevels,
+    .scale = 10,
 };
 
-static struct class *cl; // Global variable for the device class
-static dev_t dev_num;
+static struct fe_gain_map tpa613a2_volume_map;
+
+// Largest number of TPA6130A2s the driver can handle, each one gets a minor number
+#define FE_TPA613A2_MAX_DEVICES 16
+
+static struct class *cl; // Global variable for the device class, shared by every TPA6130A2
+static dev_t dev_num;    // First device number of the region reserved for the TPA6130A2s
+static DEFINE_IDA(fe_TPA613A2_ida); // Minor numbers in use
 
 // Define some I2C stuff
 struct i2c_driver tpa_i2c_driver;
 struct i2c_client *tpa_i2c_client;
+static struct regmap *tpa_regmap;       // Register map of tpa_i2c_client, cached so reads don't touch the bus
+static DEFINE_MUTEX(tpa_reg_lock);      // Serializes the read-modify-write of the control and volume registers
 static const unsigned short normal_i2c[]=
   { 0x35, I2C_CLIENT_END }; // remove?
 
@@ -142,16 +155,20 @@ static ssize_t name_show(struct device *dev, struct device_attribute *attr, char
 // I2C operation prototypes
 static ssize_t volume_write(struct device *dev, struct device_attribute *attr, const char *buf, size_t count);
 static ssize_t volume_read(struct device *dev, struct device_attribute *attr, char *buf);
+static ssize_t mute_write(struct device *dev, struct device_attribute *attr, const char *buf, size_t count);
+static ssize_t mute_read(struct device *dev, struct device_attribute *attr, char *buf);
+static ssize_t enable_write(struct device *dev, struct device_attribute *attr, const char *buf, size_t count);
+static ssize_t enable_read(struct device *dev, struct device_attribute *attr, char *buf);
+static int TPA613A2_update(uint8_t control_mask, uint8_t control, uint8_t volume_mask, uint8_t volume);
 
 // Custom function declarations
-char *strcat2(char *dst, char *src);
-uint32_t set_fixed_num(const char *s);
-int fp_to_string(char *buf, uint32_t fp28_num);
-uint8_t find_volume_level(uint32_t fp28_num, uint8_t pn);
+uint8_t find_volume_level(int32_t value);
 uint32_t decode_volume(uint8_t code);
 
 //Create the attributes that show up in /sys/class
 static DEVICE_ATTR(volume,          0664, volume_read,          volume_write);
+static DEVICE_ATTR(mute,            0664, mute_read,            mute_write);
+static DEVICE_ATTR(enable,          0664, enable_read,          enable_write);
 
 static DEVICE_ATTR(name, 0444, name_show, NULL);
 
@@ -162,9 +179,9 @@ static DEVICE_ATTR(name, 0444, name_show, NULL);
 struct fe_TPA613A2_dev
 {
     struct cdev cdev;           ///< The driver structure containing major/minor, etc
+    dev_t devt;                 ///< Device number of this TPA6130A2
     char *name;                 ///< This gets the name of the device when loading the driver
     void __iomem *regs;         ///< Pointer to the registers on the device
-    uint32_t volume;
 };
 
 
@@ -192,14 +209,50 @@ static struct i2c_board_info tpa_i2c_info = {
   I2C_BOARD_INFO("tpa_i2c",0x60),
 };
 
+/** Registers of the TPA6130A2, reg 0 doesn't exist and the version register is read only */
+static bool tpa_writeable_reg(struct device *dev, unsigned int reg)
+{
+    return reg >= TPA6130A2_REG_CONTROL && reg <= TPA6130A2_REG_OUT_IMPEDANCE;
+}
+
+static bool tpa_readable_reg(struct device *dev, unsigned int reg)
+{
+    return reg >= TPA6130A2_REG_CONTROL && reg <= TPA6130A2_REG_VERSION;
+}
+
+/** 8 bit registers behind an 8 bit address.  Nothing but this driver changes them, so a flat cache holds all of
+    them and regmap_update_bits() leaves the bus alone when a value doesn't change */
+static const struct regmap_config tpa_regmap_config =
+{
+    .reg_bits = 8,
+    .val_bits = 8,
+    .max_register = TPA6130A2_REG_VERSION,
+    .writeable_reg = tpa_writeable_reg,
+    .readable_reg = tpa_readable_reg,
+    .cache_type = REGCACHE_FLAT,
+};
+
 static int tpa_i2c_probe(struct i2c_client *client,
                          const struct i2c_device_id *id)
 {
+  struct regmap *regmap;
+
+  regmap = devm_regmap_init_i2c(client, &tpa_regmap_config);
+  if (IS_ERR(regmap))
+  {
+    pr_err("devm_regmap_init_i2c returned %ld\n", PTR_ERR(regmap));
+    return PTR_ERR(regmap);
+  }
+
+  tpa_regmap = regmap;
+
   return 0;
 }
 
 static int tpa_i2c_remove(struct i2c_client *client)
 {
+  tpa_regmap = NULL;
+
   return 0;
 }
 struct i2c_driver tpa_i2c_driver = {
@@ -249,18 +302,35 @@ static int TPA613A2_init(void)
 {
     int ret_val = 0;
     struct i2c_adapter *i2c_adapt;
-    struct i2c_board_info i2c_info;
+    char className[24];
+    uint8_t regs[2];
     
     pr_info("Initializing the Audio Logic TPA613A2 module\n");
 
-    // Register our driver with the "Platform Driver" bus
-    ret_val = platform_driver_register(&TPA613A2_platform);
+    ret_val = fe_gain_map_init(&tpa613a2_volume_map, &tpa613a2_volume_desc);
     if (ret_val != 0)
     {
-        pr_err("platform_driver_register returned %d\n", ret_val);
+        pr_err("fe_gain_map_init returned %d\n", ret_val);
         return ret_val;
     }
-    
+
+    //Reserve a Major number and enough Minor numbers for every TPA6130A2 in the system
+    ret_val = alloc_chrdev_region(&dev_num, 0, FE_TPA613A2_MAX_DEVICES, "fe_TPA6130A2_");
+    if (ret_val != 0)
+    {
+        pr_err("alloc_chrdev_region returned %d\n", ret_val);
+        return ret_val;
+    }
+
+    //One class for all the TPA6130A2s, named after the Major number like the per device classes used to be
+    sprintf(className, "fe_TPA6130A2_%d", MAJOR(dev_num));
+    cl = class_create(THIS_MODULE, className);
+    if (IS_ERR(cl))
+    {
+        ret_val = PTR_ERR(cl);
+        goto bad_class_create;
+    }
+
     /*------------------------------------------------------------------
       I2C communication
     ------------------------------------------------------------------*/
@@ -270,42 +340,78 @@ static int TPA613A2_init(void)
     if (ret_val < 0)
     {
       pr_err("Failed to register I2C driver");
-      return ret_val;
+      goto bad_i2c_add_driver;
     }
     
     i2c_adapt = i2c_get_adapter(0);
-    memset(&i2c_info,0,sizeof(struct i2c_board_info));    
-    strlcpy(i2c_info.type, "tpa_i2c",I2C_NAME_SIZE);
-    
-    tpa_i2c_client = i2c_new_device(i2c_adapt,&tpa_i2c_info);
+    if (!i2c_adapt)
+    {
+      pr_err("I2C adapter 0 not found\n");
+      ret_val = -ENODEV;
+      goto bad_i2c_new_device;
+    }
+
+    tpa_i2c_client = i2c_new_client_device(i2c_adapt,&tpa_i2c_info);
     
     i2c_put_adapter(i2c_adapt);
 
-    if (!tpa_i2c_client)
+    if (IS_ERR(tpa_i2c_client))
     {
       pr_err("Failed to connect to I2C client\n");
-      ret_val = -ENODEV;
-      return ret_val;
+      ret_val = PTR_ERR(tpa_i2c_client);
+      goto bad_i2c_new_device;
     }
 
-    //Send some initialization commands
-
-    // Enable both channels
-    char cmd[2] = {0x01, 0xc0};
-    i2c_master_send(tpa_i2c_client,&cmd[0],2);
+    // tpa_i2c_probe runs when the client is created and sets up the register map
+    if (!tpa_regmap)
+    {
+      pr_err("No register map for the I2C client\n");
+      ret_val = -ENODEV;
+      goto bad_regmap;
+    }
 
-    // Set -.3dB gain on both channels (closest value to unity)
-    cmd[0] = 0x02;
-    cmd[1] = 0x34;
-    i2c_master_send(tpa_i2c_client,&cmd[0],2);
+    // Enable both channels and set them to -0.3 dB in one transaction.  Both registers are written whatever the
+    // cache holds so the cache matches the amplifier from here on.
+    regs[0] = TPA6130A2_HP_EN;
+    regs[1] = TPA6130A2_DEFAULT_VOLUME;
+    ret_val = regmap_bulk_write(tpa_regmap, TPA6130A2_REG_CONTROL, regs, 2);
+    if (ret_val)
+    {
+      pr_err("Failed to initialize the TPA6130A2: %d\n", ret_val);
+      goto bad_regmap;
+    }
 
     /*------------------------------------------------------------------
     --------------------------------------------------------------------
     ------------------------------------------------------------------*/
+
+    // Register our driver with the "Platform Driver" bus, once the amplifier is set up since probe creates the
+    // attributes that go through the register map
+    ret_val = platform_driver_register(&TPA613A2_platform);
+    if (ret_val != 0)
+    {
+        pr_err("platform_driver_register returned %d\n", ret_val);
+        goto bad_platform_driver_register;
+    }
     
     pr_info("Audio Logic TPA6130A2 module successfully initialized!\n");
 
     return 0;
+
+bad_platform_driver_register:
+bad_regmap:
+    i2c_unregister_device(tpa_i2c_client);
+
+bad_i2c_new_device:
+    i2c_del_driver(&tpa_i2c_driver);
+
+bad_i2c_add_driver:
+    class_destroy(cl);
+
+bad_class_create:
+    unregister_chrdev_region(dev_num, FE_TPA613A2_MAX_DEVICES);
+
+    return ret_val;
 }
 
 
@@ -322,8 +428,8 @@ static int TPA613A2_probe(struct platform_device *pdev)
 {
     int ret_val = -EBUSY;
 
-    char deviceName[20] = "fe_TPA6130A2_";
-    char deviceMinor[20];
+    char deviceName[24];
+    int minor;
     int status;
 
     struct device *deviceObj;
@@ -333,6 +439,8 @@ static int TPA613A2_probe(struct platform_device *pdev)
 
     // Create structure to hold device-specific information (like the registers). Make size of &pdev->dev + sizeof(struct(fe_TPA613A2_dev)).
     fe_TPA613A2_devp = devm_kzalloc(&pdev->dev, sizeof(fe_TPA613A2_dev_t), GFP_KERNEL);
+    if (fe_TPA613A2_devp == NULL)
+        return -ENOMEM;
 
     // Give a pointer to the instance-specific data to the generic platform_device structure
     // so we can access this data later on (for instance, in the read and write functions)
@@ -347,32 +455,34 @@ static int TPA613A2_probe(struct platform_device *pdev)
     strcpy(fe_TPA613A2_devp->name, (char *)pdev->name);
     pr_info("%s\n", (char *)pdev->name);
 
-    //Request a Major/Minor number for the driver
-    status = alloc_chrdev_region(&dev_num, 0, 1, "fe_TPA6130A2_");
-    if (status != 0)
-        goto bad_alloc_chrdev_region;
+    //Take the lowest free Minor number from the region reserved in TPA613A2_init
+    minor = ida_alloc_max(&fe_TPA613A2_ida, FE_TPA613A2_MAX_DEVICES - 1, GFP_KERNEL);
+    if (minor < 0)
+    {
+        pr_err("No free minor numbers, only %d TPA6130A2s are supported\n", FE_TPA613A2_MAX_DEVICES);
+        ret_val = minor;
+        goto bad_ida_alloc;
+    }
+    fe_TPA613A2_devp->devt = MKDEV(MAJOR(dev_num), minor);
 
-    //Create the device name with the information reserved above
-    sprintf(deviceMinor, "%d", MAJOR(dev_num));
-    strcat(deviceName, deviceMinor);
+    //Create the device name, the first TPA6130A2 keeps the fe_TPA6130A2_NNN name so existing scripts still find it
+    if (minor == 0)
+        sprintf(deviceName, "fe_TPA6130A2_%d", MAJOR(dev_num));
+    else
+        sprintf(deviceName, "fe_TPA6130A2_%d_%d", MAJOR(dev_num), minor);
     pr_info("%s\n", deviceName);
 
-    //Create sysfs entries
-    cl = class_create(THIS_MODULE, deviceName);
-    if (cl == NULL)
-        goto bad_class_create;
-
     //Initialize a char dev structure
     cdev_init(&fe_TPA613A2_devp->cdev, &fe_TPA613A2_fops);
 
     //Registers the char driver with the kernel
-    status = cdev_add(&fe_TPA613A2_devp->cdev, dev_num, 1);
+    status = cdev_add(&fe_TPA613A2_devp->cdev, fe_TPA613A2_devp->devt, 1);
     if (status != 0)
         goto bad_cdev_add;
 
     //Creates the device entries in sysfs
-    deviceObj = device_create(cl, NULL, dev_num, NULL, deviceName);
-    if (deviceObj == NULL)
+    deviceObj = device_create(cl, NULL, fe_TPA613A2_devp->devt, NULL, deviceName);
+    if (IS_ERR(deviceObj))
         goto bad_device_create;
 
     //Put a pointer to the fe_fir_dev struct that is created into the driver object so it can be accessed uniquely from elsewhere
@@ -388,26 +498,40 @@ static int TPA613A2_probe(struct platform_device *pdev)
     if (status)
         goto bad_device_create_file_2;
 
+    //---------------------------------------------------------
+    status = device_create_file(deviceObj, &dev_attr_mute);
+    if (status)
+        goto bad_device_create_file_3;
+
+    //---------------------------------------------------------
+    status = device_create_file(deviceObj, &dev_attr_enable);
+    if (status)
+        goto bad_device_create_file_4;
+
     pr_info("TPA613A2_probe exit\n");
 
     return 0;
 
+  bad_device_create_file_4:
+      device_remove_file(deviceObj, &dev_attr_enable);
+
+  bad_device_create_file_3:
+      device_remove_file(deviceObj, &dev_attr_mute);
+
   bad_device_create_file_2:
       device_remove_file(deviceObj, &dev_attr_name);
           
   bad_device_create_file_1:
       device_remove_file(deviceObj, &dev_attr_volume); 
+      device_destroy(cl, fe_TPA613A2_devp->devt);
       
   bad_device_create:
       cdev_del(&fe_TPA613A2_devp->cdev);
 
   bad_cdev_add:
-      class_destroy(cl);
-
-  bad_class_create:
-      unregister_chrdev_region(dev_num, 1);
+      ida_free(&fe_TPA613A2_ida, minor);
 
-  bad_alloc_chrdev_region:
+  bad_ida_alloc:
   bad_mem_alloc:
 
     return ret_val;
@@ -431,9 +555,6 @@ static int TPA613A2_open(struct inode *inode, struct file *file)
     devp = container_of(inode->i_cdev, fe_TPA613A2_dev_t, cdev);
     file->private_data = devp;
 
-    //Instantiate default values for the codec
-    devp->volume       = 0;
-
     return 0;
 }
 
@@ -510,11 +631,14 @@ static int TPA613A2_remove(struct platform_device *pdev)
 
     pr_info("TPA613A2_remove enter\n");
 
+    // Remove the sysfs entries (and their attributes) of this TPA6130A2
+    device_destroy(cl, dev->devt);
+
     // Unregister the character file (remove it from /dev)
     cdev_del(&dev->cdev);
 
-    //Tell the os that the major/minor pair is avalible again
-    unregister_chrdev_region(dev_num, 2);
+    //Tell the os that the minor number is avalible again, the region is released in TPA613A2_exit
+    ida_free(&fe_TPA613A2_ida, MINOR(dev->devt));
 
     pr_info("TPA613A2_remove exit\n");
 
@@ -531,6 +655,15 @@ static void TPA613A2_exit(void)
     // Unregister our driver from the "Platform Driver" bus
     // This will cause "TPA613A2_remove" to be called for each connected device
     platform_driver_unregister(&TPA613A2_platform);
+
+    // Release the I2C client and driver registered in TPA613A2_init
+    i2c_unregister_device(tpa_i2c_client);
+    i2c_del_driver(&tpa_i2c_driver);
+
+    // Every TPA6130A2 is gone, release the class and the device numbers
+    class_destroy(cl);
+    unregister_chrdev_region(dev_num, FE_TPA613A2_MAX_DEVICES);
+    ida_destroy(&fe_TPA613A2_ida);
  
     pr_info("Audio Logic TPA6130A2 module successfully unregistered\n");
 }
@@ -555,369 +688,194 @@ static ssize_t name_show(struct device *dev, struct device_attribute *attr, char
     return strlen(buf);
 }
 
-static ssize_t volume_write(struct device *dev, struct device_attribute *attr, const char *buf, size_t count)
-{
-    // Initialize some variables
-    uint32_t tempValue = 0;
-    char substring[80];
-    int substring_count = 0;
-    int i;
-    char cmd[2] = {0x02,0x00};
-    uint8_t code = 0x00;
-
-    // Create a new instance of the TPA
-    fe_TPA613A2_dev_t *devp = (fe_TPA613A2_dev_t *)dev_get_drvdata(dev);
-
-    for (i = 0; i < count; i++)
-    {
-        //If its not a space or a comma, add the digit to the substring
-        if ((buf[i] != ',') && (buf[i] != ' ') && (buf[i] != '\0') && (buf[i] != '\r') && (buf[i] != '\n'))
-        {
-            substring[substring_count] = buf[i];
-            substring_count++;
-        }
-    }
-
-    substring[substring_count] = '\0';
-    
-    // If the first character is a negative sign
-    if (buf[0] == '-')
-    {
-      // Shift all the values "left" to remove it
-      for (i=0;i<79;i++)
-        substring[i] = substring[i+1];
-
-      // Find the fp28 number
-      tempValue = set_fixed_num(substring);
-
-      // Determine the code for the volume level
-      code = find_volume_level(tempValue,0);
-    }
-    // Otherwise, 
-    else
-    {
-      // Calculate the fp28 number
-      tempValue = set_fixed_num(substring);
-
-      // Determine the code for the volume level
-      code = find_volume_level(tempValue,1);
-    }
-
-    // Determine the closest volume level
-    tempValue = decode_volume(code);
-
-    // Record the volume level to the volume variable
-    devp->volume = tempValue;
+/** Changes bits of the control and volume registers together
 
-    // Send the I2C commands
-    cmd[1] = code;
-    i2c_master_send(tpa_i2c_client,&cmd[0],2);
+    The new values are worked out from the register cache.  Registers that don't change aren't written, and when both
+    change they go out in one I2C transaction (the TPA6130A2 increments the register address after each byte), so
+    enabling the amplifier and setting its volume or mute happen together.
 
-    return count;
-}
-static ssize_t volume_read(struct device *dev, struct device_attribute *attr, char *buf)
+    @param control_mask Bits of the control register to change
+    @param control New value of those bits
+    @param volume_mask Bits of the volume register to change
+    @param volume New value of those bits
+    @returns 0 or the error of the I2C transfer
+*/
+static int TPA613A2_update(uint8_t control_mask, uint8_t control, uint8_t volume_mask, uint8_t volume)
 {
-    fe_TPA613A2_dev_t *devp = (fe_TPA613A2_dev_t *)dev_get_drvdata(dev);
-
-    fp_to_string(buf, devp->volume);
+    unsigned int old_control;
+    unsigned int old_volume;
+    uint8_t regs[2];
+    int status;
 
-    strcat2(buf, "\n");
+    mutex_lock(&tpa_reg_lock);
 
-    //Return the length of the buffer so it will print in the console
-    return strlen(buf);
-}
+    status = regmap_read(tpa_regmap, TPA6130A2_REG_CONTROL, &old_control);
+    if (status == 0)
+        status = regmap_read(tpa_regmap, TPA6130A2_REG_VOLUME, &old_volume);
+    if (status)
+        goto out;
 
-char *strcat2(char *dst, char *src)
-{
-    char *cp = dst;
+    regs[0] = (old_control & ~control_mask) | (control & control_mask);
+    regs[1] = (old_volume & ~volume_mask) | (volume & volume_mask);
 
-    while (*cp)
-        cp++; /* find end of dst */
+    if (regs[0] != old_control && regs[1] != old_volume)
+        status = regmap_bulk_write(tpa_regmap, TPA6130A2_REG_CONTROL, regs, 2);
+    else if (regs[0] != old_control)
+        status = regmap_write(tpa_regmap, TPA6130A2_REG_CONTROL, regs[0]);
+    else if (regs[1] != old_volume)
+        status = regmap_write(tpa_regmap, TPA6130A2_REG_VOLUME, regs[1]);
 
-    while (( *cp++ = *src++ ) != 0); /* Copy src to end of dst */
+out:
+    mutex_unlock(&tpa_reg_lock);
 
-    return dst; /* return dst */
+    return status;
 }
 
-/** Convert a string to a fixed point number structure
-    @param s String containing the string to convert to 32F16 representation
-    @return SUCCESS
+/** Reads a register from the cache
 
-    @todo This function is really ugly and could be cleaned up to make it clear what is happening....
+    @param reg TPA6130A2_REG_*
+    @param val Set to the value of the register
+    @returns 0 or an error code
 */
-uint32_t set_fixed_num(const char *s)
+static int TPA613A2_read_reg(unsigned int reg, unsigned int *val)
 {
-    struct fixed_num num = {0, 0, 0};
-    int seen_point = 0;
-    int pointIndex;
-    int i;
-    int ii;
-    int frac_comp;
-    uint32_t acc = 0;
-    char s2[80];
-    int pointsSeen = 0;
-    int charIndex = 0;
-
-    //If no leading 0, add one (eg: .25 -> 0.25)
-    if (s[0] == '.')
-    {
-        s2[0] = '0';
-        charIndex++;
-    }
+    int status;
 
-    //This is a strcpy() to move the data a "const char *" to a "char *" and validate the data
-    for (i = 0; i < strlen(s); i++)
-    {
-        //Make sure the string contains an non-valid char (eg: not a number or a decimal point)
-        if ((s[i] == '.') || (s[i] >= '0' && s[i] <= '9'))
-        {
-            //Copy the data over and increment the pointer
-            s2[charIndex] = s[i];
-            charIndex++;
-        }
-        else
-        {
-            pr_info("Invalid char (c:%c x:%X) in number %s\n", s[i], s[i], s);
-            return 0x00000000;
-        }
-
-        //Count the number of decimals in the string
-        if (s[i] == '.')
-            pointsSeen++;
-    }
+    mutex_lock(&tpa_reg_lock);
+    status = regmap_read(tpa_regmap, reg, val);
+    mutex_unlock(&tpa_reg_lock);
 
-    //If multiple decimals points in the number (eg: 1.1.4)
-    if (pointsSeen > 1)
-        pr_info("Invalid number format: %s\n", s);
-
-    //Turn 1 into 1.0
-    //if (pointsSeen == 0)
-    // {
-    //    printk("Adding the decimal...\n");
-    //    s2[i] = char(".");
-    //    s2[i+1] = char("0");
-    //    //strcat2(".0",s2);
-    //    i=i+2;
-    // }
-    //Make sure the string is terminated
-    s2[i] = '\0';
-
-    //Count the fractional digits
-    for (pointIndex = 0; pointIndex < strlen(s2); pointIndex++)
-    {
-        if (s2[pointIndex] == '.')
-            break;
-    }
+    return status;
+}
 
-    //String extend so that the output is accurate
-    while (strlen(s2) - pointIndex < 9)
-        strcat2(s2, "0");
+/** Sets the volume of both channels, -100 dB mutes them */
+static ssize_t volume_write(struct device *dev, struct device_attribute *attr, const char *buf, size_t count)
+{
+    uint32_t tempValue = 0;
+    int status;
+    uint8_t code;
 
-    //Truncate the string if its longer
-    s2[strlen(s2) - pointIndex + 9] = '\0';
+    //Convert the buffer to a fixed point value
+    status = fe_fixed_from_string(buf, count, FE_SQ16, &tempValue);
+    if (status)
+        return status;
 
-    //Covert to fixed point
-    for (i = 0; i < 10; i++)
-    {
-        if (s2[i] == '.')
-        {
-            seen_point = 1;
-            continue;
-        }
-        if (!seen_point)
-        {
-            num.integer *= 10;
-            num.integer += (int)(s2[i] - '0');
-        }
-        else
-        {
-            num.fraction_len++;
-            num.fraction *= 10;
-            num.fraction += (int)(s2[i] - '0');
-        }
-    }
+    // Determine the code for the volume level
+    code = find_volume_level(tempValue);
 
-    //Turn the fixed point conversion into binary digits
-    for (ii = 0, frac_comp = 1; ii < num.fraction_len; ii++) frac_comp *= 10;
-    frac_comp /= 2;
+    // Only the volume register changes, and only if the code isn't the one the amplifier has already.  The mute code
+    // only sets the mute bits so unmuting goes back to the previous volume.
+    if (code == (TPA6130A2_MUTE | TPA6130A2_VOLUME_MASK))
+        status = TPA613A2_update(0, 0, TPA6130A2_MUTE, TPA6130A2_MUTE);
+    else
+        status = TPA613A2_update(0, 0, TPA6130A2_MUTE | TPA6130A2_VOLUME_MASK, code);
+    if (status)
+        return status;
 
-    // Get the fractional part (f28 hopefully)
-    for (ii = 0; i <= 36; i++)
-    {
-        if (num.fraction >= frac_comp)
-        {
-            acc |= 0x00000001;
-            num.fraction -= frac_comp;
-        }
-        frac_comp /= 2;
-
-        acc = acc << 1;
-    }
+    return count;
+}
+static ssize_t volume_read(struct device *dev, struct device_attribute *attr, char *buf)
+{
+    unsigned int val;
+    int status;
 
-    acc = acc >> 12;
+    status = TPA613A2_read_reg(TPA6130A2_REG_VOLUME, &val);
+    if (status)
+        return status;
 
-    //Combine the fractional part with the integer
-    acc += num.integer << 16;
+    //A muted amplifier shows the -100 dB of the mute code
+    if ((val & TPA6130A2_MUTE) == TPA6130A2_MUTE)
+        val = TPA6130A2_MUTE | TPA6130A2_VOLUME_MASK;
+    else
+        val &= TPA6130A2_VOLUME_MASK;
 
-    return acc;
+    return fe_fixed_show(buf, decode_volume(val), FE_SQ16);
 }
 
-/** Function to convert a fp16 to a string representation
-    @todo doesn't handle negative numbers
-*/
-int fp_to_string(char *buf, uint32_t fp28_num)
+/** Mutes (1) or unmutes (0) both channels, the volume is kept */
+static ssize_t mute_write(struct device *dev, struct device_attribute *attr, const char *buf, size_t count)
 {
-    int buf_pos = 0;
-    int i;
-    int fractionPart;
-    //int isNegative = 0;
-    int intPart = 1;
-    int i16 = 0;
-
-    if (fp28_num & 0x80000000)
-    {
-        fp28_num *= -1;
-
-        buf[buf_pos] = '-';
-        buf_pos++;
-    }
+    bool mute;
+    int status;
 
-    //Convert the integer part
-    i16 = (fp28_num >> 16);
-    while ( (i16 / intPart) > 9)
-    {
-        intPart *= 10;
-    }
+    status = kstrtobool(buf, &mute);
+    if (status)
+        return status;
 
-    while (intPart > 0)
-    {
-        buf[buf_pos] = (char)((i16 / intPart) + '0');
-        buf_pos++;
+    status = TPA613A2_update(0, 0, TPA6130A2_MUTE, mute ? TPA6130A2_MUTE : 0);
+    if (status)
+        return status;
 
-        i16 = i16 % intPart;
-        intPart = intPart / 10;
-    }
+    return count;
+}
+static ssize_t mute_read(struct device *dev, struct device_attribute *attr, char *buf)
+{
+    unsigned int val;
+    int status;
 
-    //buf[buf_pos] = (char)((fp28_num>>16) + '0');
-    //buf_pos++;
+    status = TPA613A2_read_reg(TPA6130A2_REG_VOLUME, &val);
+    if (status)
+        return status;
 
-    buf[buf_pos] = '.';
-    buf_pos++;
+    return sprintf(buf, "%d\n", (val & TPA6130A2_MUTE) == TPA6130A2_MUTE);
+}
 
-    //Mask the integer bits and dump 1 bit to make the conversion easier....
-    fractionPart = (0x0000FFFF & fp28_num) >> 1; // 32F27 so that 0-9 can fit in the high 5 bits)
+/** Enables (1) or disables (0) both channels, a disabled amplifier is muted in the same transaction */
+static ssize_t enable_write(struct device *dev, struct device_attribute *attr, const char *buf, size_t count)
+{
+    bool enable;
+    int status;
 
-    for (i = 0; i < 8; i++)
-    {
-        fractionPart *= 10;
-        buf[buf_pos] = (fractionPart >> 15) + '0';
-        buf_pos++;
-        fractionPart &= 0x00007FFF;
-    }
+    status = kstrtobool(buf, &enable);
+    if (status)
+        return status;
 
-    buf[buf_pos] = '\0';
+    if (enable)
+        status = TPA613A2_update(TPA6130A2_HP_EN, TPA6130A2_HP_EN, 0, 0);
+    else
+        status = TPA613A2_update(TPA6130A2_HP_EN, 0, TPA6130A2_MUTE, TPA6130A2_MUTE);
+    if (status)
+        return status;
 
-    return 0;
+    return count;
 }
-uint8_t find_volume_level(uint32_t fp28_num, uint8_t pn)
+static ssize_t enable_read(struct device *dev, struct device_attribute *attr, char *buf)
 {
-  // Instantiate some variables
-  uint8_t return_code = 0;
-  int start_index;
-  int stop_index;
-  int16_t diff = 10000;
-  int16_t curDiff = 10000;
-  uint32_t inputnum = fp28_num*10;
-  uint16_t intval = (uint16_t)((inputnum)>>=16);
-  int i;
-  uint16_t return_value = 0;
-
-  // Find the length of the array
-  size_t n = sizeof(VolumeLevels)/sizeof(VolumeLevels[0]);
-  
-  // Set the start and stop search values depending on whether
-  // a negative sign was detected
-  if (pn == 1)
-  {
-    start_index = PN_INDEX;
-    stop_index = n;
-  }
-  else
-  {  
-    start_index = 0;
-    stop_index = PN_INDEX - 1;  
-  } 
-      
-  // Determine whether the negative dB bound has been exceeded
-  if ((intval > VolumeLevels[0].value) && (pn == 0))
-  { 
-    printk("Maximum attenuation exceeded.\n");
-    printk("Setting attenuation to -100 dB.\n");
-    return VolumeLevels[0].code;
-  }
-
-  // Determine whether the positive dB bound has been exceeded
-  if ((intval > VolumeLevels[n-1].value) && (pn == 1))
-  {
-    printk("Maximum amplification exceeded.\n");
-    printk("Setting amplification to 4 dB.\n");
-    return VolumeLevels[n-1].code;
-  }  
+    unsigned int val;
+    int status;
 
-  // Search for the closest value (above or below)
-  for (i = start_index; i < stop_index; i++)
-  {
-    // calculate the difference values 
-    if (intval > VolumeLevels[i].value)
-      diff = intval - VolumeLevels[i].value;
-    else
-      diff = VolumeLevels[i].value - intval;
+    status = TPA613A2_read_reg(TPA6130A2_REG_CONTROL, &val);
+    if (status)
+        return status;
 
-    // If the calculated difference is smaller than the calculated
-    // current best (smallest) difference set the new current difference
-    if (diff < curDiff)
-    {
-      curDiff = diff;
-      return_code = VolumeLevels[i].code;
-      return_value = VolumeLevels[i].value;
-    }
-    // Otherwise, stop.  (it only gets worse from here)
-    else
-      break;
-  }
-  
-  // Return the correct volume code
-  return return_code;
+    return sprintf(buf, "%d\n", (val & TPA6130A2_HP_EN) == TPA6130A2_HP_EN);
 }
 
-uint32_t decode_volume(uint8_t code)
+/** Finds the volume code nearest to a volume
+    @param value Volume in dB as a signed Q16 fixed point word, volumes below -59.5 dB go to -100 dB (mute) and volumes
+    above 4 dB to 4 dB
+    @return Volume code of the TPA6130A2
+*/
+uint8_t find_volume_level(int32_t value)
 {
-  // Initialize some variables
-  int i;
-  size_t n = sizeof(VolumeLevels)/sizeof(VolumeLevels[0]);
-  uint32_t decodedDB = 0;
+  // The nearest step alone would only mute below -79.75 dB, halfway between -59.5 dB and the -100 dB of mute
+  if (value < TPA6130A2_MIN_VOLUME)
+    return TPA6130A2_MUTE | TPA6130A2_VOLUME_MASK;
 
-  // Find the correct volume level
-  for (i=0;i<n;i++)
-  {
-    if (code == VolumeLevels[i].code)
-      break; 
-  }
+  return fe_gain_map_code(&tpa613a2_volume_map, value);
+}
 
-  // If it's in the negative portion, multiply by -1  
-  if (i < PN_INDEX)
-  {    
-    decodedDB = VolumeLevels[i].value;
-    decodedDB = (decodedDB<<=16)/10;
-    return -1*decodedDB;
-  }  
-  else
-  {
-    decodedDB = VolumeLevels[i].value;
-    return (decodedDB<<=16)/10;
-  }  
+/** Converts a volume code to its volume
+    @param code Volume code of the TPA6130A2
+    @return Volume in dB as a signed Q16 fixed point word, 0 for codes that aren't volumes
+*/
+uint32_t decode_volume(uint8_t code)
+{
+  int32_t value = 0;
 
+  fe_gain_map_decode(&tpa613a2_volume_map, code, &value);
 
+  return value;
 }
 
 /** Tell the kernel what the initialization function is */